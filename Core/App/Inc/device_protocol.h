@@ -21,8 +21,28 @@
 #include <shared_defines.h>
 #include <shared_functions.h>
 /*--------------------------- MACROS AND DEFINES -----------------------------*/
+// IEEE 802.15.4 broadcast short address, accepted by the DW IC frame filter on every device
+#define UWB_BROADCAST_ADDRESS 0xFFFF
+// uwb_receive_timeout() without a time limit
+#define UWB_WAIT_FOREVER 0xFFFFFFFFUL
+// Events the DW IC interrupt can queue before the receiving task picks them up
+#define UWB_EVENT_QUEUE_LEN 4
+// uwb_get_rx_nlos() result when the diagnostics were not logged
+#define UWB_NLOS_UNKNOWN 0xFF
+// On-air message encoding, see uwb_msg_encode(). A receiver drops messages of any other version
+#define UWB_MSG_VERSION 2
+// Longest encoded message: header, request sequence number with 40-bit RX timestamp, 40-bit TX timestamp, coordinates and result
+#define UWB_MSG_MAX_LEN 26
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
 
+// Precision of coordinates, distances and the position solvers. The Cortex-M4F FPU does single precision only,
+// double is emulated in software. Build with POSITION_SINGLE_PRECISION for the float pipeline
+#ifdef POSITION_SINGLE_PRECISION
+typedef float position_real_t;
+#else
+typedef double position_real_t;
+#endif
+
 // Enum to represent result/status codes for UWB operations
 typedef enum {
     UWB_OK = 0,              // Operation completed successfully
@@ -35,7 +55,10 @@ typedef enum {
     UWB_BUSY,                // Device or resource is busy
     UWB_COMM_ERROR,          // Communication failure
     UWB_MEMORY_ERROR,        // Memory allocation or access error
-	UWB_WRONG_ADDRESS		 // Wrong address
+	UWB_WRONG_ADDRESS,		 // Wrong address
+	UWB_TX_LATE,             // Delayed transmission time had already passed, nothing was sent
+	UWB_RANGE_FAILED,        // No ranging result after all attempts
+	UWB_DUPLICATE            // Frame already received from its sender, or older than the last one, dropped unread
 } uwb_result_e;
 
 // Enum to represent the type of UWB device
@@ -46,9 +69,9 @@ typedef enum {
 
 // Struct to represent a 3D coordinate
 typedef struct __attribute__((packed)) {
-    double x;  // X-coordinate
-    double y;  // Y-coordinate
-    double z;  // Z-coordinate
+    position_real_t x;  // X-coordinate
+    position_real_t y;  // Y-coordinate
+    position_real_t z;  // Z-coordinate
 } coord_t;
 
 // Struct to represent a UWB (Ultra-Wideband) device
@@ -82,18 +105,62 @@ typedef enum {
     COMMAND_POSITION_ANNOUNCEMENT,   // Broadcast current position
 	COMMAND_POSITION_ANNOUNCEMENT_GN,// Broadcast current position calculated with GN method
 	COMMAND_POSITION_ANNOUNCEMENT_PREDEF, // Broadcast current position calculated with predefined anchor coords
-	COMMAND_POSITION_ANNOUNCEMENT_PREDEF_GN // Broadcast current position calculated with predefined anchor coords and GN method
+	COMMAND_POSITION_ANNOUNCEMENT_PREDEF_GN, // Broadcast current position calculated with predefined anchor coords and GN method
+	COMMAND_DS_POLL,                // Start double-sided ranging exchange
+	COMMAND_DS_RESPONSE,            // Respond with poll receive and response transmit timestamps
+	COMMAND_DS_FINAL,               // Initiator's second transmission, sent a fixed delay after the response
+	COMMAND_DS_REPORT,              // Respond with final receive timestamp and coordinates
+	COMMAND_RANGING_BROADCAST,      // Ranging request to all anchors, each responds in its own slot
+	COMMAND_POSITION_ANNOUNCEMENT_TRACKED // Broadcast current position of the tag tracker
 } uwb_command_e;
 
 typedef struct __attribute__((packed)){
 	uwb_command_e command_type;	// What msg is trying to do
 	uint64_t	  rx_ts;		// Ranging response will have receive timestamp
+	uint8_t		  rx_seq;		// Sequence number of the request rx_ts belongs to, pairs the reply with it
 	uint64_t 	  tx_ts;		// Ranging response will have transmit timestamp
 	coord_t		  coord;		// Ranging response and position announcement will have local coords
 	uwb_result_e  result; 		// If there was an error and results are not valid
 } uwb_msg_t;
 
 
+// Frames kept resident in the DW IC TX buffer, each at its own offset, see uwb_stage_msg().
+// Ordered by how tight their timing is, the first ones are patched without the indirect buffer access
+typedef enum {
+    UWB_TX_SLOT_RESPONSE = 0,       // Timed reply (SS or DS response), timestamps patched per transmission
+    UWB_TX_SLOT_FINAL,              // DS final
+    UWB_TX_SLOT_REPORT,             // DS report, timestamps patched per transmission
+    UWB_TX_SLOT_REQUEST,            // Ranging request, DS poll or broadcast ranging request
+    UWB_TX_SLOT_ANNOUNCE,           // Position announcement
+    UWB_TX_SLOTS
+} uwb_tx_slot_e;
+
+// Event reported by the DW IC interrupt callbacks
+typedef enum {
+    UWB_EVENT_TX_DONE = 0,          // Frame sent
+    UWB_EVENT_RX_OK,                // Good frame received
+    UWB_EVENT_RX_TIMEOUT,           // Frame wait or preamble detection timeout
+    UWB_EVENT_RX_ERROR              // PHY header, FCS, SFD timeout or other reception error
+} uwb_event_e;
+
+// Descriptor queued by the interrupt, the task reads the frame itself
+typedef struct {
+    uwb_event_e event;
+    uint32_t status;                // SYS_STATUS low word as seen by dwt_isr()
+    uint16_t length;                // Frame length including FCS, UWB_EVENT_RX_OK only
+    dwt_twr_stamps_t stamps;        // RX timestamp, TX timestamp and clock offset, UWB_EVENT_RX_OK only
+    uint32_t cycles;                // port_GetCycleCount() when dwt_isr() reported the frame, UWB_EVENT_RX_OK only
+} uwb_event_t;
+
+// Reception to delayed transmission turnaround, measured while uwb_turnaround_measure() is on
+typedef struct {
+    uint32_t samples;               // Delayed transmissions measured
+    uint32_t last_uus;              // RX timestamp of the last frame to dwt_starttx(), DW IC time
+    uint32_t max_uus;
+    uint32_t max_cycles;            // Frame taken from the DW IC to dwt_starttx(), DWT cycles counted since main() started them
+    uint32_t late_tx;               // Delayed transmissions refused by dwt_starttx(), counted always
+} uwb_turnaround_t;
+
 // 1. position yourself
 // 2. ranging request - rsp sadrži rx_ts, tx_ts i trenutne coord
 // 3. position anouncment
@@ -105,5 +172,48 @@ uwb_result_e uwb_device_init(uwb_device_t *uwb_device);
 uwb_result_e uwb_send_msg(const uwb_device_t *uwb_device, uint16_t target_device_address, const uwb_msg_t* uwb_msg, uint8_t mode);
 uwb_result_e uwb_send_payload(const uwb_device_t *uwb_device, uint16_t target_device_address, const uint8_t* data, uint32_t data_size, uint8_t mode);
 uwb_result_e uwb_receive_poll(uwb_device_t *uwb_device, uint16_t *sender_device_address, uint8_t* data, uint32_t max_data_size, uint32_t* received_size);
+// Receives one message and decodes it into uwb_msg, UWB_COMM_ERROR for a malformed or foreign version message
+uwb_result_e uwb_receive_msg(uwb_device_t *uwb_device, uint16_t *sender_device_address, uwb_msg_t* uwb_msg);
+// Encodes uwb_msg into buf (UWB_MSG_MAX_LEN bytes) and returns the length, 0 for an unknown command. Only the fields
+// the command uses go on the air: 1-byte command, request sequence number with 40-bit timestamps (TX as an offset
+// from RX), coordinates in mm
+uint32_t uwb_msg_encode(const uwb_msg_t *uwb_msg, uint8_t *buf);
+// Decodes a received message, fields the command does not carry are zero
+uwb_result_e uwb_msg_decode(const uint8_t *buf, uint32_t size, uwb_msg_t *uwb_msg);
+// Writes uwb_msg to its slot of the DW IC TX buffer as a template for uwb_send_staged(). Nothing goes over SPI when
+// the slot holds the same template already. The frame stays there until the slot is staged with another message
+uwb_result_e uwb_stage_msg(const uwb_device_t *uwb_device, uwb_tx_slot_e slot, const uwb_msg_t *uwb_msg);
+// Command staged in the slot, COMMAND_NOTHING when it is empty
+uwb_command_e uwb_get_staged_command(uwb_tx_slot_e slot);
+// Sends the frame resident in the slot with only the sequence number, destination and, for a message carrying them,
+// the request sequence number and timestamps rewritten. UWB_INVALID_PARAM when tx_ts is too far from rx_ts for the template, send the whole message instead
+uwb_result_e uwb_send_staged(const uwb_device_t *uwb_device, uwb_tx_slot_e slot, uint16_t target_device_address, uint8_t rx_seq, uint64_t rx_ts, uint64_t tx_ts, uint8_t mode);
+// Hands RX/TX events to a FreeRTOS queue from the DW IC interrupt, from then on receiving blocks the task instead of polling SYS_STATUS
+uwb_result_e uwb_irq_enable(uwb_device_t *uwb_device);
+// Receives one frame, blocking for at most timeout_ms (UWB_WAIT_FOREVER for no limit). Needs uwb_irq_enable()
+uwb_result_e uwb_receive_timeout(uwb_device_t *uwb_device, uint16_t *sender_device_address, uint8_t* data, uint32_t max_data_size, uint32_t* received_size, uint32_t timeout_ms);
+// Events lost because the queue was full
+uint32_t uwb_get_dropped_events(void);
+// Receiver turn-on delay after a DWT_RESPONSE_EXPECTED transmission, frame wait timeout (UUS) and preamble detection
+// timeout (PAC units), 0 disables each. They stay in force for every reception until changed
+void uwb_set_response_timeouts(uint32_t rx_after_tx_uus, uint32_t frame_timeout_uus, uint16_t preamble_timeout_pac);
+// Times every delayed transmission against the frame received before it, costs one SYS_TIME read per transmission
+void uwb_turnaround_measure(bool enable);
+void uwb_get_turnaround(uwb_turnaround_t *turnaround);
+void uwb_reset_turnaround(void);
+// Timestamps and clock offset captured with the last frame returned by uwb_receive_poll or uwb_receive_timeout
+void uwb_get_rx_stamps(dwt_twr_stamps_t *stamps);
+// MAC sequence number of that frame
+uint8_t uwb_get_rx_seq(void);
+// Sequence number of the last frame sent. Each peer gets its own count, a reply carries the one of its request
+uint8_t uwb_get_tx_seq(void);
+// Frames dropped as UWB_DUPLICATE
+uint32_t uwb_get_duplicate_frames(void);
+// Makes the CIA log all diagnostic registers, uwb_get_rx_nlos() needs it on before the frame arrives
+void uwb_rx_diagnostics(bool enable);
+// First path power and receive signal level of the last frame, dBm in q8.8. Reads the Ipatov diagnostics
+uwb_result_e uwb_get_rx_power(int16_t *fp_power, int16_t *rsl);
+// Probability in percent that the last frame came over a non line of sight channel, UWB_NLOS_UNKNOWN without diagnostics
+uint8_t uwb_get_rx_nlos(void);
 
 #endif /* APP_INC_DEVICE_PROTOCOL_H_ */
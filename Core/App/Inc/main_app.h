@@ -18,7 +18,37 @@
         }                                                    \
     } while (0)
 
+// Reply delay until range_calibrate_turnaround has measured this build, and the broadcast slot base
 #define POLL_RX_TO_RESP_TX_DLY_UUS 650
+// Preamble and SFD, transmitted before the RMARKER the delayed TX time refers to (PLEN 128, PRF64)
+#define TURNAROUND_SHR_UUS 140
+// Jitter headroom on top of the longest measured turnaround
+#define TURNAROUND_MARGIN_UUS 50
+#define TURNAROUND_CAL_SAMPLES 50
+// Response frame plus the time the tag needs to take it and re-enable the receiver
+#define RANGING_SLOT_UUS 500
+// range_with response timeouts. The receiver turns on this long after the request leaves
+#define POLL_TX_TO_RESP_RX_DLY_UUS 100
+// and gives up when no preamble starts within about 1.2 ms (PAC 8) or no frame is in after 1.5 ms,
+// enough for a reply delay up to 1.4 ms
+#define RESP_PRE_TIMEOUT_PAC 150
+#define RESP_RX_TIMEOUT_UUS 1500
+// Longest reply delay the timeouts above wait for, range_calibrate_turnaround goes no further
+#define TURNAROUND_MAX_UUS 1400
+#define RANGING_RETRIES 2
+// Self positioning: ranges per anchor before the confidence interval is trusted, the interval it stops at,
+// and the outlier threshold in standard deviations (MAD based)
+#define SELF_POS_MIN_RANGES 10
+#define SELF_POS_CI_M 0.005
+#define SELF_POS_MAD_K 3.0
+// Tag tracking: broadcast rounds per self positioning, standard deviation of a range, process noise (m^2/s^3),
+// innovation gate in standard deviations, and the uncertainty the track starts with at the first fix
+#define TAG_TRACK_ROUNDS 20
+#define TAG_TRACK_RANGE_SD_M 0.05
+#define TAG_TRACK_ACCEL_PSD 1.0
+#define TAG_TRACK_GATE 4.0
+#define TAG_TRACK_START_SD_M 0.3
+#define TAG_TRACK_START_VELOCITY_SD 1.0
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
 /*--------------------------- EXTERN -----------------------------------------*/
 /*--------------------------- GLOBAL FUNCTION PROTOTYPES ---------------------*/
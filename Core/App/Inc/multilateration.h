@@ -13,20 +13,75 @@
 #include <stdbool.h>
 #include "device_protocol.h"
 /*--------------------------- MACROS AND DEFINES -----------------------------*/
+// Anchors multilat_wls() takes at most
+#define MULTILAT_ANCHORS_MAX 16
+// Levenberg-Marquardt steps after the linear estimate, the solve time is bounded by this many passes over the anchors
+#define MULTILAT_ITER_MAX 10
+// The refinement has converged once a step is shorter than this, in float above the resolution of room coordinates
+#ifdef POSITION_SINGLE_PRECISION
+#define MULTILAT_STEP_TOL_M 1e-4f
+#else
+#define MULTILAT_STEP_TOL_M 1e-6
+#endif
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+// Scratch and diagnostics of multilat_wls(), owned by the caller so the solver needs no heap or large stack
+typedef struct {
+    position_real_t normal[4][5];                   // Normal equations of the current step, right side in the last used column
+    position_real_t residual[MULTILAT_ANCHORS_MAX]; // Estimated minus measured distance per anchor, NAN for an unused anchor
+    position_real_t rms;                            // Weighted RMS of the residuals
+    uint8_t used;                                   // Anchors with a distance and a positive weight
+    position_real_t lambda;                         // Levenberg-Marquardt damping the refinement ended with
+    uint8_t iterations;                             // Refinement steps taken, rejected ones included
+    bool converged;                                 // Last step below MULTILAT_STEP_TOL_M, false when MULTILAT_ITER_MAX ran out first
+} multilat_work_t;
+
+// Linear solver of fixed anchors: the pseudo-inverse of the centred system, the inverse itself for 4 anchors,
+// computed once so a fix costs one matrix-vector product
+typedef struct {
+    coord_t anchors[MULTILAT_ANCHORS_MAX];           // Positions the factorisation belongs to
+    coord_t centroid;
+    position_real_t anchor_sq[MULTILAT_ANCHORS_MAX]; // |a - centroid|^2 per anchor
+    position_real_t pinv[4][MULTILAT_ANCHORS_MAX];   // (A'A)^-1 A', rows [|p|^2; x; y; z]
+    uint8_t count;
+    bool valid;
+} multilat_geometry_t;
 /*--------------------------- EXTERN -----------------------------------------*/
 /*--------------------------- GLOBAL FUNCTION PROTOTYPES ---------------------*/
 
 void multilat_aprox_matrix(
     const coord_t anchors[4], // 4 anchora sa x,y,z
-    const double distances[4],  // 4 udaljenosti s1,s2,s3,s4
+    const position_real_t distances[4],  // 4 udaljenosti s1,s2,s3,s4
     coord_t *est		  // izlaz: x,y,z estimacije
 );
 
 void multilat_gauss_iter_matrix(
     const coord_t anchors[4], // 4 anchora sa x,y,z
-    const double distances[4],  // 4 udaljenosti s1,s2,s3,s4
+    const position_real_t distances[4],  // 4 udaljenosti s1,s2,s3,s4
     coord_t *est		  // izlaz: x,y,z estimacije
 );
 
+// Weighted least squares position from count anchors. The linearised system gives the start, weighted
+// Levenberg-Marquardt refines it, work reports how. weights are per range, 1/variance or anything proportional, NULL weighs all ranges the same.
+// An anchor with a NAN distance or a weight not above 0 is left out. Returns false below 4 usable anchors,
+// over MULTILAT_ANCHORS_MAX or with no finite solution, est is then untouched
+bool multilat_wls(
+    const coord_t *anchors,
+    const position_real_t *distances,
+    const position_real_t *weights,
+    uint8_t count,
+    multilat_work_t *work,
+    coord_t *est
+);
+
+// Forgets the factorisation, the next multilat_geometry_set() computes it again
+void multilat_geometry_invalidate(multilat_geometry_t *geometry);
+
+// Factorises the geometry of count anchors, nothing to do while they stay where they were. Returns false
+// for fewer than 4 or more than MULTILAT_ANCHORS_MAX anchors, or anchors in one plane
+bool multilat_geometry_set(multilat_geometry_t *geometry, const coord_t *anchors, uint8_t count);
+
+// Unweighted linear position from one distance per anchor of the geometry. A missing (NAN) distance changes
+// the system, false then and the caller falls back to multilat_wls()
+bool multilat_geometry_solve(const multilat_geometry_t *geometry, const position_real_t *distances, coord_t *est);
+
 #endif /* APP_INC_MULTILATERATION_H_ */
@@ -22,14 +22,88 @@
 #include <shared_defines.h>
 #include <shared_functions.h>
 /*--------------------------- MACROS AND DEFINES -----------------------------*/
+// Response slots after a broadcast ranging request, anchor address16 1..RANGING_SLOTS
+#define RANGING_SLOTS 8
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+// Exchange run by range_with
+typedef enum {
+	RANGING_SS_TWR = 0,		// Request/response, responder clock drift corrected with the clock offset ratio
+	RANGING_DS_TWR			// Poll/response/final plus report, asymmetric double-sided formula
+} ranging_mode_e;
+
+// Raw round and reply times of the last range_with exchange, in DW IC time units
+typedef struct {
+	uint32_t round_init;	// Poll TX to response RX, initiator clock
+	uint32_t reply_resp;	// Poll RX to response TX, responder clock
+	uint32_t round_resp;	// Response TX to final RX, responder clock. DS-TWR only
+	uint32_t reply_init;	// Response RX to final TX, initiator clock. DS-TWR only
+} ranging_rounds_t;
+
+// Parts of range_quality_t range_with fills in. Stamps, clock offset and sequence number are already in memory,
+// power and NLOS cost extra SPI reads of the diagnostics for every response
+typedef enum {
+	RANGE_QUALITY_STAMPS = 0x01,	// Four raw timestamps of the poll and response
+	RANGE_QUALITY_CLOCK = 0x02,		// Clock offset of the response
+	RANGE_QUALITY_POWER = 0x04,		// First path power and RSL of the response
+	RANGE_QUALITY_NLOS = 0x08,		// NLOS probability of the response
+	RANGE_QUALITY_SEQ = 0x10		// MAC sequence number of the response
+} range_quality_field_e;
+
+// Measurement quality of the last range_with exchange, only the parts in fields are valid
+typedef struct {
+	uint8_t fields;			// range_quality_field_e bits filled in
+	uint8_t seq;
+	uint8_t nlos;			// Percent, UWB_NLOS_UNKNOWN without diagnostics
+	int16_t clock_offset;	// As dwt_readclockoffset
+	int16_t fp_power;		// dBm, q8.8
+	int16_t rsl;			// dBm, q8.8
+	uint32_t poll_tx;		// Low 32 bits, DW IC time units. Initiator clock
+	uint32_t poll_rx;		// Responder clock
+	uint32_t resp_tx;		// Responder clock
+	uint32_t resp_rx;		// Initiator clock
+} range_quality_t;
 /*--------------------------- EXTERN -----------------------------------------*/
 extern const coord_t anchor1;
 extern const coord_t anchor2;
 extern const coord_t anchor3;
 extern const coord_t anchor4;
 /*--------------------------- GLOBAL FUNCTION PROTOTYPES ---------------------*/
-void range_with(uwb_device_t *uwb_device, uint16_t target_address, double *distance, coord_t *coord);
+// Ranges with one anchor, repeating a failed exchange up to the configured retries. Returns UWB_RANGE_FAILED and leaves
+// distance and coord untouched when no attempt got its responses in time
+uwb_result_e range_with(uwb_device_t *uwb_device, uint16_t target_address, position_real_t *distance, coord_t *coord);
+// Stages the response to the kind of request answered last in the DW IC TX buffer, call while waiting for requests.
+// Writes the frame only when it is not staged already or the coordinates changed
+void range_stage_response(uwb_device_t *uwb_device);
+// Answers the ranging request returned by the last uwb_receive_poll
+void range_respond(uwb_device_t *uwb_device, uint16_t initiator_address);
+// Broadcasts one ranging request and collects the slotted responses of the listed anchors, returns how many answered.
+// distance[i] of an anchor that did not answer is NAN, its coord[i] zero
+uint8_t range_with_all(uwb_device_t *uwb_device, const uint16_t *anchors, uint8_t anchor_count, position_real_t *distance, coord_t *coord);
+// Answers the broadcast ranging request returned by the last uwb_receive_poll in this device's slot
+void range_respond_slot(uwb_device_t *uwb_device, uint16_t initiator_address);
+// Answers COMMAND_DS_POLL and COMMAND_DS_FINAL returned by the last uwb_receive_poll
+void range_respond_ds(uwb_device_t *uwb_device, uint16_t initiator_address, uwb_command_e command_type);
+// Times the next samples timed replies (responses, DS finals) and then sets the reply delay to the longest
+// turnaround plus preamble and margin, at most TURNAROUND_MAX_UUS. Broadcast slots keep POLL_RX_TO_RESP_TX_DLY_UUS,
+// the tag's window depends on it
+void range_calibrate_turnaround(uint32_t samples);
+void range_set_turnaround(uint32_t delay_uus);
+uint32_t range_get_turnaround(void);
+// Selects the exchange range_with runs, RANGING_SS_TWR by default
+void range_set_mode(ranging_mode_e mode);
+// Failed exchanges range_with repeats, RANGING_RETRIES by default
+void range_set_retries(uint8_t retries);
+// 95 % confidence interval (m) at which self positioning stops ranging with an anchor, 0 always runs all rounds
+void range_set_self_position_ci(double ci_m);
+// Process noise of the tag tracker, white acceleration in m^2/s^3, TAG_TRACK_ACCEL_PSD by default
+void range_set_track_process_noise(position_real_t accel_psd);
+// Tag position as filtered up to the last range range_with_all took, false before self_position_device_5
+// started a track. Updated with every range, not once per round
+bool range_get_track(coord_t *position);
+void range_get_rounds(ranging_rounds_t *rounds);
+// Selects the range_quality_field_e parts range_with records, none by default
+void range_set_quality(uint8_t fields);
+void range_get_quality(range_quality_t *quality);
 void self_position_device_2(uwb_device_t *uwb_device);
 void self_position_device_3(uwb_device_t *uwb_device);
 void self_position_device_4(uwb_device_t *uwb_device);
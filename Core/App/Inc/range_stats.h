@@ -0,0 +1,49 @@
+/*
+ * range_stats.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Marko Srpak
+ */
+
+#ifndef APP_INC_RANGE_STATS_H_
+#define APP_INC_RANGE_STATS_H_
+
+/*--------------------------- INCLUDES ---------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+/*--------------------------- MACROS AND DEFINES -----------------------------*/
+// Last samples the median and MAD are taken over
+#define RANGE_STATS_WINDOW 15
+// Samples in the window before the outlier test starts rejecting
+#define RANGE_STATS_WINDOW_MIN 5
+// Lower bound of the MAD, below the timestamp resolution (~0.5 cm) identical ranges would reject any change
+#define RANGE_STATS_MAD_FLOOR_M 0.01
+/*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+// Online estimator of one distance: Welford mean and variance over the accepted samples,
+// median and MAD over the last RANGE_STATS_WINDOW samples for outlier rejection
+typedef struct {
+	uint32_t count;			// Accepted samples
+	uint32_t rejected;		// Samples dropped as outliers
+	double mean;
+	double m2;				// Sum of squared deviations from the mean
+	double mad_k;			// Rejection threshold in scaled MADs, 0 accepts everything
+	double window[RANGE_STATS_WINDOW];
+	uint8_t window_len;
+	uint8_t window_next;
+} range_stats_t;
+/*--------------------------- EXTERN -----------------------------------------*/
+/*--------------------------- GLOBAL FUNCTION PROTOTYPES ---------------------*/
+void range_stats_init(range_stats_t *stats, double mad_k);
+// Adds one range, returns false when it was rejected as an outlier
+bool range_stats_add(range_stats_t *stats, double sample);
+double range_stats_mean(const range_stats_t *stats);
+// Sample variance, 0 below two samples
+double range_stats_variance(const range_stats_t *stats);
+// Half width of the 95 % confidence interval of the mean, INFINITY below two samples
+double range_stats_ci95(const range_stats_t *stats);
+// Median of the window, MAD (scaled to a standard deviation for normal noise) into mad if not NULL
+double range_stats_median(const range_stats_t *stats, double *mad);
+// True once min_samples are accepted and the 95 % confidence interval is under ci_m
+bool range_stats_converged(const range_stats_t *stats, uint32_t min_samples, double ci_m);
+
+#endif /* APP_INC_RANGE_STATS_H_ */
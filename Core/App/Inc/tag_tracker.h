@@ -0,0 +1,44 @@
+/*
+ * tag_tracker.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Marko Srpak
+ */
+
+#ifndef APP_INC_TAG_TRACKER_H_
+#define APP_INC_TAG_TRACKER_H_
+
+/*--------------------------- INCLUDES ---------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "device_protocol.h"
+/*--------------------------- MACROS AND DEFINES -----------------------------*/
+// Position and velocity in x, y, z
+#define TAG_TRACKER_STATES 6
+/*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+// Extended Kalman filter of the tag position on a constant velocity model, one range at a time.
+// The covariance is kept symmetric, only its upper triangle is computed
+typedef struct {
+	position_real_t x[TAG_TRACKER_STATES];						// x, y, z in m, then their velocities in m/s
+	position_real_t p[TAG_TRACKER_STATES][TAG_TRACKER_STATES];	// Covariance of x
+	position_real_t accel_psd;		// Process noise, spectral density of the white acceleration, m^2/s^3
+	position_real_t gate;			// Innovation gate in standard deviations, 0 accepts every range
+	uint32_t updates;				// Ranges fused since the last reset
+	uint32_t rejected;				// Ranges the gate dropped since the last reset
+	bool valid;						// Started by tag_tracker_reset
+} tag_tracker_t;
+/*--------------------------- EXTERN -----------------------------------------*/
+/*--------------------------- GLOBAL FUNCTION PROTOTYPES ---------------------*/
+// Sets the noise model, the track starts with tag_tracker_reset
+void tag_tracker_init(tag_tracker_t *tracker, position_real_t accel_psd, position_real_t gate);
+void tag_tracker_set_process_noise(tag_tracker_t *tracker, position_real_t accel_psd);
+// Starts the track at position, standard deviation position_sd per axis, at rest within velocity_sd
+void tag_tracker_reset(tag_tracker_t *tracker, const coord_t *position, position_real_t position_sd, position_real_t velocity_sd);
+// Moves the state dt_s seconds ahead
+void tag_tracker_predict(tag_tracker_t *tracker, position_real_t dt_s);
+// Fuses one range to the anchor at anchor, standard deviation range_sd. Returns false without a track,
+// for a tag on the anchor or when the gate rejected the range
+bool tag_tracker_update(tag_tracker_t *tracker, const coord_t *anchor, position_real_t range, position_real_t range_sd);
+void tag_tracker_position(const tag_tracker_t *tracker, coord_t *position);
+
+#endif /* APP_INC_TAG_TRACKER_H_ */
@@ -8,14 +8,64 @@
 
 /*--------------------------- INCLUDES ---------------------------------------*/
 #include "device_protocol.h"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#include <math.h>
 /*--------------------------- MACROS AND DEFINES -----------------------------*/
-// Delay between frames, in UWB microseconds
-#define POLL_TX_TO_RESP_RX_DLY_UUS 240
-// Receive response timeout
-#define RESP_RX_TIMEOUT_UUS 400
-
 #define ALL_MSG_SN_IDX 2
+// MAC header: frame control (2), sequence number (1), PAN ID (2), destination (2), source (2)
+#define FRAME_HEADER_LEN 9
+// Checksum appended by the DW IC
+#define FRAME_FCS_LEN 2
+// Events that raise the DW IC interrupt in interrupt mode. Frame filter rejections leave the receiver on and stay silent
+#define UWB_IRQ_EVENTS (DWT_INT_TXFRS_BIT_MASK | DWT_INT_RXFCG_BIT_MASK | (SYS_STATUS_ALL_RX_ERR & ~DWT_INT_ARFE_BIT_MASK) | SYS_STATUS_ALL_RX_TO)
+/* NLOS probability from the Ipatov diagnostics, constants from APS006 part 3 and the simple_rx_nlos example */
+#define NLOS_CIR_POWER_SCALE 2097152.0f   // 2^21, channel area to first path amplitude scale (DW3000)
+#define NLOS_LEVEL_THRESHOLD_DB 12.0f     // Received minus first path level above which the channel is NLOS
+#define NLOS_LEVEL_FACTOR 0.4f            // Below threshold * factor the levels alone say line of sight
+#define NLOS_INDEX_MIN 3.3f               // First path to peak distance (samples), line of sight up to here
+#define NLOS_INDEX_MAX 6.0f
+#define NLOS_INDEX_PR_A 0.39178f
+#define NLOS_INDEX_PR_B 1.31719f
+/* On-air message encoding. Byte 0 carries the version in the top 3 bits and a presence flag per optional field,
+ * byte 1 the command, then the present fields in flag order, little endian */
+#define MSG_VERSION_SHIFT 5
+#define MSG_HAS_RX_TS 0x01                // Sequence number of the request and its 40-bit receive timestamp
+#define MSG_HAS_TX_DELTA 0x02             // Transmit timestamp as a signed 32-bit offset from the receive timestamp
+#define MSG_HAS_TX_TS 0x04                // 40-bit transmit timestamp, when the offset does not fit
+#define MSG_HAS_COORD 0x08                // Coordinates, 3 x signed 32-bit millimetres
+#define MSG_HAS_RESULT 0x10               // Result byte, left out for UWB_OK
+#define MSG_FLAGS_ALL 0x1F
+#define MSG_TS_MASK 0xFFFFFFFFFFULL       // DW IC timestamps are 40 bits
+#define MSG_COORD_SCALE 1000.0            // Metres to millimetres
+/* TX buffer layout: the uwb_tx_slot_e frames at fixed offsets, then the frame of uwb_send_payload(). Switching frames
+ * costs only a TX_FCTRL write. Offsets past the directly addressable first 128 bytes need the indirect pointer */
+#define TX_SLOT_LEN (FRAME_HEADER_LEN + UWB_MSG_MAX_LEN + FRAME_FCS_LEN)
+#define TX_PAYLOAD_OFFSET (UWB_TX_SLOTS * TX_SLOT_LEN)
+#define TX_FCTRL_PAYLOAD UWB_TX_SLOTS    // tx_fctrl value while it points at the uwb_send_payload() frame
+// Bytes of a slot rewritten per transmission: sequence number, PAN ID and destination, for a message with timestamps
+// also source, message header, RX timestamp and TX offset, contiguous so they go in one SPI write
+#define SLOT_PATCH_LEN (5)
+#define SLOT_PATCH_TS_LEN (FRAME_HEADER_LEN - ALL_MSG_SN_IDX + 2 + 6 + 4)
+// Peers with their own sequence numbers, a power of two. Beyond that a new peer takes the place of an old one
+#define PEER_TABLE_LEN 16
+// A frame this many sequence numbers behind the last one from the same peer is still dropped as stale,
+// anything further back is taken for a peer that restarted
+#define SEQ_STALE_WINDOW 8
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+// Sequence state kept per peer: the counter of the frames sent to it, the last frames received from it.
+// A peer numbers its broadcasts with a counter of their own, they are tracked apart
+typedef struct {
+    uint16_t address;
+    bool used;
+    bool rx_valid;
+    bool rx_bc_valid;
+    uint8_t tx_seq;                 // Sequence number of the next frame to the peer
+    uint8_t rx_seq;                 // Last unicast frame from the peer
+    uint8_t rx_bc_seq;              // Last broadcast frame from the peer
+} peer_seq_t;
+
 static const dwt_config_t config = {
     5,                /* Channel number. */
     DWT_PLEN_128,     /* Preamble length. Used in TX only. */
@@ -34,9 +84,45 @@ static const dwt_config_t config = {
 
 // static uwb_device_t uwb_devices[5] = {0};
 static const uint16_t default_ant_dly = 16385;
-static uint8_t frame_seq_nb = 0;
+static peer_seq_t peers[PEER_TABLE_LEN];
+/* Sequence number of the last frame sent, the one its reply echoes. */
+static uint8_t tx_seq;
+/* Frames dropped as duplicates or stale. */
+static uint32_t duplicate_frames = 0;
+/* Fields each command carries on the air, the receiver of a command never looks at the others. */
+static const uint8_t msg_fields[] = {
+	[COMMAND_NOTHING] = 0,
+	[COMMAND_RANGING_REQUEST] = 0,
+	[COMMAND_RANGING_RESPONSE] = MSG_HAS_RX_TS | MSG_HAS_TX_DELTA | MSG_HAS_COORD,
+	[COMMAND_POSITION_YOURSELF] = 0,
+	[COMMAND_POSITION_ANNOUNCEMENT] = MSG_HAS_COORD,
+	[COMMAND_POSITION_ANNOUNCEMENT_GN] = MSG_HAS_COORD,
+	[COMMAND_POSITION_ANNOUNCEMENT_PREDEF] = MSG_HAS_COORD,
+	[COMMAND_POSITION_ANNOUNCEMENT_PREDEF_GN] = MSG_HAS_COORD,
+	[COMMAND_DS_POLL] = 0,
+	[COMMAND_DS_RESPONSE] = MSG_HAS_RX_TS | MSG_HAS_TX_DELTA,
+	[COMMAND_DS_FINAL] = 0,
+	[COMMAND_DS_REPORT] = MSG_HAS_RX_TS | MSG_HAS_TX_DELTA | MSG_HAS_COORD,
+	[COMMAND_RANGING_BROADCAST] = 0,
+	[COMMAND_POSITION_ANNOUNCEMENT_TRACKED] = MSG_HAS_COORD
+};
 /*--------------------------- STATIC FUNCTION PROTOTYPES ---------------------*/
 static uint32_t hash_fnv1a(uint8_t *data, size_t len);
+static peer_seq_t *peer_find(uint16_t address);
+static uint8_t peer_next_seq(uint16_t address);
+static uwb_result_e rx_seq_check(const uint8_t *header);
+static uwb_result_e tx_start(uint8_t mode);
+static uwb_result_e rx_header_check(const uwb_device_t *uwb_device, uint8_t *header);
+static uwb_result_e rx_payload_read(const uint8_t *header, uint16_t frame_len, uint16_t *sender_device_address, uint8_t* data, uint32_t max_data_size, uint32_t* received_size);
+static void irq_queue_event(uwb_event_t *event);
+static void turnaround_sample(void);
+static void irq_tx_done_cb(const dwt_cb_data_t *cb_data);
+static void irq_rx_ok_cb(const dwt_cb_data_t *cb_data);
+static void irq_rx_to_cb(const dwt_cb_data_t *cb_data);
+static void irq_rx_err_cb(const dwt_cb_data_t *cb_data);
+static uint8_t *put_le(uint8_t *buf, uint64_t value, uint8_t bytes);
+static uint64_t get_le(const uint8_t *buf, uint8_t bytes);
+static int32_t coord_to_mm(double value);
 /*--------------------------- VARIABLES --------------------------------------*/
 
 /* Values for the PG_DELAY and TX_POWER registers reflect the bandwidth and power of the spectrum at the current
@@ -123,11 +209,111 @@ static const uwb_device_t deviceTable[]={
 };
 
 static uint8_t tx_msg[118];
-static uint8_t rx_msg[FRAME_LEN_MAX];
 /* Hold copy of status register state here for reference so that it can be examined at a debug breakpoint. */
 static uint32_t status_reg = 0;
+/* Frame length, timestamps and clock offset of the last good frame, read in one SPI chain on reception. */
+static dwt_twr_stamps_t rx_stamps;
+/* MAC sequence number of the last frame returned to the caller. */
+static uint8_t rx_seq;
+/* Host cycle count when the last good frame was taken from the DW IC, start of the turnaround measurement. */
+static uint32_t rx_cycles;
+static bool turnaround_on = false;
+/* Set by a transmission with DWT_RESPONSE_EXPECTED: the receiver comes on by itself after the TX (with the
+ * rx-after-tx delay and the timeouts programmed for that exchange), the next receive must not restart it. */
+static bool rx_armed = false;
+static uwb_turnaround_t turnaround;
+
+/* Frames resident in the DW IC TX buffer, written by uwb_stage_msg(). The copy here is patched and written back
+ * in part per transmission, msg is the template as encoded with zero timestamps. */
+static struct {
+    uwb_command_e command;          // COMMAND_NOTHING while the slot is empty
+    uint8_t size;                   // Encoded message length
+    uint8_t msg[UWB_MSG_MAX_LEN];
+    uint8_t frame[TX_SLOT_LEN];
+} tx_slots[UWB_TX_SLOTS];
+/* Frame TX_FCTRL currently selects, a uwb_tx_slot_e or TX_FCTRL_PAYLOAD */
+static uint8_t tx_fctrl = TX_FCTRL_PAYLOAD;
+
+/* Interrupt mode: the DW IC ISR queues event descriptors, the receiving task blocks on the queue. */
+static bool irq_enabled = false;
+static QueueHandle_t event_queue = NULL;
+static StaticQueue_t event_queue_buffer;
+static uint8_t event_queue_storage[UWB_EVENT_QUEUE_LEN * sizeof(uwb_event_t)];
+static volatile uint32_t dropped_events = 0;
 
 /*--------------------------- STATIC FUNCTIONS -------------------------------*/
+// Entry of a peer, created on first contact. Open addressing with linear probing
+static peer_seq_t *peer_find(uint16_t address)
+{
+    uint8_t home = (uint8_t)(((uint32_t)address * 40503U) >> 8) & (PEER_TABLE_LEN - 1);
+    peer_seq_t *peer;
+
+    for (uint8_t i = 0; i < PEER_TABLE_LEN; i++) {
+        peer = &peers[(home + i) & (PEER_TABLE_LEN - 1)];
+        if (peer->used && peer->address == address) {
+            return peer;
+        }
+        if (!peer->used) {
+            break;
+        }
+    }
+    // A free entry, or with the table full the home entry, whose peer starts over as a new one
+    if (peer->used) {
+        peer = &peers[home];
+    }
+    memset(peer, 0, sizeof(*peer));
+    peer->used = true;
+    peer->address = address;
+    // Not from 0, a peer that knew us before a restart would take the first frames for stale ones
+    peer->tx_seq = (uint8_t)dwt_readsystimestamphi32();
+    return peer;
+}
+
+static uint8_t peer_next_seq(uint16_t address)
+{
+    tx_seq = peer_find(address)->tx_seq++;
+    return tx_seq;
+}
+
+// Drops a frame its sender already delivered, or one older than the last from it, before the payload is read
+static uwb_result_e rx_seq_check(const uint8_t *header)
+{
+    uint16_t sender, dest;
+    uint8_t seq = header[ALL_MSG_SN_IDX];
+
+    memcpy(&dest, &header[5], sizeof(uint16_t));
+    memcpy(&sender, &header[7], sizeof(uint16_t));
+    peer_seq_t *peer = peer_find(sender);
+    bool broadcast = (dest == UWB_BROADCAST_ADDRESS);
+    bool *valid = broadcast ? &peer->rx_bc_valid : &peer->rx_valid;
+    uint8_t *last = broadcast ? &peer->rx_bc_seq : &peer->rx_seq;
+
+    int8_t ahead = (int8_t)(seq - *last);
+    if (*valid && ahead <= 0 && ahead > -SEQ_STALE_WINDOW) {
+        duplicate_frames++;
+        return UWB_DUPLICATE;
+    }
+    *valid = true;
+    *last = seq;
+    return UWB_OK;
+}
+
+// Starts the frame already in the TX buffer. A delayed one whose time has passed is not sent at all
+static uwb_result_e tx_start(uint8_t mode)
+{
+    if ((mode & DWT_START_TX_DELAYED) && turnaround_on) {
+        turnaround_sample();
+    }
+
+    rx_armed = false;
+    if (dwt_starttx(mode) != DWT_SUCCESS) {
+        turnaround.late_tx++;
+        return UWB_TX_LATE;
+    }
+    rx_armed = (mode & DWT_RESPONSE_EXPECTED) != 0;
+    return UWB_OK;
+}
+
 static uint32_t hash_fnv1a(uint8_t *data, size_t len) {
     uint32_t hash = 0x811c9dc5;
     for (size_t i = 0; i < len; i++) {
@@ -136,6 +322,162 @@ static uint32_t hash_fnv1a(uint8_t *data, size_t len) {
     }
     return hash;
 }
+
+// Reads the MAC header of the frame in the RX buffer and checks that it is meant for this device
+static uwb_result_e rx_header_check(const uwb_device_t *uwb_device, uint8_t *header)
+{
+    // Read only the MAC header first, a frame that got past the filter but is not for us costs no more SPI traffic than this
+    dwt_readrxdata(header, FRAME_HEADER_LEN, 0);
+
+#if 0
+    printf("RX HDR:");
+    for (uint16_t i = 0; i < FRAME_HEADER_LEN; i++) {
+        printf(" %02X", header[i]);
+    }
+    printf("\n\r");
+#endif
+
+    // Validate Frame Control bytes, should all be the same accross all msg
+    if (header[0] != tx_msg[0] || header[1] != tx_msg[1]) {
+        return UWB_WRONG_ADDRESS;
+    }
+
+    // Validate PAN ID (bytes 3–4)
+    uint16_t received_panID;
+    memcpy(&received_panID, &header[3], sizeof(uint16_t));
+    if (received_panID != uwb_device->panID) {
+        return UWB_WRONG_ADDRESS;
+    }
+
+    // Validate destination address (bytes 5–6)
+    uint16_t dest_addr;
+    memcpy(&dest_addr, &header[5], sizeof(uint16_t));
+    if (dest_addr != uwb_device->address16 && dest_addr != UWB_BROADCAST_ADDRESS) {
+        return UWB_WRONG_ADDRESS;
+    }
+
+    return rx_seq_check(header);
+}
+
+// Copies the payload of the frame in the RX buffer to the caller and extracts the sender from the header
+static uwb_result_e rx_payload_read(const uint8_t *header, uint16_t frame_len, uint16_t *sender_device_address, uint8_t* data, uint32_t max_data_size, uint32_t* received_size)
+{
+    if (frame_len < FRAME_HEADER_LEN + FRAME_FCS_LEN) {
+        return UWB_COMM_ERROR;
+    }
+
+    // Payload (starting at byte 9, before 2-byte checksum) goes straight from the RX buffer to the caller
+    uint32_t payload_size = frame_len - FRAME_HEADER_LEN - FRAME_FCS_LEN;
+    if (payload_size > max_data_size) {
+        return UWB_MEMORY_ERROR;
+    }
+    if (payload_size > 0) {
+        dwt_readrxdata(data, (uint16_t)payload_size, FRAME_HEADER_LEN);
+    }
+
+    // Extract sender address (bytes 7–8)
+    memcpy(sender_device_address, &header[7], sizeof(uint16_t));
+    rx_seq = header[ALL_MSG_SN_IDX];
+    *received_size = payload_size;
+    return UWB_OK;
+}
+
+// Time from the RX timestamp of the last frame to now, the point the delayed transmission gets started
+static void turnaround_sample(void)
+{
+    uint32_t cycles = port_GetCycleCount() - rx_cycles;
+    // SYS_TIME counts in units of 256 DW IC time units, the same as the upper 32 bits of a timestamp
+    uint32_t elapsed = dwt_readsystimestamphi32() - (uint32_t)(rx_stamps.rx_stamp >> 8);
+    uint32_t uus = (uint32_t)(((uint64_t)elapsed << 8) / UUS_TO_DWT_TIME);
+
+    turnaround.samples++;
+    turnaround.last_uus = uus;
+    if (uus > turnaround.max_uus) {
+        turnaround.max_uus = uus;
+    }
+    if (cycles > turnaround.max_cycles) {
+        turnaround.max_cycles = cycles;
+    }
+}
+
+/* DW IC interrupt callbacks, called from dwt_isr() in interrupt context. They only queue a descriptor, the frame itself
+ * stays in the RX buffer until the task reads it: the receiver is not re-enabled before that. */
+static void irq_queue_event(uwb_event_t *event)
+{
+    BaseType_t woken = pdFALSE;
+    BaseType_t sent;
+
+    // dwt_isr() runs in the EXTI handler, or in the radio task with DECA_IRQ_DEFERRED
+    if (xPortIsInsideInterrupt()) {
+        sent = xQueueSendFromISR(event_queue, event, &woken);
+    } else {
+        sent = xQueueSend(event_queue, event, 0);
+    }
+    if (sent != pdPASS) {
+        dropped_events++;
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+static void irq_tx_done_cb(const dwt_cb_data_t *cb_data)
+{
+    uwb_event_t event = { .event = UWB_EVENT_TX_DONE, .status = cb_data->status };
+
+    irq_queue_event(&event);
+}
+
+static void irq_rx_ok_cb(const dwt_cb_data_t *cb_data)
+{
+    uwb_event_t event = { .event = UWB_EVENT_RX_OK, .status = cb_data->status, .length = cb_data->datalength };
+
+    // Timestamps are read here, in the same SPI chain as on the polled path
+    (void)dwt_readtwrstamps(&event.stamps);
+    event.cycles = port_GetCycleCount();
+    irq_queue_event(&event);
+}
+
+static void irq_rx_to_cb(const dwt_cb_data_t *cb_data)
+{
+    uwb_event_t event = { .event = UWB_EVENT_RX_TIMEOUT, .status = cb_data->status };
+
+    irq_queue_event(&event);
+}
+
+static void irq_rx_err_cb(const dwt_cb_data_t *cb_data)
+{
+    uwb_event_t event = { .event = UWB_EVENT_RX_ERROR, .status = cb_data->status };
+
+    irq_queue_event(&event);
+}
+static uint8_t *put_le(uint8_t *buf, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; i++) {
+        *buf++ = (uint8_t)(value >> (8 * i));
+    }
+    return buf;
+}
+
+static uint64_t get_le(const uint8_t *buf, uint8_t bytes)
+{
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)buf[i] << (8 * i);
+    }
+    return value;
+}
+
+// Rounds to the nearest millimetre, saturating far outside any room
+static int32_t coord_to_mm(double value)
+{
+    double mm = value * MSG_COORD_SCALE;
+    if (!(mm > INT32_MIN)) {
+        return (mm > 0) ? INT32_MAX : INT32_MIN;     // NaN ends up here as well
+    }
+    if (mm >= INT32_MAX) {
+        return INT32_MAX;
+    }
+    return (int32_t)lround(mm);
+}
 /*--------------------------- GLOBAL FUNCTIONS -------------------------------*/
 uwb_result_e uwb_device_init(uwb_device_t *uwb_device)
 {
@@ -144,6 +486,10 @@ uwb_result_e uwb_device_init(uwb_device_t *uwb_device)
 	}
 
 	printf("Start device initialization\r\n");
+	/* The reset below masks every DW IC interrupt again, receiving goes back to polling until uwb_irq_enable() */
+	port_set_dwic_isr(NULL);
+	irq_enabled = false;
+
     /* Configure SPI rate, DW3000 supports up to 38 MHz */
     port_set_dw_ic_spi_fastrate();
 
@@ -207,17 +553,24 @@ uwb_result_e uwb_device_init(uwb_device_t *uwb_device)
 	dwt_setrxantennadelay(uwb_device->rx_ant_dly);
 	dwt_settxantennadelay(uwb_device->tx_ant_dly);
 
-	// Ovo vjerojatno maknuti i na drugi nacin handelati
-	/* Set expected response's delay and timeout.
-	 * As this example only handles one incoming frame with always the same delay and timeout, those values can be set here once for all. */
-	//dwt_setrxaftertxdelay(POLL_TX_TO_RESP_RX_DLY_UUS);
-	// dwt_setrxtimeout(RESP_RX_TIMEOUT_UUS);
+	/* Frames for other PANs and addresses are dropped by the DW IC, they never raise RXFCG.
+	 * Data frames carry the protocol, acks are let through for when auto-ack gets used. */
+	dwt_setpanid(uwb_device->panID);
+	dwt_setaddress16(uwb_device->address16);
+	dwt_configureframefilter(DWT_FF_ENABLE_802_15_4, DWT_FF_DATA_EN | DWT_FF_ACK_EN);
+
+	/* No response delay or timeouts by default: a listening anchor waits for the next request forever.
+	 * range_with() sets them for the duration of each exchange, see uwb_set_response_timeouts(). */
+	uwb_set_response_timeouts(0, 0, 0);
 
 	/* Next can enable TX/RX states output on GPIOs 5 and 6 to help debug, and also TX/RX LEDs
 	 * Note, in real low power applications the LEDs should not be used. */
 	dwt_setlnapamode(DWT_LNA_ENABLE | DWT_PA_ENABLE);
 
 	uwb_device->is_initialized = true;
+	memset(tx_slots, 0, sizeof(tx_slots));
+	memset(peers, 0, sizeof(peers));
+	tx_fctrl = TX_FCTRL_PAYLOAD;
 	tx_msg[0] = 0x41;
 	tx_msg[1] = 0x88;
 
@@ -231,14 +584,105 @@ uwb_result_e uwb_send_msg(const uwb_device_t *uwb_device, uint16_t target_device
         return UWB_INVALID_PARAM;
     }
 
-    // Send the message as raw bytes
-    return uwb_send_payload(
-        uwb_device,
-        target_device_address,
-        (const uint8_t*)uwb_msg,
-        sizeof(uwb_msg_t),
-        mode
-    );
+    uint8_t payload[UWB_MSG_MAX_LEN];
+    uint32_t size = uwb_msg_encode(uwb_msg, payload);
+    if (size == 0) {
+        return UWB_INVALID_PARAM;
+    }
+
+    return uwb_send_payload(uwb_device, target_device_address, payload, size, mode);
+}
+
+uint32_t uwb_msg_encode(const uwb_msg_t *uwb_msg, uint8_t *buf)
+{
+    if ((uint32_t)uwb_msg->command_type >= sizeof(msg_fields) / sizeof(msg_fields[0])) {
+        return 0;
+    }
+
+    uint8_t flags = msg_fields[uwb_msg->command_type];
+    uint64_t rx_ts = uwb_msg->rx_ts & MSG_TS_MASK;
+    uint64_t tx_ts = uwb_msg->tx_ts & MSG_TS_MASK;
+    // Offset of the transmit from the receive timestamp across the 40-bit wrap, negative for DS_REPORT
+    int64_t tx_delta = (int64_t)(((tx_ts - rx_ts) & MSG_TS_MASK) << 24) >> 24;
+
+    if ((flags & MSG_HAS_TX_DELTA) && (tx_delta < INT32_MIN || tx_delta > INT32_MAX)) {
+        flags = (flags & ~MSG_HAS_TX_DELTA) | MSG_HAS_TX_TS;
+    }
+    if (uwb_msg->result != UWB_OK) {
+        flags |= MSG_HAS_RESULT;
+    }
+
+    uint8_t *p = buf;
+    *p++ = (UWB_MSG_VERSION << MSG_VERSION_SHIFT) | flags;
+    *p++ = (uint8_t)uwb_msg->command_type;
+    if (flags & MSG_HAS_RX_TS) {
+        *p++ = uwb_msg->rx_seq;
+        p = put_le(p, rx_ts, 5);
+    }
+    if (flags & MSG_HAS_TX_DELTA) {
+        p = put_le(p, (uint32_t)(int32_t)tx_delta, 4);
+    }
+    if (flags & MSG_HAS_TX_TS) {
+        p = put_le(p, tx_ts, 5);
+    }
+    if (flags & MSG_HAS_COORD) {
+        p = put_le(p, (uint32_t)coord_to_mm(uwb_msg->coord.x), 4);
+        p = put_le(p, (uint32_t)coord_to_mm(uwb_msg->coord.y), 4);
+        p = put_le(p, (uint32_t)coord_to_mm(uwb_msg->coord.z), 4);
+    }
+    if (flags & MSG_HAS_RESULT) {
+        *p++ = (uint8_t)uwb_msg->result;
+    }
+    return (uint32_t)(p - buf);
+}
+
+uwb_result_e uwb_msg_decode(const uint8_t *buf, uint32_t size, uwb_msg_t *uwb_msg)
+{
+    if (size < 2 || (buf[0] >> MSG_VERSION_SHIFT) != UWB_MSG_VERSION) {
+        return UWB_COMM_ERROR;
+    }
+
+    uint8_t flags = buf[0] & MSG_FLAGS_ALL;
+    uint32_t expected = 2;
+    expected += (flags & MSG_HAS_RX_TS) ? 6 : 0;
+    expected += (flags & MSG_HAS_TX_DELTA) ? 4 : 0;
+    expected += (flags & MSG_HAS_TX_TS) ? 5 : 0;
+    expected += (flags & MSG_HAS_COORD) ? 12 : 0;
+    expected += (flags & MSG_HAS_RESULT) ? 1 : 0;
+    // The offset needs the receive timestamp, and it is one or the other for the transmit timestamp
+    if (size != expected || ((flags & MSG_HAS_TX_DELTA) && !(flags & MSG_HAS_RX_TS))
+            || ((flags & MSG_HAS_TX_DELTA) && (flags & MSG_HAS_TX_TS))) {
+        return UWB_COMM_ERROR;
+    }
+
+    const uint8_t *p = buf + 2;
+    memset(uwb_msg, 0, sizeof(*uwb_msg));
+    uwb_msg->command_type = (uwb_command_e)buf[1];
+    uwb_msg->result = UWB_OK;
+    if (flags & MSG_HAS_RX_TS) {
+        uwb_msg->rx_seq = p[0];
+        uwb_msg->rx_ts = get_le(p + 1, 5);
+        p += 6;
+    }
+    if (flags & MSG_HAS_TX_DELTA) {
+        int32_t tx_delta = (int32_t)(uint32_t)get_le(p, 4);
+        uwb_msg->tx_ts = (uwb_msg->rx_ts + (uint64_t)(int64_t)tx_delta) & MSG_TS_MASK;
+        p += 4;
+    }
+    if (flags & MSG_HAS_TX_TS) {
+        uwb_msg->tx_ts = get_le(p, 5);
+        p += 5;
+    }
+    if (flags & MSG_HAS_COORD) {
+        uwb_msg->coord.x = (int32_t)(uint32_t)get_le(p, 4) / MSG_COORD_SCALE;
+        uwb_msg->coord.y = (int32_t)(uint32_t)get_le(p + 4, 4) / MSG_COORD_SCALE;
+        uwb_msg->coord.z = (int32_t)(uint32_t)get_le(p + 8, 4) / MSG_COORD_SCALE;
+        p += 12;
+    }
+    if (flags & MSG_HAS_RESULT) {
+        uwb_msg->result = (uwb_result_e)*p;
+    }
+    return UWB_OK;
 }
 
 uwb_result_e uwb_send_payload(const uwb_device_t *uwb_device, uint16_t target_device_address, const uint8_t* data, uint32_t data_size, uint8_t mode)
@@ -255,7 +699,7 @@ uwb_result_e uwb_send_payload(const uwb_device_t *uwb_device, uint16_t target_de
     }
 
     // sequence number
-    tx_msg[ALL_MSG_SN_IDX] = frame_seq_nb++;
+    tx_msg[ALL_MSG_SN_IDX] = peer_next_seq(target_device_address);
 
     // PAN ID (2 bytes)
     memcpy(&tx_msg[3], &uwb_device->panID, sizeof(uint16_t));
@@ -275,11 +719,15 @@ uwb_result_e uwb_send_payload(const uwb_device_t *uwb_device, uint16_t target_de
 
     // Clear TX frame sent event
     dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
-    dwt_writetxdata(total_size, tx_msg, 0); // Offset 0
-    dwt_writetxfctrl(total_size, 0, 1);     // Offset 0, ranging frame
+    // Behind the resident slots, they stay intact
+    dwt_writetxdata(total_size, tx_msg, TX_PAYLOAD_OFFSET);
+    dwt_writetxfctrl(total_size, TX_PAYLOAD_OFFSET, 1);     // Ranging frame
+    tx_fctrl = TX_FCTRL_PAYLOAD;
 
-    // Start transmission
-    dwt_starttx(mode);
+    uwb_result_e result = tx_start(mode);
+    if (result != UWB_OK) {
+        return result;
+    }
 #if 0
     printf("TX RAW [%lu bytes]:", total_size);
     for (uint16_t i = 0; i < total_size; i++) {
@@ -291,73 +739,325 @@ uwb_result_e uwb_send_payload(const uwb_device_t *uwb_device, uint16_t target_de
     return UWB_OK;
 }
 
+uwb_result_e uwb_stage_msg(const uwb_device_t *uwb_device, uwb_tx_slot_e slot, const uwb_msg_t *uwb_msg)
+{
+    if (uwb_device == NULL || uwb_msg == NULL || !uwb_device->is_initialized || slot >= UWB_TX_SLOTS) {
+        return UWB_INVALID_PARAM;
+    }
+
+    // Timestamps are patched in later, the template always carries an offset that fits
+    uwb_msg_t msg = *uwb_msg;
+    msg.rx_ts = 0;
+    msg.tx_ts = 0;
+    uint8_t payload[UWB_MSG_MAX_LEN];
+    uint32_t size = uwb_msg_encode(&msg, payload);
+    if (size == 0) {
+        return UWB_INVALID_PARAM;
+    }
+
+    // Already in the TX buffer, nothing to write
+    if (tx_slots[slot].command == msg.command_type && tx_slots[slot].size == size
+            && memcmp(tx_slots[slot].msg, payload, size) == 0) {
+        return UWB_OK;
+    }
+
+    uint8_t *frame = tx_slots[slot].frame;
+    uint32_t total_size = FRAME_HEADER_LEN + size + FRAME_FCS_LEN;
+    memset(frame, 0, sizeof(tx_slots[slot].frame));
+    frame[0] = tx_msg[0];
+    frame[1] = tx_msg[1];
+    memcpy(&frame[3], &uwb_device->panID, sizeof(uint16_t));
+    memcpy(&frame[7], &uwb_device->address16, sizeof(uint16_t));
+    memcpy(&frame[FRAME_HEADER_LEN], payload, size);
+
+    dwt_writetxdata(total_size, frame, slot * TX_SLOT_LEN);
+    if (tx_fctrl == slot) {
+        dwt_writetxfctrl(total_size, slot * TX_SLOT_LEN, 1);
+    }
+    memcpy(tx_slots[slot].msg, payload, size);
+    tx_slots[slot].size = size;
+    tx_slots[slot].command = msg.command_type;
+    return UWB_OK;
+}
+
+uwb_command_e uwb_get_staged_command(uwb_tx_slot_e slot)
+{
+    return (slot < UWB_TX_SLOTS) ? tx_slots[slot].command : COMMAND_NOTHING;
+}
+
+uwb_result_e uwb_send_staged(const uwb_device_t *uwb_device, uwb_tx_slot_e slot, uint16_t target_device_address, uint8_t rx_seq, uint64_t rx_ts, uint64_t tx_ts, uint8_t mode)
+{
+    if (uwb_device == NULL || !uwb_device->is_initialized || slot >= UWB_TX_SLOTS) {
+        return UWB_INVALID_PARAM;
+    }
+    if (tx_slots[slot].command == COMMAND_NOTHING) {
+        return UWB_NOT_CONFIGURED;
+    }
+
+    // The resident frame keeps everything but the sequence number, destination and timestamps
+    uint8_t *frame = tx_slots[slot].frame;
+    uint16_t patch_len = SLOT_PATCH_LEN;
+    memcpy(&frame[5], &target_device_address, sizeof(uint16_t));
+    if ((tx_slots[slot].msg[0] & (MSG_HAS_RX_TS | MSG_HAS_TX_DELTA)) == (MSG_HAS_RX_TS | MSG_HAS_TX_DELTA)) {
+        rx_ts &= MSG_TS_MASK;
+        int64_t tx_delta = (int64_t)(((tx_ts - rx_ts) & MSG_TS_MASK) << 24) >> 24;
+        if (tx_delta < INT32_MIN || tx_delta > INT32_MAX) {
+            return UWB_INVALID_PARAM;
+        }
+        frame[FRAME_HEADER_LEN + 2] = rx_seq;
+        uint8_t *p = put_le(&frame[FRAME_HEADER_LEN + 3], rx_ts, 5);
+        put_le(p, (uint32_t)(int32_t)tx_delta, 4);
+        patch_len = SLOT_PATCH_TS_LEN;
+    }
+    frame[ALL_MSG_SN_IDX] = peer_next_seq(target_device_address);
+
+    dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+    dwt_writetxdata(patch_len, &frame[ALL_MSG_SN_IDX], slot * TX_SLOT_LEN + ALL_MSG_SN_IDX);
+    if (tx_fctrl != slot) {
+        dwt_writetxfctrl(FRAME_HEADER_LEN + tx_slots[slot].size + FRAME_FCS_LEN, slot * TX_SLOT_LEN, 1);
+        tx_fctrl = slot;
+    }
+    return tx_start(mode);
+}
+
 uwb_result_e uwb_receive_poll(uwb_device_t *uwb_device, uint16_t *sender_device_address, uint8_t* data, uint32_t max_data_size, uint32_t* received_size)
 {
-    if (uwb_device == NULL || data == NULL || sender_device_address == NULL || !uwb_device->is_initialized) {
+    if (uwb_device == NULL || data == NULL || sender_device_address == NULL || received_size == NULL || !uwb_device->is_initialized) {
         return UWB_INVALID_PARAM;
     }
 
-    // Enable RX mode immediately
-    dwt_rxenable(DWT_START_RX_IMMEDIATE);
-    // Wait for frame received or error/timeout
-    waitforsysstatus(&status_reg, NULL, (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR), 0);
+    // In interrupt mode the task sleeps on the event queue instead
+    if (irq_enabled) {
+        return uwb_receive_timeout(uwb_device, sender_device_address, data, max_data_size, received_size, UWB_WAIT_FOREVER);
+    }
+
+    // Enable RX mode immediately, unless the last transmission already turns the receiver on
+    if (!rx_armed) {
+        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    }
+    rx_armed = false;
+    // Wait for frame received or error/timeout. A frame rejected by the frame filter (ARFE) leaves the receiver on, no need to wake up for it
+    waitforsysstatus(&status_reg, NULL, (DWT_INT_RXFCG_BIT_MASK | (SYS_STATUS_ALL_RX_ERR & ~DWT_INT_ARFE_BIT_MASK) | SYS_STATUS_ALL_RX_TO), 0);
 
     if (status_reg & DWT_INT_RXFCG_BIT_MASK)
     {
-        uint16_t frame_len;
+        uint8_t header[FRAME_HEADER_LEN];
+
+        rx_cycles = port_GetCycleCount();
 
-        // Clear RX frame received flag
-        dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK);
+        // Clear RX frame received flag, and frame filter rejections seen while waiting
+        dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | DWT_INT_ARFE_BIT_MASK);
 
-        // Read frame length and check buffer size
-        frame_len = dwt_getframelength(0);
-        if (frame_len > sizeof(rx_msg)) {
-            return UWB_MEMORY_ERROR;
+        uwb_result_e result = rx_header_check(uwb_device, header);
+        if (result != UWB_OK) {
+            return result;
         }
 
-        // Read frame into rx_buffer
-        dwt_readrxdata(rx_msg, frame_len, 0);
+        // Read frame length together with the ranging timestamps
+        if (dwt_readtwrstamps(&rx_stamps) != DWT_SUCCESS) {
+            return UWB_COMM_ERROR;
+        }
 
-#if 0
-    printf("RX RAW [%u bytes]:", frame_len);
-    for (uint16_t i = 0; i < frame_len; i++) {
-        printf(" %02X", rx_msg[i]);
+        return rx_payload_read(header, rx_stamps.frame_len, sender_device_address, data, max_data_size, received_size);
     }
-    printf("\n\r");
-#endif
 
-        // Validate Frame Control bytes, should all be the same accross all msg
-        if (rx_msg[0] != tx_msg[0] || rx_msg[1] != tx_msg[1]) {
-            return UWB_WRONG_ADDRESS;
-        }
+    // Clear RX error and timeout events, they stay set otherwise and every following call would return straight away
+    dwt_writesysstatuslo(SYS_STATUS_ALL_RX_ERR | SYS_STATUS_ALL_RX_TO);
 
-        // Validate PAN ID (bytes 3–4)
-        uint16_t received_panID;
-        memcpy(&received_panID, &rx_msg[3], sizeof(uint16_t));
-        if (received_panID != uwb_device->panID) {
-            return UWB_WRONG_ADDRESS;
-        }
+    return UWB_TIMEOUT;
+}
 
-        // Validate destination address (bytes 5–6)
-        uint16_t dest_addr;
-        memcpy(&dest_addr, &rx_msg[5], sizeof(uint16_t));
-        if (dest_addr != uwb_device->address16 && dest_addr != 0x0000) {
-            return UWB_WRONG_ADDRESS;
-        }
+uwb_result_e uwb_receive_timeout(uwb_device_t *uwb_device, uint16_t *sender_device_address, uint8_t* data, uint32_t max_data_size, uint32_t* received_size, uint32_t timeout_ms)
+{
+    uwb_event_t event;
+    uint8_t header[FRAME_HEADER_LEN];
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = (timeout_ms == UWB_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
 
-        // Extract sender address (bytes 7–8)
-        memcpy(sender_device_address, &rx_msg[7], sizeof(uint16_t));
+    if (uwb_device == NULL || data == NULL || sender_device_address == NULL || received_size == NULL || !uwb_device->is_initialized) {
+        return UWB_INVALID_PARAM;
+    }
+    if (!irq_enabled) {
+        return UWB_NOT_CONFIGURED;
+    }
+
+    // Enable RX mode immediately, unless the last transmission already turns the receiver on
+    if (!rx_armed) {
+        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    }
+    rx_armed = false;
+
+    // Sent frames are reported too, they are of no interest here
+    do {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        TickType_t wait = (timeout == portMAX_DELAY) ? portMAX_DELAY : (elapsed < timeout) ? (timeout - elapsed) : 0;
 
-        // Extract payload (starting at byte 9, before 2-byte checksum)
-        uint32_t payload_size = frame_len - 9 - 2;
-        if (payload_size > max_data_size) {
-            return UWB_MEMORY_ERROR;
+        if (xQueueReceive(event_queue, &event, wait) != pdTRUE) {
+            // Take the receiver down, a frame arriving now would otherwise be taken for the answer to the next call
+            dwt_forcetrxoff();
+            xQueueReset(event_queue);
+            return UWB_TIMEOUT;
         }
+    } while (event.event == UWB_EVENT_TX_DONE);
 
-        memcpy(data, &rx_msg[9], payload_size);
-        *received_size = payload_size;
-        return UWB_OK;
+    // dwt_isr() already cleared the events, errors are reported the same way as on the polled path
+    if (event.event != UWB_EVENT_RX_OK) {
+        return UWB_TIMEOUT;
     }
 
-    return UWB_TIMEOUT;
+    uwb_result_e result = rx_header_check(uwb_device, header);
+    if (result != UWB_OK) {
+        return result;
+    }
+    rx_stamps = event.stamps;
+    rx_cycles = event.cycles;
+
+    return rx_payload_read(header, event.length, sender_device_address, data, max_data_size, received_size);
+}
+
+uwb_result_e uwb_receive_msg(uwb_device_t *uwb_device, uint16_t *sender_device_address, uwb_msg_t* uwb_msg)
+{
+    uint32_t received_size = 0;
+
+    if (uwb_msg == NULL) {
+        return UWB_INVALID_PARAM;
+    }
+
+    uint8_t payload[UWB_MSG_MAX_LEN];
+    uwb_result_e result = uwb_receive_poll(uwb_device, sender_device_address, payload, sizeof(payload), &received_size);
+    if (result != UWB_OK) {
+        return result;
+    }
+
+    return uwb_msg_decode(payload, received_size, uwb_msg);
+}
+
+void uwb_set_response_timeouts(uint32_t rx_after_tx_uus, uint32_t frame_timeout_uus, uint16_t preamble_timeout_pac)
+{
+    dwt_setrxaftertxdelay(rx_after_tx_uus);
+    dwt_setrxtimeout(frame_timeout_uus);
+    dwt_setpreambledetecttimeout(preamble_timeout_pac);
+}
+
+void uwb_turnaround_measure(bool enable)
+{
+    turnaround_on = enable;
+}
+
+void uwb_get_turnaround(uwb_turnaround_t *out)
+{
+    *out = turnaround;
+}
+
+void uwb_reset_turnaround(void)
+{
+    memset(&turnaround, 0, sizeof(turnaround));
+}
+
+void uwb_get_rx_stamps(dwt_twr_stamps_t *stamps)
+{
+    *stamps = rx_stamps;
+}
+
+uint8_t uwb_get_rx_seq(void)
+{
+    return rx_seq;
+}
+
+uint8_t uwb_get_tx_seq(void)
+{
+    return tx_seq;
+}
+
+uint32_t uwb_get_duplicate_frames(void)
+{
+    return duplicate_frames;
+}
+
+void uwb_rx_diagnostics(bool enable)
+{
+    // Without LOG_ALL the CIA leaves most of the Ipatov diagnostic registers at 0
+    dwt_configciadiag(enable ? DW_CIA_DIAG_LOG_ALL : DW_CIA_DIAG_LOG_OFF);
+}
+
+uwb_result_e uwb_get_rx_power(int16_t *fp_power, int16_t *rsl)
+{
+    dwt_cirdiags_t diag;
+
+    if (dwt_readdiagnostics_acc(&diag, DWT_ACC_IDX_IP_M) != DWT_SUCCESS
+            || dwt_calculate_first_path_power(&diag, DWT_ACC_IDX_IP_M, fp_power) != DWT_SUCCESS
+            || dwt_calculate_rssi(&diag, DWT_ACC_IDX_IP_M, rsl) != DWT_SUCCESS) {
+        return UWB_ERROR;
+    }
+    return UWB_OK;
+}
+
+uint8_t uwb_get_rx_nlos(void)
+{
+    dwt_nlos_alldiag_t diag = { .diag_type = IPATOV };
+    dwt_nlos_ipdiag_t index;
+
+    if (dwt_nlos_alldiag(&diag) != DWT_SUCCESS || diag.accumCount == 0) {
+        return UWB_NLOS_UNKNOWN;
+    }
+
+    // APS006 part 3 on the Ipatov CIR. The received and first path levels share the accumulation count, the DGC
+    // decision and the PRF constant, their difference only needs the channel area against the first path amplitudes
+    float f1 = (float)(diag.F1 / 4), f2 = (float)(diag.F2 / 4), f3 = (float)(diag.F3 / 4);
+    float fp_area = f1 * f1 + f2 * f2 + f3 * f3;
+    if (fp_area <= 0.0f) {
+        return 100;
+    }
+    float level_diff = 10.0f * log10f((float)diag.cir_power * NLOS_CIR_POWER_SCALE / fp_area);
+    if (level_diff > NLOS_LEVEL_THRESHOLD_DB) {
+        return 100;
+    }
+    if (level_diff > NLOS_LEVEL_THRESHOLD_DB * NLOS_LEVEL_FACTOR) {
+        return (uint8_t)(100.0f * (level_diff / NLOS_LEVEL_THRESHOLD_DB - NLOS_LEVEL_FACTOR) / (1.0f - NLOS_LEVEL_FACTOR));
+    }
+
+    // Weak levels say little, the distance from the first path to the peak decides (indices in Q10.6)
+    dwt_nlos_ipdiag(&index);
+    float index_diff = ((float)index.index_pp_u32 - (float)index.index_fp_u32) / 64.0f;
+    if (index_diff <= NLOS_INDEX_MIN) {
+        return 0;
+    }
+    if (index_diff < NLOS_INDEX_MAX) {
+        // The fit crosses 0 % just above NLOS_INDEX_MIN and 100 % just below NLOS_INDEX_MAX
+        float probability = 100.0f * (NLOS_INDEX_PR_A * index_diff - NLOS_INDEX_PR_B);
+        return (uint8_t)fminf(fmaxf(probability, 0.0f), 100.0f);
+    }
+    return 100;
+}
+
+uwb_result_e uwb_irq_enable(uwb_device_t *uwb_device)
+{
+    static dwt_callbacks_s callbacks = {
+        .cbTxDone = irq_tx_done_cb,
+        .cbRxOk = irq_rx_ok_cb,
+        .cbRxTo = irq_rx_to_cb,
+        .cbRxErr = irq_rx_err_cb,
+    };
+
+    if (uwb_device == NULL || !uwb_device->is_initialized) {
+        return UWB_INVALID_PARAM;
+    }
+
+    if (event_queue == NULL) {
+        event_queue = xQueueCreateStatic(UWB_EVENT_QUEUE_LEN, sizeof(uwb_event_t), event_queue_storage, &event_queue_buffer);
+    }
+    xQueueReset(event_queue);
+
+    dwt_setcallbacks(&callbacks);
+    // Also clears whatever these events latched while polling
+    dwt_setinterrupt(UWB_IRQ_EVENTS, 0, DWT_ENABLE_INT_ONLY);
+    port_set_dwic_isr(dwt_isr);
+    irq_enabled = true;
+
+    return UWB_OK;
+}
+
+uint32_t uwb_get_dropped_events(void)
+{
+    return dropped_events;
 }
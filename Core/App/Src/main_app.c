@@ -23,13 +23,8 @@ static void start_positioning();
 static double distance(coord_t p1, coord_t p2);
 /*--------------------------- VARIABLES --------------------------------------*/
 static uwb_device_t uwb_device = {0};
-static uint8_t rx_data[128];
-static uint32_t received_size = 0;
 static uint16_t sender_address = 0;
 static uwb_msg_t rx_msg;
-static uwb_msg_t tx_msg;
-static uint64_t poll_rx_ts;
-static uint64_t resp_tx_ts;
 /*--------------------------- STATIC FUNCTIONS -------------------------------*/
 static double distance(coord_t p1, coord_t p2){
 	return sqrt((p1.x - p2.x)*(p1.x - p2.x) + (p1.y - p2.y)*(p1.y - p2.y) + (p1.z - p2.z)*(p1.z - p2.z));
@@ -37,35 +32,23 @@ static double distance(coord_t p1, coord_t p2){
 static void start_receive_loop()
 {
 	while(1){
-		uwb_result_e result = uwb_receive_poll(&uwb_device, &sender_address, rx_data, sizeof(rx_data), &received_size);
-		if(result == UWB_OK && received_size == sizeof(uwb_msg_t)){
-			rx_msg = *(uwb_msg_t *)rx_data;
+		// Idle until the next request, the time to put the response template in place
+		range_stage_response(&uwb_device);
+		uwb_result_e result = uwb_receive_msg(&uwb_device, &sender_address, &rx_msg);
+		if(result == UWB_OK){
 // COMMAND_RANGING_REQUEST --------------------------------------------- RESPOND WITH RANGE AND COORDS
 			if(rx_msg.command_type == COMMAND_RANGING_REQUEST){
-				uint32_t resp_tx_time;
-
-				// Retrieve poll reception timestamp.
-				poll_rx_ts = get_rx_timestamp_u64();
-
-				// Compute response message transmission time.
-				resp_tx_time = (poll_rx_ts + (POLL_RX_TO_RESP_TX_DLY_UUS * UUS_TO_DWT_TIME)) >> 8;
-				dwt_setdelayedtrxtime(resp_tx_time);
-
-				// Response TX timestamp is the transmission time we programmed plus the antenna delay.
-				resp_tx_ts = (((uint64_t)(resp_tx_time & 0xFFFFFFFEUL)) << 8) + uwb_device.tx_ant_dly;
-
-				// Write all timestamps in the final message.
-				tx_msg.rx_ts = poll_rx_ts;
-				tx_msg.tx_ts = resp_tx_ts;
-
-				// Write coords in final message
-				tx_msg.coord = uwb_device.coord;
-
-				tx_msg.command_type = COMMAND_RANGING_RESPONSE;
-
-				tx_msg.result = UWB_OK;
-
-				ASSERT_OK(uwb_send_msg(&uwb_device, sender_address, &tx_msg, DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED));
+				range_respond(&uwb_device, sender_address);
+			}
+// COMMAND_RANGING_BROADCAST ------------------------------------------ ANCHORS RESPOND IN THEIR SLOT
+			else if(rx_msg.command_type == COMMAND_RANGING_BROADCAST){
+				if(uwb_device.device_type == ANCHOR){
+					range_respond_slot(&uwb_device, sender_address);
+				}
+			}
+// COMMAND_DS_POLL, COMMAND_DS_FINAL ---------------------------------- DOUBLE-SIDED RESPONSE, THEN REPORT
+			else if(rx_msg.command_type == COMMAND_DS_POLL || rx_msg.command_type == COMMAND_DS_FINAL){
+				range_respond_ds(&uwb_device, sender_address, rx_msg.command_type);
 			}
 // COMMAND_RANGING_RESPONSE-------------------------------------------- SHOULD NOT HAPPEN HERE
 			else if(rx_msg.command_type == COMMAND_RANGING_RESPONSE){
@@ -90,6 +73,7 @@ static void start_receive_loop()
 					|| rx_msg.command_type == COMMAND_POSITION_ANNOUNCEMENT_GN
 					|| rx_msg.command_type == COMMAND_POSITION_ANNOUNCEMENT_PREDEF
 					|| rx_msg.command_type == COMMAND_POSITION_ANNOUNCEMENT_PREDEF_GN
+					|| rx_msg.command_type == COMMAND_POSITION_ANNOUNCEMENT_TRACKED
 			){
 				if(uwb_device.is_serial){
 					if(sender_address == 2){
@@ -182,6 +166,12 @@ static void start_positioning()
 void main_app_task(void *parameters)
 {
     ASSERT_OK(uwb_device_init(&uwb_device));
+    // Wait for frames on the DW IC interrupt, not by polling SYS_STATUS
+    ASSERT_OK(uwb_irq_enable(&uwb_device));
+    // Double-sided ranging cancels the clock drift, self positioning needs far fewer exchanges to average
+    range_set_mode(RANGING_DS_TWR);
+    // The first timed replies go out at the default delay, after that at what this build actually needs
+    range_calibrate_turnaround(TURNAROUND_CAL_SAMPLES);
 
     if(uwb_device.device_type == ANCHOR && uwb_device.is_serial){
     	start_calibration();
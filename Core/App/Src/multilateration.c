@@ -9,43 +9,270 @@
 #include "multilateration.h"
 #include "math.h"
 #include <stdlib.h>
+#include <string.h>
 /*--------------------------- MACROS AND DEFINES -----------------------------*/
+// Constants and math functions of position_real_t, so float builds do no double arithmetic at all
+#define REAL(c) ((position_real_t)(c))
+#ifdef POSITION_SINGLE_PRECISION
+#define real_sqrt sqrtf
+#define real_fabs fabsf
+#define real_fmax fmaxf
+// Pivot of the Cholesky factorisation relative to the trace below which the system is taken as singular
+#define CHOLESKY_PIVOT_MIN REAL(1e-6)
+#else
+#define real_sqrt sqrt
+#define real_fabs fabs
+#define real_fmax fmax
+#define CHOLESKY_PIVOT_MIN REAL(1e-12)
+#endif
+// Levenberg-Marquardt damping: start, floor and the factor it changes by per step
+#define LM_LAMBDA_INIT REAL(1e-2)
+#define LM_LAMBDA_MIN REAL(1e-7)
+#define LM_LAMBDA_UP REAL(10.0)
+// Least damping of a direction as a fraction of the mean curvature, for directions J'WJ does not see
+#define LM_DIAG_FLOOR REAL(1e-3)
+// Relative drop of the residual below which the refinement has converged
+#ifdef POSITION_SINGLE_PRECISION
+#define LM_COST_RTOL REAL(1e-4)
+#else
+#define LM_COST_RTOL REAL(1e-6)
+#endif
+// Distance floor of the linear weights, a range of 0 would give its equation an infinite weight
+#define LINEAR_RANGE_MIN_M REAL(0.01)
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
 /*--------------------------- STATIC FUNCTION PROTOTYPES ---------------------*/
+static bool cholesky_factor(position_real_t m[4][5], uint8_t n);
+static void cholesky_subst(const position_real_t m[4][5], uint8_t n, position_real_t *x);
+static bool cholesky_solve(position_real_t m[4][5], uint8_t n, position_real_t *x);
+static void normal_add(position_real_t m[4][5], uint8_t n, const position_real_t *row, position_real_t rhs, position_real_t weight);
+static position_real_t range_weight(const position_real_t *distances, const position_real_t *weights, uint8_t i);
+static position_real_t lm_linearise(const coord_t *anchors, const position_real_t *distances, const position_real_t *weights,
+                                    uint8_t count, const coord_t *p, position_real_t m[4][5]);
+static void lm_refine(const coord_t *anchors, const position_real_t *distances, const position_real_t *weights, uint8_t count,
+                      multilat_work_t *work, coord_t *p);
 /*--------------------------- VARIABLES --------------------------------------*/
 /*--------------------------- STATIC FUNCTIONS -------------------------------*/
+// Factorises the symmetric positive definite n x n system in m into L L'. The factor overwrites the lower
+// triangle, the upper one is not read
+static bool cholesky_factor(position_real_t m[4][5], uint8_t n)
+{
+    position_real_t pivot_min = REAL(0.0);
+    for (uint8_t i = 0; i < n; i++)
+    {
+        pivot_min += m[i][i];
+    }
+    pivot_min *= CHOLESKY_PIVOT_MIN;
+
+    for (uint8_t j = 0; j < n; j++)
+    {
+        position_real_t d = m[j][j];
+        for (uint8_t k = 0; k < j; k++)
+        {
+            d -= m[j][k] * m[j][k];
+        }
+        if (!(d > pivot_min))
+        {
+            return false;
+        }
+        m[j][j] = real_sqrt(d);
+        for (uint8_t i = j + 1; i < n; i++)
+        {
+            position_real_t v = m[i][j];
+            for (uint8_t k = 0; k < j; k++)
+            {
+                v -= m[i][k] * m[j][k];
+            }
+            m[i][j] = v / m[j][j];
+        }
+    }
+    return true;
+}
+
+// Solves with the factor from cholesky_factor() for the right side in column n: L y = b, then L' x = y
+static void cholesky_subst(const position_real_t m[4][5], uint8_t n, position_real_t *x)
+{
+    for (uint8_t i = 0; i < n; i++)
+    {
+        position_real_t v = m[i][n];
+        for (uint8_t k = 0; k < i; k++)
+        {
+            v -= m[i][k] * x[k];
+        }
+        x[i] = v / m[i][i];
+    }
+    for (int i = n - 1; i >= 0; i--)
+    {
+        position_real_t v = x[i];
+        for (uint8_t k = (uint8_t)(i + 1); k < n; k++)
+        {
+            v -= m[k][i] * x[k];
+        }
+        x[i] = v / m[i][i];
+    }
+}
+
+// Solves the symmetric positive definite n x n system in m, right side in column n
+static bool cholesky_solve(position_real_t m[4][5], uint8_t n, position_real_t *x)
+{
+    if (!cholesky_factor(m, n))
+    {
+        return false;
+    }
+    cholesky_subst((const position_real_t (*)[5])m, n, x);
+    return true;
+}
+
+// Adds one weighted equation row * x = rhs to the normal equations, lower triangle and right side only
+static void normal_add(position_real_t m[4][5], uint8_t n, const position_real_t *row, position_real_t rhs, position_real_t weight)
+{
+    for (uint8_t i = 0; i < n; i++)
+    {
+        position_real_t wr = weight * row[i];
+        for (uint8_t j = 0; j <= i; j++)
+        {
+            m[i][j] += wr * row[j];
+        }
+        m[i][n] += wr * rhs;
+    }
+}
+
+// Weight of range i, 0 for a missing range or one weighted out
+static position_real_t range_weight(const position_real_t *distances, const position_real_t *weights, uint8_t i)
+{
+    position_real_t w = (weights != NULL) ? weights[i] : REAL(1.0);
+    return (isnan(distances[i]) || !(w > REAL(0.0))) ? REAL(0.0) : w;
+}
+
+// Normal equations J'WJ delta = J'W (s - d) of the ranges at p into m, returns the weighted squared residual there
+static position_real_t lm_linearise(const coord_t *anchors, const position_real_t *distances, const position_real_t *weights,
+                                    uint8_t count, const coord_t *p, position_real_t m[4][5])
+{
+    position_real_t cost = REAL(0.0);
+
+    memset(m, 0, 4 * sizeof(m[0]));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        position_real_t w = range_weight(distances, weights, i);
+        if (w == REAL(0.0))
+        {
+            continue;
+        }
+        position_real_t dx = p->x - anchors[i].x;
+        position_real_t dy = p->y - anchors[i].y;
+        position_real_t dz = p->z - anchors[i].z;
+        position_real_t d = real_sqrt(dx * dx + dy * dy + dz * dz);
+        position_real_t r = distances[i] - d;
+        cost += w * r * r;
+        if (d < REAL(1e-12))
+        {
+            continue;
+        }
+        position_real_t row[3] = { dx / d, dy / d, dz / d };
+        normal_add(m, 3, row, r, w);
+    }
+    return cost;
+}
+
+// Levenberg-Marquardt from p: Gauss-Newton steps while they lower the residual, damped towards gradient descent
+// while they do not. The damping scales with the diagonal of J'WJ, floored so a direction the geometry does not
+// observe (anchors in one plane, the tag in it) gets a bounded step instead of a singular system.
+// One pass over the anchors per iteration: the normal equations of an accepted point are the next step's
+static void lm_refine(const coord_t *anchors, const position_real_t *distances, const position_real_t *weights, uint8_t count,
+                      multilat_work_t *work, coord_t *p)
+{
+    position_real_t trial[4][5];
+    position_real_t lambda = LM_LAMBDA_INIT;
+    position_real_t cost = lm_linearise(anchors, distances, weights, count, p, work->normal);
+
+    work->converged = false;
+    for (uint8_t iter = 0; iter < MULTILAT_ITER_MAX; iter++)
+    {
+        position_real_t delta[3];
+        position_real_t damp_min = (work->normal[0][0] + work->normal[1][1] + work->normal[2][2]) * LM_DIAG_FLOOR;
+
+        memcpy(trial, work->normal, sizeof(trial));
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            trial[k][k] += lambda * real_fmax(work->normal[k][k], damp_min);
+        }
+        work->iterations++;
+        if (!cholesky_solve(trial, 3, delta))
+        {
+            lambda *= LM_LAMBDA_UP;
+            continue;
+        }
+
+        coord_t next = { p->x + delta[0], p->y + delta[1], p->z + delta[2] };
+        if (delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2] < MULTILAT_STEP_TOL_M * MULTILAT_STEP_TOL_M)
+        {
+            // Within the tolerance whether the residual still drops or not, no pass to evaluate it
+            *p = next;
+            work->converged = true;
+            break;
+        }
+        position_real_t next_cost = lm_linearise(anchors, distances, weights, count, &next, trial);
+        // A residual that no longer changes is the minimum as far as the ranges can tell. Steps towards it
+        // shrink only linearly when the ranges disagree or the geometry is poor, or overshoot it uphill
+        work->converged = (real_fabs(cost - next_cost) <= LM_COST_RTOL * cost);
+        if (next_cost <= cost)
+        {
+            *p = next;
+            cost = next_cost;
+            memcpy(work->normal, trial, sizeof(trial));
+            lambda = real_fmax(lambda / LM_LAMBDA_UP, LM_LAMBDA_MIN);
+        }
+        else
+        {
+            lambda *= LM_LAMBDA_UP;
+        }
+        if (work->converged)
+        {
+            break;
+        }
+    }
+    work->lambda = lambda;
+}
 /*--------------------------- GLOBAL FUNCTIONS -------------------------------*/
 
 void multilat_aprox_matrix(
     const coord_t anchors[4], // 4 anchora sa x,y,z
-    const double distances[4],  // 4 udaljenosti s1,s2,s3,s4
+    const position_real_t distances[4],  // 4 udaljenosti s1,s2,s3,s4
     coord_t *est		  // izlaz: x,y,z estimacije
 )
 {
     int N = 4;
-    double A[4][4];
-    double b[4];
-    double X[4]; // rješenje [c; x; y; z]
+    position_real_t A[4][4];
+    position_real_t b[4];
+    position_real_t X[4]; // rješenje [c; x; y; z]
+
+    // Centriranje oko težišta anchora, A i b ostaju mali i u float preciznosti
+    coord_t c = {0};
+    for (int i = 0; i < N; i++)
+    {
+        c.x += anchors[i].x / N;
+        c.y += anchors[i].y / N;
+        c.z += anchors[i].z / N;
+    }
 
     // Konstrukcija matrice A i vektora b
     for (int i = 0; i < N; i++)
     {
-        double xi = anchors[i].x;
-        double yi = anchors[i].y;
-        double zi = anchors[i].z;
-        double si = distances[i];
+        position_real_t xi = anchors[i].x - c.x;
+        position_real_t yi = anchors[i].y - c.y;
+        position_real_t zi = anchors[i].z - c.z;
+        position_real_t si = distances[i];
 
-        A[i][0] = 1.0;
-        A[i][1] = -2.0 * xi;
-        A[i][2] = -2.0 * yi;
-        A[i][3] = -2.0 * zi;
+        A[i][0] = REAL(1.0);
+        A[i][1] = REAL(-2.0) * xi;
+        A[i][2] = REAL(-2.0) * yi;
+        A[i][3] = REAL(-2.0) * zi;
 
         b[i] = si * si - xi * xi - yi * yi - zi * zi;
     }
 
     // Sustav 4 jednadzbe s 4 nepoznanice
     // Rješavanje sustava A*X = b metodom Gaussove eliminacije
-    double M[4][5]; // augmentirana matrica [A|b]
+    position_real_t M[4][5]; // augmentirana matrica [A|b]
     for (int i = 0; i < 4; i++)
     {
         for (int j = 0; j < 4; j++)
@@ -62,7 +289,7 @@ void multilat_aprox_matrix(
         int max_row = i;
         for (int k = i + 1; k < 4; k++)
         {
-            if (abs(M[k][i]) > abs(M[max_row][i]))
+            if (real_fabs(M[k][i]) > real_fabs(M[max_row][i]))
             {
                 max_row = k;
             }
@@ -71,7 +298,7 @@ void multilat_aprox_matrix(
         // Zamjena redova
         for (int j = 0; j < 5; j++)
         {
-            double tmp = M[i][j];
+            position_real_t tmp = M[i][j];
             M[i][j] = M[max_row][j];
             M[max_row][j] = tmp;
         }
@@ -79,7 +306,7 @@ void multilat_aprox_matrix(
         // Eliminacija
         for (int k = i + 1; k < 4; k++)
         {
-            double factor = M[k][i] / M[i][i];
+            position_real_t factor = M[k][i] / M[i][i];
             for (int j = i; j < 5; j++)
             {
                 M[k][j] -= factor * M[i][j];
@@ -98,21 +325,19 @@ void multilat_aprox_matrix(
         X[i] /= M[i][i];
     }
 
-    // Rezultat: X = [c; x; y; z]
-    est->x = X[1];
-    est->y = X[2];
-    est->z = X[3];
+    // Rezultat: X = [c; x; y; z], natrag iz centriranih koordinata
+    est->x = X[1] + c.x;
+    est->y = X[2] + c.y;
+    est->z = X[3] + c.z;
 }
 
 void multilat_gauss_iter_matrix(
     const coord_t anchors[4], // 4 anchora sa x,y,z
-    const double distances[4],  // 4 udaljenosti s1,s2,s3,s4
+    const position_real_t distances[4],  // 4 udaljenosti s1,s2,s3,s4
     coord_t *est		  // izlaz: x,y,z estimacije
 )
 {
     int N = 4;
-    int max_iter = 10;
-    double tol = 1e-6;
 
     // --- start: linearna aproksimacija ---
     coord_t est0;
@@ -135,93 +360,208 @@ void multilat_gauss_iter_matrix(
         est0.z /= N;
     }
 
-    // --- iterativni Gauss-Newton ---
-    for (int iter = 0; iter < max_iter; iter++)
+    // --- Levenberg-Marquardt umjesto čistog Gauss-Newtona ---
+    multilat_work_t work;
+    work.iterations = 0;
+    lm_refine(anchors, distances, NULL, N, &work, &est0);
+
+    est->x = est0.x;
+    est->y = est0.y;
+    est->z = est0.z;
+}
+
+bool multilat_wls(
+    const coord_t *anchors,
+    const position_real_t *distances,
+    const position_real_t *weights,
+    uint8_t count,
+    multilat_work_t *work,
+    coord_t *est
+)
+{
+    if (anchors == NULL || distances == NULL || work == NULL || est == NULL || count > MULTILAT_ANCHORS_MAX)
     {
-        double r[4];    // reziduali
-        double J[4][3]; // Jacobian
+        return false;
+    }
 
-        for (int i = 0; i < N; i++)
+    work->used = 0;
+    work->iterations = 0;
+    work->rms = NAN;
+    position_real_t weight_sum = REAL(0.0);
+    coord_t centroid = {0};
+    for (uint8_t i = 0; i < count; i++)
+    {
+        position_real_t w = range_weight(distances, weights, i);
+        if (w == REAL(0.0))
         {
-            double dx = est0.x - anchors[i].x;
-            double dy = est0.y - anchors[i].y;
-            double dz = est0.z - anchors[i].z;
-            double di = sqrt(dx * dx + dy * dy + dz * dz);
-            r[i] = di - distances[i];
-
-            if (di < 1e-12)
-            {
-                J[i][0] = J[i][1] = J[i][2] = 0.0;
-            }
-            else
-            {
-                J[i][0] = dx / di;
-                J[i][1] = dy / di;
-                J[i][2] = dz / di;
-            }
+            continue;
         }
+        work->used++;
+        weight_sum += w;
+        centroid.x += w * anchors[i].x;
+        centroid.y += w * anchors[i].y;
+        centroid.z += w * anchors[i].z;
+    }
+    if (work->used < 4)
+    {
+        return false;
+    }
+    centroid.x /= weight_sum;
+    centroid.y /= weight_sum;
+    centroid.z /= weight_sum;
 
-        // --- Gauss-Newton korak: delta = -(J' * J)^-1 * J' * r ---
-        // Za 4x3 Jacobian i 4x1 r koristimo normalne jednadžbe:
-        // delta = - (J^T J)^(-1) J^T r
-        double JTJ[3][3] = {0};
-        double JTr[3] = {0};
-        for (int i = 0; i < N; i++)
+    // Linear start: s^2 = |p|^2 - 2 a.p + |a|^2 in the unknowns [|p|^2; x; y; z]. The error of s^2 grows
+    // with 2 s, its weight is that of the range over 4 s^2. Taken about the anchor centroid |a|^2 and |p|^2
+    // stay small, which keeps the normal equations well conditioned in float as well
+    position_real_t X[4];
+    coord_t p;
+    memset(work->normal, 0, sizeof(work->normal));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        position_real_t w = range_weight(distances, weights, i);
+        if (w == REAL(0.0))
         {
-            for (int m = 0; m < 3; m++)
-            {
-                JTr[m] += J[i][m] * r[i];
-                for (int n = 0; n < 3; n++)
-                {
-                    JTJ[m][n] += J[i][m] * J[i][n];
-                }
-            }
+            continue;
         }
+        position_real_t ax = anchors[i].x - centroid.x;
+        position_real_t ay = anchors[i].y - centroid.y;
+        position_real_t az = anchors[i].z - centroid.z;
+        position_real_t s = real_fmax(distances[i], LINEAR_RANGE_MIN_M);
+        position_real_t row[4] = { REAL(1.0), REAL(-2.0) * ax, REAL(-2.0) * ay, REAL(-2.0) * az };
+        position_real_t rhs = distances[i] * distances[i] - ax * ax - ay * ay - az * az;
+        normal_add(work->normal, 4, row, rhs, w / (REAL(4.0) * s * s));
+    }
+    if (cholesky_solve(work->normal, 4, X))
+    {
+        p.x = X[1] + centroid.x;
+        p.y = X[2] + centroid.y;
+        p.z = X[3] + centroid.z;
+    }
+    else
+    {
+        // Anchors in one plane leave the linear system singular, the refinement starts from the weighted centroid
+        p = centroid;
+    }
 
-        // --- invertiranje 3x3 matrice JTJ ---
-        double a = JTJ[0][0], b = JTJ[0][1], c = JTJ[0][2];
-        double d = JTJ[1][0], e = JTJ[1][1], f = JTJ[1][2];
-        double g = JTJ[2][0], h = JTJ[2][1], i3 = JTJ[2][2];
-
-        double det = a * (e * i3 - f * h) - b * (d * i3 - f * g) + c * (d * h - e * g);
-        if (fabs(det) < 1e-12)
-            break; // singularni slučaj
-
-        double invJTJ[3][3];
-        invJTJ[0][0] = (e * i3 - f * h) / det;
-        invJTJ[0][1] = -(b * i3 - c * h) / det;
-        invJTJ[0][2] = (b * f - c * e) / det;
-        invJTJ[1][0] = -(d * i3 - f * g) / det;
-        invJTJ[1][1] = (a * i3 - c * g) / det;
-        invJTJ[1][2] = -(a * f - c * d) / det;
-        invJTJ[2][0] = (d * h - e * g) / det;
-        invJTJ[2][1] = -(a * h - b * g) / det;
-        invJTJ[2][2] = (a * e - b * d) / det;
-
-        // delta = -inv(JTJ) * JTr
-        double delta[3];
-        for (int m = 0; m < 3; m++)
-        {
-            delta[m] = 0.0;
-            for (int n = 0; n < 3; n++)
-            {
-                delta[m] += invJTJ[m][n] * JTr[n];
-            }
-            delta[m] = -delta[m];
+    // Weighted refinement on the ranges themselves
+    lm_refine(anchors, distances, weights, count, work, &p);
+
+    if (!isfinite(p.x) || !isfinite(p.y) || !isfinite(p.z))
+    {
+        return false;
+    }
+
+    position_real_t sum = REAL(0.0);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        position_real_t w = range_weight(distances, weights, i);
+        work->residual[i] = NAN;
+        if (w == REAL(0.0))
+        {
+            continue;
         }
+        position_real_t dx = p.x - anchors[i].x;
+        position_real_t dy = p.y - anchors[i].y;
+        position_real_t dz = p.z - anchors[i].z;
+        work->residual[i] = real_sqrt(dx * dx + dy * dy + dz * dz) - distances[i];
+        sum += w * work->residual[i] * work->residual[i];
+    }
+    work->rms = real_sqrt(sum / weight_sum);
+    *est = p;
+    return true;
+}
 
-        // update
-        est0.x += delta[0];
-        est0.y += delta[1];
-        est0.z += delta[2];
+void multilat_geometry_invalidate(multilat_geometry_t *geometry)
+{
+    geometry->valid = false;
+    geometry->count = 0;
+}
 
-        // stop kriterij
-        double norm_delta = sqrt(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
-        if (norm_delta < tol)
-            break;
+bool multilat_geometry_set(multilat_geometry_t *geometry, const coord_t *anchors, uint8_t count)
+{
+    if (geometry == NULL || anchors == NULL || count < 4 || count > MULTILAT_ANCHORS_MAX)
+    {
+        return false;
+    }
+    // Same anchors where they were, the factorisation still holds
+    if (geometry->valid && geometry->count == count && memcmp(geometry->anchors, anchors, count * sizeof(coord_t)) == 0)
+    {
+        return true;
     }
 
-    est->x = est0.x;
-    est->y = est0.y;
-    est->z = est0.z;
+    geometry->valid = false;
+    geometry->count = count;
+    memcpy(geometry->anchors, anchors, count * sizeof(coord_t));
+    geometry->centroid.x = REAL(0.0);
+    geometry->centroid.y = REAL(0.0);
+    geometry->centroid.z = REAL(0.0);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        geometry->centroid.x += anchors[i].x / (position_real_t)count;
+        geometry->centroid.y += anchors[i].y / (position_real_t)count;
+        geometry->centroid.z += anchors[i].z / (position_real_t)count;
+    }
+
+    // Rows [1, -2 a] of the centred linear system, A'A factorised once
+    position_real_t m[4][5];
+    position_real_t rows[MULTILAT_ANCHORS_MAX][4];
+    memset(m, 0, sizeof(m));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        position_real_t ax = anchors[i].x - geometry->centroid.x;
+        position_real_t ay = anchors[i].y - geometry->centroid.y;
+        position_real_t az = anchors[i].z - geometry->centroid.z;
+        rows[i][0] = REAL(1.0);
+        rows[i][1] = REAL(-2.0) * ax;
+        rows[i][2] = REAL(-2.0) * ay;
+        rows[i][3] = REAL(-2.0) * az;
+        geometry->anchor_sq[i] = ax * ax + ay * ay + az * az;
+        normal_add(m, 4, rows[i], REAL(0.0), REAL(1.0));
+    }
+    if (!cholesky_factor(m, 4))
+    {
+        return false;
+    }
+    // Column i of the pseudo-inverse (A'A)^-1 A' is the solution for row i of A as the right side
+    for (uint8_t i = 0; i < count; i++)
+    {
+        position_real_t column[4];
+        for (uint8_t k = 0; k < 4; k++)
+        {
+            m[k][4] = rows[i][k];
+        }
+        cholesky_subst((const position_real_t (*)[5])m, 4, column);
+        for (uint8_t k = 0; k < 4; k++)
+        {
+            geometry->pinv[k][i] = column[k];
+        }
+    }
+    geometry->valid = true;
+    return true;
+}
+
+bool multilat_geometry_solve(const multilat_geometry_t *geometry, const position_real_t *distances, coord_t *est)
+{
+    if (geometry == NULL || distances == NULL || est == NULL || !geometry->valid)
+    {
+        return false;
+    }
+
+    // X = pinv * b with b = s^2 - |a|^2, only the rows of x, y and z are needed
+    position_real_t X[3] = { REAL(0.0), REAL(0.0), REAL(0.0) };
+    for (uint8_t i = 0; i < geometry->count; i++)
+    {
+        if (isnan(distances[i]))
+        {
+            return false;
+        }
+        position_real_t b = distances[i] * distances[i] - geometry->anchor_sq[i];
+        X[0] += geometry->pinv[1][i] * b;
+        X[1] += geometry->pinv[2][i] * b;
+        X[2] += geometry->pinv[3][i] * b;
+    }
+    est->x = X[0] + geometry->centroid.x;
+    est->y = X[1] + geometry->centroid.y;
+    est->z = X[2] + geometry->centroid.z;
+    return true;
 }
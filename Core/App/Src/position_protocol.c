@@ -12,67 +12,563 @@
 #include "device_protocol.h"
 #include "main_app.h"
 #include "math.h"
+#include <string.h>
 #include "multilateration.h"
+#include "range_stats.h"
+#include "tag_tracker.h"
 /*--------------------------- MACROS AND DEFINES -----------------------------*/
+// Frames receive_reply passes over before it gives up on the reply
+#define REPLY_SKIP_MAX 3
+// Seconds per unit of dwt_readsystimestamphi32, the upper 32 of the 40 bit system time
+#define SYS_TIME_HI_S (256.0 * DWT_TIME_UNITS)
 /*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
 /*--------------------------- STATIC FUNCTION PROTOTYPES ---------------------*/
 static void anounce_coords(uwb_device_t *uwb_device, uwb_command_e command_type, uint8_t mode);
+static uwb_result_e range_with_ss(uwb_device_t *uwb_device, uint16_t target_address, position_real_t *distance, coord_t *coord);
+static uwb_result_e range_with_ds(uwb_device_t *uwb_device, uint16_t target_address, position_real_t *distance, coord_t *coord);
+static position_real_t ss_distance(void);
+static uint32_t ranging_slot(uint16_t address16);
+static void respond_after(uwb_device_t *uwb_device, uint16_t initiator_address, uint32_t delay_uus);
+static uwb_result_e send_delayed(uwb_device_t *uwb_device, uint16_t target_address, uwb_tx_slot_e slot, uwb_command_e command_type, uint8_t rx_seq, uint64_t rx_ts, uint64_t tx_ts);
+static uwb_result_e receive_reply(uwb_device_t *uwb_device, uwb_command_e command_type);
+static uwb_result_e send_resident(uwb_device_t *uwb_device, uwb_tx_slot_e slot, uint16_t target_address, uint8_t mode);
+static void stage_reply(uwb_device_t *uwb_device, uwb_tx_slot_e slot, uwb_command_e command_type);
+static uint64_t delayed_tx_at(const uwb_device_t *uwb_device, uint64_t rx_ts, uint32_t delay_uus);
+static void capture_quality(void);
+static bool self_position_ranges(uwb_device_t *uwb_device, const uint16_t *anchors, uint8_t anchor_count, int max_rounds, position_real_t *distance, coord_t *coord);
+static void track_start(const coord_t *fix);
+static void track_range(const coord_t *anchor, position_real_t distance);
 /*--------------------------- VARIABLES --------------------------------------*/
 const coord_t anchor1 = {0, 0, 0};
 const coord_t anchor2 = {4, 0, 0};
 const coord_t anchor3 = {2, 4, 0};
 const coord_t anchor4 = {2, 2, 2};
 const coord_t anchors_predef[4] = {anchor1, anchor2, anchor3, anchor4};
-static double tof;
+static position_real_t tof;
 static uwb_msg_t rx_msg;
 static uwb_msg_t tx_msg;
 static uint16_t sender_address = 0;
-static uint8_t rx_data[128];
-static uint32_t received_size = 0;
+static ranging_mode_e ranging_mode = RANGING_SS_TWR;
+static ranging_rounds_t rounds;
+// Parts of the quality record range_with fills in, and the record of the last exchange
+static uint8_t quality_fields = 0;
+static range_quality_t quality;
+// Responder side of the DS-TWR exchange in progress, kept between the poll and the final
+static uint16_t ds_initiator;
+static uint64_t ds_resp_tx_ts;
+// Reception to timed reply delay of responses and DS finals, tuned by range_calibrate_turnaround
+static uint32_t turnaround_uus = POLL_RX_TO_RESP_TX_DLY_UUS;
+static uint32_t turnaround_cal_samples = 0;
+// Timed reply range_stage_response keeps in the DW IC TX buffer, the kind of the last request answered
+static uwb_command_e staged_response = COMMAND_RANGING_RESPONSE;
+// Exchanges range_with repeats after the first one failed
+static uint8_t ranging_retries = RANGING_RETRIES;
+// Self positioning stops ranging with an anchor once the 95 % confidence interval of its distance is this narrow
+static double self_position_ci_m = SELF_POS_CI_M;
+// Scratch of the position solver
+static multilat_work_t multilat_work;
+// Linear solvers of the anchors as they answered and of the predefined ones, refactorised when an anchor moves
+static multilat_geometry_t geometry_rx;
+static multilat_geometry_t geometry_predef;
+// Tag position filtered over the single ranges, and the system time (high 32 bits) it was last moved to
+static position_real_t track_accel_psd = TAG_TRACK_ACCEL_PSD;
+static tag_tracker_t tag_tracker;
+static uint32_t track_time;
 /*--------------------------- STATIC FUNCTIONS -------------------------------*/
-/*--------------------------- GLOBAL FUNCTIONS -------------------------------*/
-void range_with(uwb_device_t *uwb_device, uint16_t target_address, double *distance, coord_t *coord){
+// Programs a delayed transmission delay_uus after rx_ts, returns the TX timestamp it will have
+static uint64_t delayed_tx_at(const uwb_device_t *uwb_device, uint64_t rx_ts, uint32_t delay_uus)
+{
+	uint32_t tx_time = (rx_ts + ((uint64_t)delay_uus * UUS_TO_DWT_TIME)) >> 8;
+	dwt_setdelayedtrxtime(tx_time);
+
+	// TX timestamp is the transmission time we programmed plus the antenna delay.
+	return (((uint64_t)(tx_time & 0xFFFFFFFEUL)) << 8) + uwb_device->tx_ant_dly;
+}
+
+// Stages a timed reply with this device's coordinates in its TX buffer slot
+static void stage_reply(uwb_device_t *uwb_device, uwb_tx_slot_e slot, uwb_command_e command_type)
+{
+	uwb_msg_t reply = {
+		.command_type = command_type,
+		.coord = uwb_device->coord,
+		.result = UWB_OK
+	};
+
+	ASSERT_OK(uwb_stage_msg(uwb_device, slot, &reply));
+}
+
+// Sends tx_msg from its resident TX buffer slot, the frame is written only when the slot held something else
+static uwb_result_e send_resident(uwb_device_t *uwb_device, uwb_tx_slot_e slot, uint16_t target_address, uint8_t mode)
+{
+	uwb_result_e result = uwb_stage_msg(uwb_device, slot, &tx_msg);
+
+	if(result != UWB_OK){
+		return result;
+	}
+	result = uwb_send_staged(uwb_device, slot, target_address, tx_msg.rx_seq, tx_msg.rx_ts, tx_msg.tx_ts, mode);
+	if(result == UWB_INVALID_PARAM){
+		// Timestamps too far apart for the staged TX offset, the whole message goes
+		result = uwb_send_msg(uwb_device, target_address, &tx_msg, mode);
+	}
+	return result;
+}
+
+// Sends a timed reply at the programmed delayed time, and finishes the turnaround calibration once it has its samples.
+// Only the sequence number, destination and timestamps go to the DW IC when the slot holds the reply already
+static uwb_result_e send_delayed(uwb_device_t *uwb_device, uint16_t target_address, uwb_tx_slot_e slot, uwb_command_e command_type, uint8_t rx_seq, uint64_t rx_ts, uint64_t tx_ts)
+{
+	uwb_turnaround_t measured;
+	uwb_result_e result;
+
+	if(uwb_get_staged_command(slot) != command_type){
+		stage_reply(uwb_device, slot, command_type);
+	}
+	result = uwb_send_staged(uwb_device, slot, target_address, rx_seq, rx_ts, tx_ts, DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED);
+	if(result == UWB_INVALID_PARAM){
+		// Reply too far after the request for the staged TX offset, the whole message goes
+		tx_msg.rx_seq = rx_seq;
+		tx_msg.rx_ts = rx_ts;
+		tx_msg.tx_ts = tx_ts;
+		tx_msg.coord = uwb_device->coord;
+		tx_msg.command_type = command_type;
+		tx_msg.result = UWB_OK;
+		result = uwb_send_msg(uwb_device, target_address, &tx_msg, DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED);
+	}
+
+	ASSERT_OK(result);
+	if(turnaround_cal_samples == 0){
+		return result;
+	}
+	uwb_get_turnaround(&measured);
+	if(measured.samples >= turnaround_cal_samples){
+		// The delayed TX time is the RMARKER, the preamble and SFD have to start before it
+		turnaround_uus = measured.max_uus + TURNAROUND_SHR_UUS + TURNAROUND_MARGIN_UUS;
+		turnaround_cal_samples = 0;
+		uwb_turnaround_measure(false);
+		printf("Turnaround: max %lu uus, %lu cycles, %lu late, reply delay %lu uus\r\n",
+				(unsigned long)measured.max_uus, (unsigned long)measured.max_cycles,
+				(unsigned long)measured.late_tx, (unsigned long)turnaround_uus);
+		// The initiator stops listening before a longer delay runs out, one slow sample would fail every later exchange
+		if(turnaround_uus > TURNAROUND_MAX_UUS){
+			printf("ERROR: Turnaround beyond the response window, reply delay held at %lu uus\r\n",
+					(unsigned long)TURNAROUND_MAX_UUS);
+			turnaround_uus = TURNAROUND_MAX_UUS;
+		}
+	}
+	return result;
+}
+
+// Receives the reply to the request just sent into rx_msg. Frames the device layer dropped as duplicates and replies
+// to an earlier request (late ones, overtaken by a retry) are passed over, each restarts the frame wait timeout
+static uwb_result_e receive_reply(uwb_device_t *uwb_device, uwb_command_e command_type)
+{
+	uint8_t request_seq = uwb_get_tx_seq();
+	uwb_result_e result = UWB_TIMEOUT;
+
+	for(uint8_t skipped = 0; skipped <= REPLY_SKIP_MAX; skipped++){
+		result = uwb_receive_msg(uwb_device, &sender_address, &rx_msg);
+		if(result == UWB_DUPLICATE){
+			continue;
+		}
+		if(result == UWB_OK && rx_msg.command_type == command_type && rx_msg.rx_seq != request_seq){
+			result = UWB_DUPLICATE;
+			continue;
+		}
+		return result;
+	}
+	return result;
+}
+
+// Single-sided distance from the ranging response in rx_msg and the timestamps read with it
+static position_real_t ss_distance(void)
+{
+	uint32_t poll_tx_ts, resp_rx_ts, poll_rx_ts, resp_tx_ts;
+	int32_t rtd_init, rtd_resp;
+	float clockOffsetRatio;
+	dwt_twr_stamps_t stamps;
+
+	// Poll transmission and response reception timestamps, read together with the response frame.
+	uwb_get_rx_stamps(&stamps);
+	poll_tx_ts = stamps.tx_stamp_lo;
+	resp_rx_ts = (uint32_t)stamps.rx_stamp;
+
+	// Clock offset of the response and the resulting clock offset ratio.
+	clockOffsetRatio = ((float)stamps.clock_offset) / (uint32_t)(1 << 26);
+
+	// Get timestamps embedded in response message.
+	poll_rx_ts = rx_msg.rx_ts;
+	resp_tx_ts = rx_msg.tx_ts;
+
+	// Compute time of flight and distance, using clock offset ratio to correct for differing local and remote clock rates
+	rtd_init = resp_rx_ts - poll_tx_ts;
+	rtd_resp = resp_tx_ts - poll_rx_ts;
+	rounds.round_init = rtd_init;
+	rounds.reply_resp = rtd_resp;
+	rounds.round_resp = 0;
+	rounds.reply_init = 0;
+
+	// rtd_init - rtd_resp * (1 - ratio) with the round trips subtracted as integers first, the float part is only
+	// the small drift correction so the DTU resolution survives a 24-bit mantissa
+	tof = ((position_real_t)(rtd_init - rtd_resp) + (position_real_t)rtd_resp * clockOffsetRatio) * (position_real_t)(DWT_TIME_UNITS / 2.0);
+	return tof * (position_real_t)SPEED_OF_LIGHT;
+}
+
+// Quality record of the response in rx_msg, read before the next reception replaces the diagnostics
+static void capture_quality(void)
+{
+	dwt_twr_stamps_t stamps;
+
+	quality.fields = quality_fields;
+	if(quality_fields & (RANGE_QUALITY_STAMPS | RANGE_QUALITY_CLOCK)){
+		uwb_get_rx_stamps(&stamps);
+		quality.poll_tx = stamps.tx_stamp_lo;
+		quality.poll_rx = (uint32_t)rx_msg.rx_ts;
+		quality.resp_tx = (uint32_t)rx_msg.tx_ts;
+		quality.resp_rx = (uint32_t)stamps.rx_stamp;
+		quality.clock_offset = stamps.clock_offset;
+	}
+	if(quality_fields & RANGE_QUALITY_SEQ){
+		quality.seq = uwb_get_rx_seq();
+	}
+	if((quality_fields & RANGE_QUALITY_POWER) && uwb_get_rx_power(&quality.fp_power, &quality.rsl) != UWB_OK){
+		quality.fields &= (uint8_t)~RANGE_QUALITY_POWER;
+	}
+	if(quality_fields & RANGE_QUALITY_NLOS){
+		quality.nlos = uwb_get_rx_nlos();
+	}
+}
+
+// Response slot of an anchor after a broadcast ranging request, anchors 1..RANGING_SLOTS answer in address order
+static uint32_t ranging_slot(uint16_t address16)
+{
+	return (uint16_t)(address16 - 1) % RANGING_SLOTS;
+}
+
+// Sends a ranging response delay_uus after the request reception
+static void respond_after(uwb_device_t *uwb_device, uint16_t initiator_address, uint32_t delay_uus)
+{
+	uint64_t poll_rx_ts, resp_tx_ts;
+	dwt_twr_stamps_t stamps;
+
+	// Poll reception timestamp, already read together with the poll frame.
+	uwb_get_rx_stamps(&stamps);
+	poll_rx_ts = stamps.rx_stamp;
+
+	// Program the response transmission time.
+	resp_tx_ts = delayed_tx_at(uwb_device, poll_rx_ts, delay_uus);
+
+	// Coords and command are staged already, the timestamps complete the response
+	staged_response = COMMAND_RANGING_RESPONSE;
+	send_delayed(uwb_device, initiator_address, UWB_TX_SLOT_RESPONSE, COMMAND_RANGING_RESPONSE, uwb_get_rx_seq(), poll_rx_ts, resp_tx_ts);
+}
+
+static uwb_result_e range_with_ss(uwb_device_t *uwb_device, uint16_t target_address, position_real_t *distance, coord_t *coord){
 	tx_msg.rx_ts = 0;
 	tx_msg.tx_ts = 0;
 	tx_msg.coord = uwb_device->coord;
 	tx_msg.command_type = COMMAND_RANGING_REQUEST;
 	tx_msg.result = UWB_OK;
-	ASSERT_OK(uwb_send_msg(uwb_device, target_address, &tx_msg, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED));
-	uwb_result_e result = uwb_receive_poll(uwb_device, &sender_address, rx_data, sizeof(rx_data), &received_size);
-	if(result == UWB_OK && received_size == sizeof(uwb_msg_t)){
-		rx_msg = *(uwb_msg_t *)rx_data;
+	ASSERT_OK(send_resident(uwb_device, UWB_TX_SLOT_REQUEST, target_address, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED));
+	uwb_result_e result = receive_reply(uwb_device, COMMAND_RANGING_RESPONSE);
+	if(result == UWB_OK){
 		// We expect ranging response after ranging request. Anything else is not good
 		if(rx_msg.command_type == COMMAND_RANGING_RESPONSE)
 		{
-			uint32_t poll_tx_ts, resp_rx_ts, poll_rx_ts, resp_tx_ts;
-			int32_t rtd_init, rtd_resp;
-			float clockOffsetRatio;
-
-			// Retrieve poll transmission and response reception timestamps.
-			poll_tx_ts = dwt_readtxtimestamplo32();
-			resp_rx_ts = dwt_readrxtimestamplo32(0);
-
-			// Read carrier integrator value and calculate clock offset ratio.
-			clockOffsetRatio = ((float)dwt_readclockoffset()) / (uint32_t)(1 << 26);
-
-			// Get timestamps embedded in response message.
-			poll_rx_ts = rx_msg.rx_ts;
-			resp_tx_ts = rx_msg.tx_ts;
-
-			// Compute time of flight and distance, using clock offset ratio to correct for differing local and remote clock rates
-			rtd_init = resp_rx_ts - poll_tx_ts;
-			rtd_resp = resp_tx_ts - poll_rx_ts;
-
-			tof = ((rtd_init - rtd_resp * (1 - clockOffsetRatio)) / 2.0) * DWT_TIME_UNITS;
-			*distance = tof * SPEED_OF_LIGHT;
+			*distance = ss_distance();
+			capture_quality();
 			*coord = rx_msg.coord;
 			//printf("Distance to addr: %d = %lf\r\n", sender_address, *distance);
 		}
 		else
 		{
 			printf("ERROR: Didnt get ranging response\r\n");
+			result = UWB_ERROR;
 		}
 	}
+	return result;
+}
+
+static uwb_result_e range_with_ds(uwb_device_t *uwb_device, uint16_t target_address, position_real_t *distance, coord_t *coord){
+	uint32_t poll_tx_ts, resp_rx_ts, final_tx_ts, poll_rx_ts, resp_tx_ts, final_rx_ts;
+	dwt_twr_stamps_t stamps;
+	uwb_result_e result;
+
+	tx_msg.rx_ts = 0;
+	tx_msg.tx_ts = 0;
+	tx_msg.coord = uwb_device->coord;
+	tx_msg.command_type = COMMAND_DS_POLL;
+	tx_msg.result = UWB_OK;
+	ASSERT_OK(send_resident(uwb_device, UWB_TX_SLOT_REQUEST, target_address, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED));
+	result = receive_reply(uwb_device, COMMAND_DS_RESPONSE);
+	if(result != UWB_OK){
+		return result;
+	}
+	if(rx_msg.command_type != COMMAND_DS_RESPONSE || sender_address != target_address){
+		printf("ERROR: Didnt get DS ranging response\r\n");
+		return UWB_ERROR;
+	}
+
+	// Poll transmission and response reception timestamps, read together with the response frame.
+	uwb_get_rx_stamps(&stamps);
+	poll_tx_ts = stamps.tx_stamp_lo;
+	resp_rx_ts = (uint32_t)stamps.rx_stamp;
+	poll_rx_ts = rx_msg.rx_ts;
+	resp_tx_ts = rx_msg.tx_ts;
+	capture_quality();
+
+	// Final goes out a fixed delay after the response, the same way the responder times its response
+	final_tx_ts = delayed_tx_at(uwb_device, stamps.rx_stamp, turnaround_uus);
+	result = send_delayed(uwb_device, target_address, UWB_TX_SLOT_FINAL, COMMAND_DS_FINAL, 0, 0, 0);
+	if(result != UWB_OK){
+		return result;
+	}
+	result = receive_reply(uwb_device, COMMAND_DS_REPORT);
+	if(result != UWB_OK){
+		return result;
+	}
+	if(rx_msg.command_type != COMMAND_DS_REPORT || sender_address != target_address){
+		printf("ERROR: Didnt get DS ranging report\r\n");
+		return UWB_ERROR;
+	}
+	final_rx_ts = rx_msg.rx_ts;
+
+	// 32 bit differences are wrap safe, the exchange is far shorter than the 67 ms the low word covers
+	rounds.round_init = resp_rx_ts - poll_tx_ts;
+	rounds.reply_init = final_tx_ts - resp_rx_ts;
+	rounds.round_resp = final_rx_ts - resp_tx_ts;
+	rounds.reply_resp = resp_tx_ts - poll_rx_ts;
+
+	// Asymmetric DS-TWR: the clock drift error scales with the difference of the two reply times, not with their length.
+	// The products are exact in 64 bits, only their small difference goes to floating point
+	int64_t num = (int64_t)((uint64_t)rounds.round_init * rounds.round_resp - (uint64_t)rounds.reply_init * rounds.reply_resp);
+	uint64_t den = (uint64_t)rounds.round_init + rounds.round_resp + rounds.reply_init + rounds.reply_resp;
+	tof = (position_real_t)num / (position_real_t)den * (position_real_t)DWT_TIME_UNITS;
+	*distance = tof * (position_real_t)SPEED_OF_LIGHT;
+	*coord = rx_msg.coord;
+	return UWB_OK;
+}
+
+// Ranges with the anchors round after round until every distance has converged or max_rounds are done.
+// distance gets the mean of the accepted ranges, false if an anchor never answered
+static bool self_position_ranges(uwb_device_t *uwb_device, const uint16_t *anchors, uint8_t anchor_count, int max_rounds, position_real_t *distance, coord_t *coord)
+{
+	range_stats_t stats[3];
+	uint8_t converged = 0;
+	int round;
+
+	for(uint8_t a = 0; a < anchor_count; a++){
+		range_stats_init(&stats[a], SELF_POS_MAD_K);
+	}
+	for(round = 0; round < max_rounds && converged < anchor_count; round++){
+		converged = 0;
+		for(uint8_t a = 0; a < anchor_count; a++){
+			position_real_t range;
+			// A converged anchor is not asked again, the others keep going
+			if(!range_stats_converged(&stats[a], SELF_POS_MIN_RANGES, self_position_ci_m)
+					&& range_with(uwb_device, anchors[a], &range, &coord[a]) == UWB_OK){
+				range_stats_add(&stats[a], range);
+			}
+			converged += range_stats_converged(&stats[a], SELF_POS_MIN_RANGES, self_position_ci_m) ? 1 : 0;
+		}
+	}
+
+	for(uint8_t a = 0; a < anchor_count; a++){
+		if(stats[a].count == 0){
+			printf("ERROR: Self positioning got no ranges from %u\r\n", anchors[a]);
+			return false;
+		}
+		distance[a] = range_stats_mean(&stats[a]);
+		printf("Self positioning: %u at %.3f m, %lu ranges, %lu rejected, +-%.1f mm after %d rounds\r\n",
+				anchors[a], distance[a], (unsigned long)stats[a].count, (unsigned long)stats[a].rejected,
+				1000.0 * range_stats_ci95(&stats[a]), round);
+	}
+	return true;
+}
+
+// Starts the track at a fix of all anchors, the ranges range_with_all takes from then on update it
+static void track_start(const coord_t *fix)
+{
+	tag_tracker_reset(&tag_tracker, fix, (position_real_t)TAG_TRACK_START_SD_M, (position_real_t)TAG_TRACK_START_VELOCITY_SD);
+	track_time = dwt_readsystimestamphi32();
+}
+
+// Moves the track to now and fuses one range, nothing without a track
+static void track_range(const coord_t *anchor, position_real_t distance)
+{
+	uint32_t now;
+
+	if(!tag_tracker.valid){
+		return;
+	}
+	now = dwt_readsystimestamphi32();
+	// The system time wraps every ~17 s, the difference is right as long as ranges come more often
+	tag_tracker_predict(&tag_tracker, (position_real_t)(now - track_time) * (position_real_t)SYS_TIME_HI_S);
+	tag_tracker_update(&tag_tracker, anchor, distance, (position_real_t)TAG_TRACK_RANGE_SD_M);
+	track_time = now;
+}
+/*--------------------------- GLOBAL FUNCTIONS -------------------------------*/
+void range_calibrate_turnaround(uint32_t samples){
+	uwb_reset_turnaround();
+	uwb_turnaround_measure(samples != 0);
+	turnaround_cal_samples = samples;
+}
+
+void range_set_turnaround(uint32_t delay_uus){
+	turnaround_uus = delay_uus;
+}
+
+uint32_t range_get_turnaround(void){
+	return turnaround_uus;
+}
+
+void range_set_mode(ranging_mode_e mode){
+	ranging_mode = mode;
+}
+
+void range_get_rounds(ranging_rounds_t *out){
+	*out = rounds;
+}
+
+void range_set_quality(uint8_t fields){
+	quality_fields = fields;
+	// Power and NLOS need the full set of Ipatov diagnostics logged
+	uwb_rx_diagnostics((fields & (RANGE_QUALITY_POWER | RANGE_QUALITY_NLOS)) != 0);
+}
+
+void range_get_quality(range_quality_t *out){
+	*out = quality;
+}
+
+void range_set_retries(uint8_t retries){
+	ranging_retries = retries;
+}
+
+void range_set_self_position_ci(double ci_m){
+	self_position_ci_m = ci_m;
+}
+
+void range_set_track_process_noise(position_real_t accel_psd){
+	track_accel_psd = accel_psd;
+	tag_tracker_set_process_noise(&tag_tracker, accel_psd);
+}
+
+bool range_get_track(coord_t *position){
+	if(!tag_tracker.valid){
+		return false;
+	}
+	tag_tracker_position(&tag_tracker, position);
+	return true;
+}
+
+uwb_result_e range_with(uwb_device_t *uwb_device, uint16_t target_address, position_real_t *distance, coord_t *coord){
+	uwb_result_e result = UWB_RANGE_FAILED;
+
+	quality.fields = 0;
+	// Every response is waited for a bounded time, a lost frame costs one attempt instead of hanging the caller
+	uwb_set_response_timeouts(POLL_TX_TO_RESP_RX_DLY_UUS, RESP_RX_TIMEOUT_UUS, RESP_PRE_TIMEOUT_PAC);
+	for(uint8_t attempt = 0; attempt <= ranging_retries && result != UWB_OK; attempt++){
+		if(ranging_mode == RANGING_DS_TWR){
+			result = range_with_ds(uwb_device, target_address, distance, coord);
+		}
+		else{
+			result = range_with_ss(uwb_device, target_address, distance, coord);
+		}
+	}
+	// Back to unbounded reception, a responder waits for the next request as long as it takes
+	uwb_set_response_timeouts(0, 0, 0);
+
+	return (result == UWB_OK) ? UWB_OK : UWB_RANGE_FAILED;
+}
+
+uint8_t range_with_all(uwb_device_t *uwb_device, const uint16_t *anchors, uint8_t anchor_count, position_real_t *distance, coord_t *coord){
+	uint32_t last_slot = 0;
+	uint32_t window_uus, window_end;
+	uint8_t request_seq;
+	uint8_t received = 0;
+
+	for(uint8_t i = 0; i < anchor_count; i++){
+		distance[i] = NAN;
+		coord[i] = (coord_t){0};
+		if(ranging_slot(anchors[i]) > last_slot){
+			last_slot = ranging_slot(anchors[i]);
+		}
+	}
+
+	tx_msg.rx_ts = 0;
+	tx_msg.tx_ts = 0;
+	tx_msg.coord = uwb_device->coord;
+	tx_msg.command_type = COMMAND_RANGING_BROADCAST;
+	tx_msg.result = UWB_OK;
+	// The receiver the request turns on takes the frame wait timeout set at that point, so it is set up front
+	window_uus = POLL_RX_TO_RESP_TX_DLY_UUS + (last_slot + 2) * RANGING_SLOT_UUS;
+	dwt_setrxtimeout(window_uus);
+	ASSERT_OK(send_resident(uwb_device, UWB_TX_SLOT_REQUEST, UWB_BROADCAST_ADDRESS, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED));
+	request_seq = uwb_get_tx_seq();
+
+	// Receive window closes one slot after the last expected response starts, in SYS_TIME units (256 DW IC time units)
+	window_end = dwt_readsystimestamphi32() + (uint32_t)(((uint64_t)window_uus * UUS_TO_DWT_TIME) >> 8);
+
+	while(received < anchor_count){
+		int32_t remaining = (int32_t)(window_end - dwt_readsystimestamphi32());
+		if(remaining <= 0){
+			break;
+		}
+		// The frame wait timeout bounds every receive to the end of the window, a missing anchor costs no more than its slot
+		dwt_setrxtimeout((uint32_t)(((uint64_t)remaining << 8) / UUS_TO_DWT_TIME) + 1);
+		if(uwb_receive_msg(uwb_device, &sender_address, &rx_msg) != UWB_OK || rx_msg.command_type != COMMAND_RANGING_RESPONSE
+				|| rx_msg.rx_seq != request_seq){
+			continue;
+		}
+		for(uint8_t i = 0; i < anchor_count; i++){
+			if(anchors[i] == sender_address && isnan(distance[i])){
+				distance[i] = ss_distance();
+				coord[i] = rx_msg.coord;
+				track_range(&coord[i], distance[i]);
+				received++;
+				break;
+			}
+		}
+	}
+	dwt_setrxtimeout(0);
+
+	return received;
+}
+
+void range_stage_response(uwb_device_t *uwb_device){
+	stage_reply(uwb_device, UWB_TX_SLOT_RESPONSE, staged_response);
+}
+
+void range_respond(uwb_device_t *uwb_device, uint16_t initiator_address){
+	respond_after(uwb_device, initiator_address, turnaround_uus);
+}
+
+void range_respond_slot(uwb_device_t *uwb_device, uint16_t initiator_address){
+	respond_after(uwb_device, initiator_address, POLL_RX_TO_RESP_TX_DLY_UUS + ranging_slot(uwb_device->address16) * RANGING_SLOT_UUS);
+}
+
+void range_respond_ds(uwb_device_t *uwb_device, uint16_t initiator_address, uwb_command_e command_type){
+	dwt_twr_stamps_t stamps;
+
+	uwb_get_rx_stamps(&stamps);
+
+	if(command_type == COMMAND_DS_POLL){
+		// Same delayed response as single-sided, the initiator times its final from it
+		ds_initiator = initiator_address;
+		ds_resp_tx_ts = delayed_tx_at(uwb_device, stamps.rx_stamp, turnaround_uus);
+		staged_response = COMMAND_DS_RESPONSE;
+		send_delayed(uwb_device, initiator_address, UWB_TX_SLOT_RESPONSE, COMMAND_DS_RESPONSE, uwb_get_rx_seq(), stamps.rx_stamp, ds_resp_tx_ts);
+	}
+	else if(command_type == COMMAND_DS_FINAL && initiator_address == ds_initiator){
+		// The report is not part of the measurement, it can go out right away
+		tx_msg.coord = uwb_device->coord;
+		tx_msg.result = UWB_OK;
+		tx_msg.rx_seq = uwb_get_rx_seq();
+		tx_msg.rx_ts = stamps.rx_stamp;
+		tx_msg.tx_ts = ds_resp_tx_ts;
+		tx_msg.command_type = COMMAND_DS_REPORT;
+		ds_initiator = 0;
+		ASSERT_OK(send_resident(uwb_device, UWB_TX_SLOT_REPORT, initiator_address, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED));
+	}
 }
 
 static void anounce_coords(uwb_device_t *uwb_device, uwb_command_e command_type, uint8_t mode)
@@ -100,47 +596,42 @@ static void anounce_coords(uwb_device_t *uwb_device, uwb_command_e command_type,
 
 	printf("Announced coords (%lf, %lf, %lf) \r\n", uwb_device->coord.x, uwb_device->coord.y, uwb_device->coord.z);
 */
-	ASSERT_OK(uwb_send_msg(uwb_device, 0x0001, &tx_msg, mode));
+	ASSERT_OK(send_resident(uwb_device, UWB_TX_SLOT_ANNOUNCE, 0x0001, mode));
 	return;
 }
 
 void self_position_device_2(uwb_device_t *uwb_device)
 {
-	double distance = 0.f;
-	coord_t rx_coord = {0};
-	double distance_uk = 0.f;
-	int times = 1000;
-	for(int i = 0; i < times; i++){
-		range_with(uwb_device, 0x0001, &distance, &rx_coord);
-		distance_uk += distance;
+	const uint16_t anchors[1] = {0x0001};
+	position_real_t distance[1];
+	coord_t rx_coord[1] = {{0}};
+
+	if(!self_position_ranges(uwb_device, anchors, 1, 1000, distance, rx_coord)){
+		return;
 	}
 
-	uwb_device->coord.x = rx_coord.x + distance_uk/times;
-	uwb_device->coord.y = rx_coord.y;
-	uwb_device->coord.z = rx_coord.z;
+	uwb_device->coord.x = rx_coord[0].x + distance[0];
+	uwb_device->coord.y = rx_coord[0].y;
+	uwb_device->coord.z = rx_coord[0].z;
 	anounce_coords(uwb_device, COMMAND_POSITION_ANNOUNCEMENT, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED);
 	return;
 }
 
 void self_position_device_3(uwb_device_t *uwb_device)
 {
-	double distance1 = 0.f;
-	coord_t rx_coord1 = {0};
-	double distance2 = 0.f;
-	coord_t rx_coord2 = {0};
-	double distance_uk1 = 0.f;
-	double distance_uk2 = 0.f;
-	int times = 500;
-	for(int i = 0; i < times; i++){
-		range_with(uwb_device, 0x0001, &distance1, &rx_coord1);
-		range_with(uwb_device, 0x0002, &distance2, &rx_coord2);
-		distance_uk1 += distance1;
-		distance_uk2 += distance2;
-	}
-	distance1 = distance_uk1 / times;
-	distance2 = distance_uk2 / times;
+	const uint16_t anchors[2] = {0x0001, 0x0002};
+	position_real_t distance[2];
+	coord_t rx_coord[2] = {{0}, {0}};
+
+	if(!self_position_ranges(uwb_device, anchors, 2, 500, distance, rx_coord)){
+		return;
+	}
+	position_real_t distance1 = distance[0];
+	position_real_t distance2 = distance[1];
+	coord_t rx_coord1 = rx_coord[0];
+	coord_t rx_coord2 = rx_coord[1];
 	uwb_device->coord.x = (distance1*distance1 - distance2*distance2 + rx_coord2.x*rx_coord2.x) / (2*rx_coord2.x);
-	double temp = distance1*distance1 - uwb_device->coord.x*uwb_device->coord.x;
+	position_real_t temp = distance1*distance1 - uwb_device->coord.x*uwb_device->coord.x;
 	if(temp <= 0)
 	{
 		uwb_device->coord.y = 0;
@@ -156,31 +647,22 @@ void self_position_device_3(uwb_device_t *uwb_device)
 
 void self_position_device_4(uwb_device_t *uwb_device)
 {
-	double distance1 = 0.f;
-	coord_t rx_coord1 = {0};
-	double distance2 = 0.f;
-	coord_t rx_coord2 = {0};
-	double distance3 = 0.f;
-	coord_t rx_coord3 = {0};
-	double distance_uk1 = 0.f;
-	double distance_uk2 = 0.f;
-	double distance_uk3 = 0.f;
-	int times = 100;
-	for(int i = 0; i < times; i++){
-		range_with(uwb_device, 0x0001, &distance1, &rx_coord1);
-		range_with(uwb_device, 0x0002, &distance2, &rx_coord2);
-		range_with(uwb_device, 0x0003, &distance3, &rx_coord3);
-		distance_uk1 += distance1;
-		distance_uk2 += distance2;
-		distance_uk3 += distance3;
-	}
-	distance1 = distance_uk1 / times;
-	distance2 = distance_uk2 / times;
-	distance3 = distance_uk3 / times;
+	const uint16_t anchors[3] = {0x0001, 0x0002, 0x0003};
+	position_real_t distance[3];
+	coord_t rx_coord[3] = {{0}, {0}, {0}};
+
+	if(!self_position_ranges(uwb_device, anchors, 3, 100, distance, rx_coord)){
+		return;
+	}
+	position_real_t distance1 = distance[0];
+	position_real_t distance2 = distance[1];
+	position_real_t distance3 = distance[2];
+	coord_t rx_coord2 = rx_coord[1];
+	coord_t rx_coord3 = rx_coord[2];
 	uwb_device->coord.x = (distance1*distance1 - distance2*distance2 + rx_coord2.x*rx_coord2.x) / (2*rx_coord2.x);
 	uwb_device->coord.y = (distance2*distance2 - distance3*distance3 - rx_coord2.x*rx_coord2.x + rx_coord3.x*rx_coord3.x + rx_coord3.y*rx_coord3.y + 2*uwb_device->coord.x*(rx_coord2.x - rx_coord3.x))
 			/ (2 * rx_coord3.y);
-	double temp = distance1*distance1 - uwb_device->coord.x*uwb_device->coord.x - uwb_device->coord.y*uwb_device->coord.y;
+	position_real_t temp = distance1*distance1 - uwb_device->coord.x*uwb_device->coord.x - uwb_device->coord.y*uwb_device->coord.y;
 	if(temp <= 0)
 	{
 		uwb_device->coord.z = 0;
@@ -196,24 +678,29 @@ void self_position_device_4(uwb_device_t *uwb_device)
 
 void self_position_device_5(uwb_device_t *uwb_device)
 {
-	double distance[4] = {0.f, 0.f, 0.f, 0.f};
+	position_real_t distance[4];
 	coord_t rx_coord[4] = {{0}, {0}, {0}, {0}};
-	double distance_uk[4] = {0.f, 0.f, 0.f, 0.f};
-	int times = 1;
-	for(int i = 0; i < times; i++){
-		range_with(uwb_device, 0x0001, &distance[0], &rx_coord[0]);
-		range_with(uwb_device, 0x0002, &distance[1], &rx_coord[1]);
-		range_with(uwb_device, 0x0003, &distance[2], &rx_coord[2]);
-		range_with(uwb_device, 0x0004, &distance[3], &rx_coord[3]);
-		distance_uk[0] += distance[0];
-		distance_uk[1] += distance[1];
-		distance_uk[2] += distance[2];
-		distance_uk[3] += distance[3];
-	}
-	distance[0] = distance_uk[0] / times;
-	distance[1] = distance_uk[1] / times;
-	distance[2] = distance_uk[2] / times;
-	distance[3] = distance_uk[3] / times;
+	position_real_t round_distance[4];
+	coord_t round_coord[4] = {{0}, {0}, {0}, {0}};
+	coord_t fix;
+	bool complete = false;
+	const uint16_t anchors[4] = {0x0001, 0x0002, 0x0003, 0x0004};
+
+	// One broadcast request per round, the four anchors answer in their slots. The first complete round starts
+	// the track, every range after it updates the track as it comes in. The snapshot solvers take the first
+	// complete round as well, the last round if none was
+	tag_tracker_init(&tag_tracker, track_accel_psd, (position_real_t)TAG_TRACK_GATE);
+	for(int round = 0; round < TAG_TRACK_ROUNDS; round++){
+		uint8_t received = range_with_all(uwb_device, anchors, 4, round_distance, round_coord);
+		if(!complete){
+			memcpy(distance, round_distance, sizeof(distance));
+			memcpy(rx_coord, round_coord, sizeof(rx_coord));
+			complete = (received == 4);
+		}
+		if(!tag_tracker.valid && multilat_wls(round_coord, round_distance, NULL, 4, &multilat_work, &fix)){
+			track_start(&fix);
+		}
+	}
 
 /*	printf("Distances: (%lf, %lf, %lf, %lf)\r\n", distance[0], distance[1], distance[2], distance[3]);
 	// Printanje koordinata svih anchor-a
@@ -221,16 +708,24 @@ void self_position_device_5(uwb_device_t *uwb_device)
 	    printf("Anchor %d coord: x=%lf, y=%lf, z=%lf\r\n", i+1, rx_coord[i].x, rx_coord[i].y, rx_coord[i].z);
 	}
 */
-	multilat_aprox_matrix(rx_coord, distance, &uwb_device->coord);
+	if(!multilat_geometry_set(&geometry_rx, rx_coord, 4) || !multilat_geometry_solve(&geometry_rx, distance, &uwb_device->coord)){
+		multilat_aprox_matrix(rx_coord, distance, &uwb_device->coord);
+	}
 	anounce_coords(uwb_device, COMMAND_POSITION_ANNOUNCEMENT, DWT_START_TX_IMMEDIATE);
 	vTaskDelay(1000);
-	multilat_gauss_iter_matrix(rx_coord, distance, &uwb_device->coord);
+	(void)multilat_wls(rx_coord, distance, NULL, 4, &multilat_work, &uwb_device->coord);
 	anounce_coords(uwb_device, COMMAND_POSITION_ANNOUNCEMENT_GN, DWT_START_TX_IMMEDIATE);
 	vTaskDelay(1000);
-	multilat_aprox_matrix(anchors_predef, distance, &uwb_device->coord);
+	if(range_get_track(&uwb_device->coord)){
+		anounce_coords(uwb_device, COMMAND_POSITION_ANNOUNCEMENT_TRACKED, DWT_START_TX_IMMEDIATE);
+		vTaskDelay(1000);
+	}
+	if(!multilat_geometry_set(&geometry_predef, anchors_predef, 4) || !multilat_geometry_solve(&geometry_predef, distance, &uwb_device->coord)){
+		multilat_aprox_matrix(anchors_predef, distance, &uwb_device->coord);
+	}
 	anounce_coords(uwb_device, COMMAND_POSITION_ANNOUNCEMENT_PREDEF, DWT_START_TX_IMMEDIATE);
 	vTaskDelay(1000);
-	multilat_gauss_iter_matrix(anchors_predef, distance, &uwb_device->coord);
+	(void)multilat_wls(anchors_predef, distance, NULL, 4, &multilat_work, &uwb_device->coord);
 	anounce_coords(uwb_device, COMMAND_POSITION_ANNOUNCEMENT_PREDEF_GN, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED);
 
 
@@ -0,0 +1,130 @@
+/*
+ * range_stats.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Marko Srpak
+ */
+
+/*--------------------------- INCLUDES ---------------------------------------*/
+#include "range_stats.h"
+#include "math.h"
+#include <string.h>
+/*--------------------------- MACROS AND DEFINES -----------------------------*/
+// MAD to standard deviation for normally distributed samples
+#define MAD_TO_SIGMA 1.4826
+#define Z_95 1.96
+/*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+/*--------------------------- STATIC FUNCTION PROTOTYPES ---------------------*/
+static double median_of(double *values, uint8_t n);
+/*--------------------------- VARIABLES --------------------------------------*/
+/*--------------------------- STATIC FUNCTIONS -------------------------------*/
+// Sorts values in place, insertion sort is plenty for RANGE_STATS_WINDOW entries
+static double median_of(double *values, uint8_t n)
+{
+    for (uint8_t i = 1; i < n; i++)
+    {
+        double v = values[i];
+        uint8_t j = i;
+        while (j > 0 && values[j - 1] > v)
+        {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = v;
+    }
+    return (n % 2) ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+/*--------------------------- GLOBAL FUNCTIONS -------------------------------*/
+
+void range_stats_init(range_stats_t *stats, double mad_k)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->mad_k = mad_k;
+}
+
+bool range_stats_add(range_stats_t *stats, double sample)
+{
+    bool accept = true;
+
+    if (stats->mad_k > 0 && stats->window_len >= RANGE_STATS_WINDOW_MIN)
+    {
+        double mad;
+        double median = range_stats_median(stats, &mad);
+        if (mad < RANGE_STATS_MAD_FLOOR_M)
+        {
+            mad = RANGE_STATS_MAD_FLOOR_M;
+        }
+        accept = fabs(sample - median) <= stats->mad_k * mad;
+    }
+
+    // Rejected samples still enter the window, a real change of distance moves the median after half a window
+    stats->window[stats->window_next] = sample;
+    stats->window_next = (stats->window_next + 1) % RANGE_STATS_WINDOW;
+    if (stats->window_len < RANGE_STATS_WINDOW)
+    {
+        stats->window_len++;
+    }
+
+    if (!accept)
+    {
+        stats->rejected++;
+        return false;
+    }
+
+    // Welford's update, no cancellation between a large sum of squares and the squared mean
+    stats->count++;
+    double delta = sample - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (sample - stats->mean);
+    return true;
+}
+
+double range_stats_mean(const range_stats_t *stats)
+{
+    return stats->mean;
+}
+
+double range_stats_variance(const range_stats_t *stats)
+{
+    return (stats->count < 2) ? 0.0 : stats->m2 / (stats->count - 1);
+}
+
+double range_stats_ci95(const range_stats_t *stats)
+{
+    if (stats->count < 2)
+    {
+        return INFINITY;
+    }
+    return Z_95 * sqrt(range_stats_variance(stats) / stats->count);
+}
+
+double range_stats_median(const range_stats_t *stats, double *mad)
+{
+    double sorted[RANGE_STATS_WINDOW];
+    uint8_t n = stats->window_len;
+
+    if (n == 0)
+    {
+        if (mad)
+        {
+            *mad = 0.0;
+        }
+        return NAN;
+    }
+    memcpy(sorted, stats->window, n * sizeof(double));
+    double median = median_of(sorted, n);
+    if (mad)
+    {
+        for (uint8_t i = 0; i < n; i++)
+        {
+            sorted[i] = fabs(sorted[i] - median);
+        }
+        *mad = MAD_TO_SIGMA * median_of(sorted, n);
+    }
+    return median;
+}
+
+bool range_stats_converged(const range_stats_t *stats, uint32_t min_samples, double ci_m)
+{
+    return stats->count >= min_samples && range_stats_ci95(stats) < ci_m;
+}
@@ -0,0 +1,169 @@
+/*
+ * tag_tracker.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Marko Srpak
+ */
+
+/*--------------------------- INCLUDES ---------------------------------------*/
+#include "tag_tracker.h"
+#include "math.h"
+#include <string.h>
+/*--------------------------- MACROS AND DEFINES -----------------------------*/
+#define REAL(c) ((position_real_t)(c))
+#ifdef POSITION_SINGLE_PRECISION
+#define real_sqrt sqrtf
+#else
+#define real_sqrt sqrt
+#endif
+// Closer to the anchor than this the direction of the range is undefined
+#define RANGE_MIN_M REAL(1e-3)
+/*--------------------------- TYPEDEFS AND STRUCTS ---------------------------*/
+/*--------------------------- STATIC FUNCTION PROTOTYPES ---------------------*/
+static void mirror_upper(position_real_t p[TAG_TRACKER_STATES][TAG_TRACKER_STATES]);
+/*--------------------------- VARIABLES --------------------------------------*/
+/*--------------------------- STATIC FUNCTIONS -------------------------------*/
+static void mirror_upper(position_real_t p[TAG_TRACKER_STATES][TAG_TRACKER_STATES])
+{
+    for (uint8_t i = 1; i < TAG_TRACKER_STATES; i++)
+    {
+        for (uint8_t j = 0; j < i; j++)
+        {
+            p[i][j] = p[j][i];
+        }
+    }
+}
+/*--------------------------- GLOBAL FUNCTIONS -------------------------------*/
+
+void tag_tracker_init(tag_tracker_t *tracker, position_real_t accel_psd, position_real_t gate)
+{
+    memset(tracker, 0, sizeof(*tracker));
+    tracker->accel_psd = accel_psd;
+    tracker->gate = gate;
+}
+
+void tag_tracker_set_process_noise(tag_tracker_t *tracker, position_real_t accel_psd)
+{
+    tracker->accel_psd = accel_psd;
+}
+
+void tag_tracker_reset(tag_tracker_t *tracker, const coord_t *position, position_real_t position_sd, position_real_t velocity_sd)
+{
+    memset(tracker->x, 0, sizeof(tracker->x));
+    memset(tracker->p, 0, sizeof(tracker->p));
+    tracker->x[0] = position->x;
+    tracker->x[1] = position->y;
+    tracker->x[2] = position->z;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        tracker->p[i][i] = position_sd * position_sd;
+        tracker->p[i + 3][i + 3] = velocity_sd * velocity_sd;
+    }
+    tracker->updates = 0;
+    tracker->rejected = 0;
+    tracker->valid = true;
+}
+
+void tag_tracker_predict(tag_tracker_t *tracker, position_real_t dt_s)
+{
+    position_real_t (*p)[TAG_TRACKER_STATES] = tracker->p;
+
+    if (!tracker->valid || !(dt_s > REAL(0.0)))
+    {
+        return;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        tracker->x[i] += dt_s * tracker->x[i + 3];
+    }
+
+    // F P F' of F = [I dt*I; 0 I] block by block, position rows first while the cross terms are still the old ones
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t j = i; j < 3; j++)
+        {
+            p[i][j] += dt_s * (p[i][j + 3] + p[j][i + 3]) + dt_s * dt_s * p[i + 3][j + 3];
+        }
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            p[i][j + 3] += dt_s * p[i + 3][j + 3];
+        }
+    }
+
+    // White acceleration integrated over dt, per axis
+    position_real_t q = tracker->accel_psd;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        p[i][i] += q * dt_s * dt_s * dt_s / REAL(3.0);
+        p[i][i + 3] += q * dt_s * dt_s / REAL(2.0);
+        p[i + 3][i + 3] += q * dt_s;
+    }
+    mirror_upper(p);
+}
+
+bool tag_tracker_update(tag_tracker_t *tracker, const coord_t *anchor, position_real_t range, position_real_t range_sd)
+{
+    position_real_t (*p)[TAG_TRACKER_STATES] = tracker->p;
+    position_real_t u[3];
+    position_real_t ph[TAG_TRACKER_STATES];
+
+    if (!tracker->valid)
+    {
+        return false;
+    }
+    u[0] = tracker->x[0] - anchor->x;
+    u[1] = tracker->x[1] - anchor->y;
+    u[2] = tracker->x[2] - anchor->z;
+    position_real_t predicted = real_sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+    if (predicted < RANGE_MIN_M)
+    {
+        return false;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        u[i] /= predicted;
+    }
+
+    // The range is a scalar: H = [u' 0], the innovation variance H P H' + R is a number and the gain P H' / S
+    // needs no inverse
+    for (uint8_t i = 0; i < TAG_TRACKER_STATES; i++)
+    {
+        ph[i] = p[i][0] * u[0] + p[i][1] * u[1] + p[i][2] * u[2];
+    }
+    position_real_t s = ph[0] * u[0] + ph[1] * u[1] + ph[2] * u[2] + range_sd * range_sd;
+    position_real_t innovation = range - predicted;
+    if (tracker->gate > REAL(0.0) && innovation * innovation > tracker->gate * tracker->gate * s)
+    {
+        tracker->rejected++;
+        return false;
+    }
+
+    position_real_t k = innovation / s;
+    for (uint8_t i = 0; i < TAG_TRACKER_STATES; i++)
+    {
+        tracker->x[i] += ph[i] * k;
+    }
+    // P - K S K' = P - (P H')(P H')' / S
+    position_real_t s_inv = REAL(1.0) / s;
+    for (uint8_t i = 0; i < TAG_TRACKER_STATES; i++)
+    {
+        position_real_t row = ph[i] * s_inv;
+        for (uint8_t j = i; j < TAG_TRACKER_STATES; j++)
+        {
+            p[i][j] -= row * ph[j];
+        }
+    }
+    mirror_upper(p);
+    tracker->updates++;
+    return true;
+}
+
+void tag_tracker_position(const tag_tracker_t *tracker, coord_t *position)
+{
+    position->x = tracker->x[0];
+    position->y = tracker->x[1];
+    position->z = tracker->x[2];
+}
@@ -23,7 +23,8 @@ static const struct dwt_spi_s dw3000_spi_fct = {
     .writetospi = writetospi,
     .writetospiwithcrc = writetospiwithcrc,
     .setslowrate = port_set_dw_ic_spi_slowrate,
-    .setfastrate = port_set_dw_ic_spi_fastrate
+    .setfastrate = port_set_dw_ic_spi_fastrate,
+    .readfromspichain = readfromspichain
 };
 
 const struct dwt_probe_s dw3000_probe_interf = 
@@ -12,15 +12,179 @@
  */
 
 #include <deca_device_api.h>
+#include <deca_interface.h>
 #include <deca_spi.h>
 #include <port.h>
 #include <stm32f4xx_hal_def.h>
+#include <string.h>
 
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
 
 extern SPI_HandleTypeDef    *hcurrent_active_spi;/*clocked from 72MHz*/
 extern uint16_t             pin_io_active_spi;
 extern GPIO_PinState        SPI_CS_state;
 
+#ifdef DWT_SPI_STATS
+#include <stdio.h>
+
+static deca_spi_stats_t     spi_stats;
+
+/* Time stamp taken right after chip select goes low, recorded right before it goes high */
+#define SPI_STATS_START(n)      uint32_t cs_start = port_GetCycleCount(); uint16_t cs_length = (n)
+#define SPI_STATS_END(h, hl)    spi_stats_record((h), (hl), cs_length, port_GetCycleCount() - cs_start)
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_stats_record()
+ *
+ * Books one chip select frame against the register file decoded from its header:
+ * header[0] is R/W, EAM flag, 5-bit register file and FAC flag, a single byte header with FAC set is a fast command.
+ */
+static void spi_stats_record(const uint8_t *header, uint16_t headerLength, uint16_t length, uint32_t cycles)
+{
+    deca_spi_stat_t *stat;
+
+    if ((headerLength == 1) && ((header[0] & 0x41) == 0x01))
+    {
+        stat = &spi_stats.fastcmd;
+    }
+    else
+    {
+        stat = &spi_stats.regfile[(header[0] >> 1) & 0x1F];
+    }
+
+    stat->transactions++;
+    stat->bytes += headerLength + length;
+    stat->cs_cycles += cycles;
+}
+#else
+#define SPI_STATS_START(n)
+#define SPI_STATS_END(h, hl)
+#endif //DWT_SPI_STATS
+
+#if DECA_SPI_USE_DMA
+static SemaphoreHandle_t    spi_dma_sem;
+static StaticSemaphore_t    spi_dma_sem_buffer;
+static volatile uint8_t     spi_dma_error;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_dma_usable()
+ *
+ * DMA is only worth it for long data phases, and only possible when the caller can block:
+ * dwt_isr() runs from the EXTI handler without DECA_IRQ_DEFERRED and the driver is also used before
+ * the scheduler starts, both of those keep the polled path.
+ * returns 1 if the data phase should go through DMA
+ */
+static int spi_dma_usable(uint16_t length)
+{
+    if ((length < DECA_SPI_DMA_MIN_LEN) || (__get_IPSR() != 0U))
+    {
+        return 0;
+    }
+
+    if ((xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+        || (hcurrent_active_spi->hdmarx == NULL) || (hcurrent_active_spi->hdmatx == NULL))
+    {
+        return 0;
+    }
+
+    if (spi_dma_sem == NULL)
+    {
+        spi_dma_sem = xSemaphoreCreateBinaryStatic(&spi_dma_sem_buffer);
+    }
+
+    return 1;
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_dma_wait()
+ *
+ * Blocks the calling task until the DMA completion (or error) callback gives the semaphore.
+ * returns 0 for success, or -1 for error/timeout
+ */
+static int32_t spi_dma_wait(void)
+{
+    if (xSemaphoreTake(spi_dma_sem, pdMS_TO_TICKS(DECA_SPI_DMA_TIMEOUT_MS)) != pdTRUE)
+    {
+        HAL_SPI_Abort(hcurrent_active_spi);
+        return -1;
+    }
+
+    return (spi_dma_error) ? -1 : 0;
+}
+
+static void spi_dma_complete(SPI_HandleTypeDef *hspi, uint8_t error)
+{
+    BaseType_t woken = pdFALSE;
+
+    if ((hspi != hcurrent_active_spi) || (spi_dma_sem == NULL))
+    {
+        return;
+    }
+
+    spi_dma_error = error;
+    xSemaphoreGiveFromISR(spi_dma_sem, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    spi_dma_complete(hspi, 0);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    spi_dma_complete(hspi, 0);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    spi_dma_complete(hspi, 1);
+}
+#endif //DECA_SPI_USE_DMA
+
+static SemaphoreHandle_t    spi_bus_mutex;
+static StaticSemaphore_t    spi_bus_mutex_buffer;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_bus_lock()
+ *
+ * Masking the DW IC EXTI keeps dwt_isr() off the bus when it runs from the interrupt. With DECA_IRQ_DEFERRED it
+ * runs in the radio task instead, which can block on a DMA transfer or be preempted half way through a frame,
+ * so tasks also take the bus mutex (priority inheritance keeps the radio task wait short).
+ * Interrupt context and the start-up code before the scheduler do not need it.
+ * returns 1 if the mutex was taken and must be given back with spi_bus_unlock()
+ */
+static int spi_bus_lock(void)
+{
+    if ((__get_IPSR() != 0U) || (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING))
+    {
+        return 0;
+    }
+
+    if (spi_bus_mutex == NULL)
+    {
+        taskENTER_CRITICAL();
+        if (spi_bus_mutex == NULL)
+        {
+            spi_bus_mutex = xSemaphoreCreateMutexStatic(&spi_bus_mutex_buffer);
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    xSemaphoreTake(spi_bus_mutex, portMAX_DELAY);
+    return 1;
+}
+
+static void spi_bus_unlock(int locked)
+{
+    if (locked)
+    {
+        xSemaphoreGive(spi_bus_mutex);
+    }
+}
+
 /****************************************************************************
  *
  *
@@ -60,19 +224,23 @@ int32_t writetospiwithcrc(uint16_t headerLength, const uint8_t *headerBuffer, ui
 {
 #ifdef DWT_ENABLE_CRC
     decaIrqStatus_t stat;
+    int locked = spi_bus_lock();
     stat = decamutexon();
     while (HAL_SPI_GetState(hcurrent_active_spi) != HAL_SPI_STATE_READY);
 
     HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, SPI_CS_state); /**< Put chip select line low */
+    SPI_STATS_START(bodyLength + 1U);
 
 
     HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t *)headerBuffer, headerLength, 10);    /* Send header in polling mode */
     HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t *)bodyBuffer, bodyLength, 10);        /* Send data in polling mode */
     HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t *)&crc8, 1, 10);      /* Send data in polling mode */
 
+    SPI_STATS_END(headerBuffer, headerLength);
     HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi,(GPIO_PinState)(!((uint8_t)SPI_CS_state))); /**< Put chip select line high */
 
     decamutexoff(stat);
+    spi_bus_unlock(locked);
 #endif //DWT_ENABLE_CRC
     return 0;
 } // end writetospiwithcrc()
@@ -87,24 +255,44 @@ int32_t writetospiwithcrc(uint16_t headerLength, const uint8_t *headerBuffer, ui
 int32_t writetospi(uint16_t headerLength, const uint8_t *headerBuffer, uint16_t bodyLength, const uint8_t *bodyBuffer)
 {
     decaIrqStatus_t stat;
+    int32_t ret = 0;
+    int locked = spi_bus_lock();
     stat = decamutexon();
 
     while (HAL_SPI_GetState(hcurrent_active_spi) != HAL_SPI_STATE_READY);
 
     HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, SPI_CS_state); /**< Put chip select line low */
+    SPI_STATS_START(bodyLength);
 
     HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t *)headerBuffer, headerLength, HAL_MAX_DELAY); /* Send header in polling mode */
 
+#if DECA_SPI_USE_DMA
+    if(spi_dma_usable(bodyLength))
+    {
+        xSemaphoreTake(spi_dma_sem, 0);
+        if (HAL_SPI_Transmit_DMA(hcurrent_active_spi, (uint8_t *)bodyBuffer, bodyLength) != HAL_OK)  /* Send data by DMA */
+        {
+            ret = -1;
+        }
+        else
+        {
+            ret = spi_dma_wait();
+        }
+    }
+    else
+#endif //DECA_SPI_USE_DMA
     if(bodyLength != 0)
     {
         HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t *)bodyBuffer,   bodyLength, HAL_MAX_DELAY);     /* Send data in polling mode */
     }
 
+    SPI_STATS_END(headerBuffer, headerLength);
     HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, (GPIO_PinState)(!((uint8_t)SPI_CS_state))); /**< Put chip select line high */
 
     decamutexoff(stat);
+    spi_bus_unlock(locked);
 
-    return 0;
+    return ret;
 } // end writetospi()
 
 /*! ------------------------------------------------------------------------------------------------------------------
@@ -132,6 +320,41 @@ uint16_t spi_cs_low_delay(uint16_t delay_ms)
     return 0;
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_read_polled()
+ *
+ * Clocks readlength bytes in with MOSI held at 0, chip select must already be asserted and the header sent.
+ * For the data buffer LL register access is used directly as the HAL SPI read function
+ * has issue reading single bytes.
+ */
+static void spi_read_polled(uint16_t readlength, uint8_t *readBuffer)
+{
+    while(__HAL_SPI_GET_FLAG(hcurrent_active_spi, SPI_FLAG_TXE) == RESET)//Verify that the transmit was ended
+    {
+    }
+
+    while (readlength-- > 0)
+    {
+        /* Wait until TXE flag is set to send data */
+        while(__HAL_SPI_GET_FLAG(hcurrent_active_spi, SPI_FLAG_TXE) == RESET)
+        {
+        }
+
+        hcurrent_active_spi->Instance->DR=0;
+
+        /* set output to 0 (MOSI), this is necessary for
+        e.g. when waking up DW3000 from DEEPSLEEP via dwt_spicswakeup() function.
+        */
+
+        /* Wait until RXNE flag is set to read data */
+        while(__HAL_SPI_GET_FLAG(hcurrent_active_spi, SPI_FLAG_RXNE) == RESET)
+        {
+        }
+
+        (*readBuffer++) = hcurrent_active_spi->Instance->DR;  //copy data read form (MISO)
+    }
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * Function: readfromspi()
  *
@@ -145,51 +368,146 @@ int32_t readfromspi(uint16_t headerLength, uint8_t *headerBuffer, uint16_t readl
 {
 
     decaIrqStatus_t stat;
+    int32_t ret = 0;
+    int locked = spi_bus_lock();
     stat = decamutexon();
 
     /* Blocking: Check whether previous transfer has been finished */
     while (HAL_SPI_GetState(hcurrent_active_spi) != HAL_SPI_STATE_READY);
 
     HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, SPI_CS_state); /**< Put chip select line low */
+    SPI_STATS_START(readlength);
 
     /* Send header */
     HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t*)headerBuffer, headerLength, HAL_MAX_DELAY); //No timeout
 
-    while(__HAL_SPI_GET_FLAG(hcurrent_active_spi, SPI_FLAG_TXE) == RESET)//Verify that the transmit was ended
-    {
-    }
-
-    /* for the data buffer use LL functions directly as the HAL SPI read function
-     * has issue reading single bytes */
-    while (readlength-- > 0)
+#if DECA_SPI_USE_DMA
+    if (spi_dma_usable(readlength))
     {
-        /* Wait until TXE flag is set to send data */
-        while(__HAL_SPI_GET_FLAG(hcurrent_active_spi, SPI_FLAG_TXE) == RESET)
+        /* full duplex from the same buffer, zeroed first so MOSI stays low as in the polled loop below */
+        memset(readBuffer, 0, readlength);
+        xSemaphoreTake(spi_dma_sem, 0);
+        if (HAL_SPI_TransmitReceive_DMA(hcurrent_active_spi, readBuffer, readBuffer, readlength) != HAL_OK)
         {
+            ret = -1;
         }
-
-        hcurrent_active_spi->Instance->DR=0;
-
-        /* set output to 0 (MOSI), this is necessary for
-        e.g. when waking up DW3000 from DEEPSLEEP via dwt_spicswakeup() function.
-        */
-
-        /* Wait until RXNE flag is set to read data */
-        while(__HAL_SPI_GET_FLAG(hcurrent_active_spi, SPI_FLAG_RXNE) == RESET)
+        else
         {
+            ret = spi_dma_wait();
         }
-
-        (*readBuffer++) = hcurrent_active_spi->Instance->DR;  //copy data read form (MISO)
+        readlength = 0;
     }
+#endif //DECA_SPI_USE_DMA
+
+    spi_read_polled(readlength, readBuffer);
 
 
+    SPI_STATS_END(headerBuffer, headerLength);
     HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, (GPIO_PinState)(!((uint8_t)SPI_CS_state))); /**< Put chip select line high */
 
     decamutexoff(stat);
+    spi_bus_unlock(locked);
 
-    return 0;
+    return ret;
 } // end readfromspi()
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: readfromspichain()
+ *
+ * Low level abstract function to run several reads back to back
+ * Each element carries its own header and gets its own chip select frame, the IRQ mutex and the
+ * SPI ownership check are done once for the whole chain. All elements are read in polling mode.
+ * returns 0 for success, or -1 for error
+ */
+int32_t readfromspichain(uint8_t count, const struct dwt_spi_rd_s *chain)
+{
+    decaIrqStatus_t stat;
+    int locked = spi_bus_lock();
+    stat = decamutexon();
+
+    /* Blocking: Check whether previous transfer has been finished */
+    while (HAL_SPI_GetState(hcurrent_active_spi) != HAL_SPI_STATE_READY);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, SPI_CS_state); /**< Put chip select line low */
+        SPI_STATS_START(chain[i].readlength);
+
+        HAL_SPI_Transmit(hcurrent_active_spi, (uint8_t*)chain[i].header, chain[i].headerLength, HAL_MAX_DELAY);
+
+        spi_read_polled(chain[i].readlength, chain[i].readBuffer);
+
+        SPI_STATS_END(chain[i].header, chain[i].headerLength);
+        HAL_GPIO_WritePin(DW_NSS_GPIO_Port, pin_io_active_spi, (GPIO_PinState)(!((uint8_t)SPI_CS_state))); /**< Put chip select line high */
+    }
+
+    decamutexoff(stat);
+    spi_bus_unlock(locked);
+
+    return 0;
+} // end readfromspichain()
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_stats_get()
+ *
+ * Takes a snapshot of the SPI counters (all zero unless DWT_SPI_STATS is defined)
+ */
+void spi_stats_get(deca_spi_stats_t *stats)
+{
+#ifdef DWT_SPI_STATS
+    *stats = spi_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_stats_reset()
+ *
+ * Clears the SPI counters, in the port and in the driver, and starts the cycle counter
+ */
+void spi_stats_reset(void)
+{
+#ifdef DWT_SPI_STATS
+    port_CycleCounterInit();
+    memset(&spi_stats, 0, sizeof(spi_stats));
+    dwt_resetspistats();
+#endif
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_stats_dump()
+ *
+ * Prints one line per register file that saw traffic: driver calls, SPI frames, bytes, microseconds with CS low
+ */
+void spi_stats_dump(void)
+{
+#ifdef DWT_SPI_STATS
+    dwt_spi_stats_t drv;
+    uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+    uint32_t total = 0;
+
+    dwt_getspistats(&drv);
+
+    printf("SPI: file calls frames bytes cs_us\r\n");
+    for (uint8_t i = 0; i < 32; i++)
+    {
+        if ((drv.calls[i] == 0) && (spi_stats.regfile[i].transactions == 0))
+        {
+            continue;
+        }
+        printf("SPI: 0x%02X %lu %lu %lu %lu\r\n", i, (unsigned long)drv.calls[i],
+               (unsigned long)spi_stats.regfile[i].transactions, (unsigned long)spi_stats.regfile[i].bytes,
+               (unsigned long)(spi_stats.regfile[i].cs_cycles / cycles_per_us));
+        total += spi_stats.regfile[i].cs_cycles;
+    }
+    total += spi_stats.fastcmd.cs_cycles;
+    printf("SPI: fcmd %lu %lu %lu %lu\r\n", (unsigned long)drv.fastcmd, (unsigned long)spi_stats.fastcmd.transactions,
+           (unsigned long)spi_stats.fastcmd.bytes, (unsigned long)(spi_stats.fastcmd.cs_cycles / cycles_per_us));
+    printf("SPI: total cs_us %lu\r\n", (unsigned long)(total / cycles_per_us));
+#endif
+}
+
 /****************************************************************************
  *
  *                              END OF DW3xxx SPI section
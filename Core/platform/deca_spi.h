@@ -22,6 +22,34 @@ extern "C"
 #include <deca_types.h>
 
 #define DECA_MAX_SPI_HEADER_LENGTH (3) // max number of bytes in header (for formating & sizing)
+
+/* Set to 0 to build the port with the polled-only SPI transport */
+#ifndef DECA_SPI_USE_DMA
+#define DECA_SPI_USE_DMA           (1)
+#endif
+
+/* Data phases shorter than this stay polled: below ~64 bytes the DMA set-up and the
+ * task switch cost more than clocking the bytes out directly at 36 MHz */
+#define DECA_SPI_DMA_MIN_LEN       (64)
+
+/* Upper bound for one DMA transfer, 12 KB accumulator read at slow rate is ~22 ms */
+#define DECA_SPI_DMA_TIMEOUT_MS    (50)
+
+/* Per register file SPI counters, built when DWT_SPI_STATS is defined in deca_device_api.h.
+ * Index 0x00..0x1F is the register file decoded from the transaction header. */
+typedef struct
+{
+    uint32_t transactions;  // chip select frames
+    uint32_t bytes;         // header and data bytes
+    uint32_t cs_cycles;     // HCLK cycles with chip select asserted
+} deca_spi_stat_t;
+
+typedef struct
+{
+    deca_spi_stat_t regfile[32];
+    deca_spi_stat_t fastcmd;    // fast commands (no register file)
+} deca_spi_stats_t;
+
     /*! ------------------------------------------------------------------------------------------------------------------
      * Function: openspi()
      *
@@ -67,6 +95,39 @@ extern "C"
     //#pragma GCC optimize ("O3")
     int32_t readfromspi(uint16_t headerLength, uint8_t *headerBuffer, uint16_t readlength, uint8_t *readBuffer);
 
+    struct dwt_spi_rd_s;
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * Function: readfromspichain()
+     *
+     * Low level abstract function to run several reads back to back
+     * Each element carries its own header and gets its own chip select frame, the IRQ mutex and the
+     * SPI ownership check are done once for the whole chain.
+     * returns 0 for success, or -1 for error
+     */
+    int32_t readfromspichain(uint8_t count, const struct dwt_spi_rd_s *chain);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * Function: spi_stats_get()
+     *
+     * Takes a snapshot of the SPI counters (all zero unless DWT_SPI_STATS is defined)
+     */
+    void spi_stats_get(deca_spi_stats_t *stats);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * Function: spi_stats_reset()
+     *
+     * Clears the SPI counters, in the port and in the driver, and starts the cycle counter
+     */
+    void spi_stats_reset(void);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * Function: spi_stats_dump()
+     *
+     * Prints one line per register file that saw traffic: driver calls, SPI frames, bytes, microseconds with CS low
+     */
+    void spi_stats_dump(void);
+
 #ifdef __cplusplus
 }
 #endif
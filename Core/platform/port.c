@@ -13,6 +13,7 @@
 
 #include <port.h>
 //#include <stm32f1xx_hal_conf.h>
+#include "task.h"
 
 /****************************************************************************
  *
@@ -35,6 +36,19 @@ static volatile uint32_t signalResetDone;
 /* DW IC IRQ handler definition. */
 static port_dwic_isr_t port_dwic_isr = NULL;
 
+/* Cycle count at the last DW IC EXTI, the start of the latency measurement */
+static volatile uint32_t dwic_irq_cycles;
+static port_dwic_irq_stats_t dwic_irq_stats;
+
+#if DECA_IRQ_DEFERRED
+/* Radio task servicing the DW IC IRQ, created with the first handler */
+static TaskHandle_t dwic_task;
+static StaticTask_t dwic_task_buffer;
+static StackType_t  dwic_task_stack[DECA_IRQ_TASK_STACK];
+
+static void dwic_irq_task(void *argument);
+#endif
+
 /****************************************************************************
  *
  *                              Time section
@@ -75,6 +89,25 @@ __INLINE void Sleep(uint32_t x)
     HAL_Delay(x);
 }
 
+/* @fn    port_CycleCounterInit
+ * @brief enable the Cortex-M4 DWT cycle counter, which counts HCLK cycles
+ *        (144 MHz, wraps every ~29.8 s)
+ * */
+void port_CycleCounterInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/* @fn    port_GetCycleCount
+ * @brief read the DWT cycle counter, see port_CycleCounterInit()
+ * */
+__INLINE uint32_t port_GetCycleCount(void)
+{
+    return DWT->CYCCNT;
+}
+
 /****************************************************************************
  *
  *                              END OF Time section
@@ -445,6 +478,19 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
     case DW_IRQn_Pin :
     case DW_IRQ2_Pin :
         {
+            dwic_irq_cycles = port_GetCycleCount();
+#if DECA_IRQ_DEFERRED
+            if (dwic_task != NULL)
+            {
+                BaseType_t woken = pdFALSE;
+
+                /* the line stays high until the task has processed the events: mask it, the task unmasks it */
+                port_DisableEXT_IRQ();
+                vTaskNotifyGiveFromISR(dwic_task, &woken);
+                portYIELD_FROM_ISR(woken);
+                break;
+            }
+#endif
             //while (HAL_GPIO_ReadPin(DECAIRQ_GPIO, DW_IRQn_Pin) == GPIO_PIN_SET)
             {
                 process_deca_irq();
@@ -466,13 +512,62 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
  * */
 __INLINE void process_deca_irq(void)
 {
-    while (port_CheckEXT_IRQ() != 0)
+    uint32_t start = port_GetCycleCount();
+    uint32_t latency = start - dwic_irq_cycles;
+    uint32_t service;
+
+    // Without a handler nothing would clear the line: leave it alone instead of spinning here
+    while ((port_dwic_isr != NULL) && (port_CheckEXT_IRQ() != 0))
     {
-        if (port_dwic_isr)
-        {
-            port_dwic_isr();
-        }
+        port_dwic_isr();
     } // while DW3000 IRQ line active
+
+    service = port_GetCycleCount() - start;
+    dwic_irq_stats.count++;
+    dwic_irq_stats.latency_last = latency;
+    dwic_irq_stats.latency_sum += latency;
+    if (latency > dwic_irq_stats.latency_max)
+    {
+        dwic_irq_stats.latency_max = latency;
+    }
+    if (service > dwic_irq_stats.service_max)
+    {
+        dwic_irq_stats.service_max = service;
+    }
+}
+
+#if DECA_IRQ_DEFERRED
+/* @fn      dwic_irq_task
+ * @brief   radio task: processes the DW IC events signalled by HAL_GPIO_EXTI_Callback()
+ *          in task context, then unmasks the EXTI line again
+ * */
+static void dwic_irq_task(void *argument)
+{
+    (void)argument;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        process_deca_irq();
+        port_EnableEXT_IRQ();
+    }
+}
+#endif
+
+/* @fn      port_dwic_irq_stats_get
+ * @brief   snapshot of the DW IC interrupt timing, see port.h
+ * */
+void port_dwic_irq_stats_get(port_dwic_irq_stats_t *stats)
+{
+    *stats = dwic_irq_stats;
+}
+
+/* @fn      port_dwic_irq_stats_reset
+ * @brief   clear the DW IC interrupt timing
+ * */
+void port_dwic_irq_stats_reset(void)
+{
+    memset(&dwic_irq_stats, 0, sizeof(dwic_irq_stats));
 }
 
 /* @fn      port_DisableEXT_IRQ
@@ -693,6 +788,14 @@ void port_set_dwic_isr(port_dwic_isr_t dwic_isr)
 
     port_dwic_isr = dwic_isr;
 
+#if DECA_IRQ_DEFERRED
+    if ((dwic_isr != NULL) && (dwic_task == NULL))
+    {
+        dwic_task = xTaskCreateStatic(dwic_irq_task, "DwIcIrqTask", DECA_IRQ_TASK_STACK, NULL,
+                                      DECA_IRQ_TASK_PRIORITY, dwic_task_stack, &dwic_task_buffer);
+    }
+#endif
+
     if (!en)
     {
         port_EnableEXT_IRQ();
@@ -25,6 +25,7 @@ extern "C"
 
 #include <stm32f4xx_hal.h>
 #include "main.h"
+#include "FreeRTOS.h"
 
 #define EVB1000_LED_SUPPORT 0
 #define EVB1000_LCD_SUPPORT 0
@@ -48,6 +49,54 @@ extern "C"
      */
     void port_set_dwic_isr(port_dwic_isr_t isr);
 
+/* With DECA_IRQ_DEFERRED the EXTI handler only notifies a radio task, which runs the installed handler (dwt_isr)
+ * and its callbacks in task context: the EXTI handler stays a few dozen cycles long and other interrupts
+ * (UART, the HAL time base) are never held off by the SPI traffic of the DW IC event processing. */
+#ifndef DECA_IRQ_DEFERRED
+#define DECA_IRQ_DEFERRED           (1)
+#endif
+
+/* Above every application task, so the RX-to-callback latency is one context switch */
+#ifndef DECA_IRQ_TASK_PRIORITY
+#define DECA_IRQ_TASK_PRIORITY      (configMAX_PRIORITIES - 1)
+#endif
+
+/* dwt_isr() and the callbacks run on this stack, in words */
+#ifndef DECA_IRQ_TASK_STACK
+#define DECA_IRQ_TASK_STACK         (256)
+#endif
+
+    /* DW IC interrupt service timing in HCLK cycles, see port_dwic_irq_stats_get() */
+    typedef struct
+    {
+        uint32_t count;         // EXTI events serviced
+        uint32_t latency_last;  // EXTI handler entry to the start of the DW IC event processing
+        uint32_t latency_max;
+        uint32_t latency_sum;
+        uint32_t service_max;   // longest DW IC event processing, callbacks included
+    } port_dwic_irq_stats_t;
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @fn port_dwic_irq_stats_get()
+     *
+     * @brief Takes a snapshot of the DW IC interrupt timing. The latency includes the radio task wake-up with
+     *        DECA_IRQ_DEFERRED, and is only the EXTI dispatch without it.
+     *
+     * @param stats  the snapshot
+     *
+     * @return none
+     */
+    void port_dwic_irq_stats_get(port_dwic_irq_stats_t *stats);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @fn port_dwic_irq_stats_reset()
+     *
+     * @brief Clears the DW IC interrupt timing.
+     *
+     * @return none
+     */
+    void port_dwic_irq_stats_reset(void);
+
 #define BUFFLEN (4096 + 128)
 
 #define BUF_SIZE (64)
@@ -149,6 +198,8 @@ extern "C"
 
     void Sleep(uint32_t Delay);
     unsigned long portGetTickCnt(void);
+    void port_CycleCounterInit(void);
+    uint32_t port_GetCycleCount(void);
 
 #define S1_SWITCH_ON  (1)
 #define S1_SWITCH_OFF (0)
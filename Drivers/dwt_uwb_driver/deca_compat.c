@@ -1839,6 +1839,73 @@ int16_t dwt_readclockoffset(void)
     return tmp;
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This is used to read several registers as one queued chain. The IRQ mutex is taken once for the whole chain
+ *        and, when the platform provides readfromspichain, the SPI transactions are issued back to back by the port.
+ *
+ * input parameters
+ * @param list  - array of read descriptors (register file ID, byte offset, length, destination buffer)
+ * @param count - number of descriptors, 1 to DWT_READREGS_MAX
+ *
+ * return value - DWT_SUCCESS for success, or DWT_ERROR for error
+ */
+int32_t dwt_readregs(const dwt_reg_rd_t *list, uint8_t count)
+{
+    return dw->dwt_driver->dwt_ops->ioctl(dw, DWT_READREGS, (int32_t)count, (void *)list);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This is used to read the frame length, RX timestamp, TX timestamp (low 32 bits) and clock offset of the last
+ *        exchange with a single dwt_readregs() chain.
+ *
+ * input parameters
+ * @param stamps - pointer to the structure to fill
+ *
+ * return value - DWT_SUCCESS for success, or DWT_ERROR for error
+ */
+int32_t dwt_readtwrstamps(dwt_twr_stamps_t *stamps)
+{
+    return dw->dwt_driver->dwt_ops->ioctl(dw, DWT_READTWRSTAMPS, 0, (void *)stamps);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This is used to drop the driver's shadow copy of the host-owned configuration registers (DWT_REG_SHADOW).
+ *        Must be called after anything outside the driver changes the device registers, e.g. a hard reset.
+ *
+ * input parameters - NONE
+ *
+ * no return value
+ */
+void dwt_shadowinvalidate(void)
+{
+    (void)dw->dwt_driver->dwt_ops->ioctl(dw, DWT_SHADOWINVALIDATE, 0, NULL);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This is used to take a snapshot of the driver's SPI access counters (DWT_SPI_STATS).
+ *
+ * input parameters
+ * @param stats - pointer to the structure to fill
+ *
+ * no return value
+ */
+void dwt_getspistats(dwt_spi_stats_t *stats)
+{
+    (void)dw->dwt_driver->dwt_ops->ioctl(dw, DWT_GETSPISTATS, 0, (void *)stats);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This is used to clear the driver's SPI access counters (DWT_SPI_STATS).
+ *
+ * input parameters - NONE
+ *
+ * no return value
+ */
+void dwt_resetspistats(void)
+{
+    (void)dw->dwt_driver->dwt_ops->ioctl(dw, DWT_RESETSPISTATS, 0, NULL);
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief This is used to read the RX carrier integrator value (relating to the frequency offset of the TX node)
  *
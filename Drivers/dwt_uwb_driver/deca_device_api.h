@@ -59,6 +59,14 @@ extern "C"
 // Enable CRC functionality. Disable to save space when CRC not required.
 #define DWT_ENABLE_CRC
 
+// Enable the shadow cache of host-owned configuration registers (see dwt_shadowinvalidate()). Disable to save RAM or
+// when another master can modify the device configuration behind the driver's back.
+#define DWT_REG_SHADOW
+
+// Enable per register file SPI access counters (see dwt_getspistats()). The platform SPI layer may use the same switch to
+// time its transactions.
+// #define DWT_SPI_STATS
+
 #define DWT_DEBUG_PRINT  0 //debug
 #if (DWT_DEBUG_PRINT == 1)
 #include <stdio.h>
@@ -1124,6 +1132,39 @@ extern "C"
         DBL_BUFF_ACCESS_BUFFER_1 = 0x3,
     } dwt_dbl_buff_conf_e;
 
+    // Maximum number of descriptors accepted by dwt_readregs()
+#define DWT_READREGS_MAX 8U
+
+    // Descriptor for one register read in a dwt_readregs() chain
+    typedef struct
+    {
+        uint32_t regFileID; // ID of register file or buffer being accessed
+        uint16_t index;     // byte index into register file or buffer being accessed
+        uint16_t length;    // number of bytes to read
+        uint8_t *buffer;    // destination buffer, at least 'length' bytes
+    } dwt_reg_rd_t;
+
+    // Registers needed to complete a two-way ranging exchange, read in one chain by dwt_readtwrstamps()
+    typedef struct
+    {
+        uint64_t rx_stamp;     // 40-bit adjusted RX timestamp, as dwt_readrxtimestamp()
+        uint32_t tx_stamp_lo;  // low 32 bits of the last TX timestamp, as dwt_readtxtimestamplo32()
+        int16_t clock_offset;  // sign extended crystal offset, as dwt_readclockoffset()
+        uint16_t frame_len;    // length of the last received frame, as dwt_getframelength()
+    } dwt_twr_stamps_t;
+
+    // Number of DW3000 register files tracked by dwt_getspistats()
+#define DWT_SPI_STATS_REGFILES 32U
+
+    // SPI access counters kept by the driver when DWT_SPI_STATS is defined
+    typedef struct
+    {
+        uint32_t calls[DWT_SPI_STATS_REGFILES]; // register accesses requested per register file
+        uint32_t spi[DWT_SPI_STATS_REGFILES];   // accesses that reached the SPI bus (the rest were served by DWT_REG_SHADOW)
+        uint32_t bytes[DWT_SPI_STATS_REGFILES]; // data bytes moved over SPI, excluding headers
+        uint32_t fastcmd;                       // fast commands issued
+    } dwt_spi_stats_t;
+
     // DW3000 NLOS DIAGNOSTIC TYPE
     typedef enum
     {
@@ -2740,6 +2781,61 @@ extern "C"
      */
     int32_t dwt_readcarrierintegrator(void);
 
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @brief This is used to read several registers as one queued chain. The IRQ mutex is taken once for the whole chain
+     *        and, when the platform provides readfromspichain, the SPI transactions are issued back to back by the port.
+     *
+     * input parameters
+     * @param list  - array of read descriptors (register file ID, byte offset, length, destination buffer)
+     * @param count - number of descriptors, 1 to DWT_READREGS_MAX
+     *
+     * return value - DWT_SUCCESS for success, or DWT_ERROR for error
+     */
+    int32_t dwt_readregs(const dwt_reg_rd_t *list, uint8_t count);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @brief This is used to read the frame length, RX timestamp, TX timestamp (low 32 bits) and clock offset of the last
+     *        exchange with a single dwt_readregs() chain, replacing four separate SPI transactions on the ranging path.
+     *        In double buffer mode the values are read one by one from the buffer the host is accessing.
+     *
+     * input parameters
+     * @param stamps - pointer to the structure to fill
+     *
+     * return value - DWT_SUCCESS for success, or DWT_ERROR for error
+     */
+    int32_t dwt_readtwrstamps(dwt_twr_stamps_t *stamps);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @brief This is used to drop the driver's shadow copy of the host-owned configuration registers (DWT_REG_SHADOW).
+     *        The driver does this itself on soft reset, sleep, wake-up and configuration restore. The host must call it
+     *        after anything else that changes the device registers, e.g. a hard reset through the RSTn line.
+     *
+     * input parameters - NONE
+     *
+     * no return value
+     */
+    void dwt_shadowinvalidate(void);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @brief This is used to take a snapshot of the driver's SPI access counters (DWT_SPI_STATS).
+     *        Without DWT_SPI_STATS the snapshot is all zeros.
+     *
+     * input parameters
+     * @param stats - pointer to the structure to fill
+     *
+     * no return value
+     */
+    void dwt_getspistats(dwt_spi_stats_t *stats);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @brief This is used to clear the driver's SPI access counters (DWT_SPI_STATS).
+     *
+     * input parameters - NONE
+     *
+     * no return value
+     */
+    void dwt_resetspistats(void);
+
     /*! ------------------------------------------------------------------------------------------------------------------
      * @brief this function enables CIA diagnostic data. When turned on the following registers will be logged:
      * IP_TOA_LO, IP_TOA_HI, STS_TOA_LO, STS_TOA_HI, STS1_TOA_LO, STS1_TOA_HI, CIA_TDOA_0, CIA_TDOA_1_PDOA, CIA_DIAG_0, CIA_DIAG_1
@@ -62,6 +62,11 @@ typedef enum
     DWT_RUNPGFCAL,
     DWT_PGF_CAL,
     DWT_READCLOCKOFFSET,
+    DWT_READREGS,
+    DWT_READTWRSTAMPS,
+    DWT_SHADOWINVALIDATE,
+    DWT_GETSPISTATS,
+    DWT_RESETSPISTATS,
     DWT_CLEARAONCONFIG,
     DWT_CALCBANDWIDTHADJ,
     DWT_READDIAGNOSTICS,
@@ -463,6 +468,15 @@ struct dw_rx_s;
     * NB: In porting this to a particular microprocessor, the implementer needs to define the low
     * level abstract functions matching the selected hardware.
 */
+/* One element of a chained SPI read, see readfromspichain in struct dwt_spi_s */
+struct dwt_spi_rd_s
+{
+    uint16_t headerLength;
+    uint8_t header[2];
+    uint16_t readlength;
+    uint8_t *readBuffer;
+};
+
 struct dwt_spi_s
 {
 /*! ------------------------------------------------------------------------------------------------------------------
@@ -532,6 +546,20 @@ struct dwt_spi_s
      *
      */
     void (*setfastrate)(void);
+
+    /*! ------------------------------------------------------------------------------------------------------------------
+     * @brief readfromspichain
+     * Optional low level function to run several reads back to back, each with its own header and chip select frame,
+     * under a single IRQ mutex and SPI ownership check. May be NULL, the driver then issues the reads one by one.
+     *
+     * input parameters:
+     * @param count - number of elements in chain
+     * @param chain - array of read descriptors with pre-composed headers
+     *
+     * output parameters:
+     * returns DWT_SUCCESS for success, or DWT_ERROR for error
+     */
+    int32_t (*readfromspichain)(uint8_t count, const struct dwt_spi_rd_s *chain);
 };
 
 struct rxtx_configure_s
@@ -55,6 +55,13 @@ struct dwt_local_data_s
     uint8_t sys_cfg_dis_fce_bit_flag;  // Cached value of the SYS_CFG_DIS_FCE_BIT in the SYS_CFG_ID register
     dwt_sts_lengths_e stsLength;       // Current STS length
     uint16_t preamble_len;             // Current preamble length
+#ifdef DWT_REG_SHADOW
+    uint16_t shadow_valid;             // Bit n is set when shadow_val[n] mirrors the device register shadow_regs[n]
+    uint32_t shadow_val[12];           // Cached values of the host-owned configuration registers
+#endif
+#ifdef DWT_SPI_STATS
+    dwt_spi_stats_t spi_stats;         // SPI access counters, only cleared by dwt_resetspistats()
+#endif
 };
 
 typedef struct dwt_local_data_s dwt_local_data_t;
@@ -346,6 +353,9 @@ static void ull_enable_rftx_blocks(dwchip_t *dw);
 static void ull_disable_rftx_blocks(dwchip_t *dw);
 static void ull_increase_ch5_ppl_ldo_tune(dwchip_t *dw);
 static int32_t ull_setchannel(dwchip_t *dw, uint8_t ch);
+#ifdef DWT_REG_SHADOW
+static void dwt_shadow_invalidate(dwchip_t *dw);
+#endif
 static void ull_dis_otp_ips(dwchip_t *dw, int32_t mode);
 static float ull_convertrawtemperature(dwchip_t *dw, uint8_t raw_temp);
 static uint16_t ull_readtempvbat(dwchip_t *dw);
@@ -412,6 +422,9 @@ static void ull_setstslength(dwchip_t *dw, dwt_sts_lengths_e sts_len)
  */
 static void ull_wakeup_ic(dwchip_t *dw)
 {
+#ifdef DWT_REG_SHADOW
+    dwt_shadow_invalidate(dw);
+#endif
 #ifndef WIN32
     dw->wakeup_device_with_io();
 #else
@@ -420,31 +433,24 @@ static void ull_wakeup_ic(dwchip_t *dw)
 }
 
 /*! ------------------------------------------------------------------------------------------------------------------
- * @brief  this function is used to read/write to the DW3000 device registers
+ * @brief  this function is used to compose the SPI header (FAC/FACRW/EAMRW) for a DW3000 register access
  *
  * input parameters:
- * @param dw            - DW3000 chip descriptor handler.
- * @param recordNumber  - ID of register file or buffer being accessed
- * @param index         - byte index into register file or buffer being accessed
- * @param length        - number of bytes being written
- * @param buffer        - pointer to buffer containing the 'length' bytes to be written
- * @param rw            - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT
+ * @param regFileID     - ID of register file or buffer being accessed
+ * @param indx          - byte index into register file or buffer being accessed
+ * @param length        - number of bytes being transferred
+ * @param mode          - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT/DW3000_SPI_AND_OR_xx
+ * @param header        - pointer to 2-byte buffer in which to compose the header
  *
- * no return value
+ * returns the number of header bytes (1 or 2)
  */
-static void dwt_xfer3xxx(dwchip_t *dw,
-    uint32_t regFileID, // 0x0, 0x04-0x7F ; 0x10000, 0x10004, 0x10008-0x1007F; 0x20000 etc
-    uint16_t indx,      // sub-index, calculated from regFileID 0..0x7F,
-    uint16_t length, uint8_t *buffer, const spi_modes_e mode)
+static uint16_t dwt_xfer3xxx_header(uint32_t regFileID, uint16_t indx, uint16_t length, const spi_modes_e mode, uint8_t *header)
 {
-    uint8_t header[2]; // Buffer to compose header in
     uint16_t cnt = 0U;  // Counter for length of a header
 
     uint16_t reg_file = (uint16_t)(0x1FUL & ((regFileID + indx) >> 16UL));
     uint16_t reg_offset = (uint16_t)(0x7FUL & (regFileID + indx));
 
-    bool loop_forever = false;
-
     assert(reg_file <= 0x1FU);
     assert(reg_offset <= 0x7FU);
     assert(length < 0x3100U);
@@ -476,6 +482,44 @@ static void dwt_xfer3xxx(dwchip_t *dw,
         cnt = 2U;
     }
 
+    return cnt;
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function is used to read/write to the DW3000 device registers
+ *
+ * input parameters:
+ * @param dw            - DW3000 chip descriptor handler.
+ * @param recordNumber  - ID of register file or buffer being accessed
+ * @param index         - byte index into register file or buffer being accessed
+ * @param length        - number of bytes being written
+ * @param buffer        - pointer to buffer containing the 'length' bytes to be written
+ * @param rw            - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT
+ *
+ * no return value
+ */
+static void dwt_xfer3xxx_spi(dwchip_t *dw,
+    uint32_t regFileID, // 0x0, 0x04-0x7F ; 0x10000, 0x10004, 0x10008-0x1007F; 0x20000 etc
+    uint16_t indx,      // sub-index, calculated from regFileID 0..0x7F,
+    uint16_t length, uint8_t *buffer, const spi_modes_e mode)
+{
+    uint8_t header[2]; // Buffer to compose header in
+    uint16_t cnt = dwt_xfer3xxx_header(regFileID, indx, length, mode, header);
+
+    bool loop_forever = false;
+
+#ifdef DWT_SPI_STATS
+    if (length == 0U)
+    {
+        LOCAL_DATA(dw)->spi_stats.fastcmd++;
+    }
+    else
+    {
+        LOCAL_DATA(dw)->spi_stats.spi[0x1FUL & ((regFileID + indx) >> 16UL)]++;
+        LOCAL_DATA(dw)->spi_stats.bytes[0x1FUL & ((regFileID + indx) >> 16UL)] += length;
+    }
+#endif
+
     switch (mode)
     {
     case DW3000_SPI_AND_OR_8:
@@ -538,6 +582,187 @@ static void dwt_xfer3xxx(dwchip_t *dw,
             {}
     }
 
+} // end dwt_xfer3xxx_spi()
+
+#ifdef DWT_REG_SHADOW
+/* Host-owned configuration registers mirrored by the shadow cache, one 32-bit word each. The device never changes these
+ * on its own, so after the first access reads can be served locally and writes that change nothing can be dropped. */
+static const uint32_t shadow_regs[] = {
+    PANADR_ID, SYS_CFG_ID, ADR_FILT_CFG_ID, TX_FCTRL_ID, TX_FCTRL_HI_ID, RX_FWTO_ID,
+    SYS_ENABLE_LO_ID, SYS_ENABLE_HI_ID, TX_ANTD_ID, TX_POWER_ID, CHAN_CTRL_ID, CIA_CONF_ID
+};
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function is used to drop all shadowed register values
+ *
+ * input parameters:
+ * @param dw            - DW3000 chip descriptor handler.
+ *
+ * no return value
+ */
+static void dwt_shadow_invalidate(dwchip_t *dw)
+{
+    LOCAL_DATA(dw)->shadow_valid = 0U;
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function serves a register access from the shadow cache where possible
+ *
+ * Only accesses contained in one shadowed word are handled. A miss reads the whole word through first, then
+ * reads are copied from the cache, and writes and AND/OR modifies are computed against the cached value and only sent
+ * to the device if they change it. Writes that partially overlap shadowed words invalidate those words.
+ *
+ * input parameters:
+ * @param dw            - DW3000 chip descriptor handler.
+ * @param regFileID     - ID of register file or buffer being accessed
+ * @param indx          - byte index into register file or buffer being accessed
+ * @param length        - number of bytes in buffer
+ * @param buffer        - data to write, AND/OR masks to apply or buffer to read into
+ * @param mode          - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT/DW3000_SPI_AND_OR_xx
+ *
+ * returns true if the access was completed here, false if it must still go to the device
+ */
+static bool dwt_shadow_xfer(dwchip_t *dw, uint32_t regFileID, uint16_t indx, uint16_t length, uint8_t *buffer, const spi_modes_e mode)
+{
+    dwt_local_data_t *data = LOCAL_DATA(dw);
+    uint32_t addr = regFileID + indx;
+    uint32_t offs = addr & 0x3UL;
+    uint16_t width = length;
+    uint32_t field = 0UL;
+    uint32_t and_value = 0UL;
+    uint32_t or_value = 0UL;
+    uint32_t value;
+    uint16_t i;
+    int32_t idx = -1;
+
+    if ((mode == DW3000_SPI_AND_OR_8) || (mode == DW3000_SPI_AND_OR_16) || (mode == DW3000_SPI_AND_OR_32))
+    {
+        width = length / 2U; // AND mask followed by OR mask
+    }
+
+    for (i = 0U; i < (uint16_t)(sizeof(shadow_regs) / sizeof(shadow_regs[0])); i++)
+    {
+        if ((addr < (shadow_regs[i] + 4UL)) && (shadow_regs[i] < (addr + width)))
+        {
+            if (((addr - offs) == shadow_regs[i]) && ((offs + width) <= 4UL))
+            {
+                idx = (int32_t)i;
+            }
+            else if (mode != DW3000_SPI_RD_BIT)
+            {
+                data->shadow_valid &= (uint16_t)~(1U << i); // a wider write lands on this word
+            }
+            else
+            {
+                // reads do not change the device
+            }
+        }
+    }
+
+    if (idx < 0)
+    {
+        return false;
+    }
+
+    if ((data->shadow_valid & (1U << (uint32_t)idx)) == 0U)
+    {
+        uint8_t word[4];
+
+        if ((mode == DW3000_SPI_WR_BIT) && (width == 4U))
+        {
+            dwt_xfer3xxx_spi(dw, regFileID, indx, length, buffer, mode);
+            data->shadow_val[idx] = (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8U) | ((uint32_t)buffer[2] << 16U) | ((uint32_t)buffer[3] << 24U);
+            data->shadow_valid |= (uint16_t)(1U << (uint32_t)idx);
+            return true;
+        }
+
+        dwt_xfer3xxx_spi(dw, shadow_regs[idx], 0U, 4U, word, DW3000_SPI_RD_BIT);
+        data->shadow_val[idx] = (uint32_t)word[0] | ((uint32_t)word[1] << 8U) | ((uint32_t)word[2] << 16U) | ((uint32_t)word[3] << 24U);
+        data->shadow_valid |= (uint16_t)(1U << (uint32_t)idx);
+    }
+
+    value = data->shadow_val[idx];
+
+    for (i = 0U; i < width; i++)
+    {
+        field |= 0xFFUL << (8U * i);
+        and_value |= (uint32_t)buffer[i] << (8U * i);
+        if (width < length)
+        {
+            or_value |= (uint32_t)buffer[width + i] << (8U * i);
+        }
+    }
+    field <<= 8U * offs;
+    and_value <<= 8U * offs;
+    or_value <<= 8U * offs;
+
+    switch (mode)
+    {
+    case DW3000_SPI_RD_BIT:
+        for (i = 0U; i < width; i++)
+        {
+            buffer[i] = (uint8_t)(value >> (8U * (offs + i)));
+        }
+        return true;
+    case DW3000_SPI_WR_BIT:
+        value = (value & ~field) | and_value; // for plain writes the data sits where the AND mask would be
+        break;
+    default:
+        value = (value & (and_value | ~field)) | or_value;
+        break;
+    }
+
+    if (value != data->shadow_val[idx])
+    {
+        dwt_xfer3xxx_spi(dw, regFileID, indx, length, buffer, mode);
+        data->shadow_val[idx] = value;
+    }
+
+    return true;
+}
+#endif // DWT_REG_SHADOW
+
+/** @note unique instance of local driver data */
+static dwt_local_data_t dwt_local_data;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function is used to read/write to the DW3000 device registers, through the register shadow when enabled
+ *
+ * input parameters:
+ * @param dw            - DW3000 chip descriptor handler.
+ * @param recordNumber  - ID of register file or buffer being accessed
+ * @param index         - byte index into register file or buffer being accessed
+ * @param length        - number of bytes being written
+ * @param buffer        - pointer to buffer containing the 'length' bytes to be written
+ * @param rw            - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT
+ *
+ * no return value
+ */
+static void dwt_xfer3xxx(dwchip_t *dw,
+    uint32_t regFileID, // 0x0, 0x04-0x7F ; 0x10000, 0x10004, 0x10008-0x1007F; 0x20000 etc
+    uint16_t indx,      // sub-index, calculated from regFileID 0..0x7F,
+    uint16_t length, uint8_t *buffer, const spi_modes_e mode)
+{
+    // The probe does not set priv: accesses made before dwt_initialise() (e.g. dwt_checkidlerc()) use the
+    // local data in its reset state
+    if (dw->priv == NULL)
+    {
+        dw->priv = &dwt_local_data;
+    }
+#ifdef DWT_SPI_STATS
+    if (length != 0U)
+    {
+        LOCAL_DATA(dw)->spi_stats.calls[0x1FUL & ((regFileID + indx) >> 16UL)]++;
+    }
+#endif
+#ifdef DWT_REG_SHADOW
+    // Fast commands (no data) address the command set, not the register map
+    if ((length != 0U) && dwt_shadow_xfer(dw, regFileID, indx, length, buffer, mode))
+    {
+        return;
+    }
+#endif
+    dwt_xfer3xxx_spi(dw, regFileID, indx, length, buffer, mode);
 } // end dwt_xfer3xxx()
 
 /*! ------------------------------------------------------------------------------------------------------------------
@@ -578,6 +803,60 @@ static void ull_readfromdevice(dwchip_t *dw, uint32_t regFileID, uint16_t index,
     dwt_xfer3xxx(dw, regFileID, index, length, buffer, DW3000_SPI_RD_BIT);
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function is used to read a list of DW3000 registers as one queued chain
+ *         The IRQ mutex is taken once for the whole chain. If the platform provides readfromspichain (and read CRC
+ *         checking is off) the pre-composed transactions are handed to the port in one call, otherwise each read
+ *         goes through dwt_xfer3xxx() as usual.
+ *
+ * input parameters
+ * @param dw            - DW3000 chip descriptor handler.
+ * @param list          - array of read descriptors
+ * @param count         - number of descriptors, 1 to DWT_READREGS_MAX
+ *
+ * returns DWT_SUCCESS for success, or DWT_ERROR for error
+ */
+static int32_t ull_readregs(dwchip_t *dw, const dwt_reg_rd_t *list, uint8_t count)
+{
+    struct dwt_spi_rd_s chain[DWT_READREGS_MAX];
+    decaIrqStatus_t stat;
+    int32_t ret = (int32_t)DWT_SUCCESS;
+
+    if ((list == NULL) || (count == 0U) || (count > DWT_READREGS_MAX))
+    {
+        return (int32_t)DWT_ERROR;
+    }
+
+    stat = decamutexon();
+
+    if ((dw->SPI->readfromspichain != NULL) && (LOCAL_DATA(dw)->spicrc != DWT_SPI_CRC_MODE_WRRD))
+    {
+        for (uint8_t i = 0U; i < count; i++)
+        {
+            chain[i].headerLength = dwt_xfer3xxx_header(list[i].regFileID, list[i].index, list[i].length, DW3000_SPI_RD_BIT, chain[i].header);
+            chain[i].readlength = list[i].length;
+            chain[i].readBuffer = list[i].buffer;
+#ifdef DWT_SPI_STATS
+            LOCAL_DATA(dw)->spi_stats.calls[0x1FUL & ((list[i].regFileID + list[i].index) >> 16UL)]++;
+            LOCAL_DATA(dw)->spi_stats.spi[0x1FUL & ((list[i].regFileID + list[i].index) >> 16UL)]++;
+            LOCAL_DATA(dw)->spi_stats.bytes[0x1FUL & ((list[i].regFileID + list[i].index) >> 16UL)] += list[i].length;
+#endif
+        }
+        ret = dw->SPI->readfromspichain(count, chain);
+    }
+    else
+    {
+        for (uint8_t i = 0U; i < count; i++)
+        {
+            ull_readfromdevice(dw, list[i].regFileID, list[i].index, list[i].length, list[i].buffer);
+        }
+    }
+
+    decamutexoff(stat);
+
+    return ret;
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief  this function is used to read 32-bit value in the device register
  *
@@ -900,6 +1179,9 @@ static void dwt_kick_dgc_on_wakeup(dwchip_t *dw, int8_t channel)
 static void dwt_localstruct_init(dwt_local_data_t *data)
 {
     data->dblbuffon = (uint8_t)DBL_BUFF_OFF; // Double buffer mode off by default / clear the flag
+#ifdef DWT_REG_SHADOW
+    data->shadow_valid = 0U; // Device registers are back at reset values or unknown
+#endif
     data->sleep_mode = (uint16_t)DWT_RUNSAR;  // Configure RUN_SAR on wake by default as it is needed when running PGF_CAL
     data->spicrc = DWT_SPI_CRC_MODE_NO;
     data->stsconfig = (uint8_t)DWT_STS_MODE_OFF; // STS off
@@ -985,9 +1267,6 @@ static int32_t ull_set_vdddig_mv(dwchip_t *dw,  dwt_vdddig_mv_t vdddig)
 }
 #endif
 
-/** @note unique instance of local driver data */
-static dwt_local_data_t dwt_local_data;
-
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief This function initialises the DW3000 transceiver:
  * it reads its DEV_ID register (address 0x00) to verify the IC is one supported
@@ -1657,6 +1936,11 @@ static void ull_restoreconfig(dwchip_t *dw, int32_t full_restore)
     uint8_t channel = 5U;
     uint16_t chan_ctrl;
 
+#ifdef DWT_REG_SHADOW
+    // registers not held in AON came back at reset values
+    dwt_shadow_invalidate(dw);
+#endif
+
     // restore/enable the OTP IPS for normal OTP use
     ull_dis_otp_ips(dw, 0);
 
@@ -4045,6 +4329,10 @@ static void ull_entersleep(dwchip_t *dw, int32_t idle_rc)
     // Copy config to AON - upload the new configuration
     dwt_write8bitoffsetreg(dw, AON_CTRL_ID, 0U, 0U);
     dwt_write8bitoffsetreg(dw, AON_CTRL_ID, 0U, AON_CTRL_ARRAY_SAVE_BIT_MASK);
+
+#ifdef DWT_REG_SHADOW
+    dwt_shadow_invalidate(dw);
+#endif
 }
 
 /*! ------------------------------------------------------------------------------------------------------------------
@@ -6628,6 +6916,81 @@ static uint16_t ull_getframelength(dwchip_t *dw, uint8_t *rng_bit)
     return finfo16;
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This function reads the frame length, RX timestamp, TX timestamp (low 32 bits) and clock offset needed to
+ *        complete a two-way ranging exchange. In single buffer mode all four registers are read in one ull_readregs()
+ *        chain, in double buffer mode the per-buffer accessors are used.
+ *
+ * input parameters
+ * @param dw - DW3000 chip descriptor handler.
+ * @param stamps - pointer to the structure to fill
+ *
+ * returns DWT_SUCCESS for success, or DWT_ERROR for error
+ */
+static int32_t ull_readtwrstamps(dwchip_t *dw, dwt_twr_stamps_t *stamps)
+{
+    uint8_t finfo[2];
+    uint8_t rx_time[RX_TIME_RX_STAMP_LEN];
+    uint8_t tx_time[4];
+    uint8_t diag[2];
+    uint16_t regval;
+    int32_t ret;
+
+    if (stamps == NULL)
+    {
+        return (int32_t)DWT_ERROR;
+    }
+
+    if ((dwt_dbl_buff_conf_e)LOCAL_DATA(dw)->dblbuffon != DBL_BUFF_OFF)
+    {
+        uint8_t rng = 0U;
+        stamps->frame_len = ull_getframelength(dw, &rng);
+        ull_readrxtimestamp(dw, rx_time);
+        stamps->tx_stamp_lo = ull_readtxtimestamplo32(dw);
+        stamps->clock_offset = ull_readclockoffset(dw);
+    }
+    else
+    {
+        const dwt_reg_rd_t list[] = {
+            { RX_FINFO_ID, 0U, (uint16_t)sizeof(finfo), finfo },
+            { RX_TIME_0_ID, 0U, (uint16_t)sizeof(rx_time), rx_time },
+            { TX_TIME_LO_ID, 0U, (uint16_t)sizeof(tx_time), tx_time },
+            { CIA_DIAG_0_ID, 0U, (uint16_t)sizeof(diag), diag },
+        };
+
+        ret = ull_readregs(dw, list, (uint8_t)(sizeof(list) / sizeof(list[0])));
+        if (ret != (int32_t)DWT_SUCCESS)
+        {
+            return ret;
+        }
+
+        regval = (uint16_t)finfo[0] | ((uint16_t)finfo[1] << 8U);
+        regval &= (LOCAL_DATA(dw)->longFrames == 0U) ? (uint16_t)RX_FINFO_STD_RXFLEN_MASK : (uint16_t)RX_FINFO_RXFLEN_BIT_MASK;
+        LOCAL_DATA(dw)->cbData.datalength = regval;
+        stamps->frame_len = regval;
+
+        stamps->tx_stamp_lo = (uint32_t)tx_time[0] | ((uint32_t)tx_time[1] << 8U) | ((uint32_t)tx_time[2] << 16U) | ((uint32_t)tx_time[3] << 24U);
+
+        regval = (uint16_t)diag[0] | ((uint16_t)diag[1] << 8U);
+        regval &= CIA_DIAG_0_COE_PPM_BIT_MASK;
+        // Bit 12 is sign, make the number to be sign extended if this bit is '1'
+        if ((regval & B12_U16_SIGN_EXTEND_TEST) != 0U)
+        {
+            regval |= B12_U16_SIGN_EXTEND_MASK; // sign extend bit #12 to whole U16 word
+        }
+        stamps->clock_offset = (int16_t)regval;
+    }
+
+    stamps->rx_stamp = 0U;
+    for (int32_t i = RX_TIME_RX_STAMP_LEN - 1; i >= 0; i--)
+    {
+        stamps->rx_stamp <<= 8U;
+        stamps->rx_stamp |= rx_time[i];
+    }
+
+    return (int32_t)DWT_SUCCESS;
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief This function drive the antenna configuration GPIO6/7
  *
@@ -8263,6 +8626,41 @@ static int32_t dwt_ioctl(dwchip_t *dw, dwt_ioctl_e fn, int32_t parm, void *ptr)
         }
         break;
 
+    case DWT_READREGS:
+        ret = ull_readregs(dw, (const dwt_reg_rd_t *)ptr, (uint8_t)parm);
+        break;
+
+    case DWT_READTWRSTAMPS:
+        ret = ull_readtwrstamps(dw, (dwt_twr_stamps_t *)ptr);
+        break;
+
+    case DWT_SHADOWINVALIDATE:
+#ifdef DWT_REG_SHADOW
+        dwt_shadow_invalidate(dw);
+#endif
+        break;
+
+    case DWT_GETSPISTATS:
+        if (ptr != NULL)
+        {
+#ifdef DWT_SPI_STATS
+            *(dwt_spi_stats_t *)ptr = LOCAL_DATA(dw)->spi_stats;
+#else
+            static const dwt_spi_stats_t no_stats = { 0 };
+            *(dwt_spi_stats_t *)ptr = no_stats;
+#endif
+        }
+        break;
+
+    case DWT_RESETSPISTATS:
+#ifdef DWT_SPI_STATS
+        {
+            static const dwt_spi_stats_t no_stats = { 0 };
+            LOCAL_DATA(dw)->spi_stats = no_stats;
+        }
+#endif
+        break;
+
     case DWT_READCARRIERINTEGRATOR:
         if (ptr != NULL)
         {
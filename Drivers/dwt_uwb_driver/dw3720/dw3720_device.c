@@ -439,33 +439,22 @@ static void ull_wakeup_ic(dwchip_t *dw)
 }
 
 /*! ------------------------------------------------------------------------------------------------------------------
- * @brief  this function is used to read/write to the DW3720 device registers
+ * @brief  this function is used to compose the SPI header (FAC/FACRW/EAMRW) for a DW3720 register access
  *
  * input parameters:
- * @param dw            - DW3720 chip descriptor handler.
  * @param regFileID     - ID of register file or buffer being accessed
  * @param index         - byte index into register file or buffer being accessed
- * @param length        - number of bytes being written
- * @param buffer        - pointer to buffer containing the 'length' bytes to be written
- * @param mode          - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT
+ * @param mode          - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT/DW3000_SPI_AND_OR_xx/fast commands
+ * @param header        - pointer to 2-byte buffer in which to compose the header
  *
- * no return value
+ * returns the number of header bytes (1 or 2)
  */
-static void dwt_xfer3xxx(dwchip_t *dw,
-    uint32_t regFileID, // 0x0, 0x04-0x7F; 0x10000, 0x10004, 0x10008-0x1007F; 0x20000 etc.
-    uint16_t index,      // sub-index, calculated from regFileID 0..0x7F
-    uint16_t length, uint8_t *buffer, const spi_modes_e mode)
+static uint16_t dwt_xfer3xxx_header(uint32_t regFileID, uint16_t index, const spi_modes_e mode, uint8_t *header)
 {
-    uint8_t header[2]; // Buffer to compose header in
     uint16_t cnt = 1U;  // Counter for length of a header
     uint16_t reg_file;
     uint16_t reg_offset;
     uint16_t addr;
-    uint8_t crc8, dwcrc8;
-    bool fatal_error_occurred = false;
-
-    bool length_is_correct = length < DWT_REG_DATA_MAX_LENGTH;
-    assert(length_is_correct);
 
     if ((mode == DW3000_SPI_WR_FAST_CMD) || (mode == DW3000_SPI_RD_FAST_CMD))
     { /* Fast Access Commands (FAC) */
@@ -488,6 +477,47 @@ static void dwt_xfer3xxx(dwchip_t *dw,
         }
     }
 
+    return cnt;
+}
+
+/** @note unique instance of local driver data */
+static dwt_local_data_t dwt_local_data;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function is used to read/write to the DW3720 device registers
+ *
+ * input parameters:
+ * @param dw            - DW3720 chip descriptor handler.
+ * @param regFileID     - ID of register file or buffer being accessed
+ * @param index         - byte index into register file or buffer being accessed
+ * @param length        - number of bytes being written
+ * @param buffer        - pointer to buffer containing the 'length' bytes to be written
+ * @param mode          - DW3000_SPI_WR_BIT/DW3000_SPI_RD_BIT
+ *
+ * no return value
+ */
+static void dwt_xfer3xxx(dwchip_t *dw,
+    uint32_t regFileID, // 0x0, 0x04-0x7F; 0x10000, 0x10004, 0x10008-0x1007F; 0x20000 etc.
+    uint16_t index,      // sub-index, calculated from regFileID 0..0x7F
+    uint16_t length, uint8_t *buffer, const spi_modes_e mode)
+{
+    uint8_t header[2]; // Buffer to compose header in
+    uint16_t cnt;       // Counter for length of a header
+    uint8_t crc8, dwcrc8;
+    bool fatal_error_occurred = false;
+
+    // The probe does not set priv: accesses made before dwt_initialise() (e.g. dwt_checkidlerc()) use the
+    // local data in its reset state
+    if (dw->priv == NULL)
+    {
+        dw->priv = &dwt_local_data;
+    }
+
+    bool length_is_correct = length < DWT_REG_DATA_MAX_LENGTH;
+    assert(length_is_correct);
+
+    cnt = dwt_xfer3xxx_header(regFileID, index, mode, header);
+
     switch (mode)
     {
     case DW3000_SPI_AND_OR_8:
@@ -590,6 +620,55 @@ static void ull_readfromdevice(dwchip_t *dw, uint32_t regFileID, uint16_t index,
     dwt_xfer3xxx(dw, regFileID, index, length, buffer, DW3000_SPI_RD_BIT);
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief  this function is used to read a list of DW3720 registers as one queued chain
+ *         The IRQ mutex is taken once for the whole chain. If the platform provides readfromspichain (and read CRC
+ *         checking is off) the pre-composed transactions are handed to the port in one call, otherwise each read
+ *         goes through dwt_xfer3xxx() as usual.
+ *
+ * input parameters
+ * @param dw            - DW3720 chip descriptor handler.
+ * @param list          - array of read descriptors
+ * @param count         - number of descriptors, 1 to DWT_READREGS_MAX
+ *
+ * returns DWT_SUCCESS for success, or DWT_ERROR for error
+ */
+static int32_t ull_readregs(dwchip_t *dw, const dwt_reg_rd_t *list, uint8_t count)
+{
+    struct dwt_spi_rd_s chain[DWT_READREGS_MAX];
+    decaIrqStatus_t stat;
+    int32_t ret = (int32_t)DWT_SUCCESS;
+
+    if ((list == NULL) || (count == 0U) || (count > DWT_READREGS_MAX))
+    {
+        return (int32_t)DWT_ERROR;
+    }
+
+    stat = decamutexon();
+
+    if ((dw->SPI->readfromspichain != NULL) && (LOCAL_DATA(dw)->spicrc != DWT_SPI_CRC_MODE_WRRD))
+    {
+        for (uint8_t i = 0U; i < count; i++)
+        {
+            chain[i].headerLength = dwt_xfer3xxx_header(list[i].regFileID, list[i].index, DW3000_SPI_RD_BIT, chain[i].header);
+            chain[i].readlength = list[i].length;
+            chain[i].readBuffer = list[i].buffer;
+        }
+        ret = dw->SPI->readfromspichain(count, chain);
+    }
+    else
+    {
+        for (uint8_t i = 0U; i < count; i++)
+        {
+            ull_readfromdevice(dw, list[i].regFileID, list[i].index, list[i].length, list[i].buffer);
+        }
+    }
+
+    decamutexoff(stat);
+
+    return ret;
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief  this function is used to read from the DW3720 device registers by using fast read
  *
@@ -944,9 +1023,6 @@ static int32_t ull_set_vdddig_mv(dwchip_t *dw,  dwt_vdddig_mv_t vdddig)
 }
 #endif
 
-/** @note unique instance of local driver data */
-static dwt_local_data_t dwt_local_data;
-
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief This function initialises the DW3720 transceiver:
  * it reads its DEV_ID register (address 0x00) to verify the IC is one supported
@@ -7339,6 +7415,81 @@ static uint16_t ull_getframelength(dwchip_t *dw, uint8_t *rng_bit)
     return finfo16;
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @brief This function reads the frame length, RX timestamp, TX timestamp (low 32 bits) and clock offset needed to
+ *        complete a two-way ranging exchange. In single buffer mode all four registers are read in one ull_readregs()
+ *        chain, in double buffer mode the per-buffer accessors are used.
+ *
+ * input parameters
+ * @param dw - DW3720 chip descriptor handler.
+ * @param stamps - pointer to the structure to fill
+ *
+ * returns DWT_SUCCESS for success, or DWT_ERROR for error
+ */
+static int32_t ull_readtwrstamps(dwchip_t *dw, dwt_twr_stamps_t *stamps)
+{
+    uint8_t finfo[2];
+    uint8_t rx_time[RX_TIME_RX_STAMP_LEN];
+    uint8_t tx_time[4];
+    uint8_t diag[2];
+    uint16_t regval;
+    int32_t ret;
+
+    if (stamps == NULL)
+    {
+        return (int32_t)DWT_ERROR;
+    }
+
+    if ((dwt_dbl_buff_conf_e)LOCAL_DATA(dw)->dblbuffon != DBL_BUFF_OFF)
+    {
+        uint8_t rng = 0U;
+        stamps->frame_len = ull_getframelength(dw, &rng);
+        ull_readrxtimestamp(dw, rx_time);
+        stamps->tx_stamp_lo = ull_readtxtimestamplo32(dw);
+        stamps->clock_offset = ull_readclockoffset(dw);
+    }
+    else
+    {
+        const dwt_reg_rd_t list[] = {
+            { RX_FINFO_ID, 0U, (uint16_t)sizeof(finfo), finfo },
+            { RX_TIME_0_ID, 0U, (uint16_t)sizeof(rx_time), rx_time },
+            { TX_TIME_LO_ID, 0U, (uint16_t)sizeof(tx_time), tx_time },
+            { CIA_DIAG_0_ID, 0U, (uint16_t)sizeof(diag), diag },
+        };
+
+        ret = ull_readregs(dw, list, (uint8_t)(sizeof(list) / sizeof(list[0])));
+        if (ret != (int32_t)DWT_SUCCESS)
+        {
+            return ret;
+        }
+
+        regval = (uint16_t)finfo[0] | ((uint16_t)finfo[1] << 8U);
+        regval &= (LOCAL_DATA(dw)->longFrames == 0U) ? (uint16_t)RX_FINFO_STD_RXFLEN_MASK : (uint16_t)RX_FINFO_RXFLEN_BIT_MASK;
+        LOCAL_DATA(dw)->cbData.datalength = regval;
+        stamps->frame_len = regval;
+
+        stamps->tx_stamp_lo = (uint32_t)tx_time[0] | ((uint32_t)tx_time[1] << 8U) | ((uint32_t)tx_time[2] << 16U) | ((uint32_t)tx_time[3] << 24U);
+
+        regval = (uint16_t)diag[0] | ((uint16_t)diag[1] << 8U);
+        regval &= CIA_DIAG_0_COE_PPM_BIT_MASK;
+        // Bit 12 is sign, make the number to be sign extended if this bit is '1'
+        if ((regval & B12_U16_SIGN_EXTEND_TEST) != 0U)
+        {
+            regval |= B12_U16_SIGN_EXTEND_MASK; // sign extend bit #12 to whole U16 word
+        }
+        stamps->clock_offset = (int16_t)regval;
+    }
+
+    stamps->rx_stamp = 0U;
+    for (int32_t i = RX_TIME_RX_STAMP_LEN - 1; i >= 0; i--)
+    {
+        stamps->rx_stamp <<= 8U;
+        stamps->rx_stamp |= rx_time[i];
+    }
+
+    return (int32_t)DWT_SUCCESS;
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @brief This function will reset the timers block. It will reset both timers. It can be used to stop a timer running
  * in repeat mode.
@@ -9465,6 +9616,30 @@ static int32_t dwt_ioctl(dwchip_t *dw, dwt_ioctl_e fn, int32_t param, void *ptr)
         }
         break;
 
+    case DWT_READREGS:
+        ret = ull_readregs(dw, (const dwt_reg_rd_t *)ptr, (uint8_t)param);
+        break;
+
+    case DWT_READTWRSTAMPS:
+        ret = ull_readtwrstamps(dw, (dwt_twr_stamps_t *)ptr);
+        break;
+
+    case DWT_SHADOWINVALIDATE:
+        // no register shadow in this driver
+        break;
+
+    case DWT_GETSPISTATS:
+        if (ptr != NULL)
+        {
+            // no SPI statistics in this driver
+            static const dwt_spi_stats_t no_stats = { 0 };
+            *(dwt_spi_stats_t *)ptr = no_stats;
+        }
+        break;
+
+    case DWT_RESETSPISTATS:
+        break;
+
     case DWT_READCARRIERINTEGRATOR:
         if(ptr != NULL)
         {
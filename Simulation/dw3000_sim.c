@@ -0,0 +1,991 @@
+/*! ----------------------------------------------------------------------------
+ * @file    dw3000_sim.c
+ * @brief   Host side register level model of the DW3000, see dw3000_sim.h
+ *
+ * Only the behaviour the driver and the application rely on is modelled. Registers without side effects are
+ * plain memory and reset to zero unless listed in sim_reset_regs(). Frame filtering covers frame types and short or
+ * long destination addresses. Double buffer mode, SPI CRC checking, sleep/wakeup and the CIR accumulator are not
+ * modelled.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "dw3000_sim.h"
+
+#include <deca_device_api.h>
+#include <dw3000_deca_regs.h>
+#include <dw3000_deca_vals.h>
+
+#define REG_FILE(id)            ((uint8_t)(((id) >> 16UL) & 0x1FUL))
+#define REG_OFFSET(id)          ((uint8_t)((id) & 0x7FUL))
+
+#define OTP_PARTID_ADDRESS      (0x06U)
+#define OTP_LOTID_LO_ADDRESS    (0x0DU)
+#define OTP_LOTID_HI_ADDRESS    (0x0EU)
+
+#define SYS_STATE_RX            (0x12U)     // SYS_STATE_LO byte 2 while the receiver is on
+#define SYS_STATE_TX            (0x08U)     // SYS_STATE_LO byte 2 while transmitting
+
+#define TX_LATENCY_DTU          (DW3000_SIM_DTU_PER_US)    // fast command to start of preamble
+#define TX_RMARKER_ALIGN        (512U)                      // delayed TX/RX resolution (bit 0 of DX_TIME ignored)
+
+#define STATUS_TX_DONE          (SYS_STATUS_TXFRB_BIT_MASK | SYS_STATUS_TXPRS_BIT_MASK | SYS_STATUS_TXPHS_BIT_MASK | SYS_STATUS_TXFRS_BIT_MASK)
+#define STATUS_RX_HEADER        (SYS_STATUS_RXPRD_BIT_MASK | SYS_STATUS_RXSFDD_BIT_MASK | SYS_STATUS_RXPHD_BIT_MASK | SYS_STATUS_CIADONE_BIT_MASK)
+#define STATUS_RX_ALL           (STATUS_RX_HEADER | SYS_STATUS_RXFR_BIT_MASK | SYS_STATUS_RXFCG_BIT_MASK | SYS_STATUS_RXFCE_BIT_MASK | \
+                                 SYS_STATUS_RXFTO_BIT_MASK | SYS_STATUS_RXPTO_BIT_MASK | SYS_STATUS_RXSTO_BIT_MASK | SYS_STATUS_RXPHE_BIT_MASK | \
+                                 SYS_STATUS_RXFSL_BIT_MASK | SYS_STATUS_RXOVRR_BIT_MASK | SYS_STATUS_CIAERR_BIT_MASK)
+
+#define SIM_DIAG_ACCUM_COUNT    (120U)      // preamble symbols accumulated
+#define SIM_DIAG_CHANNEL_AREA   (102U)      // about -80 dBm at 120 symbols
+#define SIM_DIAG_FP_AMPLITUDE   (26770U)    // F1..F3, two fractional bits: first path 2 dB under the channel power
+#define SIM_DIAG_FP_INDEX       (745U)
+#define SIM_DIAG_NLOS_PEAK_DELAY (8U)       // CIR samples from the first path to the peak when the first path is weakened
+#define FNV_PRIME               (0x01000193UL)
+
+static dw3000_sim_t *selected;
+
+/****************************************************************************
+ *
+ *                              Register access helpers
+ *
+ *******************************************************************************/
+
+static uint64_t get_le(const uint8_t *p, uint8_t n)
+{
+    uint64_t v = 0U;
+    while (n-- > 0U)
+    {
+        v = (v << 8U) | p[n];
+    }
+    return v;
+}
+
+static void put_le(uint8_t *p, uint64_t v, uint8_t n)
+{
+    for (uint8_t i = 0U; i < n; i++)
+    {
+        p[i] = (uint8_t)(v >> (8U * i));
+    }
+}
+
+static uint64_t reg_get(const dw3000_sim_t *sim, uint32_t id, uint8_t n)
+{
+    return get_le(&sim->regs[REG_FILE(id)][REG_OFFSET(id)], n);
+}
+
+static void reg_put(dw3000_sim_t *sim, uint32_t id, uint64_t v, uint8_t n)
+{
+    put_le(&sim->regs[REG_FILE(id)][REG_OFFSET(id)], v, n);
+}
+
+static void status_set(dw3000_sim_t *sim, uint32_t bits)
+{
+    reg_put(sim, SYS_STATUS_ID, reg_get(sim, SYS_STATUS_ID, 4U) | bits, 4U);
+}
+
+static void status_clear(dw3000_sim_t *sim, uint32_t bits)
+{
+    reg_put(sim, SYS_STATUS_ID, reg_get(sim, SYS_STATUS_ID, 4U) & ~(uint64_t)bits, 4U);
+}
+
+/* 802.15.4 FCS: CRC-16 ITU-T, reflected, zero initial value */
+static uint16_t fcs16(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0U;
+    for (uint16_t i = 0U; i < length; i++)
+    {
+        crc ^= data[i];
+        for (uint8_t b = 0U; b < 8U; b++)
+        {
+            crc = (crc & 1U) ? (uint16_t)((crc >> 1U) ^ 0x8408U) : (uint16_t)(crc >> 1U);
+        }
+    }
+    return crc;
+}
+
+/* Backing store of a register file. The indirect pointers resolve to the file and offset programmed in
+ * INDIRECT_ADDR_x / ADDR_OFFSET_x. */
+static uint8_t *sim_mem(dw3000_sim_t *sim, uint8_t file, uint16_t *size)
+{
+    uint8_t *mem;
+
+    switch (file)
+    {
+    case REG_FILE(RX_BUFFER_0_ID):
+        mem = sim->rx_buffer[0];
+        *size = DW3000_SIM_BUFFER_LEN;
+        break;
+    case REG_FILE(RX_BUFFER_1_ID):
+        mem = sim->rx_buffer[1];
+        *size = DW3000_SIM_BUFFER_LEN;
+        break;
+    case REG_FILE(TX_BUFFER_ID):
+        mem = sim->tx_buffer;
+        *size = DW3000_SIM_BUFFER_LEN;
+        break;
+    case REG_FILE(INDIRECT_POINTER_A_ID):
+    case REG_FILE(INDIRECT_POINTER_B_ID):
+    {
+        bool a = (file == REG_FILE(INDIRECT_POINTER_A_ID));
+        uint8_t target = (uint8_t)(reg_get(sim, a ? INDIRECT_ADDR_A_ID : INDIRECT_ADDR_B_ID, 1U) & 0x1FU);
+        uint16_t offset = (uint16_t)(reg_get(sim, a ? ADDR_OFFSET_A_ID : ADDR_OFFSET_B_ID, 2U) & 0x7FFU);
+
+        if ((target == REG_FILE(INDIRECT_POINTER_A_ID)) || (target == REG_FILE(INDIRECT_POINTER_B_ID)))
+        {
+            target = 0U;
+        }
+        mem = sim_mem(sim, target, size);
+        offset = (offset < *size) ? offset : *size;
+        mem += offset;
+        *size = (uint16_t)(*size - offset);
+        break;
+    }
+    default:
+        mem = sim->regs[file];
+        *size = DW3000_SIM_REG_FILE_LEN;
+        break;
+    }
+    return mem;
+}
+
+static bool touches(uint8_t file, uint16_t offset, uint16_t length, uint32_t id, uint16_t n)
+{
+    return (file == REG_FILE(id)) && (offset < (REG_OFFSET(id) + n)) && ((offset + length) > REG_OFFSET(id));
+}
+
+/****************************************************************************
+ *
+ *                              Timing
+ *
+ *******************************************************************************/
+
+uint64_t dw3000_sim_frame_duration(const dw3000_sim_t *sim, uint16_t length, uint64_t *shr)
+{
+    static const uint16_t psr_symbols[16] = { 0, 64, 1024, 4096, 0, 128, 1536, 0, 0, 256, 2048, 0, 0, 512, 0, 0 };
+    uint32_t fctrl = (uint32_t)reg_get(sim, TX_FCTRL_ID, 4U);
+    uint8_t fine = (uint8_t)reg_get(sim, TX_FCTRL_HI_ID + 1U, 1U);
+    uint32_t chan = (uint32_t)reg_get(sim, CHAN_CTRL_ID, 4U);
+    uint32_t cfg = (uint32_t)reg_get(sim, SYS_CFG_ID, 4U);
+    uint32_t pcode = (chan & CHAN_CTRL_TX_PCODE_BIT_MASK) >> CHAN_CTRL_TX_PCODE_BIT_OFFSET;
+    uint32_t sfd_type = (chan & CHAN_CTRL_SFD_TYPE_BIT_MASK) >> CHAN_CTRL_SFD_TYPE_BIT_OFFSET;
+    uint64_t symbol = ((pcode >= 9U) && (pcode <= 24U)) ? 65024U : 63488U; // PRF64 : PRF16 preamble symbol
+    uint64_t psr = (fine != 0U) ? (((uint64_t)fine + 1U) * 8U) : psr_symbols[(fctrl & TX_FCTRL_TXPSR_BIT_MASK) >> TX_FCTRL_TXPSR_BIT_OFFSET];
+    uint64_t sfd = (sfd_type == 2U) ? 16U : 8U;
+    bool br_6m8 = ((fctrl & TX_FCTRL_TXBR_BIT_MASK) != 0U);
+    uint64_t data_bit = br_6m8 ? 8192U : 65536U;
+    uint64_t phr_bit = (br_6m8 && ((cfg & SYS_CFG_PHR_6M8_BIT_MASK) != 0U)) ? 8192U : 65536U;
+    uint64_t bits = (uint64_t)length * 8U;
+    uint64_t head;
+
+    if (psr == 0U)
+    {
+        psr = 128U;
+    }
+    bits += ((bits + 329U) / 330U) * 48U;   // Reed-Solomon parity
+    head = (psr + sfd) * symbol;
+    if (shr != NULL)
+    {
+        *shr = head;
+    }
+    return head + 19U * phr_bit + bits * data_bit;
+}
+
+/* Resolves a delayed TX/RX command to a local time. Returns false (and raises HPDWARN) if the time has passed. */
+static bool sim_delayed_time(dw3000_sim_t *sim, uint64_t base, uint64_t *when)
+{
+    uint64_t dx = reg_get(sim, DX_TIME_ID, 4U) << 8U;
+    uint64_t target;
+    uint64_t delta;
+
+    if (base == 0U)
+    {
+        dx &= ~(uint64_t)(TX_RMARKER_ALIGN - 1U);
+    }
+    target = (base + dx) & DW3000_SIM_TIME_MASK;
+    delta = (target - (sim->now & DW3000_SIM_TIME_MASK)) & DW3000_SIM_TIME_MASK;
+    if (delta >= ((DW3000_SIM_TIME_MASK + 1U) / 2U))
+    {
+        status_set(sim, SYS_STATUS_HPDWARN_BIT_MASK);
+        return false;
+    }
+    *when = sim->now + delta;
+    return true;
+}
+
+/* Earlier of the frame wait and preamble detection timeouts, UINT64_MAX if neither is set */
+static uint64_t sim_rx_timeout(const dw3000_sim_t *sim)
+{
+    uint64_t fwto = (sim->rx_deadline != 0U) ? sim->rx_deadline : UINT64_MAX;
+    uint64_t pto = (sim->rx_pto != 0U) ? sim->rx_pto : UINT64_MAX;
+
+    return (pto < fwto) ? pto : fwto;
+}
+
+static void sim_rx_on(dw3000_sim_t *sim, uint64_t when)
+{
+    static const uint64_t pac_symbols[4] = { 8U, 16U, 32U, 4U };
+    uint64_t pretoc = reg_get(sim, DTUNE1_ID, 2U) & DTUNE1_PRE_TOC_BIT_MASK;
+    uint64_t pac = pac_symbols[reg_get(sim, DTUNE0_ID, 1U) & DTUNE0_PRE_PAC_SYM_BIT_MASK];
+
+    sim->rx_start = when;
+    sim->rx_deadline = 0U;
+    sim->rx_pto = 0U;
+    sim->rx_pending = false;
+    if ((reg_get(sim, SYS_CFG_ID, 2U) & SYS_CFG_RXWTOE_BIT_MASK) != 0U)
+    {
+        sim->rx_deadline = when + (reg_get(sim, RX_FWTO_ID, 4U) & 0xFFFFFU) * DW3000_SIM_DTU_PER_UUS;
+    }
+    if (pretoc != 0U)
+    {
+        /* PRF64 preamble symbols, a preamble starting after this is never detected */
+        sim->rx_pto = when + pretoc * pac * 65024U;
+    }
+    sim->state = (when <= sim->now) ? DW3000_SIM_RX : DW3000_SIM_RX_DELAYED;
+}
+
+static void sim_tx_arm(dw3000_sim_t *sim, uint64_t rmarker, bool w4r)
+{
+    uint16_t length = (uint16_t)(reg_get(sim, TX_FCTRL_ID, 2U) & TX_FCTRL_TXFLEN_BIT_MASK);
+    uint64_t shr;
+    uint64_t duration = dw3000_sim_frame_duration(sim, length, &shr);
+
+    sim->tx_rmarker = rmarker;
+    sim->tx_start = rmarker - shr;
+    sim->tx_end = sim->tx_start + duration;
+    sim->w4r = w4r;
+    sim->state = DW3000_SIM_TX_DELAYED;
+}
+
+static void sim_tx_start(dw3000_sim_t *sim)
+{
+    uint32_t fctrl = (uint32_t)reg_get(sim, TX_FCTRL_ID, 4U);
+    uint16_t length = (uint16_t)(fctrl & TX_FCTRL_TXFLEN_BIT_MASK);
+    uint16_t offset = (uint16_t)((fctrl & TX_FCTRL_TXB_OFFSET_BIT_MASK) >> TX_FCTRL_TXB_OFFSET_BIT_OFFSET);
+    uint8_t *frame;
+
+    /* dwt_writetxfctrl() programs offsets past 127 with 128 added, the IC takes it off again */
+    if (offset > 127U)
+    {
+        offset = (uint16_t)(offset - 128U);
+    }
+    frame = &sim->tx_buffer[offset];
+    sim->state = DW3000_SIM_TX;
+    if ((offset + length) > DW3000_SIM_BUFFER_LEN)
+    {
+        length = (uint16_t)(DW3000_SIM_BUFFER_LEN - offset);
+    }
+    if ((length >= 2U) && ((reg_get(sim, SYS_CFG_ID, 1U) & SYS_CFG_DIS_FCS_TX_BIT_MASK) == 0U))
+    {
+        put_le(&frame[length - 2U], fcs16(frame, (uint16_t)(length - 2U)), 2U);
+    }
+    if (sim->tx_cb != NULL)
+    {
+        sim->tx_cb(sim, frame, length, sim->tx_rmarker + sim->tx_ant_dly, sim->tx_end - sim->tx_start, sim->tx_ctx);
+    }
+}
+
+static void sim_tx_done(dw3000_sim_t *sim)
+{
+    uint64_t stamp = (sim->tx_rmarker + reg_get(sim, TX_ANTD_ID, 2U)) & DW3000_SIM_TIME_MASK;
+
+    reg_put(sim, TX_TIME_LO_ID, stamp, 5U);
+    status_set(sim, STATUS_TX_DONE);
+    sim->frames_sent++;
+    sim->state = DW3000_SIM_IDLE;
+    if (sim->w4r)
+    {
+        sim_rx_on(sim, sim->tx_end + (reg_get(sim, ACK_RESP_ID, 4U) & ACK_RESP_W4R_TIM_BIT_MASK) * DW3000_SIM_DTU_PER_UUS);
+    }
+}
+
+/* 802.15.4 frame filter as configured by dwt_configureframefilter(), dwt_setpanid() and dwt_setaddress16() */
+static bool sim_frame_accepted(const dw3000_sim_t *sim, const uint8_t *frame, uint16_t length)
+{
+    uint16_t allow = (uint16_t)reg_get(sim, ADR_FILT_CFG_ID, 2U);
+    uint16_t pan = (uint16_t)(reg_get(sim, PANADR_ID, 4U) >> PANADR_PAN_ID_BIT_OFFSET);
+    uint16_t fc;
+    uint16_t dst_pan;
+
+    if ((reg_get(sim, SYS_CFG_ID, 1U) & SYS_CFG_FFEN_BIT_MASK) == 0U)
+    {
+        return true;
+    }
+    if (length < 3U)
+    {
+        return false;
+    }
+    fc = (uint16_t)get_le(frame, 2U);
+    if ((allow & (1U << (fc & 0x7U))) == 0U)
+    {
+        return false;
+    }
+    switch ((fc >> 10U) & 0x3U)
+    {
+    case 0U:
+        /* no destination: acks, or frames for the PAN coordinator */
+        return ((fc & 0x7U) == 2U) || ((allow & DWT_FF_COORD_EN) != 0U);
+    case 2U:
+        if (length < 7U)
+        {
+            return false;
+        }
+        dst_pan = (uint16_t)get_le(&frame[3], 2U);
+        return ((dst_pan == pan) || (dst_pan == 0xFFFFU))
+               && ((get_le(&frame[5], 2U) == 0xFFFFU) || (get_le(&frame[5], 2U) == reg_get(sim, PANADR_ID, 2U)));
+    case 3U:
+        if (length < 13U)
+        {
+            return false;
+        }
+        dst_pan = (uint16_t)get_le(&frame[3], 2U);
+        return ((dst_pan == pan) || (dst_pan == 0xFFFFU)) && (get_le(&frame[5], 8U) == reg_get(sim, EUI_64_LO_ID, 8U));
+    default:
+        return false;
+    }
+}
+
+/* Ipatov CIR diagnostics of the received frame: a clean line of sight channel at about -80 dBm, with rx_fp_loss_db
+ * taken off the first path and the peak moved behind it, the way a blocked direct path looks. Like the CIA the model
+ * only logs them with CIA diagnostics on (dwt_configciadiag(DW_CIA_DIAG_LOG_ALL)). */
+static void sim_rx_diagnostics(dw3000_sim_t *sim)
+{
+    static const uint32_t diag_ids[] = { IP_DIAG_0_ID, IP_DIAG_1_ID, IP_DIAG_2_ID, IP_DIAG_3_ID, IP_DIAG_4_ID,
+                                         IP_DIAG_8_ID, IP_DIAG_12_ID };
+    uint32_t fp_amplitude;
+    uint32_t peak_index = SIM_DIAG_FP_INDEX;
+    uint32_t fp_index = SIM_DIAG_FP_INDEX << 6U;    // Q10.6, the peak index is whole samples
+
+    for (size_t i = 0U; i < (sizeof(diag_ids) / sizeof(diag_ids[0])); i++)
+    {
+        reg_put(sim, diag_ids[i], 0U, 4U);
+    }
+    if ((reg_get(sim, CIA_CONF_ID, 3U) & ((uint64_t)CIA_DIAGNOSTIC_OFF << 16U)) != 0U)
+    {
+        return;
+    }
+
+    fp_amplitude = (uint32_t)(SIM_DIAG_FP_AMPLITUDE * pow(10.0, -sim->rx_fp_loss_db / 20.0));
+    if (sim->rx_fp_loss_db > 0.0)
+    {
+        peak_index += SIM_DIAG_NLOS_PEAK_DELAY;
+    }
+    if (sim->rx_peak_delay > 0.0)
+    {
+        peak_index = SIM_DIAG_FP_INDEX + SIM_DIAG_NLOS_PEAK_DELAY;
+        fp_index = (peak_index << 6U) - (uint32_t)lround(sim->rx_peak_delay * 64.0);
+    }
+    reg_put(sim, IP_DIAG_0_ID, ((uint64_t)peak_index << 21U) | SIM_DIAG_FP_AMPLITUDE, 4U);
+    reg_put(sim, IP_DIAG_1_ID, SIM_DIAG_CHANNEL_AREA, 4U);
+    reg_put(sim, IP_DIAG_2_ID, fp_amplitude, 4U);
+    reg_put(sim, IP_DIAG_3_ID, fp_amplitude, 4U);
+    reg_put(sim, IP_DIAG_4_ID, fp_amplitude, 4U);
+    reg_put(sim, IP_DIAG_8_ID, fp_index, 2U);
+    reg_put(sim, IP_DIAG_12_ID, SIM_DIAG_ACCUM_COUNT, 2U);
+}
+
+static void sim_rx_done(dw3000_sim_t *sim)
+{
+    uint16_t length = sim->rx_length;
+    uint64_t stamp = (sim->rx_rmarker - reg_get(sim, CIA_CONF_ID, 2U)) & DW3000_SIM_TIME_MASK;
+    bool good = (length >= 2U) && (((reg_get(sim, SYS_CFG_ID, 1U) & SYS_CFG_DIS_FCE_BIT_MASK) != 0U)
+                                   || (fcs16(sim->rx_frame, (uint16_t)(length - 2U)) == get_le(&sim->rx_frame[length - 2U], 2U)));
+
+    if (good && !sim_frame_accepted(sim, sim->rx_frame, length))
+    {
+        /* the frame never reaches the host and the receiver carries on listening */
+        status_set(sim, STATUS_RX_HEADER | SYS_STATUS_ARFE_BIT_MASK);
+        sim->rx_pending = false;
+        sim->frames_rejected++;
+        return;
+    }
+
+    memcpy(sim->rx_buffer[0], sim->rx_frame, length);
+    reg_put(sim, RX_FINFO_ID, (uint64_t)(length & RX_FINFO_RXFLEN_BIT_MASK) | RX_FINFO_RNG_BIT_MASK, 4U);
+    reg_put(sim, RX_TIME_0_ID, stamp, 5U);
+    reg_put(sim, CIA_DIAG_0_ID, (uint16_t)sim->rx_clock_offset & 0x1FFFU, 2U);
+    sim_rx_diagnostics(sim);
+    status_set(sim, STATUS_RX_HEADER | SYS_STATUS_RXFR_BIT_MASK | (good ? SYS_STATUS_RXFCG_BIT_MASK : SYS_STATUS_RXFCE_BIT_MASK));
+    sim->rx_pending = false;
+    sim->frames_received++;
+    sim->state = DW3000_SIM_IDLE;
+}
+
+/* FINT_STAT groups the enabled SYS_STATUS events the way dwt_isr() dispatches them. System panic events live in
+ * SYS_STATUS_HI, which the model does not raise. */
+static uint8_t sim_fint_stat(const dw3000_sim_t *sim)
+{
+    uint32_t events = (uint32_t)(reg_get(sim, SYS_STATUS_ID, 4U) & reg_get(sim, SYS_ENABLE_LO_ID, 4U));
+    uint8_t fint = 0U;
+
+    fint |= ((events & STATUS_TX_DONE) != 0U) ? FINT_STAT_TXOK_BIT_MASK : 0U;
+    fint |= ((events & (SYS_STATUS_RXFCG_BIT_MASK | SYS_STATUS_RXFR_BIT_MASK | SYS_STATUS_CIADONE_BIT_MASK)) != 0U) ? FINT_STAT_RXOK_BIT_MASK : 0U;
+    fint |= ((events & SYS_STATUS_CIAERR_BIT_MASK) != 0U) ? FINT_STAT_RXTSERR_BIT_MASK : 0U;
+    fint |= ((events & (SYS_STATUS_RXPHE_BIT_MASK | SYS_STATUS_RXFCE_BIT_MASK | SYS_STATUS_RXFSL_BIT_MASK | SYS_STATUS_RXSTO_BIT_MASK
+                        | SYS_STATUS_ARFE_BIT_MASK)) != 0U) ? FINT_STAT_RXERR_BIT_MASK : 0U;
+    fint |= ((events & (SYS_STATUS_RXFTO_BIT_MASK | SYS_STATUS_RXPTO_BIT_MASK | SYS_STATUS_CPERR_BIT_MASK)) != 0U) ? FINT_STAT_RXTO_BIT_MASK : 0U;
+    fint |= ((events & (SYS_STATUS_RCINIT_BIT_MASK | SYS_STATUS_SPIRDY_BIT_MASK)) != 0U) ? FINT_STAT_SYS_EVENT_BIT_MASK : 0U;
+    return fint;
+}
+
+/* Time of the next TX/RX event, UINT64_MAX if none */
+static uint64_t sim_next_event(const dw3000_sim_t *sim)
+{
+    switch (sim->state)
+    {
+    case DW3000_SIM_TX_DELAYED:
+        return sim->tx_start;
+    case DW3000_SIM_TX:
+        return sim->tx_end;
+    case DW3000_SIM_RX_DELAYED:
+        return sim->rx_start;
+    case DW3000_SIM_RX:
+        if (sim->rx_pending)
+        {
+            return sim->rx_end;
+        }
+        return sim_rx_timeout(sim);
+    default:
+        return UINT64_MAX;
+    }
+}
+
+static void sim_run_event(dw3000_sim_t *sim)
+{
+    sim->status_polls = 0U;
+    switch (sim->state)
+    {
+    case DW3000_SIM_TX_DELAYED:
+        sim_tx_start(sim);
+        break;
+    case DW3000_SIM_TX:
+        sim_tx_done(sim);
+        break;
+    case DW3000_SIM_RX_DELAYED:
+        sim->state = DW3000_SIM_RX;
+        break;
+    case DW3000_SIM_RX:
+        if (sim->rx_pending)
+        {
+            sim_rx_done(sim);
+        }
+        else
+        {
+            status_set(sim, (sim->now == sim->rx_pto) ? SYS_STATUS_RXPTO_BIT_MASK : SYS_STATUS_RXFTO_BIT_MASK);
+            sim->state = DW3000_SIM_IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+uint64_t dw3000_sim_next_event(const dw3000_sim_t *sim)
+{
+    uint64_t next = sim_next_event(sim);
+
+    return ((sim->alarm != 0U) && (sim->alarm < next)) ? sim->alarm : next;
+}
+
+void dw3000_sim_advance(dw3000_sim_t *sim, uint64_t dtu)
+{
+    uint64_t target = sim->now + dtu;
+    uint64_t next;
+
+    while ((next = dw3000_sim_next_event(sim)) <= target)
+    {
+        if (next > sim->now)
+        {
+            sim->now = next;
+        }
+        if ((sim->alarm != 0U) && (sim->alarm <= next))
+        {
+            /* external events first, a frame arriving now is seen before a timeout due now */
+            sim->alarm = 0U;
+            sim->status_polls = 0U;
+            if (sim->alarm_cb != NULL)
+            {
+                sim->alarm_cb(sim, sim->alarm_ctx);
+            }
+        }
+        else
+        {
+            sim_run_event(sim);
+        }
+    }
+    if (target > sim->now)
+    {
+        sim->now = target;
+    }
+}
+
+bool dw3000_sim_wait_irq(dw3000_sim_t *sim, uint64_t until)
+{
+    if (sim->wait_cb != NULL)
+    {
+        sim->wait_cb(sim, until, sim->wait_ctx);
+        return true;
+    }
+    while (!dw3000_sim_irq(sim) && (sim->now < until))
+    {
+        uint64_t next = dw3000_sim_next_event(sim);
+
+        if ((next == UINT64_MAX) && (until == UINT64_MAX))
+        {
+            return false;
+        }
+        next = (next < until) ? next : until;
+        dw3000_sim_advance(sim, (next > sim->now) ? (next - sim->now) : 0U);
+    }
+    return true;
+}
+
+bool dw3000_sim_irq(const dw3000_sim_t *sim)
+{
+    return sim_fint_stat(sim) != 0U;
+}
+
+void dw3000_sim_delay(dw3000_sim_t *sim, uint64_t dtu)
+{
+    if (sim->delay_cb != NULL)
+    {
+        sim->delay_cb(sim, dtu, sim->delay_ctx);
+    }
+    else
+    {
+        dw3000_sim_advance(sim, dtu);
+    }
+}
+
+/****************************************************************************
+ *
+ *                              Commands and register side effects
+ *
+ *******************************************************************************/
+
+static void sim_fast_cmd(dw3000_sim_t *sim, uint8_t cmd)
+{
+    uint64_t rx_stamp = reg_get(sim, RX_TIME_0_ID, 5U);
+    uint64_t tx_stamp = reg_get(sim, TX_TIME_LO_ID, 5U);
+    uint64_t ref = reg_get(sim, DREF_TIME_ID, 4U) << 8U;
+    uint64_t when;
+    uint64_t shr;
+
+    switch (cmd)
+    {
+    case CMD_TXRXOFF:
+        sim->state = DW3000_SIM_IDLE;
+        sim->rx_pending = false;
+        status_clear(sim, STATUS_TX_DONE | STATUS_RX_ALL | SYS_STATUS_HPDWARN_BIT_MASK);
+        break;
+    case CMD_TX:
+    case CMD_CCA_TX:
+    case CMD_TX_W4R:
+    case CMD_CCA_TX_W4R:
+        (void)dw3000_sim_frame_duration(sim, 0U, &shr);
+        when = sim->now + TX_LATENCY_DTU + shr;
+        when = (when + TX_RMARKER_ALIGN - 1U) & ~(uint64_t)(TX_RMARKER_ALIGN - 1U);
+        sim_tx_arm(sim, when, (cmd == CMD_TX_W4R) || (cmd == CMD_CCA_TX_W4R));
+        break;
+    case CMD_DTX:
+    case CMD_DTX_W4R:
+    case CMD_DTX_TS:
+    case CMD_DTX_TS_W4R:
+    case CMD_DTX_RS:
+    case CMD_DTX_RS_W4R:
+    case CMD_DTX_REF:
+    case CMD_DTX_REF_W4R:
+    {
+        uint64_t base = ((cmd == CMD_DTX_TS) || (cmd == CMD_DTX_TS_W4R)) ? tx_stamp
+                        : ((cmd == CMD_DTX_RS) || (cmd == CMD_DTX_RS_W4R)) ? rx_stamp
+                        : ((cmd == CMD_DTX_REF) || (cmd == CMD_DTX_REF_W4R)) ? ref : 0U;
+        if (sim_delayed_time(sim, base, &when))
+        {
+            (void)dw3000_sim_frame_duration(sim, 0U, &shr);
+            if ((when - sim->now) < (shr + TX_LATENCY_DTU))
+            {
+                /* too close to start the preamble in time */
+                status_set(sim, SYS_STATUS_HPDWARN_BIT_MASK);
+            }
+            else
+            {
+                sim_tx_arm(sim, when, (cmd == CMD_DTX_W4R) || (cmd == CMD_DTX_TS_W4R) || (cmd == CMD_DTX_RS_W4R) || (cmd == CMD_DTX_REF_W4R));
+            }
+        }
+        break;
+    }
+    case CMD_RX:
+        if ((sim->state == DW3000_SIM_TX) || (sim->state == DW3000_SIM_TX_DELAYED))
+        {
+            /* the transmission is not cut short, the receiver comes on once the frame is out */
+            sim->w4r = true;
+        }
+        else
+        {
+            sim_rx_on(sim, sim->now);
+        }
+        break;
+    case CMD_DRX:
+    case CMD_DRX_TS:
+    case CMD_DRX_RS:
+    case CMD_DRX_REF:
+    {
+        uint64_t base = (cmd == CMD_DRX_TS) ? tx_stamp : (cmd == CMD_DRX_RS) ? rx_stamp : (cmd == CMD_DRX_REF) ? ref : 0U;
+        if (sim_delayed_time(sim, base, &when))
+        {
+            sim_rx_on(sim, when);
+        }
+        break;
+    }
+    case CMD_CLR_IRQS:
+        reg_put(sim, SYS_STATUS_ID, 0U, 4U);
+        reg_put(sim, SYS_STATUS_HI_ID, 0U, 2U);
+        break;
+    default:
+        break;
+    }
+}
+
+static void sim_write(dw3000_sim_t *sim, uint8_t file, uint16_t offset, const uint8_t *data, uint16_t length)
+{
+    uint16_t size;
+    uint8_t *mem = sim_mem(sim, file, &size);
+
+    for (uint16_t i = 0U; i < length; i++)
+    {
+        uint16_t at = (uint16_t)(offset + i);
+
+        if (at >= size)
+        {
+            break;
+        }
+        if ((file == 0U) && (at >= REG_OFFSET(SYS_STATUS_ID)) && (at < (REG_OFFSET(SYS_STATUS_HI_ID) + 4U)))
+        {
+            mem[at] &= (uint8_t)~data[i];   // event bits are write-1-to-clear
+        }
+        else if (touches(file, at, 1U, RX_CAL_STS_ID, 1U))
+        {
+            mem[at] &= (uint8_t)~data[i];
+        }
+        else
+        {
+            mem[at] = data[i];
+        }
+    }
+
+    if (touches(file, offset, length, OTP_CFG_ID, 2U) && ((reg_get(sim, OTP_CFG_ID, 2U) & OTP_CFG_OTP_READ_BIT_MASK) != 0U))
+    {
+        uint16_t address = (uint16_t)(reg_get(sim, OTP_ADDR_ID, 2U) & (DW3000_SIM_OTP_LEN - 1U));
+        reg_put(sim, OTP_RDATA_ID, sim->otp[address], 4U);
+    }
+    if (touches(file, offset, length, RX_CAL_CFG_ID, 1U) && ((reg_get(sim, RX_CAL_CFG_ID, 1U) & RX_CAL_CFG_CAL_EN_BIT_MASK) != 0U))
+    {
+        reg_put(sim, RX_CAL_STS_ID, 1U, 1U);
+    }
+    if (touches(file, offset, length, PLL_CAL_ID, 4U))
+    {
+        status_set(sim, SYS_STATUS_CP_LOCK_BIT_MASK);
+    }
+}
+
+static void sim_read(dw3000_sim_t *sim, uint8_t file, uint16_t offset, uint8_t *data, uint16_t length)
+{
+    uint16_t size;
+    uint8_t *mem;
+    uint8_t state;
+
+    reg_put(sim, SYS_TIME_ID, (sim->now & DW3000_SIM_TIME_MASK) >> 8U, 4U);
+    reg_put(sim, FINT_STAT_ID, sim_fint_stat(sim), 1U);
+    state = (sim->state == DW3000_SIM_TX) ? SYS_STATE_TX : (sim->state == DW3000_SIM_RX) ? SYS_STATE_RX : (uint8_t)DW_SYS_STATE_IDLE;
+    reg_put(sim, SYS_STATE_LO_ID + 2U, state, 1U);
+
+    mem = sim_mem(sim, file, &size);
+    for (uint16_t i = 0U; i < length; i++)
+    {
+        data[i] = ((offset + i) < size) ? mem[offset + i] : 0U;
+    }
+}
+
+/* Decodes one SPI frame: header[0] = R/W, EAM, register file, FAC; header[1] = offset and AND/OR mode */
+static void sim_transaction(dw3000_sim_t *sim, const uint8_t *header, uint16_t headerLength, uint8_t *data, uint16_t length, bool write)
+{
+    uint8_t file = (uint8_t)((header[0] >> 1U) & 0x1FU);
+    uint16_t offset = 0U;
+    uint8_t mode = 0U;
+
+    if ((headerLength == 1U) && ((header[0] & 0x41U) == 0x01U))
+    {
+        sim_fast_cmd(sim, file);
+    }
+    else
+    {
+        if (headerLength >= 2U)
+        {
+            offset = (uint16_t)(((header[0] & 0x01U) << 6U) | (header[1] >> 2U));
+            mode = header[1] & 0x03U;
+        }
+
+        if (!write)
+        {
+            sim_read(sim, file, offset, data, length);
+        }
+        else if (mode == 0U)
+        {
+            sim_write(sim, file, offset, data, length);
+        }
+        else
+        {
+            /* AND/OR: body is the AND mask followed by the OR mask, 1, 2 or 4 bytes each */
+            uint8_t width = (uint8_t)(1U << (mode - 1U));
+            uint8_t value[4];
+
+            if (length >= (2U * width))
+            {
+                sim_read(sim, file, offset, value, width);
+                for (uint8_t i = 0U; i < width; i++)
+                {
+                    value[i] = (uint8_t)((value[i] & data[i]) | data[width + i]);
+                }
+                sim_write(sim, file, offset, value, width);
+            }
+        }
+    }
+
+    /* a plain SYS_STATUS read is how the host waits for an event */
+    if (!write && (headerLength == 2U) && (mode == 0U) && (file == REG_FILE(SYS_STATUS_ID)) && (offset >= REG_OFFSET(SYS_STATUS_ID))
+        && ((offset + length) <= (REG_OFFSET(SYS_STATUS_HI_ID) + 4U)))
+    {
+        sim->status_polls++;
+    }
+    else
+    {
+        sim->status_polls = 0U;
+    }
+
+    /* bus time of the transaction */
+    sim->spi_transactions++;
+    sim->spi_bytes += (uint32_t)headerLength + length;
+    dw3000_sim_advance(sim, ((uint64_t)(headerLength + length) * 8U * DW3000_SIM_DTU_PER_SEC) / sim->spi_hz + DW3000_SIM_SPI_CS_DTU);
+
+    if (sim->access_cb != NULL)
+    {
+        sim->access_cb(sim, sim->access_ctx);
+    }
+}
+
+/****************************************************************************
+ *
+ *                              struct dwt_spi_s
+ *
+ *******************************************************************************/
+
+static int32_t sim_readfromspi(uint16_t headerLength, uint8_t *headerBuffer, uint16_t readlength, uint8_t *readBuffer)
+{
+    if (selected == NULL)
+    {
+        memset(readBuffer, 0, readlength);
+        return (int32_t)DWT_ERROR;
+    }
+    sim_transaction(selected, headerBuffer, headerLength, readBuffer, readlength, false);
+    return (int32_t)DWT_SUCCESS;
+}
+
+static int32_t sim_writetospi(uint16_t headerLength, const uint8_t *headerBuffer, uint16_t bodyLength, const uint8_t *bodyBuffer)
+{
+    if (selected == NULL)
+    {
+        return (int32_t)DWT_ERROR;
+    }
+    sim_transaction(selected, headerBuffer, headerLength, (uint8_t *)bodyBuffer, bodyLength, true);
+    return (int32_t)DWT_SUCCESS;
+}
+
+static int32_t sim_writetospiwithcrc(uint16_t headerLength, const uint8_t *headerBuffer, uint16_t bodyLength, const uint8_t *bodyBuffer, uint8_t crc8)
+{
+    (void)crc8;
+    return sim_writetospi(headerLength, headerBuffer, bodyLength, bodyBuffer);
+}
+
+static int32_t sim_readfromspichain(uint8_t count, const struct dwt_spi_rd_s *chain)
+{
+    for (uint8_t i = 0U; i < count; i++)
+    {
+        if (sim_readfromspi(chain[i].headerLength, (uint8_t *)chain[i].header, chain[i].readlength, chain[i].readBuffer) != (int32_t)DWT_SUCCESS)
+        {
+            return (int32_t)DWT_ERROR;
+        }
+    }
+    return (int32_t)DWT_SUCCESS;
+}
+
+static void sim_setslowrate(void)
+{
+    if (selected != NULL)
+    {
+        selected->spi_hz = DW3000_SIM_SPI_SLOW_HZ;
+    }
+}
+
+static void sim_setfastrate(void)
+{
+    if (selected != NULL)
+    {
+        selected->spi_hz = DW3000_SIM_SPI_FAST_HZ;
+    }
+}
+
+const struct dwt_spi_s dw3000_sim_spi = {
+    .readfromspi = sim_readfromspi,
+    .writetospi = sim_writetospi,
+    .writetospiwithcrc = sim_writetospiwithcrc,
+    .setslowrate = sim_setslowrate,
+    .setfastrate = sim_setfastrate,
+    .readfromspichain = sim_readfromspichain
+};
+
+/****************************************************************************
+ *
+ *                              Public functions
+ *
+ *******************************************************************************/
+
+static void sim_reset_regs(dw3000_sim_t *sim)
+{
+    memset(sim->regs, 0, sizeof(sim->regs));
+    memset(sim->tx_buffer, 0, sizeof(sim->tx_buffer));
+    memset(sim->rx_buffer, 0, sizeof(sim->rx_buffer));
+
+    reg_put(sim, DEV_ID_ID, (uint32_t)DWT_DW3000_PDOA_DEV_ID, 4U);
+    reg_put(sim, SYS_STATUS_ID, SYS_STATUS_RCINIT_BIT_MASK | SYS_STATUS_SPIRDY_BIT_MASK | SYS_STATUS_CP_LOCK_BIT_MASK, 4U);
+    reg_put(sim, TX_FCTRL_ID, 0x0000000CUL, 4U);
+    reg_put(sim, CHAN_CTRL_ID, (9UL << CHAN_CTRL_TX_PCODE_BIT_OFFSET) | (9UL << 8U), 4U);
+
+    sim->state = DW3000_SIM_IDLE;
+    sim->rx_pending = false;
+    sim->spi_hz = DW3000_SIM_SPI_SLOW_HZ;
+}
+
+void dw3000_sim_init(dw3000_sim_t *sim)
+{
+    dw3000_sim_tx_cb_t tx_cb = sim->tx_cb;
+    void *tx_ctx = sim->tx_ctx;
+    dw3000_sim_access_cb_t access_cb = sim->access_cb;
+    void *access_ctx = sim->access_ctx;
+    dw3000_sim_alarm_cb_t alarm_cb = sim->alarm_cb;
+    void *alarm_ctx = sim->alarm_ctx;
+    dw3000_sim_delay_cb_t delay_cb = sim->delay_cb;
+    void *delay_ctx = sim->delay_ctx;
+    dw3000_sim_wait_cb_t wait_cb = sim->wait_cb;
+    void *wait_ctx = sim->wait_ctx;
+    uint32_t otp[DW3000_SIM_OTP_LEN];
+
+    memcpy(otp, sim->otp, sizeof(otp));
+    memset(sim, 0, sizeof(*sim));
+    memcpy(sim->otp, otp, sizeof(otp));
+    sim->tx_cb = tx_cb;
+    sim->tx_ctx = tx_ctx;
+    sim->access_cb = access_cb;
+    sim->access_ctx = access_ctx;
+    sim->alarm_cb = alarm_cb;
+    sim->alarm_ctx = alarm_ctx;
+    sim->delay_cb = delay_cb;
+    sim->delay_ctx = delay_ctx;
+    sim->wait_cb = wait_cb;
+    sim->wait_ctx = wait_ctx;
+
+    sim->tx_ant_dly = DW3000_SIM_ANT_DLY_DEF;
+    sim->rx_ant_dly = DW3000_SIM_ANT_DLY_DEF;
+    sim_reset_regs(sim);
+}
+
+void dw3000_sim_reset(dw3000_sim_t *sim)
+{
+    sim_reset_regs(sim);
+}
+
+dw3000_sim_t *dw3000_sim_select(dw3000_sim_t *sim)
+{
+    dw3000_sim_t *old = selected;
+    selected = sim;
+    return old;
+}
+
+dw3000_sim_t *dw3000_sim_selected(void)
+{
+    return selected;
+}
+
+bool dw3000_sim_deliver(dw3000_sim_t *sim, const uint8_t *frame, uint16_t length, uint64_t rmarker, int16_t clock_offset)
+{
+    uint64_t shr;
+    uint64_t duration = dw3000_sim_frame_duration(sim, length, &shr);
+    uint64_t frame_start = rmarker - shr;
+    bool listening = ((sim->state == DW3000_SIM_RX) || (sim->state == DW3000_SIM_RX_DELAYED)) && !sim->rx_pending;
+
+    if (!listening || (length > DW3000_SIM_BUFFER_LEN) || (frame_start < sim->rx_start)
+        || (frame_start >= sim_rx_timeout(sim)))
+    {
+        sim->frames_missed++;
+        return false;
+    }
+
+    memcpy(sim->rx_frame, frame, length);
+    sim->rx_length = length;
+    sim->rx_rmarker = rmarker + sim->rx_ant_dly;
+    sim->rx_end = frame_start + duration;
+    sim->rx_clock_offset = clock_offset;
+    sim->rx_pending = true;
+    sim->status_polls = 0U;
+
+    /* catch up if the frame is already complete */
+    dw3000_sim_advance(sim, 0U);
+    return true;
+}
+
+void dw3000_sim_set_ids(dw3000_sim_t *sim, uint32_t part_id, uint64_t lot_id)
+{
+    sim->otp[OTP_PARTID_ADDRESS] = part_id;
+    sim->otp[OTP_LOTID_LO_ADDRESS] = (uint32_t)lot_id;
+    sim->otp[OTP_LOTID_HI_ADDRESS] = (uint32_t)(lot_id >> 32U);
+}
+
+void dw3000_sim_set_ids_for_hash(dw3000_sim_t *sim, uint32_t hash, uint64_t lot_id)
+{
+    /* FNV-1a steps are invertible: h' = (h ^ b) * P, so h = (h' * P^-1) ^ b */
+    uint32_t inv = FNV_PRIME;
+    for (uint8_t i = 0U; i < 5U; i++)
+    {
+        inv *= 2UL - FNV_PRIME * inv;
+    }
+
+    for (;; lot_id++)
+    {
+        uint32_t state = hash;
+        uint32_t want;
+
+        for (int8_t i = 7; i >= 0; i--)
+        {
+            state = (state * inv) ^ (uint8_t)(lot_id >> (8U * (uint8_t)i));
+        }
+        /* state is what the hash must be after the 4 part ID bytes; the last byte only reaches the low 8 bits,
+         * so search the first three for a match in the upper 24 */
+        want = state * inv;
+        for (uint32_t b = 0U; b < 0x1000000UL; b++)
+        {
+            uint32_t h = 0x811c9dc5UL;
+            h = (h ^ (b & 0xFFU)) * FNV_PRIME;
+            h = (h ^ ((b >> 8U) & 0xFFU)) * FNV_PRIME;
+            h = (h ^ (b >> 16U)) * FNV_PRIME;
+            if (((h ^ want) & 0xFFFFFF00UL) == 0U)
+            {
+                dw3000_sim_set_ids(sim, b | (((h ^ want) & 0xFFUL) << 24U), lot_id);
+                return;
+            }
+        }
+    }
+}
+
+uint32_t dw3000_sim_status(const dw3000_sim_t *sim)
+{
+    return (uint32_t)reg_get(sim, SYS_STATUS_ID, 4U);
+}
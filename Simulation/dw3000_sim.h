@@ -0,0 +1,288 @@
+/*! ----------------------------------------------------------------------------
+ * @file    dw3000_sim.h
+ * @brief   Host side register level model of the DW3000, plugged into the driver through struct dwt_spi_s
+ *
+ * The model decodes the SPI headers produced by dwt_xfer3xxx (fast commands, FACRW, EAMRW and the AND/OR
+ * modes) and keeps enough device state for the driver and the application protocol code to run unmodified
+ * on a PC: register files, TX and RX buffers, OTP, SYS_STATUS, the system time counter, immediate and
+ * delayed TX/RX, RX frame wait timeout, TX/RX timestamps and the IRQ line (SYS_STATUS events enabled in SYS_ENABLE).
+ *
+ * Time is virtual. Every SPI transaction advances the local clock by its bus time, deca_sleep()/deca_usleep()
+ * advance it by the requested delay (or hand it to the delay callback), and dw3000_sim_advance() lets a test or a
+ * network model move it forward. Nothing is radiated: a transmitted frame is handed to the tx callback and frames
+ * reach the receiver through dw3000_sim_deliver().
+ */
+
+#ifndef DW3000_SIM_H_
+#define DW3000_SIM_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <deca_interface.h>
+
+#define DW3000_SIM_REG_FILES      (32U)
+#define DW3000_SIM_REG_FILE_LEN   (128U)     // bytes reachable in a register file through direct addressing
+#define DW3000_SIM_BUFFER_LEN     (1024U)    // TX and RX buffer size
+#define DW3000_SIM_OTP_LEN        (128U)     // 32-bit OTP words
+
+#define DW3000_SIM_DTU_PER_SEC    (63897600000ULL)   // device time units (499.2 MHz * 128) per second
+#define DW3000_SIM_DTU_PER_US     (63898ULL)         // rounded, used for host delays only
+#define DW3000_SIM_DTU_PER_UUS    (65536ULL)         // one "UWB microsecond" (512 / 499.2 MHz)
+#define DW3000_SIM_TIME_MASK      (0xFFFFFFFFFFULL)  // the device counters are 40 bits wide
+
+#define DW3000_SIM_SPI_SLOW_HZ    (4500000UL)        // SPI1 slow rate, 72 MHz / 16
+#define DW3000_SIM_SPI_FAST_HZ    (36000000UL)       // SPI1 fast rate, 72 MHz / 2
+#define DW3000_SIM_SPI_CS_DTU     (DW3000_SIM_DTU_PER_US / 2U)  // chip select and HAL overhead per transaction
+
+#define DW3000_SIM_ANT_DLY_DEF    (16385U)           // true antenna delay, per direction, in DTU
+
+typedef enum
+{
+    DW3000_SIM_IDLE = 0,
+    DW3000_SIM_TX_DELAYED,      // delayed TX armed, waiting for the start of the preamble
+    DW3000_SIM_TX,              // transmitting
+    DW3000_SIM_RX_DELAYED,      // delayed RX armed
+    DW3000_SIM_RX               // receiver on
+} dw3000_sim_state_e;
+
+struct dw3000_sim_s;
+
+/* Called when a frame starts to go out on air. rmarker is the local time at which the RMARKER leaves the antenna,
+ * duration is the time on air of the whole frame (preamble included). */
+typedef void (*dw3000_sim_tx_cb_t)(struct dw3000_sim_s *sim, const uint8_t *frame, uint16_t length, uint64_t rmarker,
+                                   uint64_t duration, void *ctx);
+
+/* Called after every SPI transaction, once the local clock has moved by the bus time of that transaction.
+ * A network model uses this to interleave nodes and to deliver frames in time order. */
+typedef void (*dw3000_sim_access_cb_t)(struct dw3000_sim_s *sim, void *ctx);
+
+/* Called when the local clock reaches the alarm time set in dw3000_sim_t.alarm. The alarm is cleared before the call. */
+typedef void (*dw3000_sim_alarm_cb_t)(struct dw3000_sim_s *sim, void *ctx);
+
+/* Called instead of advancing the clock when the host sleeps (deca_sleep, deca_usleep, vTaskDelay), see dw3000_sim_delay() */
+typedef void (*dw3000_sim_delay_cb_t)(struct dw3000_sim_s *sim, uint64_t dtu, void *ctx);
+
+/* Called instead of advancing the clock when the host blocks until the IRQ line rises, see dw3000_sim_wait_irq() */
+typedef void (*dw3000_sim_wait_cb_t)(struct dw3000_sim_s *sim, uint64_t until, void *ctx);
+
+typedef struct dw3000_sim_s
+{
+    uint64_t now;                                   // local system time in DTU, not wrapped
+    dw3000_sim_state_e state;
+
+    uint8_t regs[DW3000_SIM_REG_FILES][DW3000_SIM_REG_FILE_LEN];
+    uint8_t tx_buffer[DW3000_SIM_BUFFER_LEN];
+    uint8_t rx_buffer[2][DW3000_SIM_BUFFER_LEN];    // RX_BUFFER_0 and RX_BUFFER_1
+    uint32_t otp[DW3000_SIM_OTP_LEN];
+
+    /* transmitter */
+    uint64_t tx_start;                              // start of preamble
+    uint64_t tx_rmarker;                            // digital RMARKER (without antenna delay)
+    uint64_t tx_end;                                // end of the frame, TXFRS time
+    bool w4r;                                       // turn the receiver on after TX
+
+    /* receiver */
+    uint64_t rx_start;                              // receiver on (or armed) time
+    uint64_t rx_deadline;                           // frame wait timeout, 0 if disabled
+    uint64_t rx_pto;                                // preamble detection timeout, 0 if disabled
+    bool rx_pending;                                // a frame is being received
+    uint64_t rx_end;                                // end of the frame being received
+    uint64_t rx_rmarker;                            // raw RX RMARKER of the frame being received
+    int16_t rx_clock_offset;                        // CIA_DIAG_0 value for the frame being received
+    uint16_t rx_length;
+    uint8_t rx_frame[DW3000_SIM_BUFFER_LEN];
+
+    /* physical properties */
+    uint16_t tx_ant_dly;                            // true TX antenna delay in DTU
+    uint16_t rx_ant_dly;                            // true RX antenna delay in DTU
+    uint32_t spi_hz;                                // current SPI clock, sets the bus time of each transaction
+    double rx_fp_loss_db;                           // first path attenuation of received frames, 0 line of sight
+    double rx_peak_delay;                           // CIR samples from the first path to the peak, 0 follows rx_fp_loss_db
+
+    /* counters */
+    uint32_t spi_transactions;
+    uint32_t spi_bytes;
+    uint32_t frames_sent;
+    uint32_t frames_received;
+    uint32_t frames_missed;                         // delivered while the receiver was off
+    uint32_t frames_rejected;                       // dropped by the frame filter
+    uint32_t status_polls;                          // back to back SYS_STATUS reads with no event in between
+
+    uint64_t alarm;                                 // local time of the next external event, 0 if none
+
+    dw3000_sim_tx_cb_t tx_cb;
+    void *tx_ctx;
+    dw3000_sim_access_cb_t access_cb;
+    void *access_ctx;
+    dw3000_sim_alarm_cb_t alarm_cb;
+    void *alarm_ctx;
+    dw3000_sim_delay_cb_t delay_cb;
+    void *delay_ctx;
+    dw3000_sim_wait_cb_t wait_cb;
+    void *wait_ctx;
+} dw3000_sim_t;
+
+/* SPI functions for the driver, acting on the device selected by dw3000_sim_select() */
+extern const struct dwt_spi_s dw3000_sim_spi;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_init()
+ *
+ * @brief Clears the model and puts it through a power on reset. Callbacks and OTP contents are kept.
+ *
+ * @param sim - model instance
+ *
+ * @return none
+ */
+void dw3000_sim_init(dw3000_sim_t *sim);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_reset()
+ *
+ * @brief Emulates a pulse on RSTn: registers return to their reset values, the local clock keeps running.
+ *
+ * @param sim - model instance
+ *
+ * @return none
+ */
+void dw3000_sim_reset(dw3000_sim_t *sim);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_select()
+ *
+ * @brief Selects the device that dw3000_sim_spi and the host port functions talk to.
+ *
+ * @param sim - model instance, NULL to deselect
+ *
+ * @return the previously selected device
+ */
+dw3000_sim_t *dw3000_sim_select(dw3000_sim_t *sim);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_selected()
+ *
+ * @brief Returns the device selected by dw3000_sim_select().
+ */
+dw3000_sim_t *dw3000_sim_selected(void);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_advance()
+ *
+ * @brief Moves the local clock forward and runs any TX/RX event that falls due.
+ *
+ * @param sim - model instance
+ * @param dtu - time step in device time units
+ *
+ * @return none
+ */
+void dw3000_sim_advance(dw3000_sim_t *sim, uint64_t dtu);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_delay()
+ *
+ * @brief Host delay: hands the delay to the delay callback if one is set, otherwise advances the clock.
+ *
+ * @param sim - model instance
+ * @param dtu - delay in device time units
+ *
+ * @return none
+ */
+void dw3000_sim_delay(dw3000_sim_t *sim, uint64_t dtu);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_wait_irq()
+ *
+ * @brief Host blocked on the DW IC interrupt: hands the wait to the wait callback if one is set, otherwise advances
+ *        the clock event by event until the IRQ line is high or the local time reaches until.
+ *
+ * @param sim   - model instance
+ * @param until - local time at which the host gives up, UINT64_MAX to wait without limit
+ *
+ * @return false if nothing is pending that could ever raise the line, the wait would not end
+ */
+bool dw3000_sim_wait_irq(dw3000_sim_t *sim, uint64_t until);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_irq()
+ *
+ * @brief State of the IRQ line: high while any SYS_STATUS event enabled in SYS_ENABLE is set.
+ */
+bool dw3000_sim_irq(const dw3000_sim_t *sim);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_next_event()
+ *
+ * @brief Local time of the next TX/RX event or alarm, UINT64_MAX if there is none. While the host only polls
+ *        SYS_STATUS (see status_polls) nothing it can observe changes before this time.
+ */
+uint64_t dw3000_sim_next_event(const dw3000_sim_t *sim);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_deliver()
+ *
+ * @brief Hands a frame to the receiver. The frame is accepted only if the receiver is on at the start of its
+ *        preamble and the frame wait timeout has not expired; it shows up in SYS_STATUS once its last byte is in.
+ *
+ * @param sim          - model instance
+ * @param frame        - frame bytes including the two FCS bytes
+ * @param length       - frame length including FCS
+ * @param rmarker      - local time at which the RMARKER reaches the antenna
+ * @param clock_offset - value reported through CIA_DIAG_0 (remote vs local clock, in 2^-26 units)
+ *
+ * @return true if the receiver took the frame
+ */
+bool dw3000_sim_deliver(dw3000_sim_t *sim, const uint8_t *frame, uint16_t length, uint64_t rmarker, int16_t clock_offset);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_frame_duration()
+ *
+ * @brief Time on air of a frame with the current TX configuration.
+ *
+ * @param sim    - model instance
+ * @param length - frame length including FCS
+ * @param shr    - if not NULL, receives the preamble + SFD part of the duration (start of frame to RMARKER)
+ *
+ * @return the frame duration in DTU
+ */
+uint64_t dw3000_sim_frame_duration(const dw3000_sim_t *sim, uint16_t length, uint64_t *shr);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_set_ids()
+ *
+ * @brief Programs part and lot ID into OTP.
+ */
+void dw3000_sim_set_ids(dw3000_sim_t *sim, uint32_t part_id, uint64_t lot_id);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_set_ids_for_hash()
+ *
+ * @brief Programs OTP IDs so that the FNV-1a hash of part ID and lot ID (the deviceHash uwb_device_init() uses to
+ *        pick its deviceTable entry) equals the requested value. The lot ID is chosen freely, the part ID is
+ *        solved for.
+ *
+ * @param sim    - model instance
+ * @param hash   - requested device hash
+ * @param lot_id - lot ID to program
+ *
+ * @return none
+ */
+void dw3000_sim_set_ids_for_hash(dw3000_sim_t *sim, uint32_t hash, uint64_t lot_id);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dw3000_sim_status()
+ *
+ * @brief Returns the low 32 bits of SYS_STATUS without going through SPI.
+ */
+uint32_t dw3000_sim_status(const dw3000_sim_t *sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DW3000_SIM_H_ */
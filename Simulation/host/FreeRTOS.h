@@ -0,0 +1,34 @@
+/*! ----------------------------------------------------------------------------
+ * @file    FreeRTOS.h
+ * @brief   Host stand-in for the FreeRTOS header, only the parts the application code uses
+ *
+ * The tick rate matches Core/Inc/FreeRTOSConfig.h. vTaskDelay() and the queue functions are implemented in
+ * sim_port.c on top of the virtual clock.
+ */
+
+#ifndef SIM_FREERTOS_H_
+#define SIM_FREERTOS_H_
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE                   ((BaseType_t)0)
+#define pdTRUE                    ((BaseType_t)1)
+#define pdPASS                    (pdTRUE)
+#define pdFAIL                    (pdFALSE)
+#define errQUEUE_EMPTY            ((BaseType_t)0)
+#define errQUEUE_FULL             ((BaseType_t)0)
+
+#define portMAX_DELAY             ((TickType_t)0xFFFFFFFFUL)
+#define portYIELD_FROM_ISR(x)     ((void)(x))
+
+/* The DW IC interrupt is serviced from the waiting task, as with DECA_IRQ_DEFERRED on the target */
+#define xPortIsInsideInterrupt()  (pdFALSE)
+
+#define configTICK_RATE_HZ        ((TickType_t)1000)
+#define pdMS_TO_TICKS(xTimeInMs)  ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#endif /* SIM_FREERTOS_H_ */
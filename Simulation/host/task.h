@@ -0,0 +1,23 @@
+/*! ----------------------------------------------------------------------------
+ * @file    task.h
+ * @brief   Host stand-in for the FreeRTOS task API, see host/FreeRTOS.h
+ */
+
+#ifndef SIM_TASK_H_
+#define SIM_TASK_H_
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void vTaskDelay(const TickType_t xTicksToDelay);
+TickType_t xTaskGetTickCount(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_TASK_H_ */
@@ -0,0 +1,281 @@
+/*! ----------------------------------------------------------------------------
+ * @file    multilat_bench.c
+ * @brief   Solve time and accuracy of multilat_wls() in the precision it was built with
+ *
+ * Built twice, multilat_bench with position_real_t as double and multilat_bench_float with
+ * POSITION_SINGLE_PRECISION. Each runs the same seeded fixes with 4, 8 and 12 anchors and prints the time per
+ * fix and the error against the true position, with noisy ranges and with exact ones (the numerical floor),
+ * plus the time of the linear fix from the cached anchor geometry (multilat_geometry_solve()) in comparison.
+ * Last the tag tracker follows a tag walking a circle, one range per update round robin over 4 anchors,
+ * with its time per range and its error.
+ * Host time says little about the Cortex-M4F, where double is emulated in software: run the float
+ * build on target for the cycles per fix. It fails when the numerical floor is above 1 mm or the tracked
+ * position is no closer than a single range.
+ *
+ * $ multilat_bench -n 20000 -s 0.05
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "multilateration.h"
+#include "tag_tracker.h"
+
+#define FIXES_MAX       (1024U)
+#define FLOOR_LIMIT_M   (0.001)
+/* Tracked tag: ranges per second, walking speed on a 3 m radius circle, and the tracker's noise model */
+#define TRACK_RATE_HZ   (400.0)
+#define TRACK_SPEED_MS  (1.4)
+#define TRACK_RADIUS_M  (3.0)
+#define TRACK_ACCEL_PSD (1.0)
+#define TRACK_GATE      (4.0)
+
+/* Ceiling and wall anchors of a 10 x 8 x 3 m room */
+static const double room[12][3] = {
+    { 0.0, 0.0, 2.8 }, { 10.0, 0.0, 2.5 }, { 10.0, 8.0, 2.9 }, { 0.0, 8.0, 0.4 },
+    { 5.0, 0.0, 0.5 }, { 10.0, 4.0, 1.2 }, { 5.0, 8.0, 2.2 }, { 0.0, 4.0, 1.6 },
+    { 2.5, 2.0, 3.0 }, { 7.5, 6.0, 3.0 }, { 7.5, 2.0, 0.2 }, { 2.5, 6.0, 0.3 },
+};
+
+typedef struct
+{
+    double truth[3];
+    position_real_t distances[MULTILAT_ANCHORS_MAX];
+} fix_t;
+
+static fix_t fixes[FIXES_MAX];
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * ((double)rand() / (double)RAND_MAX);
+}
+
+static double gaussian(void)
+{
+    double u = uniform(1e-12, 1.0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * uniform(0.0, 1.0));
+}
+
+static double wall_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Runs solves fixes round robin, returns ns per fix and the mean and max error of the last pass */
+static double bench(const coord_t *anchors, uint8_t count, uint32_t fix_count, uint32_t solves, double *mean_m, double *max_m,
+                    uint32_t *failed)
+{
+    multilat_work_t work;
+    coord_t est;
+    double start = wall_clock();
+
+    *failed = 0U;
+    for (uint32_t i = 0U; i < solves; i++)
+    {
+        if (!multilat_wls(anchors, fixes[i % fix_count].distances, NULL, count, &work, &est))
+        {
+            (*failed)++;
+        }
+    }
+    double ns = (wall_clock() - start) * 1e9 / (double)solves;
+
+    *mean_m = 0.0;
+    *max_m = 0.0;
+    for (uint32_t i = 0U; i < fix_count; i++)
+    {
+        if (!multilat_wls(anchors, fixes[i].distances, NULL, count, &work, &est))
+        {
+            continue;
+        }
+        double dx = (double)est.x - fixes[i].truth[0];
+        double dy = (double)est.y - fixes[i].truth[1];
+        double dz = (double)est.z - fixes[i].truth[2];
+        double error = sqrt(dx * dx + dy * dy + dz * dz);
+        *mean_m += error / (double)fix_count;
+        *max_m = (error > *max_m) ? error : *max_m;
+    }
+    return ns;
+}
+
+/* ns per linear fix with the geometry factorised beforehand */
+static double bench_cached(const coord_t *anchors, uint8_t count, uint32_t fix_count, uint32_t solves, uint32_t *failed)
+{
+    multilat_geometry_t geometry;
+    coord_t est;
+
+    multilat_geometry_invalidate(&geometry);
+    if (!multilat_geometry_set(&geometry, anchors, count))
+    {
+        *failed += solves;
+        return 0.0;
+    }
+    double start = wall_clock();
+    for (uint32_t i = 0U; i < solves; i++)
+    {
+        if (!multilat_geometry_solve(&geometry, fixes[i % fix_count].distances, &est))
+        {
+            (*failed)++;
+        }
+    }
+    return (wall_clock() - start) * 1e9 / (double)solves;
+}
+
+static void circle_at(double t, double *pos)
+{
+    double w = TRACK_SPEED_MS / TRACK_RADIUS_M;
+
+    pos[0] = 5.0 + TRACK_RADIUS_M * cos(w * t);
+    pos[1] = 4.0 + TRACK_RADIUS_M * sin(w * t);
+    pos[2] = 1.2;
+}
+
+/* ns per range of predict and update, mean error of the track over the ranges after the first second */
+static double bench_tracker(const coord_t *anchors, uint32_t ranges, double sigma, double *mean_m)
+{
+    tag_tracker_t tracker;
+    position_real_t *distances = malloc(ranges * sizeof(*distances));
+    const position_real_t dt = (position_real_t)(1.0 / TRACK_RATE_HZ);
+    double pos[3];
+    uint32_t settle = (uint32_t)TRACK_RATE_HZ;
+    uint32_t counted = 0U;
+
+    for (uint32_t i = 0U; i < ranges; i++)
+    {
+        const coord_t *a = &anchors[i % 4U];
+        circle_at((double)i / TRACK_RATE_HZ, pos);
+        double dx = (double)a->x - pos[0];
+        double dy = (double)a->y - pos[1];
+        double dz = (double)a->z - pos[2];
+        distances[i] = (position_real_t)(sqrt(dx * dx + dy * dy + dz * dz) + sigma * gaussian());
+    }
+
+    circle_at(0.0, pos);
+    coord_t start = { (position_real_t)pos[0], (position_real_t)pos[1], (position_real_t)pos[2] };
+    tag_tracker_init(&tracker, (position_real_t)TRACK_ACCEL_PSD, (position_real_t)TRACK_GATE);
+    tag_tracker_reset(&tracker, &start, (position_real_t)0.3, (position_real_t)1.0);
+    double begin = wall_clock();
+    for (uint32_t i = 0U; i < ranges; i++)
+    {
+        tag_tracker_predict(&tracker, dt);
+        (void)tag_tracker_update(&tracker, &anchors[i % 4U], distances[i], (position_real_t)sigma);
+    }
+    double ns = (wall_clock() - begin) * 1e9 / (double)ranges;
+
+    /* again for the error, outside the timed loop */
+    *mean_m = 0.0;
+    tag_tracker_reset(&tracker, &start, (position_real_t)0.3, (position_real_t)1.0);
+    for (uint32_t i = 0U; i < ranges; i++)
+    {
+        coord_t est;
+        tag_tracker_predict(&tracker, dt);
+        (void)tag_tracker_update(&tracker, &anchors[i % 4U], distances[i], (position_real_t)sigma);
+        if (i < settle)
+        {
+            continue;
+        }
+        tag_tracker_position(&tracker, &est);
+        circle_at((double)i / TRACK_RATE_HZ, pos);
+        double dx = (double)est.x - pos[0];
+        double dy = (double)est.y - pos[1];
+        double dz = (double)est.z - pos[2];
+        *mean_m += sqrt(dx * dx + dy * dy + dz * dz);
+        counted++;
+    }
+    *mean_m /= (counted > 0U) ? (double)counted : 1.0;
+    free(distances);
+    return ns;
+}
+
+static void make_fixes(uint32_t fix_count, double sigma)
+{
+    for (uint32_t i = 0U; i < fix_count; i++)
+    {
+        fixes[i].truth[0] = uniform(1.0, 9.0);
+        fixes[i].truth[1] = uniform(1.0, 7.0);
+        fixes[i].truth[2] = uniform(0.3, 2.5);
+        for (uint8_t a = 0U; a < 12U; a++)
+        {
+            double dx = room[a][0] - fixes[i].truth[0];
+            double dy = room[a][1] - fixes[i].truth[1];
+            double dz = room[a][2] - fixes[i].truth[2];
+            fixes[i].distances[a] = (position_real_t)(sqrt(dx * dx + dy * dy + dz * dz) + sigma * gaussian());
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t solves = 20000U;
+    double sigma = 0.05;
+    unsigned seed = 1U;
+    int opt;
+    const uint8_t counts[] = { 4U, 8U, 12U };
+    coord_t anchors[12];
+    int status = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "n:s:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            solves = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sigma = strtod(optarg, NULL);
+            break;
+        case 'r':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n solves] [-s range sigma m] [-r seed]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (uint8_t a = 0U; a < 12U; a++)
+    {
+        anchors[a].x = (position_real_t)room[a][0];
+        anchors[a].y = (position_real_t)room[a][1];
+        anchors[a].z = (position_real_t)room[a][2];
+    }
+
+    printf("precision      : %s\n", (sizeof(position_real_t) == sizeof(float)) ? "float" : "double");
+    printf("anchors  ns/fix  cached ns/fix  error mm mean / max  floor mm mean / max  failed\n");
+    for (uint8_t c = 0U; c < sizeof(counts); c++)
+    {
+        double mean_m, max_m, floor_mean_m, floor_max_m;
+        uint32_t failed, floor_failed;
+
+        srand(seed);
+        make_fixes(FIXES_MAX, sigma);
+        double ns = bench(anchors, counts[c], FIXES_MAX, solves, &mean_m, &max_m, &failed);
+        double cached_ns = bench_cached(anchors, counts[c], FIXES_MAX, solves, &failed);
+        srand(seed);
+        make_fixes(FIXES_MAX, 0.0);
+        (void)bench(anchors, counts[c], FIXES_MAX, FIXES_MAX, &floor_mean_m, &floor_max_m, &floor_failed);
+
+        printf("%7u  %6.0f  %13.0f  %8.2f / %6.2f  %8.4f / %8.4f  %6lu\n", counts[c], ns, cached_ns, mean_m * 1e3, max_m * 1e3,
+               floor_mean_m * 1e3, floor_max_m * 1e3, (unsigned long)(failed + floor_failed));
+        if ((floor_max_m > FLOOR_LIMIT_M) || (failed + floor_failed != 0U))
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    double track_mean_m;
+    srand(seed);
+    double track_ns = bench_tracker(anchors, (solves > 2U * (uint32_t)TRACK_RATE_HZ) ? solves : 2U * (uint32_t)TRACK_RATE_HZ,
+                                    sigma, &track_mean_m);
+    printf("tracker: %.0f ns/range, error %.2f mm mean at %.0f ranges/s and %.1f m/s\n", track_ns, track_mean_m * 1e3,
+           TRACK_RATE_HZ, TRACK_SPEED_MS);
+    if (!(track_mean_m < sigma))
+    {
+        status = EXIT_FAILURE;
+    }
+    return status;
+}
@@ -0,0 +1,229 @@
+/*! ----------------------------------------------------------------------------
+ * @file    netsim.c
+ * @brief   Command line front end of the network simulator
+ *
+ * Default scenario: four anchors at the predefined anchor positions answer ranging requests, N tags at random
+ * positions range with all four once per period, each tag in its own slot (or at a random phase with -a).
+ * With -m the five devices of the deviceTable run main_app_task() instead, calibration and positioning included.
+ * With -i the anchor and tag tasks wait for frames on the DW IC interrupt instead of polling SYS_STATUS.
+ * With -D the tags run double-sided exchanges (poll, response, final, report) instead of request/response.
+ * With -b the tags send one broadcast request per round and the anchors answer in address slots.
+ *
+ * $ netsim -t 20 -d 10
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim_net.h"
+#include "sim_tasks.h"
+
+#define ANCHOR_COUNT    (4U)
+#define TAG_HASH        (0xD3DB7BBDUL)
+#define TAG_ADDRESS     (0x0100U)
+
+static const uint32_t anchor_hash[ANCHOR_COUNT] = { 0x1A0AB824UL, 0xF059DE36UL, 0x1FC5135CUL, 0x4BB919FBUL };
+static const double anchor_pos[ANCHOR_COUNT][3] = { { 0, 0, 0 }, { 4, 0, 0 }, { 2, 4, 0 }, { 2, 2, 2 } };
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * ((double)rand() / (double)RAND_MAX);
+}
+
+static double wall_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void usage(void)
+{
+    printf("usage: netsim [-t tags] [-d seconds] [-p period_ms] [-a] [-l loss] [-r range_m] [-s seed] [-i] [-D] [-b] [-m]\n"
+           "  -t  number of tags (default 4)\n"
+           "  -d  network time to simulate (default 10 s)\n"
+           "  -p  ranging period of each tag (default 100 ms)\n"
+           "  -a  random start phase instead of one slot per tag\n"
+           "  -l  frame loss probability per link (default 0)\n"
+           "  -r  radio range (default unlimited)\n"
+           "  -s  random seed (default 1)\n"
+           "  -i  interrupt driven reception\n"
+           "  -D  double-sided two-way ranging\n"
+           "  -b  broadcast ranging request, slotted responses\n"
+           "  -m  run main_app_task on the five deviceTable devices\n");
+}
+
+int main(int argc, char *argv[])
+{
+    sim_net_cfg_t cfg = { .node_library = SIM_NODE_LIBRARY, .seed = 1U };
+    unsigned tags = 4U;
+    double duration = 10.0;
+    double period_ms = 100.0;
+    bool aloha = false;
+    bool main_app = false;
+    bool irq = false;
+    bool ds_twr = false;
+    bool broadcast = false;
+    sim_tag_task_t *tag_task;
+    sim_anchor_task_t anchor_task[ANCHOR_COUNT] = { 0 };
+    sim_net_t *net;
+    sim_net_stats_t stats;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:d:p:al:r:s:iDbmh")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': tags = (unsigned)atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'p': period_ms = atof(optarg); break;
+        case 'a': aloha = true; break;
+        case 'l': cfg.loss = atof(optarg); break;
+        case 'r': cfg.range = atof(optarg); break;
+        case 's': cfg.seed = (uint32_t)atoi(optarg); break;
+        case 'i': irq = true; break;
+        case 'D': ds_twr = true; break;
+        case 'b': broadcast = true; break;
+        case 'm': main_app = true; break;
+        default: usage(); return 1;
+        }
+    }
+    srand(cfg.seed);
+
+    net = sim_net_create(&cfg);
+    if (net == NULL)
+    {
+        return 1;
+    }
+
+    if (main_app)
+    {
+        tags = 1U;
+    }
+    tag_task = calloc(tags, sizeof(sim_tag_task_t));
+    for (unsigned i = 0U; i < ANCHOR_COUNT; i++)
+    {
+        sim_node_cfg_t node = { .device_hash = anchor_hash[i], .ppm = uniform(-10.0, 10.0),
+                                .clock_offset = (uint64_t)uniform(0.0, 1e12) };
+
+        node.pos[0] = anchor_pos[i][0];
+        node.pos[1] = anchor_pos[i][1];
+        node.pos[2] = anchor_pos[i][2];
+        if (!main_app)
+        {
+            node.entry = "sim_task_anchor";
+            node.arg = &anchor_task[i];
+            anchor_task[i].coord[0] = anchor_pos[i][0];
+            anchor_task[i].coord[1] = anchor_pos[i][1];
+            anchor_task[i].coord[2] = anchor_pos[i][2];
+            anchor_task[i].irq = irq;
+        }
+        if (sim_net_add_node(net, &node) < 0)
+        {
+            return 1;
+        }
+    }
+    for (unsigned i = 0U; i < tags; i++)
+    {
+        sim_node_cfg_t node = { .device_hash = TAG_HASH, .ppm = uniform(-10.0, 10.0),
+                                .clock_offset = (uint64_t)uniform(0.0, 1e12),
+                                .pos = { uniform(0.5, 3.5), uniform(0.5, 3.5), uniform(0.0, 1.5) } };
+        sim_tag_task_t *task = &tag_task[i];
+
+        if (!main_app)
+        {
+            task->address16 = (uint16_t)(TAG_ADDRESS + i);
+            task->anchor_count = ANCHOR_COUNT;
+            for (unsigned a = 0U; a < ANCHOR_COUNT; a++)
+            {
+                task->anchors[a] = (uint16_t)(a + 1U);
+            }
+            task->period_us = (uint32_t)(period_ms * 1000.0);
+            task->irq = irq;
+            task->ds_twr = ds_twr;
+            task->broadcast = broadcast;
+            task->phase_us = aloha ? (uint32_t)uniform(0.0, period_ms * 1000.0) : (uint32_t)(period_ms * 1000.0 * i / tags);
+            node.entry = "sim_task_tag";
+            node.arg = task;
+        }
+        if (sim_net_add_node(net, &node) < 0)
+        {
+            return 1;
+        }
+    }
+
+    double wall = wall_clock();
+    sim_net_run(net, duration);
+    wall = wall_clock() - wall;
+    sim_net_stats(net, &stats);
+
+    printf("\nnodes          : %u anchors + %u tags%s\n", ANCHOR_COUNT, tags, main_app ? " (main_app_task)" : "");
+    printf("network time   : %.3f s, wall %.3f s (%.1fx real time)\n", duration, wall, duration / wall);
+    printf("frames         : %llu sent, %llu received, %llu missed, %llu collided, %llu out of range, %llu lost\n",
+           (unsigned long long)stats.frames_sent, (unsigned long long)stats.deliveries, (unsigned long long)stats.missed,
+           (unsigned long long)stats.collisions, (unsigned long long)stats.out_of_range, (unsigned long long)stats.lost);
+    uint64_t rejected = 0U;
+    for (unsigned i = 0U; i < ANCHOR_COUNT + tags; i++)
+    {
+        rejected += sim_net_device(net, (int)i)->frames_rejected;
+    }
+    printf("frame filter   : %llu dropped before reaching the host\n", (unsigned long long)rejected);
+    printf("scheduler      : %llu switches, %llu SPI transactions\n", (unsigned long long)stats.switches,
+           (unsigned long long)stats.spi_transactions);
+
+    if (!main_app)
+    {
+        uint64_t attempts = 0U;
+        uint64_t ranges = 0U;
+        uint64_t failures = 0U;
+        double latency = 0.0;
+        double latency_max = 0.0;
+        double bias = 0.0;
+        unsigned biased = 0U;
+        unsigned stalled = 0U;
+        uint32_t *rounds = calloc(tags, sizeof(uint32_t));
+
+        for (unsigned i = 0U; i < tags; i++)
+        {
+            sim_tag_task_t *task = &tag_task[i];
+            int node = (int)(ANCHOR_COUNT + i);
+
+            attempts += task->attempts;
+            ranges += task->ranges;
+            failures += task->failures;
+            latency += task->latency_sum_us;
+            latency_max = (task->latency_max_us > latency_max) ? task->latency_max_us : latency_max;
+            for (unsigned a = 0U; a < ANCHOR_COUNT; a++)
+            {
+                if (task->distance_count[a] != 0U)
+                {
+                    bias += fabs(task->distance_sum[a] / task->distance_count[a] - sim_net_distance(net, node, (int)a));
+                    biased++;
+                }
+            }
+            rounds[i] = task->rounds_done;
+        }
+        printf("ranges         : %llu of %llu (%.1f %%), %.1f per second\n", (unsigned long long)ranges,
+               (unsigned long long)attempts, (attempts != 0U) ? (100.0 * ranges / attempts) : 0.0, ranges / duration);
+        printf("failed ranges  : %llu, gave up after the retries\n", (unsigned long long)failures);
+        printf("latency        : %.1f us mean, %.1f us max\n", (ranges != 0U) ? (latency / ranges) : 0.0, latency_max);
+        printf("distance bias  : %.2f cm mean absolute\n", (biased != 0U) ? (100.0 * bias / biased) : 0.0);
+
+        /* the response timeouts bound every exchange, a tag that still stops finishing rounds is stuck elsewhere */
+        sim_net_run(net, 2.0 * period_ms / 1000.0);
+        for (unsigned i = 0U; i < tags; i++)
+        {
+            stalled += (tag_task[i].rounds_done == rounds[i]) ? 1U : 0U;
+        }
+        printf("stalled tags   : %u\n", stalled);
+        free(rounds);
+    }
+
+    sim_net_destroy(net);
+    free(tag_task);
+    return 0;
+}
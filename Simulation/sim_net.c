@@ -0,0 +1,614 @@
+/*! ----------------------------------------------------------------------------
+ * @file    sim_net.c
+ * @brief   Discrete event simulation of a UWB network, see sim_net.h
+ *
+ * Nodes are ucontext coroutines switched by a scheduler on the host stack. Each node library copy is written to a
+ * temporary file and opened with RTLD_LOCAL, the dynamic loader then gives every node its own driver and
+ * application globals while the device model, the network state and the callbacks live in this file.
+ */
+
+#include <dlfcn.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "sim_net.h"
+
+#define SIM_NET_IDLE_POLLS      (3U)        // back to back SYS_STATUS reads taken as waiting for an event
+#define SIM_NET_OFFSET_MAX      (4095.0)    // largest CIA_DIAG_0 clock offset, the field is 13 bits signed
+#define SIM_NET_DEFAULT_ENTRY   "main_app_task"
+
+typedef struct
+{
+    uint64_t start;             // local time of the first preamble symbol at the receiver
+    uint64_t rmarker;           // local time of the RMARKER at the receiver antenna
+    int16_t clock_offset;
+    uint16_t length;
+    uint8_t *frame;
+} sim_arrival_t;
+
+typedef struct sim_node_s
+{
+    dw3000_sim_t dev;
+    sim_net_t *net;
+    int index;
+
+    void *lib;
+    void (*entry)(void *);
+    void *arg;
+    ucontext_t ctx;
+    void *stack;
+
+    sim_node_state_e state;
+    uint64_t wake;              // local time, SIM_NODE_SLEEPING and SIM_NODE_WAITING only
+
+    double rate;                // local clock ticks per network clock tick
+    uint64_t clock_offset;      // local time at network time 0
+    double pos[3];
+
+    sim_arrival_t *arrivals;    // sorted by start
+    size_t arrival_count;
+    size_t arrival_size;
+} sim_node_t;
+
+struct sim_net_s
+{
+    sim_net_cfg_t cfg;
+    uint8_t *image;             // node library file
+    size_t image_size;
+
+    sim_node_t **nodes;
+    int count;
+    bool started;
+
+    ucontext_t sched;
+    sim_node_t *current;        // node whose coroutine runs, NULL in the scheduler
+    double time;                // network time in DTU
+    double horizon;             // the current node yields once its time passes this
+
+    uint64_t rng;
+    sim_net_frame_cb_t frame_cb;
+    void *frame_ctx;
+    sim_net_stats_t stats;
+};
+
+/****************************************************************************
+ *
+ *                              Time
+ *
+ *******************************************************************************/
+
+static double node_time(const sim_node_t *node, uint64_t local)
+{
+    return (double)(local - node->clock_offset) / node->rate;
+}
+
+static uint64_t node_local(const sim_node_t *node, double t)
+{
+    return node->clock_offset + (uint64_t)llround(t * node->rate);
+}
+
+/* Network time at which the scheduler has to look at the node next */
+static double node_key(const sim_node_t *node)
+{
+    uint64_t next;
+
+    if (node->state == SIM_NODE_READY)
+    {
+        return node_time(node, node->dev.now);
+    }
+    next = dw3000_sim_next_event(&node->dev);
+    if (((node->state == SIM_NODE_SLEEPING) || (node->state == SIM_NODE_WAITING)) && (node->wake < next))
+    {
+        next = node->wake;
+    }
+    return (next == UINT64_MAX) ? INFINITY : node_time(node, (next > node->dev.now) ? next : node->dev.now);
+}
+
+static double net_random(sim_net_t *net)
+{
+    /* xorshift64* */
+    net->rng ^= net->rng >> 12U;
+    net->rng ^= net->rng << 25U;
+    net->rng ^= net->rng >> 27U;
+    return (double)((net->rng * 0x2545F4914F6CDD1DULL) >> 11U) / 9007199254740992.0;
+}
+
+/****************************************************************************
+ *
+ *                              Coroutines
+ *
+ *******************************************************************************/
+
+static void node_main(unsigned int hi, unsigned int lo)
+{
+    sim_node_t *node = (sim_node_t *)(uintptr_t)(((uint64_t)hi << 32U) | lo);
+
+    node->entry(node->arg);
+    node->state = SIM_NODE_DONE;
+    /* returns to net->sched through uc_link */
+}
+
+static void node_yield(sim_node_t *node)
+{
+    (void)swapcontext(&node->ctx, &node->net->sched);
+}
+
+static void node_resume(sim_net_t *net, sim_node_t *node)
+{
+    net->current = node;
+    net->stats.switches++;
+    (void)swapcontext(&net->sched, &node->ctx);
+    net->current = NULL;
+}
+
+/* Moves a node that is not running host code to its next event */
+static void node_step(sim_node_t *node)
+{
+    uint64_t next = dw3000_sim_next_event(&node->dev);
+
+    if (((node->state == SIM_NODE_SLEEPING) || (node->state == SIM_NODE_WAITING)) && (node->wake < next))
+    {
+        next = node->wake;
+    }
+    dw3000_sim_advance(&node->dev, (next > node->dev.now) ? (next - node->dev.now) : 0U);
+
+    if (node->state == SIM_NODE_POLLING)
+    {
+        node->state = SIM_NODE_READY;
+    }
+    else if ((node->state == SIM_NODE_SLEEPING) && (node->dev.now >= node->wake))
+    {
+        node->state = SIM_NODE_READY;
+    }
+    else if ((node->state == SIM_NODE_WAITING) && (dw3000_sim_irq(&node->dev) || (node->dev.now >= node->wake)))
+    {
+        node->state = SIM_NODE_READY;
+    }
+}
+
+/****************************************************************************
+ *
+ *                              Device callbacks
+ *
+ *******************************************************************************/
+
+static void net_access(dw3000_sim_t *dev, void *ctx)
+{
+    sim_node_t *node = (sim_node_t *)ctx;
+    sim_net_t *net = node->net;
+
+    if (net->current != node)
+    {
+        return;
+    }
+    if (dev->status_polls >= SIM_NET_IDLE_POLLS)
+    {
+        node->state = SIM_NODE_POLLING;
+        node_yield(node);
+    }
+    else if (node_time(node, dev->now) > net->horizon)
+    {
+        node_yield(node);
+    }
+}
+
+static void net_delay(dw3000_sim_t *dev, uint64_t dtu, void *ctx)
+{
+    sim_node_t *node = (sim_node_t *)ctx;
+
+    if (node->net->current != node)
+    {
+        dw3000_sim_advance(dev, dtu);
+        return;
+    }
+    node->wake = dev->now + dtu;
+    node->state = SIM_NODE_SLEEPING;
+    node_yield(node);
+}
+
+static void net_wait(dw3000_sim_t *dev, uint64_t until, void *ctx)
+{
+    sim_node_t *node = (sim_node_t *)ctx;
+    uint64_t next;
+
+    if (node->net->current != node)
+    {
+        next = dw3000_sim_next_event(dev);
+        next = (next < until) ? next : until;
+        if (next != UINT64_MAX)
+        {
+            dw3000_sim_advance(dev, (next > dev->now) ? (next - dev->now) : 0U);
+        }
+        return;
+    }
+    node->wake = until;
+    node->state = SIM_NODE_WAITING;
+    node_yield(node);
+}
+
+static void net_alarm(dw3000_sim_t *dev, void *ctx)
+{
+    sim_node_t *node = (sim_node_t *)ctx;
+    sim_net_t *net = node->net;
+
+    while ((node->arrival_count > 0U) && (node->arrivals[0].start <= dev->now))
+    {
+        sim_arrival_t a = node->arrivals[0];
+
+        node->arrival_count--;
+        memmove(&node->arrivals[0], &node->arrivals[1], node->arrival_count * sizeof(sim_arrival_t));
+
+        if (dev->rx_pending && (a.start < dev->rx_end))
+        {
+            /* overlap: the frame being received fails its FCS check, the new one is not picked up */
+            dev->rx_frame[0] ^= 0xFFU;
+            net->stats.collisions += 2U;
+        }
+        else if (dw3000_sim_deliver(dev, a.frame, a.length, a.rmarker, a.clock_offset))
+        {
+            net->stats.deliveries++;
+        }
+        else
+        {
+            net->stats.missed++;
+        }
+        free(a.frame);
+    }
+    dev->alarm = (node->arrival_count > 0U) ? node->arrivals[0].start : 0U;
+}
+
+static void net_arrival(sim_node_t *node, const sim_arrival_t *a)
+{
+    size_t i;
+
+    if (node->arrival_count == node->arrival_size)
+    {
+        size_t size = (node->arrival_size == 0U) ? 8U : (2U * node->arrival_size);
+        sim_arrival_t *arrivals = realloc(node->arrivals, size * sizeof(sim_arrival_t));
+
+        if (arrivals == NULL)
+        {
+            free(a->frame);
+            return;
+        }
+        node->arrivals = arrivals;
+        node->arrival_size = size;
+    }
+    for (i = node->arrival_count; (i > 0U) && (node->arrivals[i - 1U].start > a->start); i--)
+    {
+        node->arrivals[i] = node->arrivals[i - 1U];
+    }
+    node->arrivals[i] = *a;
+    node->arrival_count++;
+    node->dev.alarm = node->arrivals[0].start;
+}
+
+static void net_tx(dw3000_sim_t *dev, const uint8_t *frame, uint16_t length, uint64_t rmarker, uint64_t duration, void *ctx)
+{
+    sim_node_t *src = (sim_node_t *)ctx;
+    sim_net_t *net = src->net;
+    double t = node_time(src, rmarker);
+
+    (void)dev;
+    (void)duration;
+    net->stats.frames_sent++;
+    if (net->frame_cb != NULL)
+    {
+        net->frame_cb(net->frame_ctx, src->index, frame, length, t / (double)DW3000_SIM_DTU_PER_SEC);
+    }
+
+    for (int i = 0; i < net->count; i++)
+    {
+        sim_node_t *dst = net->nodes[i];
+        double d = sim_net_distance(net, src->index, i);
+        double offset = (src->rate - dst->rate) / src->rate * 67108864.0;
+        sim_arrival_t a;
+        uint64_t shr;
+
+        if (dst == src)
+        {
+            continue;
+        }
+        if ((net->cfg.range > 0.0) && (d > net->cfg.range))
+        {
+            net->stats.out_of_range++;
+            continue;
+        }
+        if ((net->cfg.loss > 0.0) && (net_random(net) < net->cfg.loss))
+        {
+            net->stats.lost++;
+            continue;
+        }
+
+        a.rmarker = node_local(dst, t + (d / SIM_NET_SPEED_OF_LIGHT) * (double)DW3000_SIM_DTU_PER_SEC);
+        (void)dw3000_sim_frame_duration(&dst->dev, length, &shr);
+        a.start = (a.rmarker > shr) ? (a.rmarker - shr) : 1U;
+        offset = (offset > SIM_NET_OFFSET_MAX) ? SIM_NET_OFFSET_MAX : (offset < -SIM_NET_OFFSET_MAX) ? -SIM_NET_OFFSET_MAX : offset;
+        a.clock_offset = (int16_t)lround(offset);
+        a.length = length;
+        a.frame = malloc(length);
+        if (a.frame == NULL)
+        {
+            continue;
+        }
+        memcpy(a.frame, frame, length);
+        net_arrival(dst, &a);
+
+        /* the running node must not get past the arrival before the receiver has seen it */
+        if (node_time(dst, a.start) < net->horizon)
+        {
+            net->horizon = node_time(dst, a.start);
+        }
+    }
+}
+
+/****************************************************************************
+ *
+ *                              Public functions
+ *
+ *******************************************************************************/
+
+sim_net_t *sim_net_create(const sim_net_cfg_t *cfg)
+{
+    sim_net_t *net;
+    FILE *f;
+    long size;
+
+    if ((cfg == NULL) || (cfg->node_library == NULL))
+    {
+        return NULL;
+    }
+    net = calloc(1U, sizeof(sim_net_t));
+    if (net == NULL)
+    {
+        return NULL;
+    }
+    net->cfg = *cfg;
+    if (net->cfg.stack_size == 0U)
+    {
+        net->cfg.stack_size = SIM_NET_STACK_SIZE;
+    }
+    net->rng = ((uint64_t)cfg->seed << 1U) | 1U;
+
+    f = fopen(cfg->node_library, "rb");
+    if ((f != NULL) && (fseek(f, 0, SEEK_END) == 0) && ((size = ftell(f)) > 0) && (fseek(f, 0, SEEK_SET) == 0))
+    {
+        net->image = malloc((size_t)size);
+        if ((net->image != NULL) && (fread(net->image, 1U, (size_t)size, f) == (size_t)size))
+        {
+            net->image_size = (size_t)size;
+        }
+    }
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+    if (net->image_size == 0U)
+    {
+        fprintf(stderr, "sim_net: cannot read %s\n", cfg->node_library);
+        sim_net_destroy(net);
+        return NULL;
+    }
+    return net;
+}
+
+void sim_net_destroy(sim_net_t *net)
+{
+    if (net == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < net->count; i++)
+    {
+        sim_node_t *node = net->nodes[i];
+
+        for (size_t j = 0U; j < node->arrival_count; j++)
+        {
+            free(node->arrivals[j].frame);
+        }
+        free(node->arrivals);
+        free(node->stack);
+        if (node->lib != NULL)
+        {
+            dlclose(node->lib);
+        }
+        free(node);
+    }
+    free(net->nodes);
+    free(net->image);
+    free(net);
+}
+
+/* Each node gets its own copy of the library file, dlopen() of the same path would hand back the same globals */
+static void *node_load(sim_net_t *net)
+{
+    char path[] = "/tmp/uwb_node_XXXXXX";
+    int fd = mkstemp(path);
+    void *lib = NULL;
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (write(fd, net->image, net->image_size) == (ssize_t)net->image_size)
+    {
+        lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (lib == NULL)
+        {
+            fprintf(stderr, "sim_net: %s\n", dlerror());
+        }
+    }
+    close(fd);
+    unlink(path);
+    return lib;
+}
+
+int sim_net_add_node(sim_net_t *net, const sim_node_cfg_t *cfg)
+{
+    sim_node_t **nodes;
+    sim_node_t *node;
+    dw3000_sim_t *(*select)(dw3000_sim_t *);
+    const char *entry = (cfg->entry != NULL) ? cfg->entry : SIM_NET_DEFAULT_ENTRY;
+
+    if (net->started)
+    {
+        return -1;
+    }
+    nodes = realloc(net->nodes, (size_t)(net->count + 1) * sizeof(sim_node_t *));
+    if (nodes == NULL)
+    {
+        return -1;
+    }
+    net->nodes = nodes;
+    node = calloc(1U, sizeof(sim_node_t));
+    if (node == NULL)
+    {
+        return -1;
+    }
+    node->net = net;
+    node->index = net->count;
+    node->lib = node_load(net);
+    node->stack = malloc(net->cfg.stack_size);
+    if ((node->lib == NULL) || (node->stack == NULL))
+    {
+        goto fail;
+    }
+    *(void **)&node->entry = dlsym(node->lib, entry);
+    *(void **)&select = dlsym(node->lib, "dw3000_sim_select");
+    if ((node->entry == NULL) || (select == NULL))
+    {
+        fprintf(stderr, "sim_net: %s not found in %s\n", (node->entry == NULL) ? entry : "dw3000_sim_select", net->cfg.node_library);
+        goto fail;
+    }
+    node->arg = cfg->arg;
+    node->rate = 1.0 + cfg->ppm * 1e-6;
+    node->clock_offset = cfg->clock_offset;
+    memcpy(node->pos, cfg->pos, sizeof(node->pos));
+
+    node->dev.tx_cb = net_tx;
+    node->dev.tx_ctx = node;
+    node->dev.access_cb = net_access;
+    node->dev.access_ctx = node;
+    node->dev.alarm_cb = net_alarm;
+    node->dev.alarm_ctx = node;
+    node->dev.delay_cb = net_delay;
+    node->dev.delay_ctx = node;
+    node->dev.wait_cb = net_wait;
+    node->dev.wait_ctx = node;
+    dw3000_sim_set_ids_for_hash(&node->dev, cfg->device_hash, 0x5A4E000000000000ULL | (uint64_t)node->index);
+    dw3000_sim_init(&node->dev);
+    node->dev.now = node->clock_offset;
+    (void)select(&node->dev);
+
+    /* the task starts once the scheduler wakes the node */
+    node->state = SIM_NODE_SLEEPING;
+    node->wake = node_local(node, cfg->start * (double)DW3000_SIM_DTU_PER_SEC);
+    (void)getcontext(&node->ctx);
+    node->ctx.uc_stack.ss_sp = node->stack;
+    node->ctx.uc_stack.ss_size = net->cfg.stack_size;
+    node->ctx.uc_link = &net->sched;
+    makecontext(&node->ctx, (void (*)(void))node_main, 2, (unsigned int)((uint64_t)(uintptr_t)node >> 32U), (unsigned int)(uintptr_t)node);
+
+    net->nodes[net->count] = node;
+    return net->count++;
+
+fail:
+    if (node->lib != NULL)
+    {
+        dlclose(node->lib);
+    }
+    free(node->stack);
+    free(node);
+    return -1;
+}
+
+void sim_net_run(sim_net_t *net, double duration)
+{
+    double end = net->time + duration * (double)DW3000_SIM_DTU_PER_SEC;
+
+    net->started = true;
+    for (;;)
+    {
+        sim_node_t *first = NULL;
+        double k1 = INFINITY;
+        double k2 = INFINITY;
+
+        for (int i = 0; i < net->count; i++)
+        {
+            double k = node_key(net->nodes[i]);
+
+            if (k < k1)
+            {
+                k2 = k1;
+                k1 = k;
+                first = net->nodes[i];
+            }
+            else if (k < k2)
+            {
+                k2 = k;
+            }
+        }
+        if ((first == NULL) || (k1 > end))
+        {
+            break;
+        }
+        if (k1 > net->time)
+        {
+            net->time = k1;
+        }
+
+        if (first->state == SIM_NODE_READY)
+        {
+            net->horizon = (k2 < end) ? k2 : end;
+            node_resume(net, first);
+        }
+        else
+        {
+            node_step(first);
+        }
+    }
+    net->time = end;
+}
+
+double sim_net_time(const sim_net_t *net)
+{
+    return net->time / (double)DW3000_SIM_DTU_PER_SEC;
+}
+
+void sim_net_set_frame_cb(sim_net_t *net, sim_net_frame_cb_t cb, void *ctx)
+{
+    net->frame_cb = cb;
+    net->frame_ctx = ctx;
+}
+
+void sim_net_stats(const sim_net_t *net, sim_net_stats_t *stats)
+{
+    *stats = net->stats;
+    stats->spi_transactions = 0U;
+    for (int i = 0; i < net->count; i++)
+    {
+        stats->spi_transactions += net->nodes[i]->dev.spi_transactions;
+    }
+}
+
+sim_node_state_e sim_net_node_state(const sim_net_t *net, int node)
+{
+    return net->nodes[node]->state;
+}
+
+dw3000_sim_t *sim_net_device(sim_net_t *net, int node)
+{
+    return &net->nodes[node]->dev;
+}
+
+double sim_net_distance(const sim_net_t *net, int a, int b)
+{
+    const double *p = net->nodes[a]->pos;
+    const double *q = net->nodes[b]->pos;
+
+    return sqrt((p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2]));
+}
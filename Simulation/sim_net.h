@@ -0,0 +1,174 @@
+/*! ----------------------------------------------------------------------------
+ * @file    sim_net.h
+ * @brief   Discrete event simulation of a UWB network made of dw3000_sim devices, in virtual time
+ *
+ * Every node runs the real driver and application code (main_app_task() or any other task function exported by
+ * the node library) in its own coroutine. The driver and the application keep their state in globals, so each
+ * node gets a private copy of the node library: same code, separate data.
+ *
+ * Radio: frames go from the sender's antenna to every other node with the propagation delay of the straight line
+ * between their positions. Each node has its own crystal error, so local clocks drift apart and the receiver
+ * reports the offset of the sender's clock through dwt_readclockoffset(). Frames beyond the configured range are
+ * not heard, frames can be dropped at random, and a frame that starts while another one is being received
+ * corrupts it (RXFCE) and is lost itself. Half duplex and receiver on/off timing come from the device model.
+ *
+ * Scheduling is conservative: the node furthest behind in network time always runs next and a node yields once it
+ * gets ahead of the others, so frames are never delivered late by more than one SPI transaction. A node that only
+ * polls SYS_STATUS, sleeps or waits for its interrupt does not run at all, its clock jumps straight to its next device
+ * event, frame arrival or wake up time. Host code itself takes no time, only SPI transfers and delays do.
+ */
+
+#ifndef SIM_NET_H_
+#define SIM_NET_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dw3000_sim.h"
+
+#define SIM_NET_SPEED_OF_LIGHT    (299702547.0)      // m/s in air, same value as the application uses
+#define SIM_NET_STACK_SIZE        (256U * 1024U)     // default coroutine stack per node
+
+typedef struct sim_net_s sim_net_t;
+
+typedef enum
+{
+    SIM_NODE_READY = 0,         // host code runnable
+    SIM_NODE_POLLING,           // host waits on SYS_STATUS, resumes at the next device event
+    SIM_NODE_SLEEPING,          // host in a delay
+    SIM_NODE_WAITING,           // host blocked on the DW IC interrupt, resumes when the IRQ line rises or at its timeout
+    SIM_NODE_DONE               // task function returned
+} sim_node_state_e;
+
+/* Called for every transmitted frame. t is the network time (seconds) at which the RMARKER leaves the antenna. */
+typedef void (*sim_net_frame_cb_t)(void *ctx, int node, const uint8_t *frame, uint16_t length, double t);
+
+typedef struct
+{
+    const char *node_library;   // path of the node library (uwb_node)
+    double range;               // metres, frames from further away are not heard, 0 for no limit
+    double loss;                // probability that a frame is lost on a link
+    uint32_t seed;              // random loss
+    size_t stack_size;          // 0 for SIM_NET_STACK_SIZE
+} sim_net_cfg_t;
+
+typedef struct
+{
+    const char *entry;          // task function in the node library, NULL for main_app_task
+    void *arg;                  // task parameter
+    uint32_t device_hash;       // deviceTable entry the node resolves to in uwb_device_init()
+    double pos[3];              // metres
+    double ppm;                 // crystal error, positive runs fast
+    double start;               // network time (seconds) at which the task starts
+    uint64_t clock_offset;      // local time at network time 0, DTU
+} sim_node_cfg_t;
+
+typedef struct
+{
+    uint64_t frames_sent;
+    uint64_t deliveries;        // frames taken by a receiver
+    uint64_t missed;            // receiver off, busy transmitting or not listening yet
+    uint64_t collisions;        // frames lost to an overlap at the receiver (both of them count)
+    uint64_t out_of_range;
+    uint64_t lost;              // random loss
+    uint64_t switches;          // coroutine switches
+    uint64_t spi_transactions;
+} sim_net_stats_t;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_create()
+ *
+ * @brief Creates an empty network.
+ *
+ * @param cfg - network configuration, node_library is required
+ *
+ * @return the network, NULL if the node library cannot be read
+ */
+sim_net_t *sim_net_create(const sim_net_cfg_t *cfg);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_destroy()
+ *
+ * @brief Releases the network. Tasks that are still running are dropped where they are.
+ */
+void sim_net_destroy(sim_net_t *net);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_add_node()
+ *
+ * @brief Loads a copy of the node library, programs the OTP IDs for the requested device hash and queues the task.
+ *        Nodes can only be added before the first sim_net_run().
+ *
+ * @param net - network
+ * @param cfg - node configuration
+ *
+ * @return node index, -1 on error
+ */
+int sim_net_add_node(sim_net_t *net, const sim_node_cfg_t *cfg);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_run()
+ *
+ * @brief Runs the network for a span of network time. Can be called repeatedly.
+ *
+ * @param net      - network
+ * @param duration - seconds of network time
+ *
+ * @return none
+ */
+void sim_net_run(sim_net_t *net, double duration);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_time()
+ *
+ * @brief Network time in seconds.
+ */
+double sim_net_time(const sim_net_t *net);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_set_frame_cb()
+ *
+ * @brief Installs a callback that sees every transmitted frame, e.g. to trace or decode the protocol.
+ */
+void sim_net_set_frame_cb(sim_net_t *net, sim_net_frame_cb_t cb, void *ctx);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_stats()
+ *
+ * @brief Returns the network counters.
+ */
+void sim_net_stats(const sim_net_t *net, sim_net_stats_t *stats);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_node_state()
+ *
+ * @brief State of a node. A node that stays SIM_NODE_POLLING with nothing on its way is stuck waiting for a frame
+ *        that will never come.
+ */
+sim_node_state_e sim_net_node_state(const sim_net_t *net, int node);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_device()
+ *
+ * @brief The device model of a node, for counters and inspection.
+ */
+dw3000_sim_t *sim_net_device(sim_net_t *net, int node);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_net_distance()
+ *
+ * @brief Distance between two nodes in metres.
+ */
+double sim_net_distance(const sim_net_t *net, int a, int b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_NET_H_ */
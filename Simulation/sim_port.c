@@ -0,0 +1,243 @@
+/*! ----------------------------------------------------------------------------
+ * @file    sim_port.c
+ * @brief   Host replacement of the platform layer (Core/platform) used when the driver and the application
+ *          protocol code run against dw3000_sim
+ *
+ * Delays advance the virtual clock of the selected device instead of blocking (or are handed to the network
+ * scheduler through the delay callback), the IRQ mutex is a no-op and the probe interface routes the driver SPI
+ * calls to the model. vTaskDelay() and the static queues are provided here as well, FreeRTOS itself is not built
+ * for the host. There is no preemption: the DW IC interrupt is taken while the task blocks on a queue.
+ */
+
+#include <string.h>
+
+#include <deca_device_api.h>
+#include <deca_interface.h>
+#include <deca_probe_interface.h>
+#include <port.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "dw3000_sim.h"
+
+extern const struct dwt_driver_s dw3000_driver;
+static const struct dwt_driver_s *sim_driver_list[] = { &dw3000_driver };
+
+static port_dwic_isr_t port_dwic_isr = NULL;
+
+const struct dwt_probe_s dw3000_probe_interf =
+{
+    .dw = NULL,
+    .spi = (void *)&dw3000_sim_spi,
+    .wakeup_device_with_io = wakeup_device_with_io,
+    .driver_list = (struct dwt_driver_s **)sim_driver_list,
+    .dw_driver_num = 1,
+};
+
+/****************************************************************************
+ *
+ *                              Time
+ *
+ *******************************************************************************/
+
+void Sleep(uint32_t Delay)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    if (sim != NULL)
+    {
+        dw3000_sim_delay(sim, ((uint64_t)Delay * DW3000_SIM_DTU_PER_SEC) / 1000U);
+    }
+}
+
+int usleep(uint32_t usec)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    if (sim != NULL)
+    {
+        dw3000_sim_delay(sim, ((uint64_t)usec * DW3000_SIM_DTU_PER_SEC) / 1000000U);
+    }
+    return 0;
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    Sleep((uint32_t)((xTicksToDelay * 1000U) / configTICK_RATE_HZ));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    return (sim != NULL) ? (TickType_t)((sim->now * configTICK_RATE_HZ) / DW3000_SIM_DTU_PER_SEC) : 0U;
+}
+
+/* DWT cycle counter of the 144 MHz target, derived from the virtual clock: only SPI traffic takes time here */
+void port_CycleCounterInit(void)
+{
+}
+
+uint32_t port_GetCycleCount(void)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    return (sim != NULL) ? (uint32_t)((sim->now * 144000000ULL) / DW3000_SIM_DTU_PER_SEC) : 0U;
+}
+
+unsigned long portGetTickCnt(void)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    return (sim != NULL) ? (unsigned long)((sim->now * 1000U) / DW3000_SIM_DTU_PER_SEC) : 0UL;
+}
+
+/****************************************************************************
+ *
+ *                              DW IC control lines
+ *
+ *******************************************************************************/
+
+void reset_DWIC(void)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    if (sim != NULL)
+    {
+        dw3000_sim_reset(sim);
+    }
+}
+
+void wakeup_device_with_io(void)
+{
+}
+
+void port_set_dw_ic_spi_slowrate(void)
+{
+    dw3000_sim_spi.setslowrate();
+}
+
+void port_set_dw_ic_spi_fastrate(void)
+{
+    dw3000_sim_spi.setfastrate();
+}
+
+decaIrqStatus_t decamutexon(void)
+{
+    return 0;
+}
+
+void decamutexoff(decaIrqStatus_t s)
+{
+    (void)s;
+}
+
+/****************************************************************************
+ *
+ *                              IRQ
+ *
+ *******************************************************************************/
+
+void port_set_dwic_isr(port_dwic_isr_t isr)
+{
+    port_dwic_isr = isr;
+}
+
+uint32_t port_CheckEXT_IRQ(void)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+
+    return ((sim != NULL) && dw3000_sim_irq(sim)) ? 1U : 0U;
+}
+
+void process_deca_irq(void)
+{
+    while ((port_dwic_isr != NULL) && (port_CheckEXT_IRQ() != 0U))
+    {
+        port_dwic_isr();
+    }
+}
+
+/****************************************************************************
+ *
+ *                              Queues
+ *
+ *******************************************************************************/
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, uint8_t *pucQueueStorageBuffer,
+                                 StaticQueue_t *pxQueueBuffer)
+{
+    pxQueueBuffer->storage = pucQueueStorageBuffer;
+    pxQueueBuffer->length = uxQueueLength;
+    pxQueueBuffer->item_size = uxItemSize;
+    pxQueueBuffer->head = 0U;
+    pxQueueBuffer->count = 0U;
+    return pxQueueBuffer;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    UBaseType_t tail;
+
+    if (xQueue->count == xQueue->length)
+    {
+        return errQUEUE_FULL;
+    }
+    tail = (xQueue->head + xQueue->count) % xQueue->length;
+    memcpy(&xQueue->storage[tail * xQueue->item_size], pvItemToQueue, xQueue->item_size);
+    xQueue->count++;
+    if (pxHigherPriorityTaskWoken != NULL)
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+    return pdPASS;
+}
+
+/* Never blocks: nothing else runs to make room in the queue */
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    return xQueueSendFromISR(xQueue, pvItemToQueue, NULL);
+}
+
+/* Blocking: the interrupt is serviced whenever the line is high, time moves on to the next IRQ or the timeout */
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    dw3000_sim_t *sim = dw3000_sim_selected();
+    uint64_t until = UINT64_MAX;
+
+    if ((sim != NULL) && (xTicksToWait != portMAX_DELAY))
+    {
+        until = sim->now + ((uint64_t)xTicksToWait * DW3000_SIM_DTU_PER_SEC) / configTICK_RATE_HZ;
+    }
+    for (;;)
+    {
+        process_deca_irq();
+        if (xQueue->count > 0U)
+        {
+            memcpy(pvBuffer, &xQueue->storage[xQueue->head * xQueue->item_size], xQueue->item_size);
+            xQueue->head = (xQueue->head + 1U) % xQueue->length;
+            xQueue->count--;
+            return pdTRUE;
+        }
+        /* with no device event left a wait without limit would never return */
+        if ((sim == NULL) || (sim->now >= until) || !dw3000_sim_wait_irq(sim, until))
+        {
+            return errQUEUE_EMPTY;
+        }
+    }
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+    xQueue->head = 0U;
+    xQueue->count = 0U;
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+    return xQueue->count;
+}
@@ -0,0 +1,183 @@
+/*! ----------------------------------------------------------------------------
+ * @file    sim_tasks.c
+ * @brief   Task functions for network scenarios, see sim_tasks.h
+ */
+
+#include <math.h>
+
+#include "device_protocol.h"
+#include "position_protocol.h"
+
+#include "dw3000_sim.h"
+#include "sim_tasks.h"
+
+static double local_us(void)
+{
+    return (double)dw3000_sim_selected()->now * 1e6 / (double)DW3000_SIM_DTU_PER_SEC;
+}
+
+/* one range_with_all() round: every anchor is an attempt, the whole round is the latency of each distance */
+static void sim_tag_record(sim_tag_task_t *task, const position_real_t *distance, double latency)
+{
+    for (uint8_t i = 0U; i < task->anchor_count; i++)
+    {
+        task->attempts++;
+        if (!isnan(distance[i]))
+        {
+            task->ranges++;
+            task->latency_sum_us += latency;
+            task->latency_max_us = (latency > task->latency_max_us) ? latency : task->latency_max_us;
+            task->distance_sum[i] += distance[i];
+            task->distance_count[i]++;
+        }
+    }
+}
+
+void sim_task_anchor(void *parameters)
+{
+    sim_anchor_task_t *task = (sim_anchor_task_t *)parameters;
+    uwb_device_t uwb_device = { 0 };
+    uwb_msg_t rx_msg;
+    uint16_t sender_address = 0;
+
+    if (uwb_device_init(&uwb_device) != UWB_OK)
+    {
+        task->init_failed = true;
+        return;
+    }
+    if (task->address16 != 0U)
+    {
+        uwb_device.address16 = task->address16;
+        dwt_setaddress16(uwb_device.address16);
+    }
+    if (task->irq && (uwb_irq_enable(&uwb_device) != UWB_OK))
+    {
+        task->init_failed = true;
+        return;
+    }
+    if (task->turnaround_uus != 0U)
+    {
+        range_set_turnaround(task->turnaround_uus);
+    }
+    range_calibrate_turnaround(task->turnaround_samples);
+    uwb_device.coord.x = task->coord[0];
+    uwb_device.coord.y = task->coord[1];
+    uwb_device.coord.z = task->coord[2];
+
+    while (1)
+    {
+        range_stage_response(&uwb_device);
+        uwb_result_e result = uwb_receive_msg(&uwb_device, &sender_address, &rx_msg);
+
+        if ((result == UWB_OK) && (rx_msg.command_type == COMMAND_RANGING_REQUEST))
+        {
+            range_respond(&uwb_device, sender_address);
+            task->requests++;
+        }
+        else if ((result == UWB_OK) && (rx_msg.command_type == COMMAND_RANGING_BROADCAST))
+        {
+            range_respond_slot(&uwb_device, sender_address);
+            task->requests++;
+        }
+        else if ((result == UWB_OK) && (rx_msg.command_type == COMMAND_DS_POLL))
+        {
+            range_respond_ds(&uwb_device, sender_address, rx_msg.command_type);
+            task->requests++;
+        }
+        else if ((result == UWB_OK) && (rx_msg.command_type == COMMAND_DS_FINAL))
+        {
+            range_respond_ds(&uwb_device, sender_address, rx_msg.command_type);
+        }
+        uwb_turnaround_t turnaround;
+
+        uwb_get_turnaround(&turnaround);
+        task->late_tx = turnaround.late_tx;
+        task->turnaround_cycles = turnaround.max_cycles;
+        task->turnaround_result = range_get_turnaround();
+    }
+}
+
+void sim_task_tag(void *parameters)
+{
+    sim_tag_task_t *task = (sim_tag_task_t *)parameters;
+    uwb_device_t uwb_device = { 0 };
+
+    if (uwb_device_init(&uwb_device) != UWB_OK)
+    {
+        task->init_failed = true;
+        return;
+    }
+    if (task->address16 != 0U)
+    {
+        uwb_device.address16 = task->address16;
+        dwt_setaddress16(uwb_device.address16);
+    }
+    if (task->irq && (uwb_irq_enable(&uwb_device) != UWB_OK))
+    {
+        task->init_failed = true;
+        return;
+    }
+    range_set_mode(task->ds_twr ? RANGING_DS_TWR : RANGING_SS_TWR);
+    range_set_quality(task->quality);
+    deca_usleep(task->phase_us);
+
+    while ((task->rounds == 0U) || (task->rounds_done < task->rounds))
+    {
+        double round_start = local_us();
+        double elapsed;
+
+        if (task->broadcast)
+        {
+            position_real_t distance[SIM_TASK_ANCHORS_MAX];
+            coord_t coord[SIM_TASK_ANCHORS_MAX];
+
+            range_with_all(&uwb_device, task->anchors, task->anchor_count, distance, coord);
+            sim_tag_record(task, distance, local_us() - round_start);
+        }
+        for (uint8_t i = 0U; !task->broadcast && (i < task->anchor_count); i++)
+        {
+            position_real_t distance = NAN;
+            coord_t coord;
+            double start = local_us();
+            double latency;
+            uwb_result_e result;
+
+            result = range_with(&uwb_device, task->anchors[i], &distance, &coord);
+            task->attempts++;
+            if (result != UWB_OK)
+            {
+                task->failures++;
+            }
+            else
+            {
+                ranging_rounds_t rounds;
+                range_quality_t quality;
+
+                range_get_rounds(&rounds);
+                task->round_init = rounds.round_init;
+                task->round_resp = rounds.round_resp;
+                range_get_quality(&quality);
+                task->quality_fields = quality.fields;
+                task->seq = quality.seq;
+                task->seq_first = (task->ranges == 0U) ? quality.seq : task->seq_first;
+                task->nlos = quality.nlos;
+                task->fp_power = quality.fp_power;
+                task->rsl = quality.rsl;
+                task->resp_rx = quality.resp_rx;
+                latency = local_us() - start;
+                task->ranges++;
+                task->latency_sum_us += latency;
+                task->latency_max_us = (latency > task->latency_max_us) ? latency : task->latency_max_us;
+                task->distance_sum[i] += distance;
+                task->distance_count[i]++;
+            }
+        }
+        task->rounds_done++;
+
+        elapsed = local_us() - round_start;
+        if (elapsed < (double)task->period_us)
+        {
+            deca_usleep((uint32_t)((double)task->period_us - elapsed));
+        }
+    }
+}
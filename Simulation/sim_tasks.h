@@ -0,0 +1,93 @@
+/*! ----------------------------------------------------------------------------
+ * @file    sim_tasks.h
+ * @brief   Task functions for network scenarios, exported by the node library next to main_app_task()
+ *
+ * The tasks drive the application protocol code (range_with(), range_respond()) the same way main_app.c does, but
+ * take their address and schedule from the task parameter so that any number of tags can share the network. The
+ * parameter structures live in the caller's memory and the tasks write their results back into them.
+ */
+
+#ifndef SIM_TASKS_H_
+#define SIM_TASKS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIM_TASK_ANCHORS_MAX    (8U)
+
+typedef struct
+{
+    uint16_t address16;                     // replaces the deviceTable address, 0 keeps it
+    double coord[3];                        // coordinates sent in ranging responses
+    bool irq;                               // receive through the DW IC interrupt (uwb_irq_enable) instead of polling
+    uint32_t turnaround_uus;                // reply delay, 0 keeps POLL_RX_TO_RESP_TX_DLY_UUS
+    uint32_t turnaround_samples;            // range_calibrate_turnaround() over this many replies, 0 does not
+
+    bool init_failed;
+    uint32_t requests;                      // ranging requests answered, broadcast ones included
+    uint32_t turnaround_result;             // reply delay in use, updated after every request
+    uint32_t turnaround_cycles;             // longest frame to dwt_starttx() time measured, cycle counter ticks
+    uint32_t late_tx;                       // replies dwt_starttx() refused as late
+} sim_anchor_task_t;
+
+typedef struct
+{
+    uint16_t address16;                     // replaces the deviceTable address, 0 keeps it
+    uint16_t anchors[SIM_TASK_ANCHORS_MAX]; // anchors ranged with, in order, every round
+    uint8_t anchor_count;
+    uint32_t phase_us;                      // delay before the first round
+    uint32_t period_us;                     // round start to round start
+    uint32_t rounds;                        // 0 runs forever
+    bool irq;                               // receive through the DW IC interrupt (uwb_irq_enable) instead of polling
+    bool ds_twr;                            // double-sided exchanges (RANGING_DS_TWR) instead of single-sided
+    bool broadcast;                         // one broadcast request per round (range_with_all), slotted responses
+    uint8_t quality;                        // range_set_quality() parts, range_with() exchanges only
+
+    bool init_failed;
+    uint32_t rounds_done;
+    uint32_t attempts;
+    uint32_t ranges;                        // exchanges that produced a distance
+    uint32_t failures;                      // range_with() calls that gave up with UWB_RANGE_FAILED
+    double latency_sum_us;                  // range_with() or range_with_all() call to return, per distance
+    double latency_max_us;
+    double distance_sum[SIM_TASK_ANCHORS_MAX];
+    uint32_t distance_count[SIM_TASK_ANCHORS_MAX];
+    uint32_t round_init;                    // range_get_rounds() of the last successful exchange
+    uint32_t round_resp;
+    uint8_t quality_fields;                 // range_get_quality() of the last successful exchange
+    uint8_t seq;
+    uint8_t seq_first;                      // range_get_quality() sequence number of the first one
+    uint8_t nlos;
+    int16_t fp_power;
+    int16_t rsl;
+    uint32_t resp_rx;
+} sim_tag_task_t;
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_task_anchor()
+ *
+ * @brief Initialises the device and answers ranging requests forever.
+ *
+ * @param parameters - sim_anchor_task_t
+ */
+void sim_task_anchor(void *parameters);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn sim_task_tag()
+ *
+ * @brief Initialises the device and ranges with the listed anchors once per period.
+ *
+ * @param parameters - sim_tag_task_t
+ */
+void sim_task_tag(void *parameters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_TASKS_H_ */
@@ -0,0 +1,676 @@
+/*
+ * test_dw3000_sim.cc
+ *
+ * Driver and application protocol code running on the host DW3000 model.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+extern "C"
+{
+#include "dw3000_sim.h"
+#include "device_protocol.h"
+#include "shared_functions.h"
+#include "dw3000_deca_regs.h"
+}
+
+static const uint32_t ANCHOR_3_HASH = 0x1FC5135C;
+static const uint32_t TAG_5_HASH = 0xD3DB7BBD;
+
+/* Raw SPI helpers, header layout as built by dwt_xfer3xxx */
+static void raw_write(uint32_t id, uint8_t mode, const uint8_t *body, uint16_t len)
+{
+	uint16_t addr = (uint16_t)((((id >> 16) & 0x1F) << 9) | ((id & 0x7F) << 2));
+	uint8_t header[2] = { (uint8_t)(0x80 | 0x40 | (addr >> 8)), (uint8_t)((addr & 0xFF) | mode) };
+	dw3000_sim_spi.writetospi(2, header, len, body);
+}
+
+static void raw_read(uint32_t id, uint8_t *body, uint16_t len)
+{
+	uint16_t addr = (uint16_t)((((id >> 16) & 0x1F) << 9) | ((id & 0x7F) << 2));
+	uint8_t header[2] = { (uint8_t)(0x40 | (addr >> 8)), (uint8_t)(addr & 0xFF) };
+	dw3000_sim_spi.readfromspi(2, header, len, body);
+}
+
+struct TestDw3000Sim : public ::testing::Test {
+    public:
+	void SetUp() override
+	{
+		memset(&sim, 0, sizeof(sim));
+		dw3000_sim_init(&sim);
+		dw3000_sim_select(&sim);
+		port_set_dw_ic_spi_fastrate();
+	}
+
+	void TearDown() override
+	{
+		dw3000_sim_select(NULL);
+	}
+
+    protected:
+	dw3000_sim_t sim;
+};
+
+TEST_F(TestDw3000Sim, RegisterAccessModes)
+{
+	uint8_t body[8] = { 0x78, 0x56, 0x34, 0x12 };
+	uint8_t out[4];
+
+	raw_write(DREF_TIME_ID, 0, body, 4);
+	raw_read(DREF_TIME_ID, out, 4);
+	EXPECT_EQ(0, memcmp(body, out, 4));
+
+	/* FACRW: single byte header, offset 0 */
+	uint8_t fac = (uint8_t)((DEV_ID_ID >> 16) << 1);
+	dw3000_sim_spi.readfromspi(1, &fac, 4, out);
+	EXPECT_EQ(0xDECA0312u, (uint32_t)out[0] | (uint32_t)out[1] << 8 | (uint32_t)out[2] << 16 | (uint32_t)out[3] << 24);
+
+	/* AND/OR 16: keep the low nibble of each byte, set bit 15 */
+	uint8_t and_or[4] = { 0x0F, 0x0F, 0x00, 0x80 };
+	raw_write(DREF_TIME_ID, 2, and_or, 4);
+	raw_read(DREF_TIME_ID, out, 4);
+	EXPECT_EQ(0x08, out[0]);
+	EXPECT_EQ(0x86, out[1]);
+	EXPECT_EQ(0x34, out[2]);
+
+	/* SYS_STATUS event bits are write-1-to-clear */
+	uint32_t status = dw3000_sim_status(&sim);
+	ASSERT_NE(0u, status & SYS_STATUS_RCINIT_BIT_MASK);
+	uint8_t clear[4] = { 0, 0, 0, (uint8_t)(SYS_STATUS_RCINIT_BIT_MASK >> 24) };
+	raw_write(SYS_STATUS_ID, 0, clear, 4);
+	EXPECT_EQ(status & ~SYS_STATUS_RCINIT_BIT_MASK, dw3000_sim_status(&sim));
+}
+
+TEST_F(TestDw3000Sim, SystemTimeFollowsVirtualClock)
+{
+	uint8_t out[4];
+
+	raw_read(SYS_TIME_ID, out, 4);
+	uint32_t t0 = (uint32_t)out[0] | (uint32_t)out[1] << 8 | (uint32_t)out[2] << 16 | (uint32_t)out[3] << 24;
+	deca_usleep(1000);
+	raw_read(SYS_TIME_ID, out, 4);
+	uint32_t t1 = (uint32_t)out[0] | (uint32_t)out[1] << 8 | (uint32_t)out[2] << 16 | (uint32_t)out[3] << 24;
+
+	/* 1 ms is 249600 units of the high 32 bits, plus the bus time of one read */
+	EXPECT_GE(t1 - t0, 249600u);
+	EXPECT_LT(t1 - t0, 249600u + 2000u);
+}
+
+TEST_F(TestDw3000Sim, OtpIdsMatchDeviceHash)
+{
+	dw3000_sim_set_ids_for_hash(&sim, ANCHOR_3_HASH, 0x1122334455667788ULL);
+
+	uint32_t part = sim.otp[0x06];
+	uint64_t lot = ((uint64_t)sim.otp[0x0E] << 32) | sim.otp[0x0D];
+	uint8_t buf[12];
+	memcpy(buf, &part, 4);
+	memcpy(buf + 4, &lot, 8);
+
+	uint32_t hash = 0x811c9dc5;
+	for (int i = 0; i < 12; i++) {
+		hash ^= buf[i];
+		hash *= 0x01000193;
+	}
+	EXPECT_EQ(ANCHOR_3_HASH, hash);
+}
+
+/* Two nodes, one driver: the driver state is global so each node is selected before use */
+struct TestDw3000SimLink : public ::testing::Test {
+    public:
+	void SetUp() override
+	{
+		memset(&sim, 0, sizeof(sim));
+		for (int i = 0; i < 2; i++) {
+			sim[i].tx_cb = on_tx;
+			sim[i].tx_ctx = this;
+			sim[i].access_cb = on_access;
+			sim[i].access_ctx = this;
+			dw3000_sim_init(&sim[i]);
+		}
+		dw3000_sim_set_ids_for_hash(&sim[0], TAG_5_HASH, 1);
+		dw3000_sim_set_ids_for_hash(&sim[1], ANCHOR_3_HASH, 2);
+
+		for (int i = 0; i < 2; i++) {
+			dw3000_sim_select(&sim[i]);
+			memset(&dev[i], 0, sizeof(dev[i]));
+			ASSERT_EQ(UWB_OK, uwb_device_init(&dev[i]));
+		}
+	}
+
+	void TearDown() override
+	{
+		dw3000_sim_select(NULL);
+	}
+
+	void use(int i)
+	{
+		dw3000_sim_select(&sim[i]);
+		dwt_shadowinvalidate();
+	}
+
+	/* The frame reaches the other node one microsecond after it was sent, on that node's own time base */
+	static void on_tx(dw3000_sim_t *s, const uint8_t *frame, uint16_t length, uint64_t rmarker, uint64_t duration, void *ctx)
+	{
+		TestDw3000SimLink *t = (TestDw3000SimLink *)ctx;
+		(void)duration;
+		t->air.assign(frame, frame + length);
+		t->air_from = (s == &t->sim[0]) ? 0 : 1;
+		t->tx_rmarker = rmarker;
+	}
+
+	static void on_access(dw3000_sim_t *s, void *ctx)
+	{
+		TestDw3000SimLink *t = (TestDw3000SimLink *)ctx;
+		int me = (s == &t->sim[0]) ? 0 : 1;
+
+		if (!t->air.empty() && (t->air_from != me) && (s->state == DW3000_SIM_RX)) {
+			uint64_t shr;
+			(void)dw3000_sim_frame_duration(s, (uint16_t)t->air.size(), &shr);
+			t->rx_rmarker = s->now + shr + DW3000_SIM_DTU_PER_US;
+			dw3000_sim_deliver(s, t->air.data(), (uint16_t)t->air.size(), t->rx_rmarker, 0);
+			t->air.clear();
+		}
+	}
+
+    protected:
+	dw3000_sim_t sim[2];
+	uwb_device_t dev[2];
+	std::vector<uint8_t> air;
+	int air_from;
+	uint64_t tx_rmarker;
+	uint64_t rx_rmarker;
+};
+
+TEST_F(TestDw3000SimLink, InitialiseResolvesDeviceTable)
+{
+	EXPECT_EQ(TAG_5_HASH, dev[0].deviceHash);
+	EXPECT_EQ(0x0005, dev[0].address16);
+	EXPECT_EQ(ANCHOR_3_HASH, dev[1].deviceHash);
+	EXPECT_EQ(0x0003, dev[1].address16);
+	EXPECT_TRUE(dev[0].is_initialized);
+}
+
+TEST_F(TestDw3000SimLink, SendPayloadReceivePoll)
+{
+	const uint8_t payload[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	uint8_t data[64];
+	uint32_t size = 0;
+	uint16_t from = 0;
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_payload(&dev[0], dev[1].address16, payload, sizeof(payload), DWT_START_TX_IMMEDIATE));
+	uint32_t status;
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	uint32_t tx_stamp = dwt_readtxtimestamplo32();
+	EXPECT_EQ((uint32_t)tx_rmarker, tx_stamp);
+	ASSERT_EQ(9u + sizeof(payload) + 2u, air.size());
+
+	use(1);
+	ASSERT_EQ(UWB_OK, uwb_receive_poll(&dev[1], &from, data, sizeof(data), &size));
+	EXPECT_EQ(dev[0].address16, from);
+	ASSERT_EQ(sizeof(payload), size);
+	EXPECT_EQ(0, memcmp(payload, data, size));
+
+	dwt_twr_stamps_t stamps;
+	uwb_get_rx_stamps(&stamps);
+	EXPECT_EQ(rx_rmarker & DW3000_SIM_TIME_MASK, stamps.rx_stamp);
+	EXPECT_EQ(9u + sizeof(payload) + 2u, stamps.frame_len);
+}
+
+TEST_F(TestDw3000SimLink, ForeignFrameRejectedOnHeader)
+{
+	uint8_t payload[80];
+	uint8_t data[sizeof(payload) + 4];
+	uint32_t size = 0;
+	uint16_t from = 0;
+	uint32_t status;
+	uint32_t bytes[2];
+	const uint16_t to[2] = { 0x0042, dev[1].address16 };
+
+	for (size_t i = 0; i < sizeof(payload); i++) {
+		payload[i] = (uint8_t)i;
+	}
+	/* software checks only: the frame filter would not let the foreign frame through */
+	use(1);
+	dwt_configureframefilter(DWT_FF_DISABLE, 0);
+
+	/* same frame length and timing both times, only the destination differs */
+	for (int i = 0; i < 2; i++) {
+		use(0);
+		ASSERT_EQ(UWB_OK, uwb_send_payload(&dev[0], to[i], payload, sizeof(payload), DWT_START_TX_IMMEDIATE));
+		waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+
+		use(1);
+		memset(data, 0xEE, sizeof(data));
+		bytes[i] = sim[1].spi_bytes;
+		uwb_result_e result = uwb_receive_poll(&dev[1], &from, data, sizeof(data), &size);
+		bytes[i] = sim[1].spi_bytes - bytes[i];
+		if (i == 0) {
+			EXPECT_EQ(UWB_WRONG_ADDRESS, result);
+			EXPECT_EQ(0xEE, data[0]);
+		} else {
+			EXPECT_EQ(UWB_OK, result);
+		}
+	}
+
+	/* the payload is read straight into the caller's buffer and nothing past it is touched */
+	ASSERT_EQ(sizeof(payload), size);
+	EXPECT_EQ(0, memcmp(payload, data, size));
+	EXPECT_EQ(0xEE, data[sizeof(payload)]);
+	/* the foreign frame cost neither the payload nor the timestamps */
+	EXPECT_GE(bytes[1] - bytes[0], sizeof(payload));
+}
+
+TEST_F(TestDw3000SimLink, FrameFilterDropsForeignFrames)
+{
+	const uint8_t payload[] = { 1, 2, 3, 4 };
+	uint8_t data[16] = { 0 };
+	uint32_t size = 0;
+	uint16_t from = 0;
+	uint32_t status;
+	const uint16_t to[3] = { 0x0042, UWB_BROADCAST_ADDRESS, dev[1].address16 };
+	const uwb_result_e expected[3] = { UWB_TIMEOUT, UWB_OK, UWB_OK };
+
+	for (int i = 0; i < 3; i++) {
+		use(0);
+		ASSERT_EQ(UWB_OK, uwb_send_payload(&dev[0], to[i], payload, sizeof(payload), DWT_START_TX_IMMEDIATE));
+		waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+
+		use(1);
+		dwt_setrxtimeout(2000);
+		EXPECT_EQ(expected[i], uwb_receive_poll(&dev[1], &from, data, sizeof(data), &size)) << "destination " << to[i];
+	}
+	/* the foreign frame never raised RXFCG, the receiver stayed on until the timeout */
+	EXPECT_EQ(1u, sim[1].frames_rejected);
+	EXPECT_EQ(2u, sim[1].frames_received);
+	EXPECT_EQ(0u, dwt_readsysstatuslo() & DWT_INT_ARFE_BIT_MASK);
+
+	/* a different PAN is dropped as well */
+	dev[0].panID = 0x1234;
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_payload(&dev[0], dev[1].address16, payload, sizeof(payload), DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	use(1);
+	EXPECT_EQ(UWB_TIMEOUT, uwb_receive_poll(&dev[1], &from, data, sizeof(data), &size));
+	EXPECT_EQ(2u, sim[1].frames_rejected);
+}
+
+TEST_F(TestDw3000SimLink, DelayedTxInThePastFails)
+{
+	use(0);
+	uint32_t now = dwt_readsystimestamphi32();
+	dwt_setdelayedtrxtime(now - 1000);
+	EXPECT_EQ(DWT_ERROR, dwt_starttx(DWT_START_TX_DELAYED));
+	EXPECT_EQ(DW3000_SIM_IDLE, sim[0].state);
+}
+
+TEST_F(TestDw3000SimLink, DelayedTxHitsProgrammedTime)
+{
+	const uint8_t frame[12] = { 0x41, 0x88 };
+
+	use(0);
+	uint32_t at = dwt_readsystimestamphi32() + 2000000; /* ~8 ms ahead */
+	dwt_writetxdata(sizeof(frame), (uint8_t *)frame, 0);
+	dwt_writetxfctrl(sizeof(frame), 0, 1);
+	dwt_setdelayedtrxtime(at);
+	ASSERT_EQ(DWT_SUCCESS, dwt_starttx(DWT_START_TX_DELAYED));
+
+	uint32_t status;
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	uint64_t expected = ((uint64_t)(at & ~1u) << 8) + dev[0].tx_ant_dly;
+	EXPECT_EQ((uint32_t)expected, dwt_readtxtimestamplo32());
+}
+
+TEST_F(TestDw3000SimLink, RxFrameWaitTimeout)
+{
+	use(1);
+	uint64_t start = sim[1].now;
+	dwt_setrxtimeout(500);
+	dwt_rxenable(DWT_START_RX_IMMEDIATE);
+
+	uint32_t status;
+	waitforsysstatus(&status, NULL, DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO, 0);
+	EXPECT_NE(0u, status & SYS_STATUS_RXFTO_BIT_MASK);
+	EXPECT_GE(sim[1].now - start, 500 * DW3000_SIM_DTU_PER_UUS);
+	EXPECT_EQ(DW3000_SIM_IDLE, sim[1].state);
+}
+
+TEST_F(TestDw3000SimLink, RxPreambleDetectTimeout)
+{
+	use(1);
+	uint64_t start = sim[1].now;
+	dwt_setrxtimeout(0);
+	dwt_setpreambledetecttimeout(20);
+	dwt_rxenable(DWT_START_RX_IMMEDIATE);
+
+	uint32_t status;
+	waitforsysstatus(&status, NULL, DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO, 0);
+	EXPECT_NE(0u, status & SYS_STATUS_RXPTO_BIT_MASK);
+	EXPECT_EQ(0u, status & SYS_STATUS_RXFTO_BIT_MASK);
+	/* 20 PAC of 8 preamble symbols */
+	EXPECT_GE(sim[1].now - start, 20u * 8u * 65024u);
+	EXPECT_EQ(DW3000_SIM_IDLE, sim[1].state);
+}
+
+TEST_F(TestDw3000SimLink, InterruptDrivenReceive)
+{
+	const uint8_t payload[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	uint8_t data[64];
+	uint32_t size = 0;
+	uint16_t from = 0;
+	uint32_t status;
+
+	use(1);
+	ASSERT_EQ(UWB_NOT_CONFIGURED, uwb_receive_timeout(&dev[1], &from, data, sizeof(data), &size, 5));
+	ASSERT_EQ(UWB_OK, uwb_irq_enable(&dev[1]));
+	EXPECT_FALSE(dw3000_sim_irq(&sim[1]));
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_payload(&dev[0], dev[1].address16, payload, sizeof(payload), DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+
+	use(1);
+	ASSERT_EQ(UWB_OK, uwb_receive_timeout(&dev[1], &from, data, sizeof(data), &size, 5));
+	EXPECT_EQ(dev[0].address16, from);
+	ASSERT_EQ(sizeof(payload), size);
+	EXPECT_EQ(0, memcmp(payload, data, size));
+	EXPECT_FALSE(dw3000_sim_irq(&sim[1]));
+
+	dwt_twr_stamps_t stamps;
+	uwb_get_rx_stamps(&stamps);
+	EXPECT_EQ(rx_rmarker & DW3000_SIM_TIME_MASK, stamps.rx_stamp);
+	EXPECT_EQ(9u + sizeof(payload) + 2u, stamps.frame_len);
+
+	/* nothing on air: the task sleeps through the timeout instead of polling SYS_STATUS */
+	uint64_t start = sim[1].now;
+	uint32_t transactions = sim[1].spi_transactions;
+	EXPECT_EQ(UWB_TIMEOUT, uwb_receive_timeout(&dev[1], &from, data, sizeof(data), &size, 5));
+	EXPECT_GE(sim[1].now - start, 5 * DW3000_SIM_DTU_PER_SEC / 1000);
+	EXPECT_LT(sim[1].now - start, 6 * DW3000_SIM_DTU_PER_SEC / 1000);
+	EXPECT_LT(sim[1].spi_transactions - transactions, 10u);
+	EXPECT_EQ(DW3000_SIM_IDLE, sim[1].state);
+	EXPECT_EQ(0u, uwb_get_dropped_events());
+}
+
+TEST_F(TestDw3000SimLink, SendMsgReceiveMsg)
+{
+	uwb_msg_t msg, rx;
+	uint16_t from = 0;
+	uint32_t status;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command_type = COMMAND_RANGING_RESPONSE;
+	msg.rx_ts = 0xFFFFF00000ULL;
+	msg.tx_ts = 0x0000100000ULL;	/* after the 40-bit wrap */
+	msg.rx_seq = 0xA5;
+	msg.coord.x = 1.234;
+	msg.coord.y = -0.5;
+	msg.coord.z = 2.0;
+	msg.result = UWB_OK;
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_msg(&dev[0], dev[1].address16, &msg, DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	/* 2 + 6 + 4 + 12 bytes instead of the 48 of the packed struct */
+	ASSERT_EQ(9u + 24u + 2u, air.size());
+
+	use(1);
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[1], &from, &rx));
+	EXPECT_EQ(dev[0].address16, from);
+	EXPECT_EQ(COMMAND_RANGING_RESPONSE, rx.command_type);
+	EXPECT_EQ(msg.rx_ts, rx.rx_ts);
+	EXPECT_EQ(msg.rx_seq, rx.rx_seq);
+	EXPECT_EQ(msg.tx_ts, rx.tx_ts);
+	EXPECT_NEAR(1.234, rx.coord.x, 1e-6);	/* rounded to a float coordinate in the single precision build */
+	EXPECT_DOUBLE_EQ(-0.5, rx.coord.y);
+	EXPECT_DOUBLE_EQ(2.0, rx.coord.z);
+	EXPECT_EQ(UWB_OK, rx.result);
+}
+
+TEST_F(TestDw3000SimLink, RepeatedFramesDropped)
+{
+	uwb_msg_t msg, rx;
+	uint16_t from = 0;
+	uint32_t status;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command_type = COMMAND_RANGING_REQUEST;
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_msg(&dev[0], dev[1].address16, &msg, DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	std::vector<uint8_t> first = air;
+
+	use(1);
+	uint32_t duplicates = uwb_get_duplicate_frames();
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[1], &from, &rx));
+
+	/* a retransmission of the same frame */
+	air = first;
+	EXPECT_EQ(UWB_DUPLICATE, uwb_receive_msg(&dev[1], &from, &rx));
+	EXPECT_EQ(duplicates + 1, uwb_get_duplicate_frames());
+
+	/* the next one passes, after it the first is stale */
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_msg(&dev[0], dev[1].address16, &msg, DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	EXPECT_EQ((uint8_t)(first[2] + 1), air[2]);
+	use(1);
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[1], &from, &rx));
+	air = first;
+	EXPECT_EQ(UWB_DUPLICATE, uwb_receive_msg(&dev[1], &from, &rx));
+
+	/* broadcasts count apart, the first one is not taken for a unicast seen before */
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_msg(&dev[0], UWB_BROADCAST_ADDRESS, &msg, DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	use(1);
+	EXPECT_EQ(UWB_OK, uwb_receive_msg(&dev[1], &from, &rx));
+	EXPECT_EQ(duplicates + 2, uwb_get_duplicate_frames());
+}
+
+TEST_F(TestDw3000SimLink, StagedResponsePatchesOnlyTimestamps)
+{
+	uwb_msg_t msg, rx;
+	uint16_t from = 0;
+	uint32_t status;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command_type = COMMAND_RANGING_RESPONSE;
+	msg.coord.x = 3.5;
+
+	use(1);
+	EXPECT_EQ(COMMAND_NOTHING, uwb_get_staged_command(UWB_TX_SLOT_RESPONSE));
+	ASSERT_EQ(UWB_OK, uwb_stage_msg(&dev[1], UWB_TX_SLOT_RESPONSE, &msg));
+	EXPECT_EQ(COMMAND_RANGING_RESPONSE, uwb_get_staged_command(UWB_TX_SLOT_RESPONSE));
+	/* the same template again costs no SPI */
+	uint32_t bytes = sim[1].spi_bytes;
+	ASSERT_EQ(UWB_OK, uwb_stage_msg(&dev[1], UWB_TX_SLOT_RESPONSE, &msg));
+	EXPECT_EQ(bytes, sim[1].spi_bytes);
+
+	bytes = sim[1].spi_bytes;
+	ASSERT_EQ(UWB_OK, uwb_send_staged(&dev[1], UWB_TX_SLOT_RESPONSE, dev[0].address16, 7, 0x0123456789ULL, 0x0123556789ULL, DWT_START_TX_IMMEDIATE));
+	uint32_t staged_bytes = sim[1].spi_bytes - bytes;
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	ASSERT_EQ(9u + 24u + 2u, air.size());
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[0], &from, &rx));
+	EXPECT_EQ(dev[1].address16, from);
+	EXPECT_EQ(COMMAND_RANGING_RESPONSE, rx.command_type);
+	EXPECT_EQ(0x0123456789ULL, rx.rx_ts);
+	EXPECT_EQ(7u, rx.rx_seq);
+	EXPECT_EQ(0x0123556789ULL, rx.tx_ts);
+	EXPECT_DOUBLE_EQ(3.5, rx.coord.x);
+
+	/* the whole message for comparison */
+	use(1);
+	msg.rx_ts = 0x0123456789ULL;
+	msg.tx_ts = 0x0123556789ULL;
+	msg.rx_seq = 7;
+	bytes = sim[1].spi_bytes;
+	ASSERT_EQ(UWB_OK, uwb_send_msg(&dev[1], dev[0].address16, &msg, DWT_START_TX_IMMEDIATE));
+	EXPECT_LT(staged_bytes + 12u, sim[1].spi_bytes - bytes);
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[0], &from, &rx));
+
+	/* it went behind the slots, the template is still there */
+	use(1);
+	EXPECT_EQ(COMMAND_RANGING_RESPONSE, uwb_get_staged_command(UWB_TX_SLOT_RESPONSE));
+	ASSERT_EQ(UWB_OK, uwb_send_staged(&dev[1], UWB_TX_SLOT_RESPONSE, dev[0].address16, 8, 0x0000001000ULL, 0x0000002000ULL, DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[0], &from, &rx));
+	EXPECT_EQ(COMMAND_RANGING_RESPONSE, rx.command_type);
+	EXPECT_EQ(8u, rx.rx_seq);
+	EXPECT_EQ(0x0000002000ULL, rx.tx_ts);
+	EXPECT_DOUBLE_EQ(3.5, rx.coord.x);
+
+	use(1);
+	EXPECT_EQ(UWB_NOT_CONFIGURED, uwb_send_staged(&dev[1], UWB_TX_SLOT_FINAL, dev[0].address16, 0, 0, 0, DWT_START_TX_IMMEDIATE));
+	EXPECT_EQ(UWB_INVALID_PARAM, uwb_stage_msg(&dev[1], UWB_TX_SLOTS, &msg));
+}
+
+TEST_F(TestDw3000SimLink, ResidentFramesSwitchWithoutRewrite)
+{
+	uwb_msg_t request, announce, rx;
+	uint16_t from = 0;
+	uint32_t status;
+
+	memset(&request, 0, sizeof(request));
+	request.command_type = COMMAND_RANGING_REQUEST;
+	memset(&announce, 0, sizeof(announce));
+	announce.command_type = COMMAND_POSITION_ANNOUNCEMENT;
+	announce.coord.y = -1.25;
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_stage_msg(&dev[0], UWB_TX_SLOT_REQUEST, &request));
+	/* any message fits any slot, this one is directly addressable like the request slot */
+	ASSERT_EQ(UWB_OK, uwb_stage_msg(&dev[0], UWB_TX_SLOT_FINAL, &announce));
+
+	const uwb_tx_slot_e order[] = { UWB_TX_SLOT_REQUEST, UWB_TX_SLOT_REQUEST, UWB_TX_SLOT_FINAL, UWB_TX_SLOT_REQUEST };
+	uint32_t cost[4];
+
+	for (int i = 0; i < 4; i++) {
+		use(0);
+		uint32_t bytes = sim[0].spi_bytes;
+		ASSERT_EQ(UWB_OK, uwb_send_staged(&dev[0], order[i], dev[1].address16, 0, 0, 0, DWT_START_TX_IMMEDIATE));
+		cost[i] = sim[0].spi_bytes - bytes;
+		waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+
+		use(1);
+		ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[1], &from, &rx));
+		EXPECT_EQ(dev[0].address16, from);
+		if (order[i] == UWB_TX_SLOT_REQUEST) {
+			EXPECT_EQ(COMMAND_RANGING_REQUEST, rx.command_type);
+		}
+		else {
+			EXPECT_EQ(COMMAND_POSITION_ANNOUNCEMENT, rx.command_type);
+			EXPECT_DOUBLE_EQ(-1.25, rx.coord.y);
+		}
+	}
+	/* the same frame again skips the frame control, switching costs the same for a 2 and a 14 byte message.
+	 * The first frame to a peer also reads the clock for its sequence number */
+	EXPECT_LT(cost[1], cost[3]);
+	EXPECT_LT(cost[3], cost[0]);
+	EXPECT_EQ(cost[2], cost[3]);
+
+	/* a frame of uwb_send_payload() leaves both intact */
+	const uint8_t payload[] = { 9, 8, 7 };
+	uint8_t data[16];
+	uint32_t size = 0;
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_payload(&dev[0], dev[1].address16, payload, sizeof(payload), DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	use(1);
+	ASSERT_EQ(UWB_OK, uwb_receive_poll(&dev[1], &from, data, sizeof(data), &size));
+	ASSERT_EQ(sizeof(payload), size);
+	EXPECT_EQ(0, memcmp(payload, data, size));
+
+	use(0);
+	ASSERT_EQ(UWB_OK, uwb_send_staged(&dev[0], UWB_TX_SLOT_FINAL, dev[1].address16, 0, 0, 0, DWT_START_TX_IMMEDIATE));
+	waitforsysstatus(&status, NULL, DWT_INT_TXFRS_BIT_MASK, 0);
+	use(1);
+	ASSERT_EQ(UWB_OK, uwb_receive_msg(&dev[1], &from, &rx));
+	EXPECT_EQ(COMMAND_POSITION_ANNOUNCEMENT, rx.command_type);
+	EXPECT_DOUBLE_EQ(-1.25, rx.coord.y);
+}
+
+TEST(TestUwbMsg, OnlyTheFieldsTheCommandNeeds)
+{
+	uwb_msg_t msg, rx;
+	uint8_t buf[UWB_MSG_MAX_LEN];
+
+	memset(&msg, 0, sizeof(msg));
+	msg.rx_ts = 1000;
+	msg.tx_ts = 2000;
+	msg.coord.x = 1.0;
+
+	msg.command_type = COMMAND_RANGING_REQUEST;
+	EXPECT_EQ(2u, uwb_msg_encode(&msg, buf));
+	msg.command_type = COMMAND_DS_RESPONSE;
+	EXPECT_EQ(12u, uwb_msg_encode(&msg, buf));
+	msg.command_type = COMMAND_POSITION_ANNOUNCEMENT_GN;
+	ASSERT_EQ(14u, uwb_msg_encode(&msg, buf));
+	ASSERT_EQ(UWB_OK, uwb_msg_decode(buf, 14, &rx));
+	EXPECT_EQ(COMMAND_POSITION_ANNOUNCEMENT_GN, rx.command_type);
+	EXPECT_EQ(0u, rx.rx_ts);
+	EXPECT_DOUBLE_EQ(1.0, rx.coord.x);
+
+	/* a failure result costs one byte */
+	msg.result = UWB_TIMEOUT;
+	ASSERT_EQ(15u, uwb_msg_encode(&msg, buf));
+	ASSERT_EQ(UWB_OK, uwb_msg_decode(buf, 15, &rx));
+	EXPECT_EQ(UWB_TIMEOUT, rx.result);
+
+	msg.command_type = (uwb_command_e)200;
+	EXPECT_EQ(0u, uwb_msg_encode(&msg, buf));
+}
+
+TEST(TestUwbMsg, TimestampOffsets)
+{
+	uwb_msg_t msg, rx;
+	uint8_t buf[UWB_MSG_MAX_LEN];
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command_type = COMMAND_DS_REPORT;
+	/* the report carries the response TX, earlier than the final RX */
+	msg.rx_ts = 0x0012345678ULL;
+	msg.tx_ts = 0x0012000000ULL;
+	ASSERT_EQ(24u, uwb_msg_encode(&msg, buf));
+	ASSERT_EQ(UWB_OK, uwb_msg_decode(buf, 24, &rx));
+	EXPECT_EQ(msg.rx_ts, rx.rx_ts);
+	EXPECT_EQ(msg.tx_ts, rx.tx_ts);
+
+	/* seconds apart the offset does not fit 32 bits, the full timestamp goes instead */
+	msg.tx_ts = 0xF000000000ULL;
+	ASSERT_EQ(25u, uwb_msg_encode(&msg, buf));
+	ASSERT_EQ(UWB_OK, uwb_msg_decode(buf, 25, &rx));
+	EXPECT_EQ(msg.tx_ts, rx.tx_ts);
+}
+
+TEST(TestUwbMsg, MalformedMessagesRejected)
+{
+	uwb_msg_t msg, rx;
+	uint8_t buf[UWB_MSG_MAX_LEN];
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command_type = COMMAND_RANGING_RESPONSE;
+	msg.coord.x = NAN;
+	msg.coord.y = 1e12;
+	ASSERT_EQ(24u, uwb_msg_encode(&msg, buf));
+	ASSERT_EQ(UWB_OK, uwb_msg_decode(buf, 24, &rx));
+	EXPECT_LT(rx.coord.x, -2e6);
+	EXPECT_GT(rx.coord.y, 2e6);
+
+	EXPECT_EQ(UWB_COMM_ERROR, uwb_msg_decode(buf, 23, &rx));
+	EXPECT_EQ(UWB_COMM_ERROR, uwb_msg_decode(buf, 1, &rx));
+	buf[0] = (uint8_t)((buf[0] & 0x1F) | ((UWB_MSG_VERSION + 1) << 5));
+	EXPECT_EQ(UWB_COMM_ERROR, uwb_msg_decode(buf, 24, &rx));
+}
@@ -0,0 +1,275 @@
+/*
+ * test_multilateration.cc
+ *
+ * Position solvers of the tag.
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+extern "C"
+{
+#include "multilateration.h"
+}
+
+/* Ceiling and wall anchors of a 10 x 8 x 3 m room */
+static const coord_t room[12] = {
+	{ 0.0, 0.0, 2.8 }, { 10.0, 0.0, 2.5 }, { 10.0, 8.0, 2.9 }, { 0.0, 8.0, 0.4 },
+	{ 5.0, 0.0, 0.5 }, { 10.0, 4.0, 1.2 }, { 5.0, 8.0, 2.2 }, { 0.0, 4.0, 1.6 },
+	{ 2.5, 2.0, 3.0 }, { 7.5, 6.0, 3.0 }, { 7.5, 2.0, 0.2 }, { 2.5, 6.0, 0.3 },
+};
+
+/* Error of a solve on exact ranges, position_real_t rounding over a room of this size */
+#ifdef POSITION_SINGLE_PRECISION
+static const double EXACT_M = 1e-5;
+#else
+static const double EXACT_M = 1e-6;
+#endif
+/* Two solvers of the same linear system */
+#ifdef POSITION_SINGLE_PRECISION
+static const double SAME_M = 1e-5;
+#else
+static const double SAME_M = 1e-9;
+#endif
+
+static double distance(const coord_t &a, const coord_t &p)
+{
+	return sqrt((a.x - p.x) * (a.x - p.x) + (a.y - p.y) * (a.y - p.y) + (a.z - p.z) * (a.z - p.z));
+}
+
+TEST(TestMultilat, ExactRangesMatchFourAnchorSolver)
+{
+	const coord_t tag = { 3.2, 4.7, 1.1 };
+	position_real_t distances[4];
+	coord_t est, gn;
+	multilat_work_t work;
+
+	for (int i = 0; i < 4; i++)
+	{
+		distances[i] = distance(room[i], tag);
+	}
+	ASSERT_TRUE(multilat_wls(room, distances, NULL, 4, &work, &est));
+	multilat_gauss_iter_matrix(room, distances, &gn);
+
+	EXPECT_LT(distance(est, tag), EXACT_M);
+	EXPECT_LT(distance(est, gn), EXACT_M);
+	EXPECT_EQ(work.used, 4u);
+	EXPECT_LE(work.iterations, MULTILAT_ITER_MAX);
+	EXPECT_TRUE(work.converged);
+	EXPECT_LT(work.rms, EXACT_M);
+}
+
+TEST(TestMultilat, LinearPivotOnMagnitude)
+{
+	/* a bench rig within half a metre: the first two anchors share x, which leaves a zero pivot after the
+	   first elimination and every other candidate below 1 in magnitude */
+	const coord_t anchors[4] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.4, 0.1 }, { 0.4, 0.0, 0.2 }, { 0.2, 0.3, 0.45 } };
+	const coord_t tag = { 0.15, 0.1, 0.2 };
+	position_real_t distances[4];
+	coord_t est;
+
+	for (int i = 0; i < 4; i++)
+	{
+		distances[i] = distance(anchors[i], tag);
+	}
+	multilat_aprox_matrix(anchors, distances, &est);
+	ASSERT_TRUE(std::isfinite(est.x) && std::isfinite(est.y) && std::isfinite(est.z));
+	EXPECT_LT(distance(est, tag), 1e-4);
+}
+
+TEST(TestMultilat, NearlyCoplanarAnchorsConverge)
+{
+	/* ceiling anchors within 6 cm of one plane, the height is barely observable */
+	coord_t anchors[8];
+	const coord_t tag = { 3.7, 2.9, 1.2 };
+	const double noise[8] = { 0.02, -0.03, 0.01, 0.04, -0.02, 0.0, 0.03, -0.01 };
+	position_real_t distances[8];
+	coord_t est, gn;
+	multilat_work_t work;
+
+	for (int i = 0; i < 8; i++)
+	{
+		anchors[i] = room[i];
+		anchors[i].z = 2.5 + 0.02 * (i % 4);
+		distances[i] = distance(anchors[i], tag) + noise[i];
+	}
+	ASSERT_TRUE(multilat_wls(anchors, distances, NULL, 8, &work, &est));
+	EXPECT_TRUE(work.converged);
+	EXPECT_LT(work.iterations, MULTILAT_ITER_MAX);
+	/* above or below the plane the ranges cannot tell, the floor plan they can */
+	EXPECT_NEAR(est.x, tag.x, 0.1);
+	EXPECT_NEAR(est.y, tag.y, 0.1);
+	EXPECT_LT(work.rms, 0.05);
+
+	/* the four anchor solver no longer gives up on the singular step, it ends on the ranges */
+	multilat_gauss_iter_matrix(anchors, distances, &gn);
+	ASSERT_TRUE(std::isfinite(gn.x) && std::isfinite(gn.y) && std::isfinite(gn.z));
+	for (int i = 0; i < 4; i++)
+	{
+		EXPECT_NEAR(distance(anchors[i], gn), distances[i], 0.05);
+	}
+}
+
+TEST(TestMultilat, MissingAndUnweightedRangesLeftOut)
+{
+	const coord_t tag = { 6.0, 2.5, 1.4 };
+	position_real_t distances[6], weights[6];
+	coord_t est = { -1.0, -1.0, -1.0 };
+	multilat_work_t work;
+
+	for (int i = 0; i < 6; i++)
+	{
+		distances[i] = distance(room[i], tag);
+		weights[i] = 1.0;
+	}
+	/* no answer from one anchor, a multipath range from another that its quality weighed out */
+	distances[1] = NAN;
+	distances[4] += 3.0;
+	weights[4] = 0.0;
+
+	ASSERT_TRUE(multilat_wls(room, distances, weights, 6, &work, &est));
+	EXPECT_EQ(work.used, 4u);
+	EXPECT_LT(distance(est, tag), EXACT_M);
+	EXPECT_TRUE(std::isnan(work.residual[1]));
+	EXPECT_TRUE(std::isnan(work.residual[4]));
+
+	/* one more gone and nothing is left to solve with */
+	coord_t before = est;
+	weights[0] = 0.0;
+	EXPECT_FALSE(multilat_wls(room, distances, weights, 6, &work, &est));
+	EXPECT_EQ(work.used, 3u);
+	EXPECT_EQ(est.x, before.x);
+	EXPECT_FALSE(multilat_wls(room, distances, NULL, MULTILAT_ANCHORS_MAX + 1, &work, &est));
+}
+
+TEST(TestMultilat, MoreAnchorsAndWeightsImproveAccuracy)
+{
+	std::mt19937 rng(21);
+	std::normal_distribution<double> noise(0.0, 1.0);
+	std::uniform_real_distribution<double> place(0.0, 1.0);
+	const double sigma[12] = { 0.05, 0.05, 0.05, 0.05, 0.05, 0.30, 0.05, 0.30, 0.05, 0.30, 0.05, 0.30 };
+	double error4 = 0.0, error12 = 0.0, error12_weighted = 0.0;
+	const int trials = 300;
+
+	for (int t = 0; t < trials; t++)
+	{
+		const coord_t tag = { (position_real_t)(1.0 + 8.0 * place(rng)), (position_real_t)(1.0 + 6.0 * place(rng)), (position_real_t)(0.3 + 2.2 * place(rng)) };
+		position_real_t distances[12], weights[12];
+		coord_t est;
+		multilat_work_t work;
+
+		for (int i = 0; i < 12; i++)
+		{
+			/* the first four are the precise ones */
+			distances[i] = distance(room[i], tag) + sigma[i] * noise(rng);
+			weights[i] = 1.0 / (sigma[i] * sigma[i]);
+		}
+		ASSERT_TRUE(multilat_wls(room, distances, NULL, 4, &work, &est));
+		error4 += distance(est, tag) / trials;
+		ASSERT_TRUE(multilat_wls(room, distances, NULL, 12, &work, &est));
+		error12 += distance(est, tag) / trials;
+		ASSERT_TRUE(multilat_wls(room, distances, weights, 12, &work, &est));
+		error12_weighted += distance(est, tag) / trials;
+		EXPECT_LE(work.iterations, MULTILAT_ITER_MAX);
+	}
+	EXPECT_LT(error12_weighted, 0.8 * error4);
+	EXPECT_LT(error12_weighted, 0.8 * error12);
+}
+
+TEST(TestMultilat, SolveTimeBounded)
+{
+	const coord_t tag = { 4.4, 3.3, 1.0 };
+	position_real_t distances[12];
+	coord_t est;
+	multilat_work_t work;
+	const int solves = 2000;
+	int iterations_max = 0;
+
+	for (int i = 0; i < 12; i++)
+	{
+		distances[i] = distance(room[i], tag) + 0.02 * ((i % 3) - 1);
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < solves; i++)
+	{
+		ASSERT_TRUE(multilat_wls(room, distances, NULL, 12, &work, &est));
+		iterations_max = std::max(iterations_max, (int)work.iterations);
+	}
+	double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / solves;
+	RecordProperty("solve_us", std::to_string(us));
+
+	EXPECT_LT(iterations_max, MULTILAT_ITER_MAX);
+	EXPECT_LT(us, 100.0);
+	EXPECT_LT(distance(est, tag), 0.05);
+}
+
+TEST(TestMultilat, CachedGeometryMatchesLinearSolver)
+{
+	const coord_t tag = { 7.1, 5.2, 1.3 };
+	const double noise[12] = { 0.03, -0.02, 0.05, 0.01, -0.04, 0.02, 0.0, -0.01, 0.03, -0.03, 0.02, 0.01 };
+	position_real_t distances[12];
+	coord_t est, linear;
+	multilat_geometry_t geometry;
+
+	for (int i = 0; i < 12; i++)
+	{
+		distances[i] = distance(room[i], tag) + noise[i];
+	}
+	multilat_geometry_invalidate(&geometry);
+	EXPECT_FALSE(multilat_geometry_solve(&geometry, distances, &est));
+
+	/* four anchors: the inverse of the same system */
+	ASSERT_TRUE(multilat_geometry_set(&geometry, room, 4));
+	ASSERT_TRUE(multilat_geometry_solve(&geometry, distances, &est));
+	multilat_aprox_matrix(room, distances, &linear);
+	EXPECT_LT(distance(est, linear), SAME_M);
+
+	/* twelve: least squares, exact ranges give the exact position */
+	for (int i = 0; i < 12; i++)
+	{
+		distances[i] = distance(room[i], tag);
+	}
+	ASSERT_TRUE(multilat_geometry_set(&geometry, room, 12));
+	ASSERT_TRUE(multilat_geometry_solve(&geometry, distances, &est));
+	EXPECT_LT(distance(est, tag), EXACT_M);
+
+	/* a missing range changes the system, the cached one does not apply */
+	distances[3] = NAN;
+	EXPECT_FALSE(multilat_geometry_solve(&geometry, distances, &est));
+}
+
+TEST(TestMultilat, CachedGeometryFactorisedOnlyWhenAnchorsMove)
+{
+	coord_t anchors[4] = { room[0], room[1], room[2], room[3] };
+	const coord_t tag = { 4.0, 4.0, 1.5 };
+	position_real_t distances[4];
+	coord_t est;
+	multilat_geometry_t geometry;
+
+	multilat_geometry_invalidate(&geometry);
+	ASSERT_TRUE(multilat_geometry_set(&geometry, anchors, 4));
+	/* the same anchors again keep the factorisation as it is, marked here */
+	geometry.pinv[0][0] = 12345.0;
+	ASSERT_TRUE(multilat_geometry_set(&geometry, anchors, 4));
+	EXPECT_EQ(geometry.pinv[0][0], 12345.0);
+
+	/* an anchor announced a new position */
+	anchors[3].z = 1.0;
+	ASSERT_TRUE(multilat_geometry_set(&geometry, anchors, 4));
+	EXPECT_NE(geometry.pinv[0][0], 12345.0);
+	for (int i = 0; i < 4; i++)
+	{
+		distances[i] = distance(anchors[i], tag);
+	}
+	ASSERT_TRUE(multilat_geometry_solve(&geometry, distances, &est));
+	EXPECT_LT(distance(est, tag), EXACT_M);
+
+	/* all in one plane: no linear solution */
+	anchors[0].z = anchors[1].z = anchors[2].z = anchors[3].z = 2.5;
+	EXPECT_FALSE(multilat_geometry_set(&geometry, anchors, 4));
+	EXPECT_FALSE(multilat_geometry_solve(&geometry, distances, &est));
+	EXPECT_FALSE(multilat_geometry_set(&geometry, anchors, 3));
+}
@@ -0,0 +1,92 @@
+/*
+ * test_range_stats.cc
+ *
+ * Online distance estimator used by the anchor self positioning.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+
+extern "C"
+{
+#include "range_stats.h"
+}
+
+TEST(TestRangeStats, WelfordMatchesTwoPass)
+{
+	const double samples[] = { 3.012, 2.998, 3.005, 3.020, 2.987, 3.001, 3.009 };
+	const unsigned n = sizeof(samples) / sizeof(samples[0]);
+	range_stats_t stats;
+	double mean = 0.0, var = 0.0;
+
+	range_stats_init(&stats, 0.0);
+	for (unsigned i = 0; i < n; i++)
+	{
+		EXPECT_TRUE(range_stats_add(&stats, samples[i]));
+		mean += samples[i] / n;
+	}
+	for (unsigned i = 0; i < n; i++)
+	{
+		var += (samples[i] - mean) * (samples[i] - mean) / (n - 1);
+	}
+
+	EXPECT_EQ(stats.count, n);
+	EXPECT_NEAR(range_stats_mean(&stats), mean, 1e-12);
+	EXPECT_NEAR(range_stats_variance(&stats), var, 1e-12);
+	EXPECT_NEAR(range_stats_ci95(&stats), 1.96 * sqrt(var / n), 1e-12);
+	EXPECT_DOUBLE_EQ(range_stats_median(&stats, NULL), 3.005);
+}
+
+TEST(TestRangeStats, OutlierRejectedByMad)
+{
+	range_stats_t stats;
+	double mad;
+
+	range_stats_init(&stats, 3.0);
+	for (int i = 0; i < 10; i++)
+	{
+		EXPECT_TRUE(range_stats_add(&stats, 2.0 + 0.01 * ((i % 3) - 1)));
+	}
+	/* a multipath range 60 cm long */
+	EXPECT_FALSE(range_stats_add(&stats, 2.6));
+	EXPECT_EQ(stats.rejected, 1u);
+	EXPECT_EQ(stats.count, 10u);
+	EXPECT_NEAR(range_stats_mean(&stats), 2.0, 0.005);
+	EXPECT_DOUBLE_EQ(range_stats_median(&stats, &mad), 2.0);
+	EXPECT_NEAR(mad, 1.4826 * 0.01, 1e-9);
+}
+
+TEST(TestRangeStats, IdenticalRangesDoNotRejectEverything)
+{
+	range_stats_t stats;
+
+	range_stats_init(&stats, 3.0);
+	for (int i = 0; i < 10; i++)
+	{
+		range_stats_add(&stats, 1.5);
+	}
+	/* one timestamp tick further, within the MAD floor */
+	EXPECT_TRUE(range_stats_add(&stats, 1.5047));
+}
+
+TEST(TestRangeStats, ConvergesAfterFewerSamplesThanFixedCount)
+{
+	std::mt19937 rng(7);
+	std::normal_distribution<double> noise(0.0, 0.02);
+	range_stats_t stats;
+	unsigned n = 0;
+
+	range_stats_init(&stats, 3.0);
+	while (!range_stats_converged(&stats, 10, 0.005) && n < 1000)
+	{
+		range_stats_add(&stats, 4.0 + noise(rng));
+		n++;
+	}
+
+	/* 2 cm noise needs about (1.96 * 0.02 / 0.005)^2 = 61 ranges, not 1000 */
+	EXPECT_LT(n, 120u);
+	EXPECT_NEAR(range_stats_mean(&stats), 4.0, 0.01);
+	EXPECT_FALSE(range_stats_converged(&stats, n + 1, 0.005));
+}
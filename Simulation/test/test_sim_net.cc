@@ -0,0 +1,673 @@
+/*
+ * test_sim_net.cc
+ *
+ * Several nodes running the driver and application code on one simulated network.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <map>
+
+extern "C"
+{
+#include "sim_net.h"
+#include "sim_tasks.h"
+#include "device_protocol.h"
+#include "position_protocol.h"
+#include "main_app.h"
+}
+
+static const uint32_t ANCHOR_HASH[4] = { 0x1A0AB824, 0xF059DE36, 0x1FC5135C, 0x4BB919FB };
+static const uint32_t TAG_5_HASH = 0xD3DB7BBD;
+static const double ANCHOR_POS[4][3] = { { 0, 0, 0 }, { 4, 0, 0 }, { 2, 4, 0 }, { 2, 2, 2 } };
+
+/* 0x41 0x88, sequence number, PAN ID, destination, source */
+static const uint16_t FRAME_HEADER_LEN = 9;
+
+struct TestSimNet : public ::testing::Test {
+    public:
+	void SetUp() override
+	{
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.node_library = SIM_NODE_LIBRARY;
+		cfg.seed = 1;
+		net = NULL;
+	}
+
+	void TearDown() override
+	{
+		sim_net_destroy(net);
+	}
+
+	void create()
+	{
+		net = sim_net_create(&cfg);
+		ASSERT_NE(net, nullptr);
+	}
+
+	int add_anchor(int i, sim_anchor_task_t *task, double ppm = 0.0)
+	{
+		sim_node_cfg_t node;
+
+		memset(&node, 0, sizeof(node));
+		node.entry = "sim_task_anchor";
+		node.arg = task;
+		node.device_hash = ANCHOR_HASH[i];
+		node.ppm = ppm;
+		memcpy(node.pos, ANCHOR_POS[i], sizeof(node.pos));
+		memcpy(task->coord, ANCHOR_POS[i], sizeof(task->coord));
+		return sim_net_add_node(net, &node);
+	}
+
+	int add_tag(sim_tag_task_t *task, const double pos[3], double ppm = 0.0, uint64_t clock_offset = 0)
+	{
+		sim_node_cfg_t node;
+
+		memset(&node, 0, sizeof(node));
+		node.entry = "sim_task_tag";
+		node.arg = task;
+		node.device_hash = TAG_5_HASH;
+		node.ppm = ppm;
+		node.clock_offset = clock_offset;
+		memcpy(node.pos, pos, sizeof(node.pos));
+		return sim_net_add_node(net, &node);
+	}
+
+	static void tag_ranges_with(sim_tag_task_t *task, uint16_t address, uint8_t anchors, uint32_t period_us)
+	{
+		memset(task, 0, sizeof(*task));
+		task->address16 = address;
+		task->anchor_count = anchors;
+		for (uint8_t a = 0; a < anchors; a++)
+		{
+			task->anchors[a] = (uint16_t)(a + 1);
+		}
+		task->period_us = period_us;
+	}
+
+    protected:
+	sim_net_cfg_t cfg;
+	sim_net_t *net;
+};
+
+TEST_F(TestSimNet, TwoWayRangingWithClockDrift)
+{
+	const double pos[3] = { 3.0, 4.0, 0.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 10000);
+	tag.rounds = 20;
+	ASSERT_EQ(add_anchor(0, &anchor, -8.0), 0);
+	ASSERT_EQ(add_tag(&tag, pos, 12.0, 700000000000ULL), 1);
+
+	sim_net_run(net, 0.5);
+
+	EXPECT_FALSE(anchor.init_failed);
+	EXPECT_FALSE(tag.init_failed);
+	EXPECT_EQ(tag.rounds_done, 20u);
+	EXPECT_EQ(tag.ranges, 20u);
+	EXPECT_EQ(anchor.requests, 20u);
+	EXPECT_DOUBLE_EQ(sim_net_distance(net, 0, 1), 5.0);
+	/* 20 ppm apart: without the clock offset correction the error would be about 2 m */
+	EXPECT_NEAR(tag.distance_sum[0] / tag.distance_count[0], 5.0, 0.05);
+	EXPECT_EQ(sim_net_node_state(net, 1), SIM_NODE_DONE);
+}
+
+TEST_F(TestSimNet, DoubleSidedRangingCancelsClockDrift)
+{
+	const double pos[3] = { 3.0, 4.0, 0.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 10000);
+	tag.rounds = 20;
+	tag.ds_twr = true;
+	ASSERT_EQ(add_anchor(0, &anchor, -20.0), 0);
+	ASSERT_EQ(add_tag(&tag, pos, 20.0, 700000000000ULL), 1);
+
+	sim_net_run(net, 0.5);
+	sim_net_stats(net, &stats);
+
+	EXPECT_EQ(tag.ranges, 20u);
+	EXPECT_EQ(anchor.requests, 20u);
+	/* poll, response, final and report */
+	EXPECT_EQ(stats.frames_sent, 80u);
+	/* no clock offset correction at all, 40 ppm apart */
+	EXPECT_NEAR(tag.distance_sum[0] / tag.distance_count[0], 5.0, 0.01);
+	/* timestamp to timestamp: each round is the other side's 650 UUS reply plus twice the time of flight */
+	EXPECT_GT(tag.round_init, 650u * 63898u);
+	EXPECT_GT(tag.round_resp, 650u * 63898u);
+	EXPECT_LT(tag.round_init, 651u * 63898u);
+	EXPECT_LT(tag.round_resp, 651u * 63898u);
+}
+
+TEST_F(TestSimNet, BroadcastRequestCollectsSlottedResponses)
+{
+	const double pos[3] = { 1.0, 1.5, 0.5 };
+	sim_anchor_task_t anchor[4] = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 4, 10000);
+	tag.rounds = 10;
+	tag.broadcast = true;
+	for (int i = 0; i < 4; i++)
+	{
+		ASSERT_EQ(add_anchor(i, &anchor[i], 3.0 * i - 4.0), i);
+	}
+	ASSERT_EQ(add_tag(&tag, pos, 6.0), 4);
+
+	sim_net_run(net, 0.2);
+	sim_net_stats(net, &stats);
+
+	EXPECT_EQ(tag.rounds_done, 10u);
+	EXPECT_EQ(tag.ranges, 40u);
+	/* one request and four responses per fix instead of four request/response pairs */
+	EXPECT_EQ(stats.frames_sent, 50u);
+	EXPECT_EQ(stats.collisions, 0u);
+	for (int i = 0; i < 4; i++)
+	{
+		EXPECT_EQ(anchor[i].requests, 10u);
+		EXPECT_NEAR(tag.distance_sum[i] / tag.distance_count[i], sim_net_distance(net, 4, i), 0.05) << "anchor " << i;
+	}
+	/* the last slot starts 650 + 3 * 500 UUS after the request */
+	EXPECT_LT(tag.latency_max_us, 3000.0);
+}
+
+TEST_F(TestSimNet, BroadcastWindowClosesWithoutMissingAnchor)
+{
+	const double pos[3] = { 1.0, 1.5, 0.5 };
+	sim_anchor_task_t anchor[3] = {};
+	sim_tag_task_t tag;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 4, 10000);
+	tag.rounds = 5;
+	tag.broadcast = true;
+	for (int i = 0; i < 3; i++)
+	{
+		ASSERT_EQ(add_anchor(i, &anchor[i]), i);
+	}
+	ASSERT_EQ(add_tag(&tag, pos), 3);
+
+	sim_net_run(net, 0.1);
+
+	/* anchor 4 never answers: the frame wait timeout ends each round after its slot */
+	EXPECT_EQ(tag.rounds_done, 5u);
+	EXPECT_EQ(tag.attempts, 20u);
+	EXPECT_EQ(tag.ranges, 15u);
+	EXPECT_EQ(tag.distance_count[3], 0u);
+	EXPECT_EQ(sim_net_node_state(net, 3), SIM_NODE_DONE);
+}
+
+TEST_F(TestSimNet, TurnaroundCalibrationShortensReplyDelay)
+{
+	const double pos[3] = { 2.0, 1.0, 0.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 5000);
+	tag.rounds = 30;
+	anchor.turnaround_samples = 10;
+	ASSERT_EQ(add_anchor(0, &anchor, 4.0), 0);
+	ASSERT_EQ(add_tag(&tag, pos, -4.0), 1);
+
+	sim_net_run(net, 0.2);
+
+	EXPECT_EQ(tag.ranges, 30u);
+	EXPECT_EQ(anchor.late_tx, 0u);
+	/* what the model needs (SPI traffic and the rest of the poll frame) plus preamble and margin */
+	EXPECT_LT(anchor.turnaround_result, 650u);
+	EXPECT_GT(anchor.turnaround_result, 140u + 50u);
+	/* the cycle counter runs from boot, the same turnaround in 144 MHz core cycles */
+	EXPECT_GT(anchor.turnaround_cycles, 0u);
+	EXPECT_LT(anchor.turnaround_cycles, 650u * 148u);
+	EXPECT_NEAR(tag.distance_sum[0] / tag.distance_count[0], sim_net_distance(net, 0, 1), 0.05);
+}
+
+TEST_F(TestSimNet, TurnaroundCalibrationStaysInResponseWindow)
+{
+	const double pos[3] = { 2.0, 1.0, 0.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+	uint32_t ranges;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 5000);
+	tag.rounds = 60;
+	anchor.turnaround_samples = 20;
+	ASSERT_EQ(add_anchor(0, &anchor, 4.0), 0);
+	ASSERT_EQ(add_tag(&tag, pos, -4.0), 1);
+
+	sim_net_run(net, 0.03);
+	ASSERT_GT(anchor.requests, 0u);
+	/* the anchor stalls on a slow bus for a few replies while it calibrates */
+	sim_net_device(net, 0)->spi_hz = 400000;
+	sim_net_run(net, 0.02);
+	sim_net_device(net, 0)->spi_hz = DW3000_SIM_SPI_FAST_HZ;
+	sim_net_run(net, 0.15);
+	ranges = tag.ranges;
+	sim_net_run(net, 0.1);
+
+	EXPECT_GT(anchor.turnaround_cycles, 144u * 1400u);
+	EXPECT_EQ(anchor.turnaround_result, (uint32_t)TURNAROUND_MAX_UUS);
+	/* every exchange after the calibration still gets its response in */
+	EXPECT_EQ(tag.ranges - ranges, 20u);
+}
+
+TEST_F(TestSimNet, LateResponseIsReportedNotSent)
+{
+	const double pos[3] = { 2.0, 1.0, 0.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 5000);
+	tag.rounds = 1;
+	anchor.turnaround_uus = 20;
+	ASSERT_EQ(add_anchor(0, &anchor), 0);
+	ASSERT_EQ(add_tag(&tag, pos), 1);
+
+	sim_net_run(net, 0.05);
+	sim_net_stats(net, &stats);
+
+	/* 20 UUS cannot even cover the preamble: every request is counted, no response leaves,
+	 * and the tag gives up after the retries */
+	EXPECT_EQ(anchor.requests, 3u);
+	EXPECT_EQ(anchor.late_tx, 3u);
+	EXPECT_EQ(stats.frames_sent, 3u);
+	EXPECT_EQ(tag.ranges, 0u);
+	EXPECT_EQ(tag.failures, 1u);
+}
+
+TEST_F(TestSimNet, RangeQualityRecordsResponseDiagnostics)
+{
+	const double pos[3] = { 3.0, 0.0, 0.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 5000);
+	tag.rounds = 2;
+	tag.quality = RANGE_QUALITY_STAMPS | RANGE_QUALITY_CLOCK | RANGE_QUALITY_POWER | RANGE_QUALITY_NLOS | RANGE_QUALITY_SEQ;
+	ASSERT_EQ(add_anchor(0, &anchor), 0);
+	ASSERT_EQ(add_tag(&tag, pos), 1);
+
+	sim_net_run(net, 0.05);
+
+	ASSERT_EQ(tag.ranges, 2u);
+	EXPECT_EQ(tag.quality_fields, tag.quality);
+	/* the anchor numbers its frames to the tag from a counter of their own */
+	EXPECT_EQ((uint8_t)(tag.seq - tag.seq_first), 1u);
+	EXPECT_EQ(tag.nlos, 0u);
+	EXPECT_NEAR(tag.rsl / 256.0, -80.0, 6.0);
+	EXPECT_NEAR(tag.fp_power / 256.0, -80.0, 10.0);
+	EXPECT_NE(tag.resp_rx, 0u);
+}
+
+TEST_F(TestSimNet, RangeQualityFlagsBlockedFirstPath)
+{
+	const double pos[3] = { 3.0, 0.0, 0.0 };
+	const double fp_loss_db[3] = { 0.0, 6.0, 15.0 };
+	sim_tag_task_t tag[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		sim_anchor_task_t anchor = {};
+
+		sim_net_destroy(net);
+		create();
+		tag_ranges_with(&tag[i], 0x0100, 1, 5000);
+		tag[i].rounds = 1;
+		tag[i].quality = RANGE_QUALITY_POWER | RANGE_QUALITY_NLOS;
+		ASSERT_EQ(add_anchor(0, &anchor), 0);
+		ASSERT_EQ(add_tag(&tag[i], pos), 1);
+		sim_net_device(net, 1)->rx_fp_loss_db = fp_loss_db[i];
+		sim_net_run(net, 0.05);
+		ASSERT_EQ(tag[i].ranges, 1u);
+	}
+
+	EXPECT_EQ(tag[0].nlos, 0u);
+	/* 8 dB between the channel and the first path is in the uncertain band */
+	EXPECT_GT(tag[1].nlos, 20u);
+	EXPECT_LT(tag[1].nlos, 80u);
+	EXPECT_EQ(tag[2].nlos, 100u);
+	EXPECT_EQ(tag[2].rsl, tag[0].rsl);
+	EXPECT_NEAR((tag[0].fp_power - tag[2].fp_power) / 256.0, 15.0, 0.5);
+}
+
+TEST_F(TestSimNet, RangeQualityNlosIndexFitStaysInRange)
+{
+	const double pos[3] = { 3.0, 0.0, 0.0 };
+	/* a strong first path leaves the decision to the first path to peak distance: just past line of sight,
+	   half way and just short of certain NLOS */
+	const double peak_delay[3] = { 3.32, 4.5, 5.98 };
+	sim_tag_task_t tag[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		sim_anchor_task_t anchor = {};
+
+		sim_net_destroy(net);
+		create();
+		tag_ranges_with(&tag[i], 0x0100, 1, 5000);
+		tag[i].rounds = 1;
+		tag[i].quality = RANGE_QUALITY_NLOS;
+		ASSERT_EQ(add_anchor(0, &anchor), 0);
+		ASSERT_EQ(add_tag(&tag[i], pos), 1);
+		sim_net_device(net, 1)->rx_peak_delay = peak_delay[i];
+		sim_net_run(net, 0.05);
+		ASSERT_EQ(tag[i].ranges, 1u);
+	}
+
+	/* the linear fit is a little below 0 % and above 100 % at these two */
+	EXPECT_EQ(tag[0].nlos, 0u);
+	EXPECT_GT(tag[1].nlos, 30u);
+	EXPECT_LT(tag[1].nlos, 60u);
+	EXPECT_EQ(tag[2].nlos, 100u);
+}
+
+TEST_F(TestSimNet, RangeQualityCostsSpiOnlyForDiagnostics)
+{
+	const double pos[3] = { 3.0, 0.0, 0.0 };
+	const uint8_t fields[3] = { 0, RANGE_QUALITY_STAMPS | RANGE_QUALITY_CLOCK | RANGE_QUALITY_SEQ,
+				    RANGE_QUALITY_POWER | RANGE_QUALITY_NLOS };
+	uint32_t spi[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		sim_anchor_task_t anchor = {};
+		sim_tag_task_t tag;
+
+		sim_net_destroy(net);
+		create();
+		tag_ranges_with(&tag, 0x0100, 1, 5000);
+		tag.rounds = 4;
+		tag.quality = fields[i];
+		ASSERT_EQ(add_anchor(0, &anchor), 0);
+		ASSERT_EQ(add_tag(&tag, pos), 1);
+		sim_net_run(net, 0.05);
+		ASSERT_EQ(tag.ranges, 4u);
+		spi[i] = sim_net_device(net, 1)->spi_transactions;
+	}
+
+	/* stamps, clock offset and sequence number come with the frame */
+	EXPECT_EQ(spi[1], spi[0]);
+	EXPECT_GT(spi[2], spi[0]);
+}
+
+TEST_F(TestSimNet, ExchangeTakesResponseDelay)
+{
+	const double pos[3] = { 1.0, 1.0, 1.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 5000);
+	tag.rounds = 10;
+	ASSERT_EQ(add_anchor(0, &anchor), 0);
+	ASSERT_EQ(add_tag(&tag, pos), 1);
+
+	sim_net_run(net, 0.1);
+	sim_net_stats(net, &stats);
+
+	EXPECT_EQ(tag.ranges, 10u);
+	EXPECT_EQ(stats.frames_sent, 20u);
+	EXPECT_EQ(stats.deliveries, 20u);
+	EXPECT_EQ(stats.collisions, 0u);
+	/* 650 UUS response delay plus the response frame itself */
+	EXPECT_GT(tag.latency_sum_us / tag.ranges, 650.0 * 1.0256);
+	EXPECT_LT(tag.latency_max_us, 1500.0);
+	/* both nodes idle most of the time: they must not have been stepped one SPI poll at a time */
+	EXPECT_LT(stats.spi_transactions, 10000u);
+}
+
+TEST_F(TestSimNet, InterruptDrivenNodesRange)
+{
+	const double pos[3] = { 1.0, 2.0, 2.0 };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	create();
+	tag_ranges_with(&tag, 0x0100, 1, 5000);
+	tag.rounds = 10;
+	tag.irq = true;
+	anchor.irq = true;
+	ASSERT_EQ(add_anchor(0, &anchor, 4.0), 0);
+	ASSERT_EQ(add_tag(&tag, pos, -6.0), 1);
+
+	sim_net_run(net, 0.1);
+	sim_net_stats(net, &stats);
+
+	EXPECT_FALSE(anchor.init_failed);
+	EXPECT_FALSE(tag.init_failed);
+	EXPECT_EQ(tag.ranges, 10u);
+	EXPECT_NEAR(tag.distance_sum[0] / tag.distance_count[0], 3.0, 0.05);
+	/* the anchor sleeps on its interrupt between requests */
+	EXPECT_EQ(sim_net_node_state(net, 0), SIM_NODE_WAITING);
+	EXPECT_LT(stats.spi_transactions, 1000u);
+}
+
+TEST_F(TestSimNet, OutOfRangeAnchorIsNotHeard)
+{
+	const double pos[3] = { 0.5, 0.0, 0.0 };
+	sim_anchor_task_t anchor[2] = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	cfg.range = 2.0;
+	create();
+	tag_ranges_with(&tag, 0x0100, 2, 10000);
+	tag.rounds = 1;
+	ASSERT_EQ(add_anchor(0, &anchor[0]), 0);
+	ASSERT_EQ(add_anchor(1, &anchor[1]), 1);
+	ASSERT_EQ(add_tag(&tag, pos), 2);
+
+	sim_net_run(net, 0.1);
+	sim_net_stats(net, &stats);
+
+	EXPECT_EQ(anchor[0].requests, 1u);
+	EXPECT_EQ(anchor[1].requests, 0u);
+	EXPECT_GT(stats.out_of_range, 0u);
+	/* the polls to anchor 2 are never answered, the response timeouts end the round anyway */
+	EXPECT_EQ(tag.attempts, 2u);
+	EXPECT_EQ(tag.ranges, 1u);
+	EXPECT_EQ(tag.failures, 1u);
+	EXPECT_EQ(tag.rounds_done, 1u);
+}
+
+TEST_F(TestSimNet, LossyLinkCostsRetriesNotRounds)
+{
+	const double pos[3] = { 2.0, 1.0, 0.5 };
+	sim_anchor_task_t anchor[4] = {};
+	sim_tag_task_t tag;
+	sim_net_stats_t stats;
+
+	cfg.loss = 0.2;
+	create();
+	tag_ranges_with(&tag, 0x0100, 4, 20000);
+	tag.rounds = 50;
+	for (int i = 0; i < 4; i++)
+	{
+		ASSERT_EQ(add_anchor(i, &anchor[i]), i);
+	}
+	ASSERT_EQ(add_tag(&tag, pos), 4);
+
+	sim_net_run(net, 2.0);
+	sim_net_stats(net, &stats);
+
+	EXPECT_GT(stats.lost, 0u);
+	/* every round completes, a lost poll or response only costs a retry */
+	EXPECT_EQ(tag.rounds_done, 50u);
+	EXPECT_EQ(tag.attempts, 200u);
+	EXPECT_GT(tag.ranges, 180u);
+	EXPECT_EQ(tag.ranges + tag.failures, tag.attempts);
+	uint32_t requests = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		requests += anchor[i].requests;
+	}
+	EXPECT_GT(requests, tag.attempts);
+	/* a failed attempt waits at most for the response timeout */
+	EXPECT_LT(tag.latency_max_us, 3 * 2000.0);
+}
+
+TEST_F(TestSimNet, SimultaneousPollsCollide)
+{
+	const double pos[2][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 } };
+	sim_anchor_task_t anchor = {};
+	sim_tag_task_t tag[2];
+	sim_net_stats_t stats;
+
+	create();
+	ASSERT_EQ(add_anchor(0, &anchor), 0);
+	for (int i = 0; i < 2; i++)
+	{
+		tag_ranges_with(&tag[i], (uint16_t)(0x0100 + i), 1, 10000);
+		tag[i].rounds = 1;
+		ASSERT_EQ(add_tag(&tag[i], pos[i]), i + 1);
+	}
+
+	sim_net_run(net, 0.05);
+	sim_net_stats(net, &stats);
+
+	/* the retries start in step as well and collide again */
+	EXPECT_GE(stats.collisions, 6u);
+	EXPECT_EQ(anchor.requests, 0u);
+	EXPECT_EQ(sim_net_device(net, 0)->frames_received, 3u);
+	EXPECT_EQ(tag[0].failures, 1u);
+	EXPECT_EQ(tag[1].failures, 1u);
+}
+
+struct announcements {
+	std::map<uint16_t, coord_t> coord;
+	std::map<uint16_t, uint8_t> command;
+	std::map<uint8_t, coord_t> tag;		/* every method of the tag */
+};
+
+static void on_frame(void *ctx, int node, const uint8_t *frame, uint16_t length, double t)
+{
+	announcements *seen = (announcements *)ctx;
+	uwb_msg_t msg;
+	uint16_t src;
+
+	(void)node;
+	(void)t;
+	if (length < FRAME_HEADER_LEN + 2
+		|| uwb_msg_decode(&frame[FRAME_HEADER_LEN], length - FRAME_HEADER_LEN - 2, &msg) != UWB_OK)
+	{
+		return;
+	}
+	src = (uint16_t)(frame[7] | (frame[8] << 8));
+	if (msg.command_type >= COMMAND_POSITION_ANNOUNCEMENT)
+	{
+		seen->coord[src] = msg.coord;
+		seen->command[src] = msg.command_type;
+		if (src == 5)
+		{
+			seen->tag[msg.command_type] = msg.coord;
+		}
+	}
+}
+
+TEST_F(TestSimNet, MainAppCalibratesAnchorsAndPositionsTag)
+{
+	const double tag_pos[3] = { 1.5, 1.0, 0.5 };
+	announcements seen;
+
+	create();
+	sim_net_set_frame_cb(net, on_frame, &seen);
+	for (int i = 3; i >= 0; i--)
+	{
+		sim_node_cfg_t node;
+
+		memset(&node, 0, sizeof(node));
+		node.device_hash = ANCHOR_HASH[i];
+		node.ppm = 2.0 * i - 3.0;
+		/* the serial anchor starts the calibration, everybody else must be listening by then */
+		node.start = (i == 0) ? 0.01 : 0.0;
+		memcpy(node.pos, ANCHOR_POS[i], sizeof(node.pos));
+		ASSERT_GE(sim_net_add_node(net, &node), 0);
+	}
+	sim_node_cfg_t node;
+	memset(&node, 0, sizeof(node));
+	node.device_hash = TAG_5_HASH;
+	node.ppm = 5.0;
+	memcpy(node.pos, tag_pos, sizeof(node.pos));
+	ASSERT_GE(sim_net_add_node(net, &node), 0);
+
+	sim_net_run(net, 8.0);
+
+	for (uint16_t address = 2; address <= 4; address++)
+	{
+		ASSERT_EQ(seen.coord.count(address), 1u) << "anchor " << address;
+		const double *expected = ANCHOR_POS[address - 1];
+		EXPECT_NEAR(seen.coord[address].x, expected[0], 0.1) << "anchor " << address;
+		EXPECT_NEAR(seen.coord[address].y, expected[1], 0.1) << "anchor " << address;
+		EXPECT_NEAR(std::fabs(seen.coord[address].z), expected[2], 0.1) << "anchor " << address;
+	}
+	ASSERT_EQ(seen.coord.count(5), 1u);
+	EXPECT_EQ(seen.command[5], COMMAND_POSITION_ANNOUNCEMENT_PREDEF_GN);
+	EXPECT_NEAR(seen.coord[5].x, tag_pos[0], 0.1);
+	EXPECT_NEAR(seen.coord[5].y, tag_pos[1], 0.1);
+	EXPECT_NEAR(seen.coord[5].z, tag_pos[2], 0.1);
+
+	/* the tracker filtered every range of its rounds */
+	ASSERT_EQ(seen.tag.count(COMMAND_POSITION_ANNOUNCEMENT_TRACKED), 1u);
+	const coord_t &tracked = seen.tag[COMMAND_POSITION_ANNOUNCEMENT_TRACKED];
+	EXPECT_NEAR(tracked.x, tag_pos[0], 0.1);
+	EXPECT_NEAR(tracked.y, tag_pos[1], 0.1);
+	EXPECT_NEAR(tracked.z, tag_pos[2], 0.1);
+}
+
+TEST_F(TestSimNet, SlottedTagsShareTheAnchors)
+{
+	const unsigned tags = 16;
+	sim_anchor_task_t anchor[4] = {};
+	sim_tag_task_t tag[tags];
+	sim_net_stats_t stats;
+	uint32_t ranges = 0;
+
+	create();
+	for (int i = 0; i < 4; i++)
+	{
+		ASSERT_EQ(add_anchor(i, &anchor[i], 3.0 - 2.0 * i), i);
+	}
+	for (unsigned i = 0; i < tags; i++)
+	{
+		const double pos[3] = { 0.5 + 0.2 * i, 3.5 - 0.2 * i, 0.1 * (i % 8) };
+
+		/* 100 ms period, one 6.25 ms slot per tag for four 1.2 ms exchanges */
+		tag_ranges_with(&tag[i], (uint16_t)(0x0100 + i), 4, 100000);
+		tag[i].phase_us = 100000 * i / tags;
+		ASSERT_GE(add_tag(&tag[i], pos, (i % 5) - 2.0, 1000000000ULL * i), 0);
+	}
+
+	sim_net_run(net, 1.0);
+	sim_net_stats(net, &stats);
+
+	for (unsigned i = 0; i < tags; i++)
+	{
+		EXPECT_EQ(tag[i].ranges, tag[i].attempts) << "tag " << i;
+		for (int a = 0; a < 4; a++)
+		{
+			ASSERT_NE(tag[i].distance_count[a], 0u);
+			EXPECT_NEAR(tag[i].distance_sum[a] / tag[i].distance_count[a], sim_net_distance(net, 4 + i, a), 0.05)
+				<< "tag " << i << " anchor " << a;
+		}
+		ranges += tag[i].ranges;
+	}
+	EXPECT_GE(ranges, tags * 4 * 9);
+	EXPECT_EQ(stats.collisions, 0u);
+}
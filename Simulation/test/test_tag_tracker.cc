@@ -0,0 +1,190 @@
+/*
+ * test_tag_tracker.cc
+ *
+ * Extended Kalman filter of the tag position, one range per update.
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+extern "C"
+{
+#include "tag_tracker.h"
+}
+
+/* Ceiling and wall anchors of a 10 x 8 x 3 m room */
+static const coord_t room[4] = {
+	{ 0.0, 0.0, 2.8 }, { 10.0, 0.0, 2.5 }, { 10.0, 8.0, 2.9 }, { 0.0, 8.0, 0.4 },
+};
+
+static double distance(const coord_t &a, const coord_t &p)
+{
+	return sqrt((a.x - p.x) * (a.x - p.x) + (a.y - p.y) * (a.y - p.y) + (a.z - p.z) * (a.z - p.z));
+}
+
+TEST(TestTagTracker, NoTrackNoUpdate)
+{
+	tag_tracker_t tracker;
+	const coord_t start = { 2.0, 3.0, 1.0 };
+
+	tag_tracker_init(&tracker, 1.0, 0.0);
+	EXPECT_FALSE(tracker.valid);
+	EXPECT_FALSE(tag_tracker_update(&tracker, &room[0], 3.0, 0.05));
+
+	/* a tag on the anchor has no direction to correct in */
+	tag_tracker_reset(&tracker, &room[0], 0.3, 1.0);
+	EXPECT_FALSE(tag_tracker_update(&tracker, &room[0], 0.5, 0.05));
+	tag_tracker_reset(&tracker, &start, 0.3, 1.0);
+	EXPECT_TRUE(tag_tracker_update(&tracker, &room[0], distance(room[0], start), 0.05));
+	EXPECT_EQ(tracker.updates, 1u);
+}
+
+TEST(TestTagTracker, PredictGrowsCovarianceByProcessNoise)
+{
+	tag_tracker_t tracker;
+	const coord_t start = { 2.0, 3.0, 1.0 };
+	const double q = 2.0, dt = 0.1, ps = 0.3, vs = 0.5;
+
+	tag_tracker_init(&tracker, q, 0.0);
+	tag_tracker_reset(&tracker, &start, ps, vs);
+	tracker.x[3] = 1.0;
+	tag_tracker_predict(&tracker, dt);
+
+	EXPECT_NEAR(tracker.x[0], 2.0 + dt, 1e-6);
+	EXPECT_NEAR(tracker.x[1], 3.0, 1e-6);
+	for (int i = 0; i < 3; i++)
+	{
+		EXPECT_NEAR(tracker.p[i][i], ps * ps + dt * dt * vs * vs + q * dt * dt * dt / 3.0, 1e-6);
+		EXPECT_NEAR(tracker.p[i][i + 3], dt * vs * vs + q * dt * dt / 2.0, 1e-6);
+		EXPECT_NEAR(tracker.p[i + 3][i + 3], vs * vs + q * dt, 1e-6);
+		EXPECT_EQ(tracker.p[i + 3][i], tracker.p[i][i + 3]);
+	}
+	EXPECT_EQ(tracker.p[0][1], 0.0);
+
+	/* more process noise, less trust in the old state */
+	tag_tracker_t agile = tracker;
+	tag_tracker_set_process_noise(&agile, 10.0 * q);
+	tag_tracker_predict(&tracker, dt);
+	tag_tracker_predict(&agile, dt);
+	EXPECT_GT(agile.p[0][0], tracker.p[0][0]);
+	EXPECT_GT(agile.p[3][3], tracker.p[3][3]);
+}
+
+TEST(TestTagTracker, StaticTagConvergesBelowRangeNoise)
+{
+	std::mt19937 rng(25);
+	std::normal_distribution<double> noise(0.0, 0.05);
+	const coord_t tag = { 4.2, 5.1, 1.3 };
+	const coord_t start = { 4.6, 4.8, 1.0 };
+	tag_tracker_t tracker;
+	coord_t est;
+
+	tag_tracker_init(&tracker, 0.01, 4.0);
+	tag_tracker_reset(&tracker, &start, 0.5, 0.2);
+	/* two seconds at 200 ranges per second, round robin */
+	for (int i = 0; i < 400; i++)
+	{
+		const coord_t &anchor = room[i % 4];
+		tag_tracker_predict(&tracker, 0.005);
+		tag_tracker_update(&tracker, &anchor, distance(anchor, tag) + noise(rng), 0.05);
+	}
+	tag_tracker_position(&tracker, &est);
+
+	/* the height is poorly observed from these anchors, the floor plan well below the range noise,
+	   each within what the covariance claims */
+	EXPECT_LT(hypot(est.x - tag.x, est.y - tag.y), 0.03);
+	EXPECT_LT(fabs(est.x - tag.x), 3.0 * sqrt(tracker.p[0][0]));
+	EXPECT_LT(fabs(est.y - tag.y), 3.0 * sqrt(tracker.p[1][1]));
+	EXPECT_LT(fabs(est.z - tag.z), 3.0 * sqrt(tracker.p[2][2]));
+	EXPECT_GE(tracker.updates, 395u);
+	for (int i = 0; i < TAG_TRACKER_STATES; i++)
+	{
+		EXPECT_GT(tracker.p[i][i], 0.0);
+		for (int j = 0; j < i; j++)
+		{
+			EXPECT_EQ(tracker.p[i][j], tracker.p[j][i]);
+		}
+	}
+}
+
+TEST(TestTagTracker, FollowsMovingTagAndItsVelocity)
+{
+	const coord_t start = { 2.0, 4.0, 1.0 };
+	const double v[3] = { 1.0, -0.5, 0.0 };
+	const double dt = 0.004;
+	tag_tracker_t tracker;
+	coord_t tag = start, est;
+
+	tag_tracker_init(&tracker, 1.0, 4.0);
+	tag_tracker_reset(&tracker, &start, 0.3, 1.0);
+	for (int i = 0; i < 750; i++)
+	{
+		tag.x += v[0] * dt;
+		tag.y += v[1] * dt;
+		tag_tracker_predict(&tracker, dt);
+		EXPECT_TRUE(tag_tracker_update(&tracker, &room[i % 4], distance(room[i % 4], tag), 0.02));
+	}
+	tag_tracker_position(&tracker, &est);
+
+	EXPECT_LT(distance(est, tag), 0.01);
+	EXPECT_NEAR(tracker.x[3], v[0], 0.05);
+	EXPECT_NEAR(tracker.x[4], v[1], 0.05);
+	EXPECT_NEAR(tracker.x[5], v[2], 0.05);
+}
+
+TEST(TestTagTracker, GateDropsMultipathRange)
+{
+	const coord_t tag = { 6.0, 3.0, 1.5 };
+	tag_tracker_t tracker;
+	coord_t before, after;
+
+	tag_tracker_init(&tracker, 0.1, 4.0);
+	tag_tracker_reset(&tracker, &tag, 0.05, 0.1);
+	for (int i = 0; i < 40; i++)
+	{
+		tag_tracker_predict(&tracker, 0.005);
+		tag_tracker_update(&tracker, &room[i % 4], distance(room[i % 4], tag), 0.05);
+	}
+	tag_tracker_position(&tracker, &before);
+
+	/* a reflection 2 m longer than the direct path */
+	EXPECT_FALSE(tag_tracker_update(&tracker, &room[1], distance(room[1], tag) + 2.0, 0.05));
+	tag_tracker_position(&tracker, &after);
+	EXPECT_EQ(tracker.rejected, 1u);
+	EXPECT_EQ(after.x, before.x);
+
+	/* without the gate it pulls the track */
+	tracker.gate = 0.0;
+	EXPECT_TRUE(tag_tracker_update(&tracker, &room[1], distance(room[1], tag) + 2.0, 0.05));
+	tag_tracker_position(&tracker, &after);
+	EXPECT_GT(distance(after, tag), 0.01);
+}
+
+TEST(TestTagTracker, UpdateTimeBounded)
+{
+	const coord_t tag = { 4.4, 3.3, 1.0 };
+	const int updates = 20000;
+	tag_tracker_t tracker;
+	position_real_t distances[4];
+
+	for (int i = 0; i < 4; i++)
+	{
+		distances[i] = distance(room[i], tag) + 0.02 * ((i % 3) - 1);
+	}
+	tag_tracker_init(&tracker, 1.0, 0.0);
+	tag_tracker_reset(&tracker, &tag, 0.3, 1.0);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < updates; i++)
+	{
+		tag_tracker_predict(&tracker, 0.0025);
+		tag_tracker_update(&tracker, &room[i % 4], distances[i % 4], 0.05);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / updates;
+	RecordProperty("update_ns", std::to_string(ns));
+
+	EXPECT_EQ(tracker.updates, (uint32_t)updates);
+	EXPECT_LT(ns, 5000.0);
+}